@@ -0,0 +1,84 @@
+#include "arena.h"
+
+void
+arena_init (struct arena *arena)
+{
+  arena->data = NULL;
+  arena->length = 0;
+  arena->capacity = 0;
+}
+
+int
+arena_reserve (struct arena *arena, size_t size)
+{
+  size_t capacity;
+  char *data;
+
+  if (arena->length + size <= arena->capacity)
+    {
+      return 0;
+    }
+
+  capacity = arena->capacity ? arena->capacity : ARENA_INITIAL_CAPACITY;
+  while (capacity < arena->length + size)
+    {
+      capacity *= 2;
+    }
+
+  /*
+   * Handles are 32 bits offsets.
+   */
+  if (capacity > UINT32_MAX)
+    {
+      capacity = UINT32_MAX;
+      if (arena->length + size > capacity)
+        {
+          return -1;
+        }
+    }
+
+  data = spill_realloc (arena->data, capacity);
+  if (data == NULL)
+    {
+      return -1;
+    }
+
+  stats_add (STATS_BYTES, capacity - arena->capacity);
+  arena->data = data;
+  arena->capacity = capacity;
+
+  return 0;
+}
+
+int
+arena_push_string (struct arena *arena, const char *str, size_t length,
+                   struct arena_handle *handle)
+{
+  if (arena_reserve (arena, length + 1) != 0)
+    {
+      return -1;
+    }
+
+  memcpy (arena->data + arena->length, str, length);
+  arena->data[arena->length + length] = '\0';
+
+  handle->offset = arena->length;
+  handle->length = length;
+
+  arena->length += length + 1;
+
+  return 0;
+}
+
+void
+arena_reset (struct arena *arena)
+{
+  arena->length = 0;
+}
+
+void
+arena_free (struct arena *arena)
+{
+  spill_free (arena->data);
+  arena_init (arena);
+}
@@ -0,0 +1,98 @@
+/*
+ * arena - library to pack strings in a single buffer
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_ARENA_H_
+#define DR_LIB_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spill.h"
+#include "stats.h"
+
+/*
+ * Size of the first allocation of an arena.
+ */
+#define ARENA_INITIAL_CAPACITY (64 * 1024)
+
+/*
+ * All the strings of a listing live next to each other in DATA,
+ * the arena grows by doubling its CAPACITY and moves to a spill file
+ * once it is large.
+ */
+struct arena
+{
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+/*
+ * Reference to a string inside an arena, it stays valid when the
+ * arena grows since it is an offset and not a pointer.
+ * LENGTH doesn't count the '\0' stored after the string.
+ */
+struct arena_handle
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+/*
+ * Initialize ARENA without allocating anything.
+ */
+void arena_init (struct arena *arena);
+
+/*
+ * Make sure ARENA can hold SIZE more bytes.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int arena_reserve (struct arena *arena, size_t size);
+
+/*
+ * Copy the LENGTH bytes of STR and a '\0' at the end of ARENA
+ * and save where they are in HANDLE.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int arena_push_string (struct arena *arena, const char *str, size_t length,
+                       struct arena_handle *handle);
+
+/*
+ * Get the string of HANDLE, the pointer is only valid until
+ * the next push since the arena can move.
+ */
+static inline const char *
+arena_string (const struct arena *arena, struct arena_handle handle)
+{
+  return arena->data + handle.offset;
+}
+
+/*
+ * Forget every string of ARENA but keep the memory for the next listing.
+ */
+void arena_reset (struct arena *arena);
+
+/*
+ * Release the memory of ARENA.
+ */
+void arena_free (struct arena *arena);
+
+#endif // DR_LIB_ARENA_H_
@@ -0,0 +1,736 @@
+#include "cache.h"
+
+static void cache_invalidate (struct cache_directory *directory);
+
+int
+cache_init (struct dir_cache *cache)
+{
+  cache->count = 0;
+  cache->clock = 0;
+  cache->detached = NULL;
+
+  cache->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (cache->inotify_fd < 0)
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Find the directory of DEV and INO.
+ * return its index in CACHE or -1.
+ */
+static long
+cache_find (struct dir_cache *cache, dev_t dev, ino_t ino)
+{
+  size_t i;
+
+  for (i = 0; i < cache->count; ++i)
+    {
+      if (cache->directories[i]->dev == dev
+          && cache->directories[i]->ino == ino)
+        {
+          return i;
+        }
+    }
+
+  return -1;
+}
+
+struct cache_directory *
+cache_lookup (struct dir_cache *cache, const char *const path)
+{
+  return cache_lookup_at (cache, AT_FDCWD, path);
+}
+
+struct cache_directory *
+cache_lookup_at (struct dir_cache *cache, int dir_fd, const char *const name)
+{
+  struct cache_directory *directory;
+  struct stat st;
+  long i;
+
+  if (fstatat (dir_fd, name, &st, 0) != 0)
+    {
+      return NULL;
+    }
+
+  i = cache_find (cache, st.st_dev, st.st_ino);
+  if (i < 0 || !cache->directories[i]->complete
+      || cache->directories[i]->lost)
+    {
+      return NULL;
+    }
+
+  directory = cache->directories[i];
+  directory->last_used = ++cache->clock;
+
+  return directory;
+}
+
+static void
+cache_directory_free (struct dir_cache *cache,
+                      struct cache_directory *directory)
+{
+  if (directory->wd >= 0)
+    {
+      inotify_rm_watch (cache->inotify_fd, directory->wd);
+    }
+
+  if (directory->dir_fd >= 0)
+    {
+      close (directory->dir_fd);
+    }
+
+  entry_store_free (&directory->entries);
+  arena_free (&directory->names);
+  free (directory->pending);
+  free (directory);
+}
+
+void
+cache_remove (struct dir_cache *cache, struct cache_directory *directory)
+{
+  struct cache_directory **link;
+  size_t i;
+
+  if (directory->detached)
+    {
+      for (link = &cache->detached; *link != NULL; link = &(*link)->next)
+        {
+          if (*link == directory)
+            {
+              *link = directory->next;
+              cache_directory_free (cache, directory);
+              return;
+            }
+        }
+      return;
+    }
+
+  for (i = 0; i < cache->count; ++i)
+    {
+      if (cache->directories[i] == directory)
+        {
+          cache->directories[i] = cache->directories[--cache->count];
+          cache_directory_free (cache, directory);
+          return;
+        }
+    }
+}
+
+void
+cache_release (struct dir_cache *cache, struct cache_directory *directory)
+{
+  if (--directory->users == 0 && directory->detached)
+    {
+      cache_remove (cache, directory);
+    }
+}
+
+/*
+ * Take the directory at INDEX out of the table of CACHE, its views
+ * keep it until they release it.
+ */
+static void
+cache_detach (struct dir_cache *cache, size_t index)
+{
+  struct cache_directory *directory = cache->directories[index];
+
+  cache->directories[index] = cache->directories[--cache->count];
+  cache_invalidate (directory);
+  directory->detached = 1;
+  directory->next = cache->detached;
+  cache->detached = directory;
+}
+
+size_t
+cache_directory_size (const struct cache_directory *directory)
+{
+  return directory->entries.names.capacity + directory->names.capacity
+         + directory->pending_capacity * sizeof (struct cache_change)
+         + directory->entries.capacity
+               * (sizeof (*directory->entries.name)
+                  + sizeof (*directory->entries.type)
+                  + sizeof (*directory->entries.size)
+                  + sizeof (*directory->entries.mtime)
+                  + sizeof (*directory->entries.mode)
+                  + sizeof (*directory->entries.uid)
+                  + sizeof (*directory->entries.gid)
+                  + sizeof (*directory->entries.state));
+}
+
+/*
+ * Get the memory taken by the listings of CACHE, in bytes.
+ */
+static size_t
+cache_size (const struct dir_cache *cache)
+{
+  size_t size = 0;
+  size_t i;
+
+  for (i = 0; i < cache->count; ++i)
+    {
+      size += cache_directory_size (cache->directories[i]);
+    }
+
+  return size;
+}
+
+/*
+ * Drop the least recently used directory of CACHE that is not in use.
+ * return 0 on success and -1 if they are all in use.
+ */
+static int
+cache_evict (struct dir_cache *cache)
+{
+  struct cache_directory *oldest = NULL;
+  size_t i;
+
+  for (i = 0; i < cache->count; ++i)
+    {
+      if (cache->directories[i]->users == 0
+          && (oldest == NULL
+              || cache->directories[i]->last_used < oldest->last_used))
+        {
+          oldest = cache->directories[i];
+        }
+    }
+
+  if (oldest == NULL)
+    {
+      return -1;
+    }
+
+  cache_remove (cache, oldest);
+
+  return 0;
+}
+
+struct cache_directory *
+cache_insert (struct dir_cache *cache, const char *const path)
+{
+  return cache_insert_at (cache, AT_FDCWD, path, path);
+}
+
+/*
+ * Watch the directory open at FD through its descriptor so its path
+ * isn't looked up again, or at PATH when /proc is not mounted.
+ * return the watch descriptor or -1 with errno set.
+ */
+static int
+cache_watch (struct dir_cache *cache, int fd, const char *const path)
+{
+  char fd_path[32];
+  int wd;
+
+  snprintf (fd_path, sizeof (fd_path), "/proc/self/fd/%d", fd);
+  wd = inotify_add_watch (cache->inotify_fd, fd_path, CACHE_WATCH_MASK);
+  if (wd < 0 && errno == ENOENT)
+    {
+      wd = inotify_add_watch (cache->inotify_fd, path, CACHE_WATCH_MASK);
+    }
+
+  return wd;
+}
+
+struct cache_directory *
+cache_insert_at (struct dir_cache *cache, int dir_fd, const char *const name,
+                 const char *const path)
+{
+  struct cache_directory *directory;
+  struct cache_directory *replaced = NULL;
+  struct stat st;
+  long i;
+  int fd;
+
+  /*
+   * The directory is known by what was opened, NAME may be replaced
+   * meanwhile.
+   */
+  fd = openat (dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      return NULL;
+    }
+
+  if (fstat (fd, &st) != 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  /*
+   * A listing that wasn't read entirely or missed changes is read
+   * again, the views that still show it keep it.
+   */
+  i = cache_find (cache, st.st_dev, st.st_ino);
+  if (i >= 0 && cache->directories[i]->users == 0)
+    {
+      cache_remove (cache, cache->directories[i]);
+    }
+  else if (i >= 0)
+    {
+      replaced = cache->directories[i];
+      cache_detach (cache, i);
+    }
+
+  /*
+   * The listings in use are kept even if they take more than
+   * CACHE_MAX_BYTES.
+   */
+  while (cache->count == CACHE_MAX_DIRECTORIES
+         || cache_size (cache) > CACHE_MAX_BYTES)
+    {
+      if (cache_evict (cache) != 0)
+        {
+          if (cache->count < CACHE_MAX_DIRECTORIES)
+            {
+              break;
+            }
+          close (fd);
+          errno = EBUSY;
+          return NULL;
+        }
+    }
+
+  directory = calloc (1, sizeof (struct cache_directory));
+  if (directory == NULL)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  directory->dev = st.st_dev;
+  directory->ino = st.st_ino;
+  entry_store_init (&directory->entries);
+  arena_init (&directory->names);
+
+  directory->dir_fd = fd;
+  directory->wd = cache_watch (cache, fd, path);
+  if (directory->wd < 0)
+    {
+      cache_directory_free (cache, directory);
+      return NULL;
+    }
+
+  /*
+   * inotify has one watch for each inode, the replaced listing
+   * hands it over so it isn't removed when that one is freed.
+   */
+  if (replaced != NULL && replaced->wd == directory->wd)
+    {
+      replaced->wd = -1;
+    }
+
+  directory->last_used = ++cache->clock;
+  cache->directories[cache->count++] = directory;
+
+  return directory;
+}
+
+/*
+ * Forget the changes of DIRECTORY and make the next visit read it
+ * again, the changes are lost so the listing can't be trusted.
+ */
+static void
+cache_invalidate (struct cache_directory *directory)
+{
+  directory->lost = 1;
+  directory->pending_count = 0;
+  arena_reset (&directory->names);
+}
+
+/*
+ * Add the change KIND of the entry NAME to DIRECTORY.
+ */
+static void
+cache_push_change (struct cache_directory *directory, const char *name,
+                   enum cache_change_kind kind)
+{
+  struct cache_change *pending;
+  struct cache_change *change;
+  size_t capacity;
+
+  if (directory->pending_count == CACHE_MAX_PENDING)
+    {
+      cache_invalidate (directory);
+      return;
+    }
+
+  if (directory->pending_count == directory->pending_capacity)
+    {
+      capacity = directory->pending_capacity
+                     ? directory->pending_capacity * 2
+                     : 64;
+      pending = realloc (directory->pending,
+                         capacity * sizeof (struct cache_change));
+      if (pending == NULL)
+        {
+          cache_invalidate (directory);
+          return;
+        }
+      directory->pending = pending;
+      directory->pending_capacity = capacity;
+    }
+
+  change = &directory->pending[directory->pending_count];
+  if (arena_push_string (&directory->names, name, strlen (name),
+                         &change->name)
+      != 0)
+    {
+      cache_invalidate (directory);
+      return;
+    }
+
+  change->kind = kind;
+  ++directory->pending_count;
+}
+
+/*
+ * return 1 if one of the last CACHE_MODIFY_LOOKBACK changes of
+ * DIRECTORY is about NAME, a write adds nothing to it.
+ */
+static int
+cache_recently_changed (const struct cache_directory *directory,
+                        const char *name)
+{
+  size_t i = directory->pending_count;
+  size_t end = i > CACHE_MODIFY_LOOKBACK ? i - CACHE_MODIFY_LOOKBACK : 0;
+
+  while (i-- > end)
+    {
+      if (strcmp (arena_string (&directory->names,
+                                directory->pending[i].name),
+                  name)
+          == 0)
+        {
+          return 1;
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Add the inotify EVENT to the changes of its directory.
+ */
+static void
+cache_handle_event (struct dir_cache *cache,
+                    const struct inotify_event *event)
+{
+  struct cache_directory *directory = NULL;
+  size_t i;
+
+  /*
+   * The kernel dropped events, none of the listings can be trusted.
+   */
+  if (event->mask & IN_Q_OVERFLOW)
+    {
+      for (i = 0; i < cache->count; ++i)
+        {
+          cache_invalidate (cache->directories[i]);
+        }
+      return;
+    }
+
+  for (i = 0; i < cache->count; ++i)
+    {
+      if (cache->directories[i]->wd == event->wd)
+        {
+          directory = cache->directories[i];
+          break;
+        }
+    }
+
+  if (directory == NULL)
+    {
+      return;
+    }
+
+  if (event->mask & (IN_IGNORED | IN_DELETE_SELF))
+    {
+      if (event->mask & IN_IGNORED)
+        {
+          directory->wd = -1;
+        }
+      cache_invalidate (directory);
+      return;
+    }
+
+  if (event->len == 0)
+    {
+      return;
+    }
+
+  if ((event->mask & IN_MODIFY)
+      && cache_recently_changed (directory, event->name))
+    {
+      return;
+    }
+
+  if (event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+      cache_push_change (directory, event->name, CACHE_ADD);
+    }
+  else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+      cache_push_change (directory, event->name, CACHE_REMOVE);
+    }
+  else
+    {
+      cache_push_change (directory, event->name, CACHE_STALE);
+    }
+}
+
+int
+cache_read_events (struct dir_cache *cache)
+{
+  char buffer[CACHE_EVENT_BUFFER_SIZE]
+      __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *event;
+  ssize_t length;
+  ssize_t position;
+  int count = 0;
+
+  while (1)
+    {
+      length = read (cache->inotify_fd, buffer, sizeof (buffer));
+      if (length < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+              return count;
+            }
+          return -1;
+        }
+
+      for (position = 0; position < length;
+           position += sizeof (struct inotify_event) + event->len)
+        {
+          event = (const struct inotify_event *)(buffer + position);
+          cache_handle_event (cache, event);
+          ++count;
+        }
+    }
+}
+
+/*
+ * Order the pending changes by name and keep the order they
+ * happened in for the same name.
+ */
+static int
+cache_compare_changes (const void *a, const void *b, void *data)
+{
+  const struct cache_directory *directory = data;
+  uint32_t ia = *(const uint32_t *)a;
+  uint32_t ib = *(const uint32_t *)b;
+  int cmp;
+
+  cmp = strcmp (arena_string (&directory->names,
+                              directory->pending[ia].name),
+                arena_string (&directory->names,
+                              directory->pending[ib].name));
+  if (cmp != 0)
+    {
+      return cmp;
+    }
+
+  return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Find the entry NAME whatever its type.
+ * return its index or -1.
+ */
+static long
+cache_find_entry (const struct entry_store *entries, const char *name)
+{
+  long index = entry_store_find (entries, name, DT_DIR);
+
+  if (index < 0)
+    {
+      index = entry_store_find (entries, name, DT_REG);
+    }
+
+  return index;
+}
+
+/*
+ * Get the type of the entry NAME of DIRECTORY.
+ * return DT_UNKNOWN if the entry is gone.
+ */
+static unsigned char
+cache_entry_type (const struct cache_directory *directory, const char *name)
+{
+  struct stat st;
+
+  if (fstatat (directory->dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+      return DT_UNKNOWN;
+    }
+
+  return IFTODT (st.st_mode);
+}
+
+/*
+ * Apply the last change of the entry NAME to ENTRIES, the entries
+ * to drop are marked in REMOVE and the new ones added to ADDITIONS.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+cache_apply_change (const struct cache_directory *directory,
+                    struct entry_store *entries, const char *name,
+                    enum cache_change_kind kind, unsigned char *remove,
+                    struct entry_store *additions)
+{
+  long index = cache_find_entry (entries, name);
+  unsigned char type;
+
+  if (kind == CACHE_STALE)
+    {
+      if (index >= 0)
+        {
+          entries->state[index] = ENTRY_META_NONE;
+        }
+      return 0;
+    }
+
+  type = kind == CACHE_ADD ? cache_entry_type (directory, name) : DT_UNKNOWN;
+
+  /*
+   * Replaced by an entry of the same kind, it keeps its place.
+   */
+  if (index >= 0 && type != DT_UNKNOWN
+      && (type == DT_DIR) == (entries->type[index] == DT_DIR))
+    {
+      entries->type[index] = type;
+      entries->state[index] = ENTRY_META_NONE;
+      return 0;
+    }
+
+  if (index >= 0)
+    {
+      remove[index] = 1;
+    }
+
+  if (type == DT_UNKNOWN)
+    {
+      return 0;
+    }
+
+  return entry_store_append (additions, name, strlen (name), type);
+}
+
+int
+cache_apply (struct cache_directory *directory)
+{
+  struct entry_store *entries = &directory->entries;
+  struct entry_store additions;
+  enum cache_change_kind kind;
+  unsigned char *remove;
+  const char *name;
+  uint32_t *order;
+  size_t i;
+  size_t j;
+  int status = 0;
+
+  if (!cache_has_changes (directory))
+    {
+      return 0;
+    }
+
+  order = malloc (directory->pending_count * sizeof (uint32_t));
+  remove = calloc (entries->count + 1, sizeof (unsigned char));
+  if (order == NULL || remove == NULL)
+    {
+      free (order);
+      free (remove);
+      cache_invalidate (directory);
+      return -1;
+    }
+
+  for (i = 0; i < directory->pending_count; ++i)
+    {
+      order[i] = i;
+    }
+
+  qsort_r (order, directory->pending_count, sizeof (uint32_t),
+           cache_compare_changes, directory);
+
+  entry_store_init (&additions);
+
+  /*
+   * Only the last change of an entry matters, a file created and
+   * written to many times is looked up once.
+   */
+  for (i = 0; i < directory->pending_count && status == 0; i = j)
+    {
+      name = arena_string (&directory->names,
+                           directory->pending[order[i]].name);
+      kind = CACHE_STALE;
+
+      for (j = i; j < directory->pending_count
+                  && strcmp (name, arena_string (
+                                 &directory->names,
+                                 directory->pending[order[j]].name))
+                         == 0;
+           ++j)
+        {
+          if (directory->pending[order[j]].kind != CACHE_STALE)
+            {
+              kind = directory->pending[order[j]].kind;
+            }
+        }
+
+      status = cache_apply_change (directory, entries, name, kind, remove,
+                                   &additions);
+    }
+
+  if (status == 0)
+    {
+      entry_store_remove (entries, remove);
+      status = entry_store_sort (&additions);
+    }
+
+  if (status == 0)
+    {
+      status = entry_store_merge (entries, &additions);
+    }
+
+  /*
+   * Part of the changes may be applied, the listing is read again
+   * on the next visit.
+   */
+  if (status != 0)
+    {
+      cache_invalidate (directory);
+    }
+
+  directory->pending_count = 0;
+  arena_reset (&directory->names);
+
+  entry_store_free (&additions);
+  free (remove);
+  free (order);
+
+  return status;
+}
+
+void
+cache_free (struct dir_cache *cache)
+{
+  while (cache->count > 0)
+    {
+      cache_remove (cache, cache->directories[cache->count - 1]);
+    }
+
+  while (cache->detached != NULL)
+    {
+      cache_remove (cache, cache->detached);
+    }
+
+  close (cache->inotify_fd);
+}
@@ -0,0 +1,242 @@
+/*
+ * cache - library to keep the listings of the visited directories
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_CACHE_H_
+#define DR_LIB_CACHE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "dir.h"
+#include "entry.h"
+
+/*
+ * Number of directories kept, the least recently used one
+ * is dropped to make room for a new one.
+ */
+#define CACHE_MAX_DIRECTORIES 16
+
+/*
+ * Memory the listings kept can take, in bytes, the least recently
+ * used ones are dropped before a new one is added when they take
+ * more.
+ */
+#define CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+/*
+ * Number of changes a directory can wait on before it is dropped
+ * and read again on the next visit.
+ */
+#define CACHE_MAX_PENDING (64 * 1024)
+
+/*
+ * Size of the buffer the inotify events are read in.
+ */
+#define CACHE_EVENT_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Events watched on every cached directory, IN_MODIFY keeps the size
+ * of a file that is still written to current.
+ */
+#define CACHE_WATCH_MASK                                                    \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB          \
+   | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_ONLYDIR)
+
+/*
+ * Number of the last changes of a directory a write is compared
+ * with, a file written again and again is only marked once until
+ * the changes are applied.
+ */
+#define CACHE_MODIFY_LOOKBACK 8
+
+/*
+ * What happened to an entry, CACHE_STALE means its metadata
+ * changed and must be fetched again.
+ */
+enum cache_change_kind
+{
+  CACHE_ADD,
+  CACHE_REMOVE,
+  CACHE_STALE,
+};
+
+/*
+ * Change of the entry NAME, in the NAMES arena of its directory.
+ */
+struct cache_change
+{
+  struct arena_handle name;
+  unsigned char kind;
+};
+
+/*
+ * Listing of a directory identified by DEV and INO and the changes
+ * inotify reported since it was last brought up to date.
+ * DIR_FD stays open while it is cached, its entries, its
+ * subdirectories and its parent are looked up relative to it.
+ * ENTRIES is sorted once READY is set and COMPLETE tells if the
+ * whole directory was read, LOST is set when changes were missed.
+ * CURSOR and OFFSET are where the list was left.
+ * USERS is the number of views showing it, it is not dropped to make
+ * room for another directory while it is not 0.
+ * PREFETCHED is set when it was read before it was visited.
+ * DETACHED is set when a new listing of the same directory replaced
+ * it while it was in use, it is LOST, in the DETACHED list of the
+ * cache through NEXT and freed once its last user releases it.
+ */
+struct cache_directory
+{
+  dev_t dev;
+  ino_t ino;
+  int dir_fd;
+  int wd;
+  struct entry_store entries;
+  int ready;
+  int complete;
+  int lost;
+
+  struct arena names;
+  struct cache_change *pending;
+  size_t pending_count;
+  size_t pending_capacity;
+
+  size_t cursor;
+  size_t offset;
+  uint64_t last_used;
+  unsigned users;
+  int prefetched;
+  int detached;
+  struct cache_directory *next;
+};
+
+/*
+ * Directories kept with an inotify watch on each so their listing
+ * follows the changes and a visit doesn't read them again.
+ * INOTIFY_FD is readable when there are events for 'cache_read_events'.
+ * DETACHED lists the directories replaced while they were in use.
+ */
+struct dir_cache
+{
+  int inotify_fd;
+  struct cache_directory *directories[CACHE_MAX_DIRECTORIES];
+  size_t count;
+  uint64_t clock;
+  struct cache_directory *detached;
+};
+
+/*
+ * Initialize CACHE.
+ * return 0 on success and -1 with errno set.
+ */
+int cache_init (struct dir_cache *cache);
+
+/*
+ * Get the directory at PATH if it is cached and was read entirely,
+ * its pending changes are not applied yet.
+ * return NULL if it isn't.
+ */
+struct cache_directory *cache_lookup (struct dir_cache *cache,
+                                      const char *const path);
+
+/*
+ * Same as 'cache_lookup' for the directory NAME relative to DIR_FD,
+ * only NAME is looked up.
+ */
+struct cache_directory *cache_lookup_at (struct dir_cache *cache, int dir_fd,
+                                         const char *const name);
+
+/*
+ * Add the directory at PATH to CACHE with an empty listing, it is
+ * watched before the caller reads it so no change is lost, the
+ * changes that happen meanwhile are applied once it is ready.
+ * a listing of the same directory that is still in use is detached
+ * instead of freed.
+ * return NULL with errno set on failure, EBUSY when every directory
+ * of CACHE is in use.
+ */
+struct cache_directory *cache_insert (struct dir_cache *cache,
+                                      const char *const path);
+
+/*
+ * Same as 'cache_insert' for the directory NAME relative to DIR_FD,
+ * only NAME is looked up and the directory is watched through the
+ * descriptor it was opened at, PATH is only used without /proc.
+ */
+struct cache_directory *cache_insert_at (struct dir_cache *cache,
+                                         int dir_fd, const char *const name,
+                                         const char *const path);
+
+/*
+ * Get the memory taken by the listing of DIRECTORY, in bytes.
+ */
+size_t cache_directory_size (const struct cache_directory *directory);
+
+/*
+ * Drop DIRECTORY from CACHE, it may be detached.
+ */
+void cache_remove (struct dir_cache *cache,
+                   struct cache_directory *directory);
+
+/*
+ * Let go of DIRECTORY for one of its users, it is freed if it was
+ * detached and that was the last one.
+ */
+void cache_release (struct dir_cache *cache,
+                    struct cache_directory *directory);
+
+/*
+ * Read the events of the inotify file descriptor and add them to
+ * the pending changes of their directory.
+ * return the number of events read or -1 with errno set.
+ */
+int cache_read_events (struct dir_cache *cache);
+
+/*
+ * return 1 if DIRECTORY has changes that 'cache_apply' would apply.
+ */
+static inline int
+cache_has_changes (const struct cache_directory *directory)
+{
+  return directory->ready && directory->pending_count > 0;
+}
+
+/*
+ * Apply the pending changes to the sorted listing of DIRECTORY,
+ * the new entries are merged in place and nothing is sorted again.
+ * the metadata of the new and changed entries must be fetched again.
+ * return 0 on success and -1 if the allocation failed, DIRECTORY is
+ * then marked LOST.
+ */
+int cache_apply (struct cache_directory *directory);
+
+/*
+ * Drop every directory and release the resources of CACHE.
+ */
+void cache_free (struct dir_cache *cache);
+
+#endif // DR_LIB_CACHE_H_
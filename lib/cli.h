@@ -55,8 +55,40 @@ struct argp_option cli_argp_options[] = {
   { "version", 'v', 0, 0, "show program version", -1 },
   { "usage", 'u', 0, 0, "show a short usage message", 0 },
   { 0, 0, 0, 0, "program settings:", 0 },
-  { "verbose", 'V', 0, 0, "print more information", 0 },
-  { "quiet", 'q', 0, 0, "print no information", 0 },
+  { "verbose", 'V', 0, 0, "log the debug messages too", 0 },
+  { "quiet", 'q', 0, 0, "only log the errors", 0 },
+  { "log", 'g', "FILE", 0,
+    "append the log to FILE instead of sending it to syslog", 0 },
+  { "threads", 'j', "N", 0,
+    "use N threads to sort large directories and walk trees (default: one "
+    "per processor)",
+    0 },
+  { "history", 'H', "MIB", 0,
+    "keep up to MIB mebibytes of visited listings to go back and forward "
+    "at once (default: 64)",
+    0 },
+  { "recursive", 'r', 0, 0, "print every entry under PATH and exit", 0 },
+  { "print", 'p', 0, 0,
+    "print the sorted entries of PATH and exit, the default when the output "
+    "is not a terminal",
+    0 },
+  { "null", '0', 0, 0,
+    "end the printed entries with a null byte instead of a newline", 0 },
+  { "json", 'J', 0, 0, "print the entries as JSON Lines and exit", 0 },
+  { "long", 'l', 0, 0,
+    "print the type, permissions, size and modification time of the "
+    "entries too",
+    0 },
+  { "follow", 'L', 0, 0, "follow symbolic links to directories", 0 },
+  { "no-cache", 'C', 0, 0,
+    "don't use the daemon or the sorted listings in the cache directory",
+    0 },
+  { "daemon", 'D', 0, 0,
+    "keep the listings in memory for the other dr and don't exit", 0 },
+  { "stats", 'S', "FILE", OPTION_ARG_OPTIONAL,
+    "time every phase and print a report on stderr when exiting, with a "
+    "JSON dump of the counters and histograms in FILE if given",
+    0 },
   { 0 },
 };
 
@@ -67,8 +99,22 @@ struct argp_option cli_argp_options[] = {
 struct cli_arguments
 {
   int verbose, quiet; /* '-v', '-q' */
+  int threads;        /* '-j' */
+  size_t history_memory; /* '-H' */
+  int recursive;      /* '-r' */
+  int print;          /* '-p' */
+  int null;           /* '-0' */
+  int json;           /* '-J' */
+  int long_format;    /* '-l' */
+  int follow;         /* '-L' */
+  int no_cache;       /* '-C' */
+  int daemon;         /* '-D' */
+  int stats;          /* '-S' */
+  char *stats_file;
+  char *log_file;     /* '-g' */
   int no_args;
-  char *name;
+  char **names;      /* PATH... */
+  size_t name_count;
 };
 
 #endif // DR_LIB_CLI_H_
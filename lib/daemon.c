@@ -0,0 +1,336 @@
+#include "daemon.h"
+
+int
+daemon_socket_path (char *buffer, size_t size)
+{
+  const char *runtime = getenv ("XDG_RUNTIME_DIR");
+  int length;
+
+  if (runtime != NULL && runtime[0] == '/')
+    {
+      length = snprintf (buffer, size, "%s/dr.sock", runtime);
+    }
+  else
+    {
+      length = snprintf (buffer, size, "/tmp/dr-%ju.sock",
+                         (uintmax_t)getuid ());
+    }
+
+  if (length < 0 || (size_t)length >= size)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Fill ADDRESS with the path of the socket.
+ */
+static int
+daemon_address (struct sockaddr_un *address)
+{
+  memset (address, 0, sizeof (*address));
+  address->sun_family = AF_UNIX;
+
+  return daemon_socket_path (address->sun_path, sizeof (address->sun_path));
+}
+
+/*
+ * return 0 if the process at the other end of FD is run by
+ * the same user and -1 with errno set otherwise.
+ */
+static int
+daemon_check_peer (int fd)
+{
+  struct ucred credentials;
+  socklen_t length = sizeof (credentials);
+
+  if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+    {
+      return -1;
+    }
+
+  if (credentials.uid != getuid ())
+    {
+      errno = EPERM;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Stop waiting for FD after DAEMON_TIMEOUT.
+ */
+static int
+daemon_set_timeout (int fd)
+{
+  struct timeval timeout;
+
+  timeout.tv_sec = DAEMON_TIMEOUT / 1000;
+  timeout.tv_usec = DAEMON_TIMEOUT % 1000 * 1000;
+
+  if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout))
+          != 0
+      || setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                     sizeof (timeout))
+             != 0)
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Connect to the socket of the daemon.
+ * return the connection or -1 with errno set.
+ */
+static int
+daemon_connect (void)
+{
+  struct sockaddr_un address;
+  int fd;
+
+  if (daemon_address (&address) != 0)
+    {
+      return -1;
+    }
+
+  fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (connect (fd, (struct sockaddr *)&address, sizeof (address)) != 0
+      || daemon_check_peer (fd) != 0 || daemon_set_timeout (fd) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+int
+daemon_listen (void)
+{
+  struct sockaddr_un address;
+  int saved_errno;
+  int client;
+  int fd;
+
+  if (daemon_address (&address) != 0)
+    {
+      return -1;
+    }
+
+  /*
+   * A socket that accepts connections belongs to a running daemon,
+   * one that refuses them was left behind.
+   */
+  client = daemon_connect ();
+  if (client >= 0)
+    {
+      close (client);
+      errno = EADDRINUSE;
+      return -1;
+    }
+  unlink (address.sun_path);
+
+  fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (bind (fd, (struct sockaddr *)&address, sizeof (address)) != 0
+      || chmod (address.sun_path, 0600) != 0 || listen (fd, SOMAXCONN) != 0)
+    {
+      saved_errno = errno;
+      close (fd);
+      errno = saved_errno;
+      return -1;
+    }
+
+  return fd;
+}
+
+int
+daemon_accept (int listen_fd, char *path, size_t size)
+{
+  ssize_t length;
+  int saved_errno;
+  int fd;
+
+  fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (daemon_check_peer (fd) != 0 || daemon_set_timeout (fd) != 0)
+    {
+      goto error;
+    }
+
+  length = recv (fd, path, size, 0);
+  if (length < 0)
+    {
+      goto error;
+    }
+
+  if (length == 0 || (size_t)length == size || path[length - 1] != '\0')
+    {
+      errno = EINVAL;
+      goto error;
+    }
+
+  return fd;
+
+error:
+  saved_errno = errno;
+  close (fd);
+  errno = saved_errno;
+  return -1;
+}
+
+int
+daemon_reply (int client_fd, int error, int fd)
+{
+  union
+  {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr message;
+  struct cmsghdr *header;
+  struct iovec iov;
+
+  iov.iov_base = &error;
+  iov.iov_len = sizeof (error);
+
+  memset (&message, 0, sizeof (message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+
+  if (error == 0)
+    {
+      memset (&control, 0, sizeof (control));
+      message.msg_control = control.buffer;
+      message.msg_controllen = sizeof (control.buffer);
+
+      header = CMSG_FIRSTHDR (&message);
+      header->cmsg_level = SOL_SOCKET;
+      header->cmsg_type = SCM_RIGHTS;
+      header->cmsg_len = CMSG_LEN (sizeof (int));
+      memcpy (CMSG_DATA (header), &fd, sizeof (int));
+    }
+
+  if (sendmsg (client_fd, &message, MSG_NOSIGNAL) != sizeof (error))
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Read the answer of the daemon on FD, the snapshot is put in
+ * *SNAPSHOT_FD.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+daemon_receive (int fd, int *snapshot_fd)
+{
+  union
+  {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr message;
+  struct cmsghdr *header;
+  struct iovec iov;
+  int error;
+
+  iov.iov_base = &error;
+  iov.iov_len = sizeof (error);
+
+  memset (&message, 0, sizeof (message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof (control.buffer);
+
+  if (recvmsg (fd, &message, MSG_CMSG_CLOEXEC) != sizeof (error))
+    {
+      if (errno == 0)
+        {
+          errno = EPROTO;
+        }
+      return -1;
+    }
+
+  header = CMSG_FIRSTHDR (&message);
+  if (header == NULL || header->cmsg_level != SOL_SOCKET
+      || header->cmsg_type != SCM_RIGHTS)
+    {
+      errno = error != 0 ? error : EPROTO;
+      return -1;
+    }
+
+  memcpy (snapshot_fd, CMSG_DATA (header), sizeof (int));
+
+  if (error != 0)
+    {
+      close (*snapshot_fd);
+      errno = error;
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+daemon_fetch (const char *path, const struct stat *st,
+              struct entry_store *store)
+{
+  size_t length = strlen (path) + 1;
+  int snapshot_fd;
+  int status;
+  int fd;
+
+  fd = daemon_connect ();
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  errno = 0;
+  if (send (fd, path, length, MSG_NOSIGNAL) != (ssize_t)length
+      || daemon_receive (fd, &snapshot_fd) != 0)
+    {
+      status = errno;
+      close (fd);
+      errno = status;
+      return -1;
+    }
+
+  close (fd);
+
+  /*
+   * The directory may have changed between the stat of the client
+   * and the one of the daemon, the snapshot is then refused.
+   */
+  status = snap_read (snapshot_fd, st, store);
+  if (status != 0)
+    {
+      errno = ESTALE;
+    }
+  close (snapshot_fd);
+
+  return status;
+}
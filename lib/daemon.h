@@ -0,0 +1,91 @@
+/*
+ * daemon - library to talk to the resident dr over a Unix socket
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_DAEMON_H_
+#define DR_LIB_DAEMON_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "entry.h"
+#include "snap.h"
+
+/*
+ * Time a client waits for the listing before reading the
+ * directory itself, in milliseconds.
+ */
+#define DAEMON_TIMEOUT 2000
+
+/*
+ * A client sends the absolute path of a directory in one packet,
+ * the daemon answers with an int that is 0 or an errno value and,
+ * on success, a memfd holding the snapshot of the listing in the
+ * format of 'snap_write'.
+ * both sides only talk to processes of the same user.
+ */
+
+/*
+ * Write the path of the socket in BUFFER of SIZE bytes,
+ * $XDG_RUNTIME_DIR/dr.sock or /tmp/dr-UID.sock.
+ * return 0 on success and -1 with errno set.
+ */
+int daemon_socket_path (char *buffer, size_t size);
+
+/*
+ * Create the listening socket of the daemon, a socket left by a
+ * daemon that is gone is replaced.
+ * return the socket or -1 with errno set, EADDRINUSE if a
+ * daemon is already running.
+ */
+int daemon_listen (void);
+
+/*
+ * Accept the next client of the socket LISTEN_FD and read its
+ * request in PATH of SIZE bytes.
+ * return the connection or -1 with errno set.
+ */
+int daemon_accept (int listen_fd, char *path, size_t size);
+
+/*
+ * Answer the client CLIENT_FD with ERROR, and the snapshot in
+ * the file FD when ERROR is 0.
+ * return 0 on success and -1 with errno set.
+ */
+int daemon_reply (int client_fd, int error, int fd);
+
+/*
+ * Ask the daemon for the listing of the directory at the absolute
+ * PATH and fill the empty STORE with it, the snapshot must be
+ * of the directory ST as the client sees it.
+ * return 0 on success and -1 with errno set when there is no
+ * daemon or it couldn't answer.
+ */
+int daemon_fetch (const char *path, const struct stat *st,
+                  struct entry_store *store);
+
+#endif // DR_LIB_DAEMON_H_
@@ -1,59 +1,79 @@
 #include "dir.h"
 
+/*
+ * Layout of the records written by getdents64,
+ * refer to getdents(2).
+ */
+struct dir_linux_dirent64
+{
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
 int
-dir_select_entries (const struct dirent *ep)
+dir_select_name (const char *name)
 {
-  int check_dot_current_directory = (0 != strcmp (ep->d_name, "."));
-  int check_dot_dot_parent_directory = (0 != strcmp (ep->d_name, ".."));
+  int check_dot_current_directory = (0 != strcmp (name, "."));
+  int check_dot_dot_parent_directory = (0 != strcmp (name, ".."));
 
   return check_dot_current_directory && check_dot_dot_parent_directory;
 }
 
 int
-dir_typesort (const struct dirent **a, const struct dirent **b)
+dir_select_entries (const struct dirent *ep)
+{
+  return dir_select_name (ep->d_name);
+}
+
+int
+dir_compare_entries (const char *a_name, unsigned char a_type,
+                     const char *b_name, unsigned char b_type)
 {
   /*
    * Both are directories so we check wich one start
    * with a '.'.
    */
-  if ((*a)->d_type == DT_DIR && (*b)->d_type == DT_DIR)
+  if (a_type == DT_DIR && b_type == DT_DIR)
     {
-      if ((*a)->d_name[0] == '.' && (*b)->d_name[0] != '.')
+      if (a_name[0] == '.' && b_name[0] != '.')
         {
           return -1;
         }
 
-      if ((*a)->d_name[0] != '.' && (*b)->d_name[0] == '.')
+      if (a_name[0] != '.' && b_name[0] == '.')
         {
           return 1;
         }
 
-      return strcoll ((*a)->d_name, (*b)->d_name);
+      return strcoll (a_name, b_name);
     }
 
   /*
    * Both are files so we check wich one start
    * with a '.'.
    */
-  if ((*a)->d_type != DT_DIR && (*b)->d_type != DT_DIR)
+  if (a_type != DT_DIR && b_type != DT_DIR)
     {
-      if ((*a)->d_name[0] == '.' && (*b)->d_name[0] != '.')
+      if (a_name[0] == '.' && b_name[0] != '.')
         {
           return -1;
         }
 
-      if ((*a)->d_name[0] != '.' && (*b)->d_name[0] == '.')
+      if (a_name[0] != '.' && b_name[0] == '.')
         {
           return 1;
         }
 
-      return strcoll ((*a)->d_name, (*b)->d_name);
+      return strcoll (a_name, b_name);
     }
 
   /*
    * One of them is directory
    */
-  if ((*a)->d_type == DT_DIR && (*b)->d_type != DT_DIR)
+  if (a_type == DT_DIR && b_type != DT_DIR)
     {
       return -1;
     }
@@ -62,21 +82,291 @@ dir_typesort (const struct dirent **a, const struct dirent **b)
 }
 
 int
-dir_get_directory_entries (const char *const dir_list_name,
-                           __attribute__ ((unused)) struct dirent ***dir_list,
-                           int *num_entries)
+dir_typesort (const struct dirent **a, const struct dirent **b)
 {
-  struct dirent **eps;
-  *num_entries
-      = scandir (dir_list_name, &eps, dir_select_entries, dir_typesort);
+  return dir_compare_entries ((*a)->d_name, (*a)->d_type, (*b)->d_name,
+                              (*b)->d_type);
+}
+
+int
+dir_reader_open (struct dir_reader *reader, const char *const dir_name)
+{
+  reader->buffer = NULL;
+
+  return dir_reader_open_at (reader, AT_FDCWD, dir_name, 0);
+}
+
+int
+dir_reader_open_at (struct dir_reader *reader, int dir_fd,
+                    const char *const name, int flags)
+{
+  int fd;
+
+  fd = openat (dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | flags);
+  if (fd < 0)
+    {
+      reader->fd = -1;
+      return -1;
+    }
+
+  return dir_reader_open_fd (reader, fd);
+}
+
+int
+dir_reader_open_fd (struct dir_reader *reader, int fd)
+{
+  reader->fd = fd;
+
+  if (reader->buffer == NULL)
+    {
+      reader->buffer_size = DIR_READER_BUFFER_SIZE;
+      reader->buffer = malloc (reader->buffer_size);
+      if (reader->buffer == NULL)
+        {
+          close (reader->fd);
+          reader->fd = -1;
+          return -1;
+        }
+    }
+
+  reader->position = 0;
+  reader->length = 0;
+  reader->eof = 0;
+
+  return 0;
+}
+
+/*
+ * Some filesystems don't fill d_type, ask the inode
+ * for its type so the sort can still group directories.
+ */
+static unsigned char
+dir_reader_resolve_type (struct dir_reader *reader, const char *name)
+{
+  struct stat st;
+
+  stats_add (STATS_STAT, 1);
+  if (fstatat (reader->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+      return DT_UNKNOWN;
+    }
+
+  return IFTODT (st.st_mode);
+}
+
+int
+dir_reader_next_batch (struct dir_reader *reader, struct dir_batch *batch)
+{
+  struct dir_linux_dirent64 *ep;
+  struct dir_record *record;
+  ssize_t nread;
 
-  if (*num_entries < 0)
+  batch->count = 0;
+
+  while (batch->count == 0)
+    {
+      if (reader->position >= reader->length)
+        {
+          /*
+           * The records of the batch point into the buffer
+           * so it can only be refilled once they were consumed.
+           */
+          if (reader->eof)
+            {
+              return 0;
+            }
+
+          nread = getdents64 (reader->fd, reader->buffer,
+                              reader->buffer_size);
+          stats_add (STATS_GETDENTS, 1);
+          if (nread < 0)
+            {
+              return -1;
+            }
+
+          if (nread == 0)
+            {
+              reader->eof = 1;
+              return 0;
+            }
+
+          reader->position = 0;
+          reader->length = nread;
+        }
+
+      while (reader->position < reader->length
+             && batch->count < DIR_BATCH_SIZE)
+        {
+          ep = (struct dir_linux_dirent64 *)(reader->buffer
+                                              + reader->position);
+          reader->position += ep->d_reclen;
+
+          if (!dir_select_name (ep->d_name))
+            {
+              continue;
+            }
+
+          record = &batch->records[batch->count++];
+          record->name = ep->d_name;
+          record->name_length = strlen (ep->d_name);
+          record->ino = ep->d_ino;
+          record->type = ep->d_type;
+
+          if (record->type == DT_UNKNOWN)
+            {
+              record->type = dir_reader_resolve_type (reader, ep->d_name);
+            }
+        }
+    }
+
+  stats_add (STATS_ENTRIES, batch->count);
+
+  return 1;
+}
+
+void
+dir_reader_close (struct dir_reader *reader)
+{
+  if (reader->fd >= 0)
+    {
+      close (reader->fd);
+      reader->fd = -1;
+    }
+
+  free (reader->buffer);
+  reader->buffer = NULL;
+}
+
+int
+dir_read_directory (const char *const dir_name, dir_batch_callback callback,
+                    void *data)
+{
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  int status = 0;
+  int ret;
+
+  if (dir_reader_open (&reader, dir_name) != 0)
     {
       perror ("Couldn't open the directory");
       return 1;
     }
 
-  *dir_list = eps;
+  batch = malloc (sizeof (struct dir_batch));
+  if (batch == NULL)
+    {
+      dir_reader_close (&reader);
+      return 1;
+    }
+
+  while ((ret = dir_reader_next_batch (&reader, batch)) > 0)
+    {
+      status = callback (batch, data);
+      if (status != 0)
+        {
+          break;
+        }
+    }
+
+  if (ret < 0)
+    {
+      perror ("Couldn't read the directory");
+      status = 1;
+    }
+
+  free (batch);
+  dir_reader_close (&reader);
+
+  return status;
+}
+
+/*
+ * Growable list of entries filled by 'dir_get_directory_entries'.
+ */
+struct dir_entries_list
+{
+  struct dirent **eps;
+  int count;
+  int capacity;
+};
+
+static int
+dir_append_batch (const struct dir_batch *batch, void *data)
+{
+  struct dir_entries_list *list = data;
+  const struct dir_record *record;
+  struct dirent **eps;
+  struct dirent *ep;
+  size_t reclen;
+  size_t i;
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      record = &batch->records[i];
+
+      if (list->count == list->capacity)
+        {
+          list->capacity = list->capacity ? list->capacity * 2 : 64;
+          eps = realloc (list->eps,
+                         list->capacity * sizeof (struct dirent *));
+          if (eps == NULL)
+            {
+              return 1;
+            }
+          list->eps = eps;
+        }
+
+      /*
+       * Only allocate what the name needs like scandir does.
+       */
+      reclen = offsetof (struct dirent, d_name) + record->name_length + 1;
+      ep = malloc (reclen);
+      if (ep == NULL)
+        {
+          return 1;
+        }
+
+      ep->d_ino = record->ino;
+      ep->d_off = 0;
+      ep->d_reclen = reclen;
+      ep->d_type = record->type;
+      memcpy (ep->d_name, record->name, record->name_length + 1);
+
+      list->eps[list->count++] = ep;
+    }
+
+  return 0;
+}
+
+int
+dir_get_directory_entries (const char *const dir_list_name,
+                           struct dirent ***dir_list, int *num_entries)
+{
+  struct dir_entries_list list = { NULL, 0, 0 };
+  uint64_t start = stats_start ();
+  int i;
+
+  if (dir_read_directory (dir_list_name, dir_append_batch, &list) != 0)
+    {
+      for (i = 0; i < list.count; ++i)
+        {
+          free (list.eps[i]);
+        }
+      free (list.eps);
+
+      *num_entries = -1;
+      return 1;
+    }
+
+  stats_stop (STATS_READ, start);
+
+  start = stats_start ();
+  qsort (list.eps, list.count, sizeof (struct dirent *),
+         (int (*) (const void *, const void *))dir_typesort);
+  stats_stop (STATS_SORT, start);
+
+  *num_entries = list.count;
+  *dir_list = list.eps;
 
   return 0;
 }
@@ -21,13 +21,72 @@
 #define DR_LIB_DIR_H_
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <locale.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sysexits.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * Size of the buffer handed to getdents64, large enough to get
+ * a few thousand entries for every system call.
+ */
+#define DIR_READER_BUFFER_SIZE (256 * 1024)
+
+/*
+ * Maximum number of entries handed to the caller at once.
+ */
+#define DIR_BATCH_SIZE 1024
+
+/*
+ * A single entry returned by the reader, NAME points inside the
+ * buffer of the reader and is only valid until the next batch.
+ */
+struct dir_record
+{
+  const char *name;
+  unsigned short name_length;
+  unsigned char type;
+  ino_t ino;
+};
+
+/*
+ * Group of entries that were read with the same system call.
+ */
+struct dir_batch
+{
+  struct dir_record records[DIR_BATCH_SIZE];
+  size_t count;
+};
+
+/*
+ * Streaming directory reader built on getdents64, the buffer is
+ * reused between calls so reading does not allocate per entry.
+ */
+struct dir_reader
+{
+  int fd;
+  char *buffer;
+  size_t buffer_size;
+  size_t position;
+  size_t length;
+  int eof;
+};
+
+/*
+ * Called for every batch read by 'dir_read_directory', DATA is the
+ * pointer passed by the caller. a non zero return value stop the scan.
+ */
+typedef int (*dir_batch_callback) (const struct dir_batch *batch, void *data);
 
 /*
  * We want the files and directories that the user can interact with,
@@ -39,15 +98,75 @@
  */
 int dir_select_entries (const struct dirent *ep);
 
+/*
+ * Same filter as 'dir_select_entries' but for a bare NAME.
+ */
+int dir_select_name (const char *name);
+
 /*
  * Make the output follow a strict sorting of:
  * hidden directory > regular directory > hidden files > regular files.
  */
 int dir_typesort (const struct dirent **a, const struct dirent **b);
 
+/*
+ * Compare two entries by their NAME and TYPE with the same order
+ * as 'dir_typesort'.
+ */
+int dir_compare_entries (const char *a_name, unsigned char a_type,
+                         const char *b_name, unsigned char b_type);
+
+/*
+ * Open the directory DIR_NAME for reading.
+ * return 0 on success or -1 with errno set.
+ */
+int dir_reader_open (struct dir_reader *reader, const char *const dir_name);
+
+/*
+ * Open the directory NAME relative to DIR_FD for reading, FLAGS
+ * are added to the flags given to 'openat'.
+ * the buffer of READER is kept if it has one so a single reader
+ * can go through many directories, it must be NULL the first time.
+ * return 0 on success or -1 with errno set.
+ */
+int dir_reader_open_at (struct dir_reader *reader, int dir_fd,
+                        const char *const name, int flags);
+
+/*
+ * Read the directory open at FD, READER owns FD after the call,
+ * the buffer is kept like 'dir_reader_open_at' does.
+ * return 0 on success or -1 with errno set.
+ */
+int dir_reader_open_fd (struct dir_reader *reader, int fd);
+
+/*
+ * Fill BATCH with the next entries of READER, the entries that
+ * don't pass 'dir_select_name' are skipped, and entries without
+ * a d_type are resolved with 'fstatat'.
+ * return 1 if BATCH got entries, 0 at the end and -1 on error.
+ */
+int dir_reader_next_batch (struct dir_reader *reader, struct dir_batch *batch);
+
+/*
+ * Release the file descriptor and the buffer of READER.
+ */
+void dir_reader_close (struct dir_reader *reader);
+
+/*
+ * Read the directory DIR_NAME and pass the entries to CALLBACK
+ * in batches as soon as they are read, without sorting them.
+ * return 0 on success, 1 on error and the value of CALLBACK
+ * if it stopped the scan.
+ */
+int dir_read_directory (const char *const dir_name,
+                        dir_batch_callback callback, void *data);
+
 /*
  * Get the directory entries for the LIST_DIR_NAME.
  * pass NUM_ENTRIES to handle errors such as if the directory is empty.
+ * the entries are read with 'dir_read_directory' and sorted with
+ * 'dir_typesort', use 'dir_read_directory' directly to work on
+ * the entries before the whole directory is read.
  * TODO: pass an array to save into it the entries to handle those errors,
  * and use them later in the program.
  */
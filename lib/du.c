@@ -0,0 +1,847 @@
+#include "du.h"
+
+struct du_cache *
+du_cache_new (void)
+{
+  struct du_cache *cache;
+
+  cache = calloc (1, sizeof (struct du_cache));
+  if (cache == NULL)
+    {
+      return NULL;
+    }
+
+  pthread_mutex_init (&cache->lock, NULL);
+  cache->references = 1;
+
+  return cache;
+}
+
+/*
+ * Find the slot of DEV and INO in CACHE, or the empty slot
+ * where they go.
+ */
+static struct du_cache_slot *
+du_cache_slot (struct du_cache *cache, dev_t dev, ino_t ino)
+{
+  size_t i = inode_hash (dev, ino, cache->capacity);
+
+  while (cache->slots[i].ino != 0
+         && (cache->slots[i].ino != ino || cache->slots[i].dev != dev))
+    {
+      i = (i + 1) & (cache->capacity - 1);
+    }
+
+  return &cache->slots[i];
+}
+
+/*
+ * Get what was kept of the directory ST if it still has the same
+ * modification time.
+ * return 1 and set BYTES and the LENGTH bytes of SUBDIRECTORIES,
+ * which must be freed, if it was kept, 0 otherwise.
+ */
+static int
+du_cache_lookup (struct du_cache *cache, const struct stat *st,
+                 uint64_t *bytes, char **subdirectories, size_t *length)
+{
+  struct du_cache_slot *slot;
+  int found = 0;
+
+  pthread_mutex_lock (&cache->lock);
+
+  if (cache->capacity > 0)
+    {
+      slot = du_cache_slot (cache, st->st_dev, st->st_ino);
+      if (slot->ino != 0 && slot->mtime.tv_sec == st->st_mtim.tv_sec
+          && slot->mtime.tv_nsec == st->st_mtim.tv_nsec)
+        {
+          *subdirectories = NULL;
+          if (slot->length > 0)
+            {
+              *subdirectories = malloc (slot->length);
+              if (*subdirectories != NULL)
+                {
+                  memcpy (*subdirectories, slot->subdirectories,
+                          slot->length);
+                }
+            }
+
+          if (slot->length == 0 || *subdirectories != NULL)
+            {
+              *bytes = slot->bytes;
+              *length = slot->length;
+              found = 1;
+            }
+        }
+    }
+
+  pthread_mutex_unlock (&cache->lock);
+
+  return found;
+}
+
+/*
+ * Keep the directory ST with its BYTES and the LENGTH bytes of
+ * SUBDIRECTORIES, which the cache takes.
+ */
+static void
+du_cache_store (struct du_cache *cache, const struct stat *st,
+                uint64_t bytes, char *subdirectories, size_t length)
+{
+  struct du_cache_slot *old;
+  struct du_cache_slot *slot;
+  struct timespec now;
+  size_t capacity;
+  size_t i;
+
+  /*
+   * A change in the same tick as the read would leave the same
+   * mtime on a directory that isn't the same anymore.
+   */
+  clock_gettime (CLOCK_REALTIME, &now);
+  if (now.tv_sec - st->st_mtim.tv_sec < DU_CACHE_RACY_SECONDS)
+    {
+      free (subdirectories);
+      return;
+    }
+
+  /*
+   * Another thread can grow the table until the lock is held.
+   */
+  pthread_mutex_lock (&cache->lock);
+
+  old = cache->slots;
+  capacity = cache->capacity;
+  if (2 * (cache->count + 1) > cache->capacity)
+    {
+      capacity = capacity ? capacity * 2 : DU_CACHE_INITIAL_CAPACITY;
+      cache->slots = calloc (capacity, sizeof (struct du_cache_slot));
+      if (cache->slots == NULL)
+        {
+          cache->slots = old;
+          pthread_mutex_unlock (&cache->lock);
+          free (subdirectories);
+          return;
+        }
+
+      cache->capacity = capacity;
+      for (i = 0; old != NULL && i < capacity / 2; ++i)
+        {
+          if (old[i].ino != 0)
+            {
+              *du_cache_slot (cache, old[i].dev, old[i].ino) = old[i];
+            }
+        }
+      free (old);
+    }
+
+  slot = du_cache_slot (cache, st->st_dev, st->st_ino);
+  if (slot->ino == 0)
+    {
+      if (cache->count == DU_CACHE_MAX_DIRECTORIES)
+        {
+          pthread_mutex_unlock (&cache->lock);
+          free (subdirectories);
+          return;
+        }
+      ++cache->count;
+    }
+
+  free (slot->subdirectories);
+  slot->dev = st->st_dev;
+  slot->ino = st->st_ino;
+  slot->mtime = st->st_mtim;
+  slot->bytes = bytes;
+  slot->subdirectories = subdirectories;
+  slot->length = length;
+
+  pthread_mutex_unlock (&cache->lock);
+}
+
+void
+du_cache_release (struct du_cache *cache)
+{
+  size_t i;
+
+  if (__atomic_sub_fetch (&cache->references, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  for (i = 0; i < cache->capacity; ++i)
+    {
+      free (cache->slots[i].subdirectories);
+    }
+
+  pthread_mutex_destroy (&cache->lock);
+  free (cache->slots);
+  free (cache);
+}
+
+/*
+ * Let go of JOB, the last of the threads and the caller frees it
+ * with the directories it counted.
+ */
+static void
+du_job_release (struct du_job *job)
+{
+  size_t i;
+
+  if (__atomic_sub_fetch (&job->references, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  while (job->count > 0)
+    {
+      close (job->tasks[--job->count].fd);
+    }
+
+  for (i = 0; i < job->top_count; ++i)
+    {
+      free (job->tops[i]);
+    }
+
+  for (i = 0; i < job->dropped_count; ++i)
+    {
+      free (job->dropped[i]);
+    }
+
+  pthread_cond_destroy (&job->wake);
+  pthread_mutex_destroy (&job->lock);
+  inode_set_free (&job->links);
+  close (job->event_fd);
+  close (job->dir_fd);
+  du_cache_release (job->cache);
+  free (job->tops);
+  free (job->dropped);
+  free (job->totals);
+  free (job);
+}
+
+static void
+du_notify (struct du_job *job)
+{
+  uint64_t one = 1;
+
+  if (write (job->event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The counter is full, the caller already has
+       * something to read.
+       */
+    }
+}
+
+/*
+ * Drop a directory of the tree of TOP, the total is done once
+ * every directory was read.
+ */
+static void
+du_finish (struct du_job *job, struct du_total *top)
+{
+    if (__atomic_sub_fetch (&top->pending, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  __atomic_store_n (&top->state, DU_DONE, __ATOMIC_RELEASE);
+  du_notify (job);
+}
+
+/*
+ * Queue the directory open at FD for another thread.
+ * return 0 on success and -1 if the queue is full.
+ */
+static int
+du_push (struct du_job *job, int fd, struct du_total *top)
+{
+  pthread_mutex_lock (&job->lock);
+
+  if (job->count == DU_MAX_QUEUED)
+    {
+      pthread_mutex_unlock (&job->lock);
+      return -1;
+    }
+
+  __atomic_add_fetch (&top->pending, 1, __ATOMIC_RELAXED);
+  job->tasks[job->count].fd = fd;
+  job->tasks[job->count].top = top;
+  ++job->count;
+  ++job->outstanding;
+
+  pthread_cond_signal (&job->wake);
+  pthread_mutex_unlock (&job->lock);
+
+  return 0;
+}
+
+static void du_read (struct du_job *job, int fd, struct du_total *top,
+                     struct dir_reader *reader, struct dir_batch *batch);
+
+/*
+ * Count the subdirectory NAME of the directory open at FD in the
+ * total of TOP, it is queued or read right away when the queue is
+ * full.
+ */
+static void
+du_descend (struct du_job *job, int fd, const char *name,
+            struct du_total *top)
+{
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  int child;
+
+  child = openat (fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (child < 0 || du_push (job, child, top) == 0)
+    {
+      return;
+    }
+
+  /*
+   * Too many directories are waiting, this one is read now with
+   * its own buffers.
+   */
+  reader.fd = -1;
+  reader.buffer = NULL;
+  batch = malloc (sizeof (struct dir_batch));
+  if (batch != NULL)
+    {
+      du_read (job, child, top, &reader, batch);
+      free (batch);
+    }
+  else
+    {
+      close (child);
+    }
+  dir_reader_close (&reader);
+}
+
+/*
+ * Append the LENGTH bytes of NAME and a null byte to the *SIZE bytes
+ * of *NAMES, which has room for *CAPACITY.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+du_add_name (char **names, size_t *size, size_t *capacity,
+             const char *name, size_t length)
+{
+  char *grown;
+  size_t wanted = *capacity ? *capacity : 256;
+
+  while (wanted < *size + length + 1)
+    {
+      wanted *= 2;
+    }
+
+  if (wanted != *capacity)
+    {
+      grown = realloc (*names, wanted);
+      if (grown == NULL)
+        {
+          return -1;
+        }
+      *names = grown;
+      *capacity = wanted;
+    }
+
+  memcpy (*names + *size, name, length + 1);
+  *size += length + 1;
+
+  return 0;
+}
+
+/*
+ * Count the directory open at FD in the total of TOP, it is only read
+ * when the cache doesn't have it, and keep it in the cache once it
+ * was read.
+ */
+static void
+du_read (struct du_job *job, int fd, struct du_total *top,
+         struct dir_reader *reader, struct dir_batch *batch)
+{
+  const struct dir_record *record;
+  char *names = NULL;
+  size_t names_length = 0;
+  size_t names_capacity = 0;
+  uint64_t bytes = 0;
+  uint64_t own = 0;
+  struct stat st;
+  struct stat file_st;
+  int keep = 1;
+  int status = -1;
+  size_t i;
+
+  if (fstat (fd, &st) != 0)
+    {
+      close (fd);
+      return;
+    }
+
+  if (du_cache_lookup (job->cache, &st, &own, &names, &names_length))
+    {
+      __atomic_add_fetch (&top->bytes, own, __ATOMIC_RELAXED);
+
+      for (i = 0; i < names_length; i += strlen (names + i) + 1)
+        {
+          du_descend (job, fd, names + i, top);
+        }
+      free (names);
+      close (fd);
+
+      return;
+    }
+
+  bytes = (uint64_t)st.st_blocks * 512;
+
+  if (dir_reader_open_fd (reader, fd) != 0)
+    {
+      free (names);
+      return;
+    }
+
+  while (!__atomic_load_n (&job->stop, __ATOMIC_RELAXED)
+         && (status = dir_reader_next_batch (reader, batch)) > 0)
+    {
+      for (i = 0; i < batch->count; ++i)
+        {
+          record = &batch->records[i];
+
+          if (record->type == DT_DIR)
+            {
+              if (keep
+                  && du_add_name (&names, &names_length, &names_capacity,
+                                  record->name, record->name_length)
+                         != 0)
+                {
+                  keep = 0;
+                }
+              du_descend (job, fd, record->name, top);
+              continue;
+            }
+
+          if (fstatat (fd, record->name, &file_st, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+              keep = 0;
+              continue;
+            }
+
+          /*
+           * A file with several links is only counted the first
+           * time, which depends on the other directories read.
+           */
+          if (file_st.st_nlink > 1 && !S_ISDIR (file_st.st_mode))
+            {
+              keep = 0;
+              if (inode_set_insert (&job->links, file_st.st_dev,
+                                    file_st.st_ino)
+                  == 0)
+                {
+                  continue;
+                }
+            }
+
+          bytes += (uint64_t)file_st.st_blocks * 512;
+        }
+
+      /*
+       * Publish the partial total once per batch.
+       */
+      __atomic_add_fetch (&top->bytes, bytes, __ATOMIC_RELAXED);
+      own += bytes;
+      bytes = 0;
+    }
+
+  __atomic_add_fetch (&top->bytes, bytes, __ATOMIC_RELAXED);
+  own += bytes;
+
+  if (keep && status == 0 && !__atomic_load_n (&job->stop, __ATOMIC_RELAXED))
+    {
+      du_cache_store (job->cache, &st, own, names, names_length);
+    }
+  else
+    {
+      free (names);
+    }
+
+  close (reader->fd);
+  reader->fd = -1;
+}
+
+/*
+ * Open the directory TOP of the listing.
+ * return its descriptor or -1 if there is nothing to read.
+ */
+static int
+du_open_top (struct du_job *job, struct du_total *top)
+{
+  return openat (job->dir_fd, top->name,
+                 O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+/*
+ * Get the next directory to read, the queued subdirectories go
+ * before the next directory of the listing, and wait for one while
+ * there is none.
+ * return 0 and fill TASK, or -1 once the job is stopped.
+ */
+static int
+du_next (struct du_job *job, struct du_task *task)
+{
+  struct du_total *top;
+
+  pthread_mutex_lock (&job->lock);
+
+  while (!job->stop)
+    {
+      if (job->count > 0)
+        {
+          *task = job->tasks[--job->count];
+          pthread_mutex_unlock (&job->lock);
+          return 0;
+        }
+
+      while (job->next_top < job->top_count
+             && job->tops[job->next_top]->state != DU_NONE)
+        {
+          ++job->next_top;
+        }
+
+      if (job->next_top < job->top_count)
+        {
+          top = job->tops[job->next_top++];
+          top->pending = 1;
+          __atomic_store_n (&top->state, DU_RUNNING, __ATOMIC_RELEASE);
+          task->fd = -1;
+          task->top = top;
+          ++job->outstanding;
+          pthread_mutex_unlock (&job->lock);
+          return 0;
+        }
+
+      pthread_cond_wait (&job->wake, &job->lock);
+    }
+
+  pthread_mutex_unlock (&job->lock);
+
+  return -1;
+}
+
+static void *
+du_worker (void *data)
+{
+  struct du_job *job = data;
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  struct du_task task;
+
+  reader.fd = -1;
+  reader.buffer = NULL;
+  batch = malloc (sizeof (struct dir_batch));
+
+  while (du_next (job, &task) == 0)
+    {
+      if (task.fd < 0)
+        {
+          task.fd = du_open_top (job, task.top);
+        }
+
+      if (task.fd >= 0)
+        {
+          if (batch != NULL)
+            {
+              du_read (job, task.fd, task.top, &reader, batch);
+            }
+          else
+            {
+              close (task.fd);
+            }
+        }
+
+      du_finish (job, task.top);
+
+      pthread_mutex_lock (&job->lock);
+      --job->outstanding;
+      pthread_mutex_unlock (&job->lock);
+    }
+
+  dir_reader_close (&reader);
+  free (batch);
+  du_job_release (job);
+
+  return NULL;
+}
+
+/*
+ * Free the dropped directories that are done, with the lock held.
+ */
+static void
+du_free_dropped (struct du_job *job)
+{
+  size_t kept = 0;
+  size_t i;
+
+  for (i = 0; i < job->dropped_count; ++i)
+    {
+      if (__atomic_load_n (&job->dropped[i]->state, __ATOMIC_ACQUIRE)
+          == DU_DONE)
+        {
+          free (job->dropped[i]);
+        }
+      else
+        {
+          job->dropped[kept++] = job->dropped[i];
+        }
+    }
+
+  job->dropped_count = kept;
+}
+
+/*
+ * Release the lists allocated by 'du_update' and the FRESH_COUNT
+ * directories of FRESH.
+ */
+static void
+du_update_free (struct du_total **tops, struct du_total **totals,
+                struct du_total **fresh, size_t fresh_count,
+                struct du_total **gone)
+{
+  size_t i;
+
+  for (i = 0; i < fresh_count; ++i)
+    {
+      free (fresh[i]);
+    }
+
+  free (tops);
+  free (totals);
+  free (fresh);
+  free (gone);
+}
+
+int
+du_update (struct du_counter *counter, const struct entry_store *store)
+{
+  struct du_job *job = counter->job;
+  struct du_total **tops;
+  struct du_total **totals;
+  struct du_total **fresh;
+  struct du_total **gone;
+  struct du_total **dropped;
+  struct du_total *top;
+  const char *name;
+  size_t top_count = 0;
+  size_t fresh_count = 0;
+  size_t gone_count = 0;
+  size_t length;
+  size_t i;
+  size_t j;
+  int cmp;
+
+  tops = malloc ((store->count + 1) * sizeof (struct du_total *));
+  totals = calloc (store->count + 1, sizeof (struct du_total *));
+  fresh = malloc ((store->count + 1) * sizeof (struct du_total *));
+  gone = malloc ((job->top_count + 1) * sizeof (struct du_total *));
+  if (tops == NULL || totals == NULL || fresh == NULL || gone == NULL)
+    {
+      du_update_free (tops, totals, fresh, 0, gone);
+      return -1;
+    }
+
+  /*
+   * Both lists are in the order of the listing, the directories
+   * found in both keep their total.  Only the caller changes the
+   * list of the job so it is read without the lock.
+   */
+  for (i = 0, j = 0; i < store->count; ++i)
+    {
+      if (store->type[i] != DT_DIR)
+        {
+          continue;
+        }
+
+      name = entry_store_name (store, i);
+      cmp = 1;
+      while (j < job->top_count
+             && (cmp = dir_compare_entries (job->tops[j]->name, DT_DIR, name,
+                                            DT_DIR))
+                    < 0)
+        {
+          gone[gone_count++] = job->tops[j++];
+        }
+
+      if (j < job->top_count && cmp == 0)
+        {
+          top = job->tops[j++];
+        }
+      else
+        {
+          length = strlen (name);
+          top = calloc (1, sizeof (struct du_total) + length + 1);
+          if (top == NULL)
+            {
+              du_update_free (tops, totals, fresh, fresh_count, gone);
+              return -1;
+            }
+          memcpy (top->name, name, length + 1);
+          fresh[fresh_count++] = top;
+        }
+
+      tops[top_count++] = top;
+      totals[i] = top;
+    }
+
+  while (j < job->top_count)
+    {
+      gone[gone_count++] = job->tops[j++];
+    }
+
+  pthread_mutex_lock (&job->lock);
+
+  dropped = realloc (job->dropped, (job->dropped_count + gone_count + 1)
+                                       * sizeof (struct du_total *));
+  if (dropped == NULL)
+    {
+      pthread_mutex_unlock (&job->lock);
+      du_update_free (tops, totals, fresh, fresh_count, gone);
+      return -1;
+    }
+  job->dropped = dropped;
+
+  /*
+   * The directories that left the listing before they were started
+   * are forgotten, the others are freed once done.
+   */
+  for (i = 0; i < gone_count; ++i)
+    {
+      if (gone[i]->state == DU_NONE)
+        {
+          free (gone[i]);
+        }
+      else
+        {
+          job->dropped[job->dropped_count++] = gone[i];
+        }
+    }
+  du_free_dropped (job);
+
+  free (job->tops);
+  job->tops = tops;
+  job->top_count = top_count;
+  job->next_top = 0;
+  free (job->totals);
+  job->totals = totals;
+  job->total_count = store->count;
+
+  pthread_cond_broadcast (&job->wake);
+  pthread_mutex_unlock (&job->lock);
+
+  du_update_free (NULL, NULL, fresh, 0, gone);
+
+  return 0;
+}
+
+int
+du_start (struct du_counter *counter, const char *const dir_name,
+          const struct entry_store *store, struct du_cache *cache)
+{
+  int dir_fd;
+  int ret;
+
+  dir_fd = open (dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    {
+      return -1;
+    }
+
+  ret = du_start_fd (counter, dir_fd, store, cache);
+  close (dir_fd);
+
+  return ret;
+}
+
+int
+du_start_fd (struct du_counter *counter, int dir_fd,
+             const struct entry_store *store, struct du_cache *cache)
+{
+  struct du_job *job;
+  pthread_t thread;
+  int started = 0;
+  int ret = 0;
+  int i;
+
+  job = calloc (1, sizeof (struct du_job));
+  if (job == NULL)
+    {
+      return -1;
+    }
+
+  job->dir_fd = fcntl (dir_fd, F_DUPFD_CLOEXEC, 0);
+  if (job->dir_fd < 0)
+    {
+      free (job);
+      return -1;
+    }
+
+  job->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (job->event_fd < 0)
+    {
+      close (job->dir_fd);
+      free (job);
+      return -1;
+    }
+
+  __atomic_add_fetch (&cache->references, 1, __ATOMIC_RELAXED);
+  job->cache = cache;
+  job->references = 1;
+  inode_set_init (&job->links);
+  pthread_mutex_init (&job->lock, NULL);
+  pthread_cond_init (&job->wake, NULL);
+
+  counter->job = job;
+  counter->event_fd = job->event_fd;
+
+  if (du_update (counter, store) != 0)
+    {
+      du_job_release (job);
+      return -1;
+    }
+
+  for (i = 0; i < DU_THREADS; ++i)
+    {
+      __atomic_add_fetch (&job->references, 1, __ATOMIC_RELAXED);
+      ret = pthread_create (&thread, NULL, du_worker, job);
+      if (ret != 0)
+        {
+          __atomic_sub_fetch (&job->references, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      pthread_detach (thread);
+      ++started;
+    }
+
+  if (started == 0)
+    {
+      du_stop (counter);
+      errno = ret;
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+du_stop (struct du_counter *counter)
+{
+  struct du_job *job = counter->job;
+
+  pthread_mutex_lock (&job->lock);
+  job->stop = 1;
+  pthread_cond_broadcast (&job->wake);
+  pthread_mutex_unlock (&job->lock);
+
+  du_job_release (job);
+  counter->job = NULL;
+  counter->event_fd = -1;
+}
@@ -0,0 +1,257 @@
+/*
+ * du - library to compute the disk usage of directories
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_DU_H_
+#define DR_LIB_DU_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "inode.h"
+
+/*
+ * Number of threads reading the trees, the work is waiting on the
+ * disk so it doesn't depend on the number of processors.
+ */
+#define DU_THREADS 8
+
+/*
+ * Number of open directories waiting for a thread, the threads read
+ * the subdirectories themselves past it so the number of open
+ * descriptors stays bounded.
+ */
+#define DU_MAX_QUEUED 256
+
+/*
+ * Number of slots allocated the first time the cache grows.
+ */
+#define DU_CACHE_INITIAL_CAPACITY 256
+
+/*
+ * Number of directories kept in the cache, the ones read past it
+ * are not kept.
+ */
+#define DU_CACHE_MAX_DIRECTORIES (1024 * 1024)
+
+/*
+ * A directory changed less than this many seconds before it was
+ * read can change again with the same mtime, it is not kept.
+ */
+#define DU_CACHE_RACY_SECONDS 2
+
+/*
+ * Progress of the total of a directory.
+ */
+enum du_state
+{
+  DU_NONE,
+  DU_RUNNING,
+  DU_DONE,
+};
+
+/*
+ * Total of the directory NAME of the listing, BYTES grows while the
+ * tree is read and is final once STATE is DU_DONE.
+ * PENDING counts the directories of the tree not read yet.
+ */
+struct du_total
+{
+  uint64_t bytes;
+  int pending;
+  unsigned char state;
+  char name[];
+};
+
+/*
+ * A directory read before, BYTES counts the directory and its files
+ * but not its subdirectories, whose names are the LENGTH bytes of
+ * SUBDIRECTORIES each followed by a null byte.
+ */
+struct du_cache_slot
+{
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  uint64_t bytes;
+  char *subdirectories;
+  size_t length;
+};
+
+/*
+ * Every directory of the trees read before, keyed by its inode.
+ * a directory is not read again while it keeps the same mtime, its
+ * files are not stated and its subdirectories are checked the same
+ * way, so a change anywhere in a tree is seen and only the
+ * directories that changed are read.
+ * a file that grows in place doesn't change the mtime of its
+ * directory and keeps its old size, the directories holding files
+ * with several links are not kept so the links are only counted
+ * once.
+ * REFERENCES counts the caller and the jobs using it, the last one
+ * to let go frees it.
+ */
+struct du_cache
+{
+  pthread_mutex_t lock;
+  struct du_cache_slot *slots;
+  size_t count;
+  size_t capacity;
+  int references;
+};
+
+/*
+ * A directory open at FD that is part of the tree of TOP.
+ */
+struct du_task
+{
+  int fd;
+  struct du_total *top;
+};
+
+/*
+ * Disk usage of every directory of a listing, like 'du' the blocks
+ * of the files are counted and a file with many hard links is only
+ * counted once, the symbolic links are not followed.
+ * the directories of the listing are started in order and the
+ * directories found inside go first so the totals finish from the
+ * top of the list, EVENT_FD is signaled as they grow.
+ * TOPS are the TOP_COUNT directories of the listing in its order,
+ * the threads only read them with LOCK held.  DROPPED are the ones
+ * that left the listing while they were counted, they are freed
+ * once done.
+ * TOTALS[I] is the total of the entry I of the listing or NULL, it
+ * is only used by the caller.
+ * the threads wait for more directories until the job is stopped.
+ * REFERENCES counts the threads and the caller, the last one to let
+ * go frees the job.
+ */
+struct du_job
+{
+  struct du_cache *cache;
+  int dir_fd;
+  int event_fd;
+  struct du_total **tops;
+  size_t top_count;
+  struct du_total **dropped;
+  size_t dropped_count;
+  struct du_total **totals;
+  size_t total_count;
+  struct inode_set links;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  struct du_task tasks[DU_MAX_QUEUED];
+  size_t count;
+  size_t next_top;
+  size_t outstanding;
+  int stop;
+  int references;
+};
+
+/*
+ * Handle of a job, EVENT_FD is the one of JOB.
+ */
+struct du_counter
+{
+  struct du_job *job;
+  int event_fd;
+};
+
+/*
+ * Allocate an empty cache.
+ * return it or NULL if the allocation failed.
+ */
+struct du_cache *du_cache_new (void);
+
+/*
+ * Let go of CACHE, it is freed once the jobs using it are over.
+ */
+void du_cache_release (struct du_cache *cache);
+
+/*
+ * Start computing the disk usage of the directories of STORE, the
+ * names are relative to DIR_NAME and the directories read are kept
+ * in CACHE.
+ * the names are copied, after STORE changes 'du_update' must be
+ * called before the totals are read again.
+ * return 0 on success and -1 with errno set.
+ */
+int du_start (struct du_counter *counter, const char *const dir_name,
+              const struct entry_store *store, struct du_cache *cache);
+
+/*
+ * Same as 'du_start' for the directory open at DIR_FD, DIR_FD can be
+ * closed once it returns.
+ */
+int du_start_fd (struct du_counter *counter, int dir_fd,
+                 const struct entry_store *store, struct du_cache *cache);
+
+/*
+ * Follow the entries of STORE after they changed, the totals of the
+ * directories still there are kept and the new ones are counted.
+ * return 0 on success and -1 if the allocation failed, JOB is then
+ * left as it was.
+ */
+int du_update (struct du_counter *counter, const struct entry_store *store);
+
+/*
+ * Get the state of the total of the entry INDEX.
+ */
+static inline enum du_state
+du_state (const struct du_job *job, size_t index)
+{
+  if (index >= job->total_count || job->totals[index] == NULL)
+    {
+      return DU_NONE;
+    }
+
+  return __atomic_load_n (&job->totals[index]->state, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Get the bytes counted so far for the entry INDEX.
+ */
+static inline uint64_t
+du_bytes (const struct du_job *job, size_t index)
+{
+  if (index >= job->total_count || job->totals[index] == NULL)
+    {
+      return 0;
+    }
+
+  return __atomic_load_n (&job->totals[index]->bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Cancel what is left and let go of COUNTER, the threads are not
+ * waited for, the directories read stay in the cache.
+ */
+void du_stop (struct du_counter *counter);
+
+#endif // DR_LIB_DU_H_
@@ -0,0 +1,455 @@
+#include "entry.h"
+
+void
+entry_store_init (struct entry_store *store)
+{
+  arena_init (&store->names);
+  store->name = NULL;
+  store->type = NULL;
+  store->size = NULL;
+  store->mtime = NULL;
+  store->mode = NULL;
+  store->uid = NULL;
+  store->gid = NULL;
+  store->state = NULL;
+  store->count = 0;
+  store->capacity = 0;
+}
+
+/*
+ * Grow the column at *COLUMN to CAPACITY elements of SIZE bytes.
+ */
+static int
+entry_store_grow_column (void **column, size_t capacity, size_t size)
+{
+  void *data = spill_realloc (*column, capacity * size);
+
+  if (data == NULL)
+    {
+      return -1;
+    }
+
+  *column = data;
+
+  return 0;
+}
+
+int
+entry_store_reserve (struct entry_store *store, size_t capacity)
+{
+  size_t new_capacity;
+
+  if (capacity <= store->capacity)
+    {
+      return 0;
+    }
+
+  /*
+   * Handles and sort orders are 32 bits.
+   */
+  if (capacity > UINT32_MAX)
+    {
+      return -1;
+    }
+
+  new_capacity = store->capacity ? store->capacity
+                                 : ENTRY_STORE_INITIAL_CAPACITY;
+  while (new_capacity < capacity)
+    {
+      new_capacity *= 2;
+    }
+
+  if (entry_store_grow_column ((void **)&store->name, new_capacity,
+                               sizeof (*store->name))
+          != 0
+      || entry_store_grow_column ((void **)&store->type, new_capacity,
+                                  sizeof (*store->type))
+             != 0
+      || entry_store_grow_column ((void **)&store->size, new_capacity,
+                                  sizeof (*store->size))
+             != 0
+      || entry_store_grow_column ((void **)&store->mtime, new_capacity,
+                                  sizeof (*store->mtime))
+             != 0
+      || entry_store_grow_column ((void **)&store->mode, new_capacity,
+                                  sizeof (*store->mode))
+             != 0
+      || entry_store_grow_column ((void **)&store->uid, new_capacity,
+                                  sizeof (*store->uid))
+             != 0
+      || entry_store_grow_column ((void **)&store->gid, new_capacity,
+                                  sizeof (*store->gid))
+             != 0
+      || entry_store_grow_column ((void **)&store->state, new_capacity,
+                                  sizeof (*store->state))
+             != 0)
+    {
+      return -1;
+    }
+
+  stats_add (STATS_BYTES,
+             (new_capacity - store->capacity)
+                 * (sizeof (*store->name) + sizeof (*store->type)
+                    + sizeof (*store->size) + sizeof (*store->mtime)
+                    + sizeof (*store->mode) + sizeof (*store->uid)
+                    + sizeof (*store->gid) + sizeof (*store->state)));
+  store->capacity = new_capacity;
+
+  return 0;
+}
+
+int
+entry_store_append (struct entry_store *store, const char *name,
+                    size_t name_length, unsigned char type)
+{
+  size_t i = store->count;
+
+  if (entry_store_reserve (store, i + 1) != 0)
+    {
+      return -1;
+    }
+
+  if (arena_push_string (&store->names, name, name_length, &store->name[i])
+      != 0)
+    {
+      return -1;
+    }
+
+  store->type[i] = type;
+  store->size[i] = ENTRY_UNKNOWN;
+  store->mtime[i] = ENTRY_UNKNOWN;
+  store->mode[i] = 0;
+  store->uid[i] = 0;
+  store->gid[i] = 0;
+  store->state[i] = ENTRY_META_NONE;
+
+  ++store->count;
+
+  return 0;
+}
+
+int
+entry_store_append_batch (const struct dir_batch *batch, void *data)
+{
+  struct entry_store *store = data;
+  const struct dir_record *record;
+  size_t i;
+
+  if (entry_store_reserve (store, store->count + batch->count) != 0)
+    {
+      return 1;
+    }
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      record = &batch->records[i];
+
+      if (entry_store_append (store, record->name, record->name_length,
+                              record->type)
+          != 0)
+        {
+          return 1;
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Gather the COUNT elements of SIZE bytes of the column SRC in ORDER
+ * into DST.
+ */
+static void
+entry_store_permute_column (char *dst, const char *src,
+                            const uint32_t *order, size_t count,
+                            size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+    {
+      memcpy (dst + i * size, src + (size_t)order[i] * size, size);
+    }
+}
+
+int
+entry_store_permute (struct entry_store *store, const uint32_t *order)
+{
+  void **columns[] = {
+    (void **)&store->name, (void **)&store->type, (void **)&store->size,
+    (void **)&store->mtime, (void **)&store->mode, (void **)&store->uid,
+    (void **)&store->gid, (void **)&store->state,
+  };
+  const size_t sizes[] = {
+    sizeof (*store->name),  sizeof (*store->type), sizeof (*store->size),
+    sizeof (*store->mtime), sizeof (*store->mode), sizeof (*store->uid),
+    sizeof (*store->gid),   sizeof (*store->state),
+  };
+  const size_t count = sizeof (columns) / sizeof (columns[0]);
+  void *permuted[sizeof (columns) / sizeof (columns[0])];
+  size_t i;
+
+  /*
+   * Every copy is allocated before the first column moves so a
+   * failure leaves the store as it was.
+   */
+  for (i = 0; i < count; ++i)
+    {
+      permuted[i] = spill_malloc (store->capacity * sizes[i]);
+      if (permuted[i] == NULL)
+        {
+          while (i > 0)
+            {
+              spill_free (permuted[--i]);
+            }
+          return -1;
+        }
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      entry_store_permute_column (permuted[i], *columns[i], order,
+                                  store->count, sizes[i]);
+      spill_free (*columns[i]);
+      *columns[i] = permuted[i];
+    }
+
+  return 0;
+}
+
+static int
+entry_store_compare (const void *a, const void *b, void *data)
+{
+  const struct entry_store *store = data;
+  uint32_t ia = *(const uint32_t *)a;
+  uint32_t ib = *(const uint32_t *)b;
+
+  return dir_compare_entries (entry_store_name (store, ia), store->type[ia],
+                              entry_store_name (store, ib), store->type[ib]);
+}
+
+int
+entry_store_sort (struct entry_store *store)
+{
+  uint32_t *order;
+  size_t i;
+  int status;
+
+  if (store->count < 2)
+    {
+      return 0;
+    }
+
+  order = malloc (store->count * sizeof (uint32_t));
+  if (order == NULL)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < store->count; ++i)
+    {
+      order[i] = i;
+    }
+
+  qsort_r (order, store->count, sizeof (uint32_t), entry_store_compare, store);
+
+  status = entry_store_permute (store, order);
+
+  free (order);
+
+  return status;
+}
+
+long
+entry_store_find (const struct entry_store *store, const char *name,
+                  unsigned char type)
+{
+  size_t low = 0;
+  size_t high = store->count;
+  size_t middle;
+  int cmp;
+
+  while (low < high)
+    {
+      middle = low + (high - low) / 2;
+      cmp = dir_compare_entries (entry_store_name (store, middle),
+                                 store->type[middle], name, type);
+
+      if (cmp == 0)
+        {
+          return middle;
+        }
+
+      if (cmp < 0)
+        {
+          low = middle + 1;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+
+  return -1;
+}
+
+/*
+ * Copy every column of the entry FROM to the entry TO.
+ */
+static void
+entry_store_move (struct entry_store *store, size_t from, size_t to)
+{
+  store->name[to] = store->name[from];
+  store->type[to] = store->type[from];
+  store->size[to] = store->size[from];
+  store->mtime[to] = store->mtime[from];
+  store->mode[to] = store->mode[from];
+  store->uid[to] = store->uid[from];
+  store->gid[to] = store->gid[from];
+  store->state[to] = store->state[from];
+}
+
+/*
+ * Copy the names of STORE to a new arena of LIVE bytes in the order
+ * of the entries, the old one is dropped.  Nothing changes if the
+ * allocation fails, the names are only kept longer.
+ */
+static void
+entry_store_compact_names (struct entry_store *store, size_t live)
+{
+  struct arena names;
+  size_t i;
+
+  arena_init (&names);
+  if (arena_reserve (&names, live) != 0)
+    {
+      arena_free (&names);
+      return;
+    }
+
+  for (i = 0; i < store->count; ++i)
+    {
+      arena_push_string (&names, entry_store_name (store, i),
+                         store->name[i].length, &store->name[i]);
+    }
+
+  arena_free (&store->names);
+  store->names = names;
+}
+
+void
+entry_store_remove (struct entry_store *store, const unsigned char *remove)
+{
+  size_t live = 0;
+  size_t kept = 0;
+  size_t i;
+
+  for (i = 0; i < store->count; ++i)
+    {
+      if (remove[i])
+        {
+          continue;
+        }
+
+      if (kept != i)
+        {
+          entry_store_move (store, i, kept);
+        }
+      live += store->name[kept].length + 1;
+      ++kept;
+    }
+
+  store->count = kept;
+
+  /*
+   * The names of the removed entries are reclaimed once they take
+   * more room than the others.
+   */
+  if (store->names.length - live > live)
+    {
+      entry_store_compact_names (store, live);
+    }
+}
+
+int
+entry_store_merge (struct entry_store *store,
+                   const struct entry_store *additions)
+{
+  struct arena_handle handle;
+  size_t count = store->count;
+  size_t i;
+  size_t j;
+  size_t w;
+
+  if (additions->count == 0)
+    {
+      return 0;
+    }
+
+  if (entry_store_reserve (store, count + additions->count) != 0
+      || arena_reserve (&store->names, additions->names.length) != 0)
+    {
+      return -1;
+    }
+
+  /*
+   * Merge from the end so every entry moves at most once and
+   * the entries before the first insertion don't move at all.
+   */
+  i = count;
+  j = additions->count;
+  w = count + additions->count;
+
+  while (j > 0)
+    {
+      if (i > 0
+          && dir_compare_entries (entry_store_name (store, i - 1),
+                                  store->type[i - 1],
+                                  entry_store_name (additions, j - 1),
+                                  additions->type[j - 1])
+                 > 0)
+        {
+          entry_store_move (store, --i, --w);
+          continue;
+        }
+
+      --j;
+      --w;
+      arena_push_string (&store->names, entry_store_name (additions, j),
+                         additions->name[j].length, &handle);
+      store->name[w] = handle;
+      store->type[w] = additions->type[j];
+      store->size[w] = additions->size[j];
+      store->mtime[w] = additions->mtime[j];
+      store->mode[w] = additions->mode[j];
+      store->uid[w] = additions->uid[j];
+      store->gid[w] = additions->gid[j];
+      store->state[w] = additions->state[j];
+    }
+
+  store->count = count + additions->count;
+
+  return 0;
+}
+
+void
+entry_store_clear (struct entry_store *store)
+{
+  arena_reset (&store->names);
+  store->count = 0;
+}
+
+void
+entry_store_free (struct entry_store *store)
+{
+  arena_free (&store->names);
+  spill_free (store->name);
+  spill_free (store->type);
+  spill_free (store->size);
+  spill_free (store->mtime);
+  spill_free (store->mode);
+  spill_free (store->uid);
+  spill_free (store->gid);
+  spill_free (store->state);
+  entry_store_init (store);
+}
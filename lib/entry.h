@@ -0,0 +1,175 @@
+/*
+ * entry - library to store the entries of a listing
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_ENTRY_H_
+#define DR_LIB_ENTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "dir.h"
+#include "spill.h"
+#include "stats.h"
+
+/*
+ * Number of entries allocated the first time the store grows.
+ */
+#define ENTRY_STORE_INITIAL_CAPACITY 256
+
+/*
+ * Value of the size and mtime columns until the
+ * metadata of the entry is known.
+ */
+#define ENTRY_UNKNOWN (-1)
+
+/*
+ * State of the metadata columns of an entry, they are filled
+ * in the background so the state is read and written atomically.
+ */
+enum entry_meta_state
+{
+  ENTRY_META_NONE,
+  ENTRY_META_PENDING,
+  ENTRY_META_READY,
+  ENTRY_META_FAILED,
+};
+
+/*
+ * Entries of a listing kept as parallel arrays so sorting and
+ * rendering only walk the columns they need, the entry I is
+ * NAME[I], TYPE[I], SIZE[I], MTIME[I], MODE[I], UID[I] and GID[I].
+ * the names are packed in the NAMES arena and STATE[I] tells
+ * if the metadata of the entry I was fetched.
+ * the columns of a large listing are kept in spill files.
+ */
+struct entry_store
+{
+  struct arena names;
+  struct arena_handle *name;
+  unsigned char *type;
+  int64_t *size;
+  int64_t *mtime;
+  mode_t *mode;
+  uid_t *uid;
+  gid_t *gid;
+  unsigned char *state;
+  size_t count;
+  size_t capacity;
+};
+
+/*
+ * Initialize STORE without allocating anything.
+ */
+void entry_store_init (struct entry_store *store);
+
+/*
+ * Make sure STORE can hold CAPACITY entries, the columns
+ * grow geometrically.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int entry_store_reserve (struct entry_store *store, size_t capacity);
+
+/*
+ * Add the entry NAME of NAME_LENGTH bytes and TYPE at the end
+ * of STORE, the metadata columns are set to ENTRY_UNKNOWN and
+ * the state to ENTRY_META_NONE.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int entry_store_append (struct entry_store *store, const char *name,
+                        size_t name_length, unsigned char type);
+
+/*
+ * Callback for 'dir_read_directory' that appends the entries
+ * of BATCH to the store in DATA.
+ */
+int entry_store_append_batch (const struct dir_batch *batch, void *data);
+
+/*
+ * Get the name of the entry INDEX.
+ */
+static inline const char *
+entry_store_name (const struct entry_store *store, size_t index)
+{
+  return arena_string (&store->names, store->name[index]);
+}
+
+/*
+ * Get the metadata state of the entry INDEX, once it is
+ * ENTRY_META_READY the metadata columns can be read.
+ */
+static inline enum entry_meta_state
+entry_store_meta_state (const struct entry_store *store, size_t index)
+{
+  return __atomic_load_n (&store->state[index], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Reorder the entries of STORE so the entry ORDER[I] ends up at I.
+ * return 0 on success and -1 if the allocation failed, STORE is
+ * then left as it was.
+ */
+int entry_store_permute (struct entry_store *store, const uint32_t *order);
+
+/*
+ * Sort the entries of STORE in the same order as 'dir_typesort'.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int entry_store_sort (struct entry_store *store);
+
+/*
+ * Find the entry NAME of TYPE in STORE sorted like 'dir_typesort'
+ * with a binary search.
+ * return its index or -1 if it isn't there.
+ */
+long entry_store_find (const struct entry_store *store, const char *name,
+                       unsigned char type);
+
+/*
+ * Drop the entries I of STORE where REMOVE[I] is not 0, the
+ * others keep their order.
+ * the names stay in the arena until they take more room than the
+ * names of the entries left, the arena is then packed again.
+ */
+void entry_store_remove (struct entry_store *store,
+                         const unsigned char *remove);
+
+/*
+ * Insert the entries of ADDITIONS in STORE, both must be sorted
+ * like 'dir_typesort' and STORE stays sorted without sorting it
+ * again, only the entries after the first insertion move.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int entry_store_merge (struct entry_store *store,
+                       const struct entry_store *additions);
+
+/*
+ * Forget every entry of STORE but keep the memory.
+ */
+void entry_store_clear (struct entry_store *store);
+
+/*
+ * Release the memory of STORE.
+ */
+void entry_store_free (struct entry_store *store);
+
+#endif // DR_LIB_ENTRY_H_
@@ -0,0 +1,961 @@
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_HAVE_X86 1
+#endif
+
+/*
+ * Pattern ready for the kernels, LOWER[I] and UPPER[I] are the two
+ * cases of the byte I, or twice the byte when the case matters.
+ */
+struct filter_pattern
+{
+  size_t length;
+  int fuzzy;
+  int fold;
+  unsigned char lower[FILTER_MAX_PATTERN];
+  unsigned char upper[FILTER_MAX_PATTERN];
+};
+
+/*
+ * Matching functions for one instruction set, the names are in the
+ * packed buffer of the filter and can be read FILTER_PADDING bytes
+ * past their end.
+ * FIND returns the position of the first byte from FROM that is
+ * LOWER or UPPER, or LENGTH if there is none, a fuzzy match is one
+ * FIND per byte of the pattern.
+ * SUBSTRING returns 1 when the pattern is in the name.
+ */
+struct filter_kernel
+{
+  const char *name;
+  size_t (*find) (const char *name, size_t from, size_t length,
+                  unsigned char lower, unsigned char upper);
+  int (*substring) (const char *name, size_t length,
+                    const struct filter_pattern *pattern);
+};
+
+static const struct filter_kernel *filter_kernel;
+
+static int
+filter_equal (const char *name, const struct filter_pattern *pattern)
+{
+  unsigned char c;
+  size_t i;
+
+  for (i = 0; i < pattern->length; ++i)
+    {
+      c = name[i];
+      if (c != pattern->lower[i] && c != pattern->upper[i])
+        {
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+static size_t
+filter_find_scalar (const char *name, size_t from, size_t length,
+                    unsigned char lower, unsigned char upper)
+{
+  unsigned char c;
+  size_t i;
+
+  for (i = from; i < length; ++i)
+    {
+      c = name[i];
+      if (c == lower || c == upper)
+        {
+          return i;
+        }
+    }
+
+  return length;
+}
+
+static int
+filter_substring_scalar (const char *name, size_t length,
+                         const struct filter_pattern *pattern)
+{
+  size_t i;
+
+  if (pattern->length > length)
+    {
+      return 0;
+    }
+
+  for (i = 0; i + pattern->length <= length; ++i)
+    {
+      if (filter_equal (name + i, pattern))
+        {
+          return 1;
+        }
+    }
+
+  return 0;
+}
+
+static const struct filter_kernel filter_kernel_scalar = {
+  "scalar",
+  filter_find_scalar,
+  filter_substring_scalar,
+};
+
+#ifdef FILTER_HAVE_X86
+/*
+ * Bits of the first REMAINING bytes of a chunk of 32 bytes.
+ */
+static inline uint32_t
+filter_valid_mask (size_t remaining)
+{
+  return remaining >= 32 ? UINT32_MAX : ((uint32_t)1 << remaining) - 1;
+}
+
+__attribute__ ((target ("sse2"))) static size_t
+filter_find_sse2 (const char *name, size_t from, size_t length,
+                  unsigned char lower, unsigned char upper)
+{
+  __m128i lower_vector = _mm_set1_epi8 (lower);
+  __m128i upper_vector = _mm_set1_epi8 (upper);
+  __m128i chunk;
+  uint32_t mask;
+  size_t base;
+
+  for (base = from; base < length; base += 16)
+    {
+      chunk = _mm_loadu_si128 ((const __m128i *)(name + base));
+      mask = _mm_movemask_epi8 (
+                 _mm_or_si128 (_mm_cmpeq_epi8 (chunk, lower_vector),
+                               _mm_cmpeq_epi8 (chunk, upper_vector)))
+             & filter_valid_mask (length - base);
+      if (mask != 0)
+        {
+          return base + __builtin_ctz (mask);
+        }
+    }
+
+  return length;
+}
+
+__attribute__ ((target ("sse2"))) static int
+filter_substring_sse2 (const char *name, size_t length,
+                       const struct filter_pattern *pattern)
+{
+  size_t last = pattern->length - 1;
+  __m128i first_lower = _mm_set1_epi8 (pattern->lower[0]);
+  __m128i first_upper = _mm_set1_epi8 (pattern->upper[0]);
+  __m128i last_lower = _mm_set1_epi8 (pattern->lower[last]);
+  __m128i last_upper = _mm_set1_epi8 (pattern->upper[last]);
+  __m128i first_chunk;
+  __m128i last_chunk;
+  uint32_t mask;
+  size_t stop;
+  size_t base;
+
+  if (pattern->length > length)
+    {
+      return 0;
+    }
+
+  /*
+   * Only the starts where the first and the last byte of the
+   * pattern are in place are compared.
+   */
+  stop = length - last;
+  for (base = 0; base < stop; base += 16)
+    {
+      first_chunk = _mm_loadu_si128 ((const __m128i *)(name + base));
+      last_chunk = _mm_loadu_si128 ((const __m128i *)(name + base + last));
+
+      mask = _mm_movemask_epi8 (_mm_and_si128 (
+                 _mm_or_si128 (_mm_cmpeq_epi8 (first_chunk, first_lower),
+                               _mm_cmpeq_epi8 (first_chunk, first_upper)),
+                 _mm_or_si128 (_mm_cmpeq_epi8 (last_chunk, last_lower),
+                               _mm_cmpeq_epi8 (last_chunk, last_upper))))
+             & filter_valid_mask (stop - base);
+
+      while (mask != 0)
+        {
+          if (filter_equal (name + base + __builtin_ctz (mask), pattern))
+            {
+              return 1;
+            }
+          mask &= mask - 1;
+        }
+    }
+
+  return 0;
+}
+
+static const struct filter_kernel filter_kernel_sse2 = {
+  "sse2",
+  filter_find_sse2,
+  filter_substring_sse2,
+};
+
+__attribute__ ((target ("avx2"))) static size_t
+filter_find_avx2 (const char *name, size_t from, size_t length,
+                  unsigned char lower, unsigned char upper)
+{
+  __m256i lower_vector = _mm256_set1_epi8 (lower);
+  __m256i upper_vector = _mm256_set1_epi8 (upper);
+  __m256i chunk;
+  uint32_t mask;
+  size_t base;
+
+  for (base = from; base < length; base += 32)
+    {
+      chunk = _mm256_loadu_si256 ((const __m256i *)(name + base));
+      mask = (uint32_t)_mm256_movemask_epi8 (_mm256_or_si256 (
+                 _mm256_cmpeq_epi8 (chunk, lower_vector),
+                 _mm256_cmpeq_epi8 (chunk, upper_vector)))
+             & filter_valid_mask (length - base);
+      if (mask != 0)
+        {
+          return base + __builtin_ctz (mask);
+        }
+    }
+
+  return length;
+}
+
+__attribute__ ((target ("avx2"))) static int
+filter_substring_avx2 (const char *name, size_t length,
+                       const struct filter_pattern *pattern)
+{
+  size_t last = pattern->length - 1;
+  __m256i first_lower = _mm256_set1_epi8 (pattern->lower[0]);
+  __m256i first_upper = _mm256_set1_epi8 (pattern->upper[0]);
+  __m256i last_lower = _mm256_set1_epi8 (pattern->lower[last]);
+  __m256i last_upper = _mm256_set1_epi8 (pattern->upper[last]);
+  __m256i first_chunk;
+  __m256i last_chunk;
+  uint32_t mask;
+  size_t stop;
+  size_t base;
+
+  if (pattern->length > length)
+    {
+      return 0;
+    }
+
+  stop = length - last;
+  for (base = 0; base < stop; base += 32)
+    {
+      first_chunk = _mm256_loadu_si256 ((const __m256i *)(name + base));
+      last_chunk
+          = _mm256_loadu_si256 ((const __m256i *)(name + base + last));
+
+      first_chunk = _mm256_or_si256 (_mm256_cmpeq_epi8 (first_chunk,
+                                                        first_lower),
+                                     _mm256_cmpeq_epi8 (first_chunk,
+                                                        first_upper));
+      last_chunk = _mm256_or_si256 (_mm256_cmpeq_epi8 (last_chunk,
+                                                       last_lower),
+                                    _mm256_cmpeq_epi8 (last_chunk,
+                                                       last_upper));
+      mask = (uint32_t)_mm256_movemask_epi8 (
+                 _mm256_and_si256 (first_chunk, last_chunk))
+             & filter_valid_mask (stop - base);
+
+      while (mask != 0)
+        {
+          if (filter_equal (name + base + __builtin_ctz (mask), pattern))
+            {
+              return 1;
+            }
+          mask &= mask - 1;
+        }
+    }
+
+  return 0;
+}
+
+static const struct filter_kernel filter_kernel_avx2 = {
+  "avx2",
+  filter_find_avx2,
+  filter_substring_avx2,
+};
+#endif
+
+void
+filter_init (struct filter *filter, int threads)
+{
+  memset (filter, 0, sizeof (*filter));
+  filter->threads = threads;
+
+  if (filter_kernel != NULL)
+    {
+      return;
+    }
+
+  filter_kernel = &filter_kernel_scalar;
+
+#ifdef FILTER_HAVE_X86
+  if (getenv ("DR_NO_SIMD") == NULL)
+    {
+      __builtin_cpu_init ();
+      if (__builtin_cpu_supports ("avx2"))
+        {
+          filter_kernel = &filter_kernel_avx2;
+        }
+      else if (__builtin_cpu_supports ("sse2"))
+        {
+          filter_kernel = &filter_kernel_sse2;
+        }
+    }
+#endif
+}
+
+const char *
+filter_kernel_name (void)
+{
+  return filter_kernel != NULL ? filter_kernel->name : "none";
+}
+
+/*
+ * Prepare the first LENGTH bytes of TEXT for the kernels, a quote in
+ * front makes it a substring, capitals make the case matter.
+ */
+static void
+filter_compile (struct filter_pattern *pattern, const char *text,
+                size_t length)
+{
+  int fold = 1;
+  unsigned char c;
+  size_t i;
+
+  pattern->fuzzy = !(length > 0 && text[0] == FILTER_QUOTE);
+  if (!pattern->fuzzy)
+    {
+      ++text;
+      --length;
+    }
+
+  for (i = 0; i < length; ++i)
+    {
+      if (text[i] >= 'A' && text[i] <= 'Z')
+        {
+          fold = 0;
+        }
+    }
+
+  pattern->fold = fold;
+  pattern->length = length;
+  for (i = 0; i < length; ++i)
+    {
+      c = text[i];
+      pattern->lower[i] = c;
+      pattern->upper[i] = c;
+
+      if (fold && c >= 'a' && c <= 'z')
+        {
+          pattern->upper[i] = c - 'a' + 'A';
+        }
+    }
+}
+
+/*
+ * return 1 if the byte at POSITION of NAME starts a word, after a
+ * separator or at a capital after a small letter.
+ */
+static int
+filter_boundary (const char *name, size_t position)
+{
+  char previous;
+
+  if (position == 0)
+    {
+      return 1;
+    }
+
+  previous = name[position - 1];
+  switch (previous)
+    {
+    case '.':
+    case '_':
+    case '-':
+    case ' ':
+      return 1;
+    default:
+      break;
+    }
+
+  return previous >= 'a' && previous <= 'z' && name[position] >= 'A'
+         && name[position] <= 'Z';
+}
+
+/*
+ * Score the fuzzy match of PATTERN in NAME that ends at END, the
+ * bytes are taken as far right as they can go so "ab" in "a_xab"
+ * is scored on "ab".
+ */
+static uint32_t
+filter_score (const char *name, const struct filter_pattern *pattern,
+              size_t end)
+{
+  long score = 0;
+  size_t position = end;
+  size_t next = end;
+  unsigned char c;
+  size_t j = pattern->length;
+
+  while (j > 0)
+    {
+      c = name[position];
+      if (c != pattern->lower[j - 1] && c != pattern->upper[j - 1])
+        {
+          --position;
+          continue;
+        }
+
+      score += FILTER_SCORE_MATCH;
+
+      if (j < pattern->length && position + 1 == next)
+        {
+          score += FILTER_BONUS_CONSECUTIVE;
+        }
+      else if (j < pattern->length)
+        {
+          score -= (next - position - 1) * FILTER_PENALTY_GAP;
+        }
+
+      if (filter_boundary (name, position))
+        {
+          score += FILTER_BONUS_BOUNDARY;
+        }
+
+      next = position;
+      if (--j > 0)
+        {
+          --position;
+        }
+    }
+
+  return score < 0 ? 0 : score;
+}
+
+/*
+ * Make sure LEVEL can hold CAPACITY matches.
+ */
+static int
+filter_level_reserve (struct filter_level *level, size_t capacity)
+{
+  uint32_t *matches;
+  uint16_t *ends;
+
+  if (capacity <= level->capacity)
+    {
+      return 0;
+    }
+
+  matches = realloc (level->matches, capacity * sizeof (uint32_t));
+  if (matches == NULL)
+    {
+      return -1;
+    }
+  level->matches = matches;
+
+  ends = realloc (level->ends, capacity * sizeof (uint16_t));
+  if (ends == NULL)
+    {
+      return -1;
+    }
+  level->ends = ends;
+
+  level->capacity = capacity;
+
+  return 0;
+}
+
+/*
+ * Part of the work of a keystroke given to a thread, the candidates
+ * from BEGIN to END of the level before are matched against PATTERN
+ * and the COUNT matches are written from BEGIN in LEVEL, or the
+ * matches from BEGIN to END of LEVEL are scored when SCORES is set.
+ */
+struct filter_task
+{
+  pthread_t thread;
+  const struct filter *filter;
+  const struct filter_pattern *pattern;
+  const struct filter_level *previous;
+  struct filter_level *level;
+  uint32_t *scores;
+  int first;
+  int again;
+  size_t begin;
+  size_t end;
+  size_t count;
+};
+
+/*
+ * The candidates are appended without a branch on the result, which
+ * the processor can't predict.
+ */
+static void
+filter_match_range (struct filter_task *task)
+{
+  const struct filter *filter = task->filter;
+  const struct filter_pattern *pattern = task->pattern;
+  const struct filter_level *previous = task->previous;
+  struct filter_level *level = task->level;
+  unsigned char lower = pattern->lower[pattern->length - 1];
+  unsigned char upper = pattern->upper[pattern->length - 1];
+  size_t count = task->begin;
+  const char *name;
+  size_t name_length;
+  size_t position;
+  size_t index;
+  size_t from;
+  size_t i;
+  size_t j;
+
+  for (i = task->begin; i < task->end; ++i)
+    {
+      index = task->first ? i : previous->matches[i];
+      name = filter->names + filter->offsets[index];
+      name_length = filter->offsets[index + 1] - filter->offsets[index] - 1;
+
+      level->matches[count] = index;
+
+      if (pattern->fuzzy && task->again)
+        {
+          position = 0;
+          for (j = 0; j < pattern->length && position < name_length; ++j)
+            {
+              from = j == 0 ? 0 : position + 1;
+              position
+                  = filter_kernel->find (name, from, name_length,
+                                         pattern->lower[j], pattern->upper[j]);
+            }
+          level->ends[count] = position;
+          count += position < name_length;
+        }
+      else if (pattern->fuzzy)
+        {
+          /*
+           * A fuzzy match of one more byte is the leftmost match
+           * before it followed by the byte.
+           */
+          from = pattern->length == 1 ? 0 : previous->ends[i] + 1u;
+          position
+              = filter_kernel->find (name, from, name_length, lower, upper);
+          level->ends[count] = position;
+          count += position < name_length;
+        }
+      else
+        {
+          count += filter_kernel->substring (name, name_length, pattern);
+        }
+    }
+
+  task->count = count - task->begin;
+}
+
+static void
+filter_score_range (struct filter_task *task)
+{
+  const struct filter_level *level = task->level;
+  size_t i;
+
+  for (i = task->begin; i < task->end; ++i)
+    {
+      task->scores[i] = filter_score (
+          task->filter->names + task->filter->offsets[level->matches[i]],
+          task->pattern, level->ends[i]);
+    }
+}
+
+static void *
+filter_run_task (void *data)
+{
+  struct filter_task *task = data;
+
+  if (task->scores != NULL)
+    {
+      filter_score_range (task);
+    }
+  else
+    {
+      filter_match_range (task);
+    }
+
+  return NULL;
+}
+
+/*
+ * Split the COUNT items of TASK between up to FILTER_MAX_THREADS
+ * TASKS, run them on their own thread and wait for them, the first
+ * one runs on the calling thread.
+ * return the number of tasks.
+ */
+static size_t
+filter_run_tasks (const struct filter *filter, const struct filter_task *task,
+                  size_t count, struct filter_task *tasks)
+{
+  size_t number = sort_threads_for (count, filter->threads);
+  size_t started;
+  size_t i;
+
+  if (number > FILTER_MAX_THREADS)
+    {
+      number = FILTER_MAX_THREADS;
+    }
+
+  for (i = 0; i < number; ++i)
+    {
+      tasks[i] = *task;
+      tasks[i].begin = count * i / number;
+      tasks[i].end = count * (i + 1) / number;
+    }
+
+  for (started = 1; started < number; ++started)
+    {
+      if (pthread_create (&tasks[started].thread, NULL, filter_run_task,
+                          &tasks[started])
+          != 0)
+        {
+          break;
+        }
+    }
+
+  /*
+   * Tasks that couldn't get a thread run here.
+   */
+  filter_run_task (&tasks[0]);
+  for (i = started; i < number; ++i)
+    {
+      filter_run_task (&tasks[i]);
+    }
+
+  for (i = 1; i < started; ++i)
+    {
+      pthread_join (tasks[i].thread, NULL);
+    }
+
+  return number;
+}
+
+/*
+ * Fill the level LENGTH with the matches of the first LENGTH bytes of
+ * the pattern among the matches of the level before, or among every
+ * entry for the first one.
+ */
+static int
+filter_level_compute (struct filter *filter, size_t length)
+{
+  const struct entry_store *store = filter->store;
+  const struct filter_level *previous = &filter->levels[length - 1];
+  struct filter_level *level = &filter->levels[length];
+  struct filter_task tasks[FILTER_MAX_THREADS];
+  struct filter_task task;
+  struct filter_pattern pattern;
+  struct filter_pattern shorter;
+  size_t candidates;
+  size_t number;
+  size_t count;
+  size_t i;
+
+  memset (&task, 0, sizeof (task));
+  filter_compile (&pattern, filter->pattern, length);
+  task.filter = filter;
+  task.pattern = &pattern;
+  task.previous = previous;
+  task.level = level;
+  task.first = length == 1;
+
+  /*
+   * The first capital makes the case matter, the leftmost matches of
+   * the level before may have used the other case and are looked for
+   * again among its matches.
+   */
+  if (!task.first)
+    {
+      filter_compile (&shorter, filter->pattern, length - 1);
+      task.again = shorter.fold && !pattern.fold;
+    }
+
+  candidates = task.first ? store->count : previous->count;
+  if (filter_level_reserve (level, candidates) != 0)
+    {
+      return -1;
+    }
+
+  if (pattern.length == 0)
+    {
+      for (i = 0; i < candidates; ++i)
+        {
+          level->matches[i] = task.first ? i : previous->matches[i];
+          level->ends[i] = 0;
+        }
+      level->count = candidates;
+      return 0;
+    }
+
+  /*
+   * Every task wrote its matches at the start of its part, they
+   * are moved next to each other.
+   */
+  number = filter_run_tasks (filter, &task, candidates, tasks);
+  count = tasks[0].count;
+  for (i = 1; i < number; ++i)
+    {
+      memmove (&level->matches[count], &level->matches[tasks[i].begin],
+               tasks[i].count * sizeof (uint32_t));
+      memmove (&level->ends[count], &level->ends[tasks[i].begin],
+               tasks[i].count * sizeof (uint16_t));
+      count += tasks[i].count;
+    }
+
+  level->count = count;
+
+  return 0;
+}
+
+/*
+ * Put the matches of LEVEL in the order, the highest score first and
+ * the order of the store for the same score, with a counting sort.
+ */
+static int
+filter_rank (struct filter *filter, struct filter_level *level)
+{
+  struct filter_task tasks[FILTER_MAX_THREADS];
+  struct filter_task task;
+  struct filter_pattern pattern;
+  uint32_t *order;
+  uint32_t *scores;
+  uint32_t *counts;
+  uint32_t max_score = 0;
+  uint32_t position;
+  uint32_t count;
+  size_t i;
+  long score;
+
+  if (level->count > filter->order_capacity)
+    {
+      order = realloc (filter->order, level->count * sizeof (uint32_t));
+      if (order == NULL)
+        {
+          return -1;
+        }
+      filter->order = order;
+
+      scores = realloc (filter->scores, level->count * sizeof (uint32_t));
+      if (scores == NULL)
+        {
+          return -1;
+        }
+      filter->scores = scores;
+
+      filter->order_capacity = level->count;
+    }
+
+  filter_compile (&pattern, filter->pattern, filter->length);
+  filter->count = level->count;
+
+  /*
+   * A substring keeps the order of the store.
+   */
+  if (!pattern.fuzzy || pattern.length == 0)
+    {
+      memcpy (filter->order, level->matches, level->count * sizeof (uint32_t));
+      return 0;
+    }
+
+  memset (&task, 0, sizeof (task));
+  task.filter = filter;
+  task.pattern = &pattern;
+  task.level = level;
+  task.scores = filter->scores;
+  filter_run_tasks (filter, &task, level->count, tasks);
+
+  for (i = 0; i < level->count; ++i)
+    {
+      if (filter->scores[i] > max_score)
+        {
+          max_score = filter->scores[i];
+        }
+    }
+
+  counts = calloc (max_score + 1, sizeof (uint32_t));
+  if (counts == NULL)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < level->count; ++i)
+    {
+      ++counts[filter->scores[i]];
+    }
+
+  position = 0;
+  for (score = max_score; score >= 0; --score)
+    {
+      count = counts[score];
+      counts[score] = position;
+      position += count;
+    }
+
+  for (i = 0; i < level->count; ++i)
+    {
+      filter->order[counts[filter->scores[i]]++] = level->matches[i];
+    }
+
+  free (counts);
+
+  return 0;
+}
+
+/*
+ * Copy the names of the store in its order after the end of every
+ * name.
+ */
+static int
+filter_pack (struct filter *filter)
+{
+  const struct entry_store *store = filter->store;
+  uint32_t *offsets;
+  char *names;
+  size_t length;
+  size_t size = FILTER_PADDING;
+  size_t i;
+
+  if (filter->packed)
+    {
+      return 0;
+    }
+
+  for (i = 0; i < store->count; ++i)
+    {
+      size += store->name[i].length + 1;
+    }
+
+  if (size > UINT32_MAX)
+    {
+      return -1;
+    }
+
+  if (size > filter->names_capacity)
+    {
+      names = realloc (filter->names, size);
+      if (names == NULL)
+        {
+          return -1;
+        }
+      filter->names = names;
+      filter->names_capacity = size;
+    }
+
+  if (store->count + 1 > filter->offsets_capacity)
+    {
+      offsets = realloc (filter->offsets,
+                         (store->count + 1) * sizeof (uint32_t));
+      if (offsets == NULL)
+        {
+          return -1;
+        }
+      filter->offsets = offsets;
+      filter->offsets_capacity = store->count + 1;
+    }
+
+  size = 0;
+  for (i = 0; i < store->count; ++i)
+    {
+      length = store->name[i].length + 1;
+      filter->offsets[i] = size;
+      memcpy (filter->names + size, entry_store_name (store, i), length);
+      size += length;
+    }
+  filter->offsets[store->count] = size;
+  memset (filter->names + size, 0, FILTER_PADDING);
+
+  filter->packed = 1;
+
+  return 0;
+}
+
+int
+filter_set (struct filter *filter, const struct entry_store *store,
+            const char *pattern)
+{
+  size_t length = strnlen (pattern, FILTER_MAX_PATTERN);
+  size_t common = 0;
+  size_t i;
+
+  if (store != filter->store)
+    {
+      filter_reset (filter);
+      filter->store = store;
+    }
+
+  if (filter_pack (filter) != 0)
+    {
+      return -1;
+    }
+
+  while (common < filter->length && common < length
+         && filter->pattern[common] == pattern[common])
+    {
+      ++common;
+    }
+
+  memcpy (filter->pattern, pattern, length);
+  filter->pattern[length] = '\0';
+  filter->length = common;
+
+  /*
+   * Without a pattern every entry matches in the order of the store.
+   */
+  if (length == 0)
+    {
+      if (filter_level_reserve (&filter->levels[0], store->count) != 0)
+        {
+          return -1;
+        }
+      for (i = 0; i < store->count; ++i)
+        {
+          filter->levels[0].matches[i] = i;
+        }
+      filter->levels[0].count = store->count;
+    }
+
+  for (i = common + 1; i <= length; ++i)
+    {
+      if (filter_level_compute (filter, i) != 0)
+        {
+          return -1;
+        }
+      filter->length = i;
+    }
+
+  return filter_rank (filter, &filter->levels[length]);
+}
+
+void
+filter_reset (struct filter *filter)
+{
+  filter->length = 0;
+  filter->count = 0;
+  filter->packed = 0;
+}
+
+void
+filter_free (struct filter *filter)
+{
+  size_t i;
+
+  for (i = 0; i <= FILTER_MAX_PATTERN; ++i)
+    {
+      free (filter->levels[i].matches);
+      free (filter->levels[i].ends);
+    }
+
+  free (filter->names);
+  free (filter->offsets);
+  free (filter->order);
+  free (filter->scores);
+  memset (filter, 0, sizeof (*filter));
+}
@@ -0,0 +1,154 @@
+/*
+ * filter - library to filter the entries of a store as the user types
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_FILTER_H_
+#define DR_LIB_FILTER_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "entry.h"
+#include "sort.h"
+
+/*
+ * Longest pattern, in bytes.
+ */
+#define FILTER_MAX_PATTERN 255
+
+/*
+ * Upper limit of threads matching the entries for one key, the
+ * store is split like for the sort.
+ */
+#define FILTER_MAX_THREADS 16
+
+/*
+ * Bytes after the last name of the packed buffer so the kernels can
+ * load a whole vector from the end of any name.
+ */
+#define FILTER_PADDING 32
+
+/*
+ * A pattern that starts with it matches the names that contain the
+ * rest as is, the others match the names that contain their
+ * characters in order and are ranked by how well they match.
+ */
+#define FILTER_QUOTE '\''
+
+/*
+ * Points of a fuzzy match, every character is worth
+ * FILTER_SCORE_MATCH plus the bonuses when it follows the previous
+ * one or starts a word, and loses FILTER_PENALTY_GAP for each
+ * character skipped before it.
+ */
+#define FILTER_SCORE_MATCH 16
+#define FILTER_BONUS_CONSECUTIVE 16
+#define FILTER_BONUS_BOUNDARY 12
+#define FILTER_PENALTY_GAP 1
+
+/*
+ * Entries matching the first LENGTH bytes of the pattern, MATCHES
+ * holds their indexes in the order of the store and, for a fuzzy
+ * pattern, ENDS the position of the last byte of the leftmost match
+ * so the next byte is only looked for after it.
+ */
+struct filter_level
+{
+  uint32_t *matches;
+  uint16_t *ends;
+  size_t count;
+  size_t capacity;
+};
+
+/*
+ * Filter of the entries of STORE by PATTERN, LEVELS[I] holds the
+ * matches of the first I bytes so a byte typed only looks at the
+ * matches of the previous level and a byte erased costs nothing.
+ * NAMES is a copy of the names of STORE in its order, the name I
+ * starts at OFFSETS[I] and ends before OFFSETS[I + 1], so the
+ * matching reads memory in order when the store was sorted.
+ * ORDER holds the COUNT matches of the whole pattern, the best first,
+ * SCORES is where they are scored before the ranking.
+ * the letters match both cases unless the pattern has capitals.
+ * the levels and the scores are computed on up to THREADS threads.
+ */
+struct filter
+{
+  const struct entry_store *store;
+  char *names;
+  uint32_t *offsets;
+  size_t names_capacity;
+  size_t offsets_capacity;
+  int packed;
+  char pattern[FILTER_MAX_PATTERN + 1];
+  size_t length;
+  struct filter_level levels[FILTER_MAX_PATTERN + 1];
+  uint32_t *order;
+  uint32_t *scores;
+  size_t count;
+  size_t order_capacity;
+  int threads;
+};
+
+/*
+ * Initialize FILTER without allocating anything, the matching
+ * kernel is picked for the processor and a large store is matched
+ * on up to THREADS threads, 0 or less means one per processor.
+ * setting DR_NO_SIMD in the environment forces the scalar kernel.
+ */
+void filter_init (struct filter *filter, int threads);
+
+/*
+ * Match the entries of STORE against PATTERN, the levels of the
+ * part PATTERN shares with the previous one are kept.
+ * the names are copied the first time, an empty PATTERN does
+ * only that and can be set before the first byte is typed.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int filter_set (struct filter *filter, const struct entry_store *store,
+                const char *pattern);
+
+/*
+ * Forget the matches and the copy of the names, to call when the
+ * entries of the store changed.
+ */
+void filter_reset (struct filter *filter);
+
+/*
+ * Get the index in the store of the match RANK.
+ */
+static inline size_t
+filter_entry (const struct filter *filter, size_t rank)
+{
+  return filter->order[rank];
+}
+
+/*
+ * Get the name of the kernel in use, "avx2", "sse2" or "scalar".
+ */
+const char *filter_kernel_name (void);
+
+/*
+ * Release the memory of FILTER.
+ */
+void filter_free (struct filter *filter);
+
+#endif // DR_LIB_FILTER_H_
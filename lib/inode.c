@@ -0,0 +1,95 @@
+#include "inode.h"
+
+void
+inode_set_init (struct inode_set *set)
+{
+  pthread_mutex_init (&set->lock, NULL);
+  set->slots = NULL;
+  set->count = 0;
+  set->capacity = 0;
+}
+
+/*
+ * Move the pairs of SET to a table twice as large.
+ */
+static int
+inode_set_grow (struct inode_set *set)
+{
+  struct inode_key *slots;
+  size_t capacity;
+  size_t i;
+  size_t j;
+
+  capacity = set->capacity ? set->capacity * 2 : INODE_SET_INITIAL_CAPACITY;
+  slots = calloc (capacity, sizeof (struct inode_key));
+  if (slots == NULL)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < set->capacity; ++i)
+    {
+      if (set->slots[i].ino == 0)
+        {
+          continue;
+        }
+
+      j = inode_hash (set->slots[i].dev, set->slots[i].ino, capacity);
+      while (slots[j].ino != 0)
+        {
+          j = (j + 1) & (capacity - 1);
+        }
+      slots[j] = set->slots[i];
+    }
+
+  free (set->slots);
+  set->slots = slots;
+  set->capacity = capacity;
+
+  return 0;
+}
+
+int
+inode_set_insert (struct inode_set *set, dev_t dev, ino_t ino)
+{
+  int status = 1;
+  size_t i;
+
+  pthread_mutex_lock (&set->lock);
+
+  if (2 * (set->count + 1) > set->capacity && inode_set_grow (set) != 0)
+    {
+      pthread_mutex_unlock (&set->lock);
+      return -1;
+    }
+
+  i = inode_hash (dev, ino, set->capacity);
+  while (set->slots[i].ino != 0)
+    {
+      if (set->slots[i].ino == ino && set->slots[i].dev == dev)
+        {
+          status = 0;
+          break;
+        }
+      i = (i + 1) & (set->capacity - 1);
+    }
+
+  if (status == 1)
+    {
+      set->slots[i].dev = dev;
+      set->slots[i].ino = ino;
+      ++set->count;
+    }
+
+  pthread_mutex_unlock (&set->lock);
+
+  return status;
+}
+
+void
+inode_set_free (struct inode_set *set)
+{
+  pthread_mutex_destroy (&set->lock);
+  free (set->slots);
+  inode_set_init (set);
+}
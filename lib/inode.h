@@ -0,0 +1,79 @@
+/*
+ * inode - library for sets of inodes shared between threads
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_INODE_H_
+#define DR_LIB_INODE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/*
+ * Number of slots allocated the first time a set grows.
+ */
+#define INODE_SET_INITIAL_CAPACITY 1024
+
+struct inode_key
+{
+  dev_t dev;
+  ino_t ino;
+};
+
+/*
+ * Set of (dev, ino) pairs in an open addressing table kept at most
+ * half full, the inode 0 marks an empty slot.
+ */
+struct inode_set
+{
+  pthread_mutex_t lock;
+  struct inode_key *slots;
+  size_t count;
+  size_t capacity;
+};
+
+/*
+ * Initialize SET without allocating anything.
+ */
+void inode_set_init (struct inode_set *set);
+
+/*
+ * Add DEV and INO to SET, any thread can call it.
+ * return 1 if they are new, 0 if they were there already and -1
+ * if the allocation failed.
+ */
+int inode_set_insert (struct inode_set *set, dev_t dev, ino_t ino);
+
+/*
+ * Get the slot of DEV and INO in a table of CAPACITY slots,
+ * CAPACITY is a power of two.
+ */
+static inline size_t
+inode_hash (dev_t dev, ino_t ino, size_t capacity)
+{
+  return ((uint64_t)ino * 0x9e3779b97f4a7c15ull ^ dev) & (capacity - 1);
+}
+
+/*
+ * Release the memory of SET.
+ */
+void inode_set_free (struct inode_set *set);
+
+#endif // DR_LIB_INODE_H_
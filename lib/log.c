@@ -0,0 +1,753 @@
+#include "log.h"
+
+int log_threshold = LOG_LEVEL_NONE;
+
+/*
+ * Rings of every thread that logged, new ones are pushed in front
+ * and none is freed before 'log_close'.
+ */
+static struct log_ring *log_rings;
+
+/*
+ * Ring of the calling thread and its id, the key gives the ring back
+ * when the thread exits.
+ */
+static __thread struct log_ring *log_own;
+static __thread pid_t log_thread_id;
+static pthread_key_t log_key;
+
+/*
+ * Where the flusher writes, syslog when LOG_FILE is NULL, it is
+ * woken up by LOG_EVENT_FD when it must stop.
+ */
+static FILE *log_file;
+static pthread_t log_flusher;
+static int log_event_fd = -1;
+static int log_stopping;
+static uint64_t log_reported;
+
+static const char *const log_level_names[] = {
+  "error",
+  "warning",
+  "info",
+  "debug",
+};
+
+static const int log_priorities[] = {
+  LOG_ERR,
+  LOG_WARNING,
+  LOG_INFO,
+  LOG_DEBUG,
+};
+
+/*
+ * Length modifiers of a conversion.
+ */
+enum log_modifier
+{
+  LOG_MODIFIER_NONE,
+  LOG_MODIFIER_CHAR,
+  LOG_MODIFIER_SHORT,
+  LOG_MODIFIER_LONG,
+  LOG_MODIFIER_LONG_LONG,
+  LOG_MODIFIER_SIZE,
+  LOG_MODIFIER_INTMAX,
+  LOG_MODIFIER_PTRDIFF,
+};
+
+/*
+ * Conversion of a format, the flags, width and precision are the
+ * PREFIX_LENGTH bytes after the '%' at START.
+ */
+struct log_spec
+{
+  const char *start;
+  size_t prefix_length;
+  enum log_modifier modifier;
+  char conversion;
+};
+
+/*
+ * Read the conversion that starts at the '%' at P in SPEC.
+ * return what follows it.
+ */
+static const char *
+log_parse (const char *p, struct log_spec *spec)
+{
+  spec->start = p++;
+
+  while (*p != '\0' && strchr ("-+ #0'", *p) != NULL)
+    {
+      ++p;
+    }
+  while ((*p >= '0' && *p <= '9') || *p == '.')
+    {
+      ++p;
+    }
+
+  spec->prefix_length = p - spec->start - 1;
+  spec->modifier = LOG_MODIFIER_NONE;
+
+  switch (*p)
+    {
+    case 'h':
+      spec->modifier = LOG_MODIFIER_SHORT;
+      if (*++p == 'h')
+        {
+          spec->modifier = LOG_MODIFIER_CHAR;
+          ++p;
+        }
+      break;
+    case 'l':
+      spec->modifier = LOG_MODIFIER_LONG;
+      if (*++p == 'l')
+        {
+          spec->modifier = LOG_MODIFIER_LONG_LONG;
+          ++p;
+        }
+      break;
+    case 'z':
+      spec->modifier = LOG_MODIFIER_SIZE;
+      ++p;
+      break;
+    case 'j':
+      spec->modifier = LOG_MODIFIER_INTMAX;
+      ++p;
+      break;
+    case 't':
+      spec->modifier = LOG_MODIFIER_PTRDIFF;
+      ++p;
+      break;
+    default:
+      break;
+    }
+
+  spec->conversion = *p;
+
+  return *p != '\0' ? p + 1 : p;
+}
+
+/*
+ * Take the next signed integer of AP of the size given by MODIFIER.
+ */
+static int64_t
+log_signed_argument (enum log_modifier modifier, va_list *ap)
+{
+  switch (modifier)
+    {
+    case LOG_MODIFIER_CHAR:
+      return (signed char)va_arg (*ap, int);
+    case LOG_MODIFIER_SHORT:
+      return (short)va_arg (*ap, int);
+    case LOG_MODIFIER_LONG:
+      return va_arg (*ap, long);
+    case LOG_MODIFIER_LONG_LONG:
+      return va_arg (*ap, long long);
+    case LOG_MODIFIER_SIZE:
+      return va_arg (*ap, ssize_t);
+    case LOG_MODIFIER_INTMAX:
+      return va_arg (*ap, intmax_t);
+    case LOG_MODIFIER_PTRDIFF:
+      return va_arg (*ap, ptrdiff_t);
+    default:
+      return va_arg (*ap, int);
+    }
+}
+
+/*
+ * Take the next unsigned integer of AP of the size given by MODIFIER.
+ */
+static uint64_t
+log_unsigned_argument (enum log_modifier modifier, va_list *ap)
+{
+  switch (modifier)
+    {
+    case LOG_MODIFIER_CHAR:
+      return (unsigned char)va_arg (*ap, unsigned);
+    case LOG_MODIFIER_SHORT:
+      return (unsigned short)va_arg (*ap, unsigned);
+    case LOG_MODIFIER_LONG:
+      return va_arg (*ap, unsigned long);
+    case LOG_MODIFIER_LONG_LONG:
+      return va_arg (*ap, unsigned long long);
+    case LOG_MODIFIER_SIZE:
+      return va_arg (*ap, size_t);
+    case LOG_MODIFIER_INTMAX:
+      return va_arg (*ap, uintmax_t);
+    case LOG_MODIFIER_PTRDIFF:
+      return va_arg (*ap, ptrdiff_t);
+    default:
+      return va_arg (*ap, unsigned);
+    }
+}
+
+/*
+ * Copy the arguments of AP converted by FORMAT in the data of
+ * RECORD, every number takes 8 bytes and the strings are copied with
+ * their '\0', what doesn't fit is left out.
+ */
+static void
+log_capture (struct log_record *record, const char *format, va_list *ap)
+{
+  unsigned char *data = record->data;
+  struct log_spec spec;
+  const char *p = format;
+  const char *string;
+  size_t length;
+  uint64_t value;
+  double real;
+
+  record->size = 0;
+
+  while ((p = strchr (p, '%')) != NULL)
+    {
+      p = log_parse (p, &spec);
+
+      switch (spec.conversion)
+        {
+        case '%':
+          continue;
+        case 'd':
+        case 'i':
+          value = log_signed_argument (spec.modifier, ap);
+          break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+          value = log_unsigned_argument (spec.modifier, ap);
+          break;
+        case 'c':
+          value = va_arg (*ap, int);
+          break;
+        case 'm':
+          value = errno;
+          break;
+        case 'p':
+          value = (uintptr_t)va_arg (*ap, void *);
+          break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+          real = va_arg (*ap, double);
+          memcpy (&value, &real, sizeof (value));
+          break;
+        case 's':
+          string = va_arg (*ap, const char *);
+          if (string == NULL)
+            {
+              string = "(null)";
+            }
+          if (record->size == LOG_RECORD_DATA)
+            {
+              return;
+            }
+          length = strnlen (string, LOG_RECORD_DATA - record->size - 1);
+          memcpy (data + record->size, string, length);
+          data[record->size + length] = '\0';
+          record->size += length + 1;
+          continue;
+        default:
+          return;
+        }
+
+      if (record->size + sizeof (value) > LOG_RECORD_DATA)
+        {
+          return;
+        }
+      memcpy (data + record->size, &value, sizeof (value));
+      record->size += sizeof (value);
+    }
+}
+
+/*
+ * Add the LENGTH bytes of TEXT to the SIZE bytes of BUFFER after
+ * *USED, they are cut to what fits.
+ */
+static void
+log_append (char *buffer, size_t size, size_t *used, const char *text,
+            size_t length)
+{
+  if (*used + length >= size)
+    {
+      length = size - 1 - *used;
+    }
+
+  memcpy (buffer + *used, text, length);
+  *used += length;
+  buffer[*used] = '\0';
+}
+
+/*
+ * Format the message of RECORD in the SIZE bytes of BUFFER, the
+ * conversions whose argument was left out stop it.
+ */
+static void
+log_format (const struct log_record *record, char *buffer, size_t size)
+{
+  const unsigned char *data = record->data;
+  const char *p = record->format;
+  char conversion[32];
+  char piece[256];
+  struct log_spec spec;
+  const char *percent;
+  const char *string;
+  size_t position = 0;
+  size_t used = 0;
+  uint64_t value;
+  double real;
+  int length;
+
+  buffer[0] = '\0';
+
+  while ((percent = strchr (p, '%')) != NULL)
+    {
+      log_append (buffer, size, &used, p, percent - p);
+      p = log_parse (percent, &spec);
+
+      if (spec.conversion == '%')
+        {
+          log_append (buffer, size, &used, "%", 1);
+          continue;
+        }
+
+      if (spec.prefix_length + 4 > sizeof (conversion))
+        {
+          return;
+        }
+
+      /*
+       * The integers were widened to 64 bits when they were copied.
+       */
+      memcpy (conversion, spec.start, spec.prefix_length + 1);
+      length = spec.prefix_length + 1;
+      if (strchr ("diouxX", spec.conversion) != NULL)
+        {
+          conversion[length++] = 'l';
+          conversion[length++] = 'l';
+        }
+      conversion[length++] = spec.conversion == 'm' ? 's' : spec.conversion;
+      conversion[length] = '\0';
+
+      if (spec.conversion == 's')
+        {
+          if (position >= record->size)
+            {
+              return;
+            }
+          string = (const char *)data + position;
+          position += strlen (string) + 1;
+          length = snprintf (piece, sizeof (piece), conversion, string);
+        }
+      else
+        {
+          if (position + sizeof (value) > record->size)
+            {
+              return;
+            }
+          memcpy (&value, data + position, sizeof (value));
+          position += sizeof (value);
+
+          switch (spec.conversion)
+            {
+            case 'd':
+            case 'i':
+              length = snprintf (piece, sizeof (piece), conversion,
+                                 (long long)value);
+              break;
+            case 'c':
+              length = snprintf (piece, sizeof (piece), conversion,
+                                 (int)value);
+              break;
+            case 'm':
+              length = snprintf (piece, sizeof (piece), conversion,
+                                 strerror ((int)value));
+              break;
+            case 'p':
+              length = snprintf (piece, sizeof (piece), conversion,
+                                 (void *)(uintptr_t)value);
+              break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+              length = snprintf (piece, sizeof (piece), conversion,
+                                 (unsigned long long)value);
+              break;
+            default:
+              memcpy (&real, &value, sizeof (real));
+              length = snprintf (piece, sizeof (piece), conversion, real);
+              break;
+            }
+        }
+
+      if (length > 0)
+        {
+          log_append (buffer, size, &used, piece,
+                      (size_t)length < sizeof (piece) ? (size_t)length
+                                                      : sizeof (piece) - 1);
+        }
+    }
+
+  log_append (buffer, size, &used, p, strlen (p));
+}
+
+/*
+ * Write the message of RECORD where the log goes.
+ */
+static void
+log_emit (const struct log_record *record)
+{
+  char message[1024];
+  char stamp[32];
+  struct tm tm;
+  time_t seconds;
+
+  log_format (record, message, sizeof (message));
+
+  if (log_file == NULL)
+    {
+      syslog (log_priorities[record->level], "%s", message);
+      return;
+    }
+
+  seconds = record->time / 1000000000;
+  localtime_r (&seconds, &tm);
+  strftime (stamp, sizeof (stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+  fprintf (log_file, "%s.%03u [%d] %s: %s\n", stamp,
+           (unsigned)(record->time / 1000000 % 1000), (int)record->thread,
+           log_level_names[record->level], message);
+}
+
+/*
+ * Write the records of every ring in the order they were logged.
+ */
+static void
+log_drain (void)
+{
+  struct log_ring *rings = __atomic_load_n (&log_rings, __ATOMIC_ACQUIRE);
+  const struct log_record *record;
+  const struct log_record *oldest;
+  struct log_ring *owner;
+  struct log_ring *ring;
+  uint64_t dropped = 0;
+  struct log_record note;
+  struct timespec now;
+
+  for (;;)
+    {
+      oldest = NULL;
+      owner = NULL;
+
+      for (ring = rings; ring != NULL; ring = ring->next)
+        {
+          if (ring->head
+              == __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE))
+            {
+              continue;
+            }
+
+          record = &ring->records[ring->head % LOG_RING_RECORDS];
+          if (oldest == NULL || record->time < oldest->time)
+            {
+              oldest = record;
+              owner = ring;
+            }
+        }
+
+      if (oldest == NULL)
+        {
+          break;
+        }
+
+      log_emit (oldest);
+      __atomic_store_n (&owner->head, owner->head + 1, __ATOMIC_RELEASE);
+    }
+
+  for (ring = rings; ring != NULL; ring = ring->next)
+    {
+      dropped += __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+    }
+
+  if (dropped > log_reported)
+    {
+      clock_gettime (CLOCK_REALTIME, &now);
+      memset (&note, 0, sizeof (note));
+      note.time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+      note.format = "%llu messages were dropped, the log was too slow";
+      note.thread = getpid ();
+      note.level = LOG_LEVEL_WARNING;
+      note.size = sizeof (uint64_t);
+      dropped -= log_reported;
+      memcpy (note.data, &dropped, sizeof (dropped));
+      log_reported += dropped;
+      log_emit (&note);
+    }
+
+  if (log_file != NULL)
+    {
+      fflush (log_file);
+    }
+}
+
+static void *
+log_flush_worker (__attribute__ ((unused)) void *data)
+{
+  struct pollfd pfd;
+  uint64_t events;
+  int stopping;
+
+  pfd.fd = log_event_fd;
+  pfd.events = POLLIN;
+
+  do
+    {
+      poll (&pfd, 1, LOG_FLUSH_INTERVAL);
+      if (read (log_event_fd, &events, sizeof (events)) < 0)
+        {
+          /*
+           * Nothing was signaled, it is time to flush.
+           */
+        }
+
+      stopping = __atomic_load_n (&log_stopping, __ATOMIC_ACQUIRE);
+      log_drain ();
+    }
+  while (!stopping);
+
+  return NULL;
+}
+
+/*
+ * Called when a thread that logged exits, its ring goes to the next
+ * thread once the flusher emptied it.
+ */
+static void
+log_release_ring (void *data)
+{
+  struct log_ring *ring = data;
+
+  __atomic_store_n (&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Get the ring of the calling thread, one left by a thread that
+ * exited or a new one.
+ * return NULL if the allocation failed.
+ */
+static struct log_ring *
+log_claim_ring (void)
+{
+  struct log_ring *ring;
+  int expected;
+
+  if (log_own != NULL)
+    {
+      return log_own;
+    }
+
+  for (ring = __atomic_load_n (&log_rings, __ATOMIC_ACQUIRE); ring != NULL;
+       ring = ring->next)
+    {
+      expected = 0;
+      if (__atomic_compare_exchange_n (&ring->in_use, &expected, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+          break;
+        }
+    }
+
+  if (ring == NULL)
+    {
+      ring = calloc (1, sizeof (struct log_ring));
+      if (ring == NULL)
+        {
+          return NULL;
+        }
+
+      ring->in_use = 1;
+      ring->next = __atomic_load_n (&log_rings, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&log_rings, &ring->next, ring, 1,
+                                           __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+  pthread_setspecific (log_key, ring);
+  log_own = ring;
+  log_thread_id = syscall (SYS_gettid);
+
+  return ring;
+}
+
+void
+log_write (enum log_level level, const char *format, ...)
+{
+  struct log_record *record;
+  struct log_ring *ring;
+  struct timespec now;
+  int saved_errno = errno;
+  va_list ap;
+  size_t tail;
+
+  ring = log_claim_ring ();
+  if (ring == NULL)
+    {
+      return;
+    }
+
+  tail = ring->tail;
+  if (tail - __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)
+      == LOG_RING_RECORDS)
+    {
+      __atomic_add_fetch (&ring->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+  clock_gettime (CLOCK_REALTIME, &now);
+
+  record = &ring->records[tail % LOG_RING_RECORDS];
+  record->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  record->format = format;
+  record->thread = log_thread_id;
+  record->level = level;
+
+  /*
+   * '%m' takes the errno of the caller.
+   */
+  errno = saved_errno;
+  va_start (ap, format);
+  log_capture (record, format, &ap);
+  va_end (ap);
+
+  __atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int
+log_open (enum log_level level, const char *file_name)
+{
+  sigset_t blocked;
+  sigset_t saved;
+  int error;
+
+  if (level == LOG_LEVEL_NONE)
+    {
+      return 0;
+    }
+
+  if (file_name != NULL)
+    {
+      log_file = fopen (file_name, "ae");
+      if (log_file == NULL)
+        {
+          return -1;
+        }
+    }
+  else
+    {
+      openlog (program_invocation_short_name, LOG_PID, LOG_USER);
+    }
+
+  log_event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (log_event_fd < 0)
+    {
+      error = errno;
+      goto fail;
+    }
+
+  error = pthread_key_create (&log_key, log_release_ring);
+  if (error != 0)
+    {
+      goto fail;
+    }
+
+  /*
+   * The flusher must not take the signals of the interface, they are
+   * blocked while it starts so it never has them.
+   */
+  sigfillset (&blocked);
+  pthread_sigmask (SIG_BLOCK, &blocked, &saved);
+  error = pthread_create (&log_flusher, NULL, log_flush_worker, NULL);
+  pthread_sigmask (SIG_SETMASK, &saved, NULL);
+
+  if (error != 0)
+    {
+      pthread_key_delete (log_key);
+      goto fail;
+    }
+
+  log_threshold = level;
+
+  return 0;
+
+fail:
+  if (log_event_fd >= 0)
+    {
+      close (log_event_fd);
+      log_event_fd = -1;
+    }
+  if (log_file != NULL)
+    {
+      fclose (log_file);
+      log_file = NULL;
+    }
+  else
+    {
+      closelog ();
+    }
+  errno = error;
+  return -1;
+}
+
+void
+log_close (void)
+{
+  struct log_ring *ring;
+  struct log_ring *next;
+  uint64_t one = 1;
+
+  if (log_threshold == LOG_LEVEL_NONE)
+    {
+      return;
+    }
+
+  log_threshold = LOG_LEVEL_NONE;
+
+  __atomic_store_n (&log_stopping, 1, __ATOMIC_RELEASE);
+  if (write (log_event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The flusher still stops at its next flush.
+       */
+    }
+  pthread_join (log_flusher, NULL);
+
+  close (log_event_fd);
+  log_event_fd = -1;
+  pthread_key_delete (log_key);
+
+  for (ring = log_rings; ring != NULL; ring = next)
+    {
+      next = ring->next;
+      free (ring);
+    }
+  log_rings = NULL;
+  log_own = NULL;
+
+  if (log_file != NULL)
+    {
+      fclose (log_file);
+      log_file = NULL;
+    }
+  else
+    {
+      closelog ();
+    }
+}
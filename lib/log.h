@@ -0,0 +1,145 @@
+/*
+ * log - library to log from any thread without waiting for the output
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_LOG_H_
+#define DR_LIB_LOG_H_
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Records a thread can hold before the flusher takes them, the ones
+ * that don't fit are dropped and counted.
+ */
+#define LOG_RING_RECORDS 256
+
+/*
+ * Bytes of the arguments of a record, a string is cut to what
+ * remains.
+ */
+#define LOG_RECORD_DATA 224
+
+/*
+ * Milliseconds between two flushes.
+ */
+#define LOG_FLUSH_INTERVAL 100
+
+/*
+ * Levels of the messages, a message is kept when its level is not
+ * above the level given to 'log_open'.
+ */
+enum log_level
+{
+  LOG_LEVEL_NONE = -1,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG,
+};
+
+/*
+ * Message logged by a thread, FORMAT is a string literal that is only
+ * formatted by the flusher, DATA holds the SIZE bytes of the
+ * arguments it converts.
+ */
+struct log_record
+{
+  uint64_t time;
+  const char *format;
+  pid_t thread;
+  int level;
+  size_t size;
+  unsigned char data[LOG_RECORD_DATA];
+};
+
+/*
+ * Ring of the records of one thread, only the thread writes TAIL and
+ * only the flusher writes HEAD so neither takes a lock.
+ * the ring goes back to the next thread once its owner exits, IN_USE
+ * is set while it has one.
+ */
+struct log_ring
+{
+  struct log_ring *next;
+  size_t head;
+  size_t tail;
+  uint64_t dropped;
+  int in_use;
+  struct log_record records[LOG_RING_RECORDS];
+};
+
+/*
+ * Level of the messages that are kept, LOG_LEVEL_NONE until
+ * 'log_open', it is all a message of another level costs.
+ */
+extern int log_threshold;
+
+/*
+ * Log a message of LEVEL like printf would print FORMAT, the
+ * arguments are only evaluated when LEVEL is kept.
+ * FORMAT must be a string literal, its conversions can't take their
+ * width or precision from an argument and the strings are copied.
+ */
+#define LOG_MESSAGE(level, ...)                                               \
+  do                                                                          \
+    {                                                                         \
+      if (__builtin_expect ((int)(level) <= log_threshold, 0))                \
+        {                                                                     \
+          log_write ((level), __VA_ARGS__);                                   \
+        }                                                                     \
+    }                                                                         \
+  while (0)
+
+/*
+ * Keep the messages up to LEVEL and start the thread that writes
+ * them, appended to FILE_NAME or sent to syslog if it is NULL.
+ * return 0 on success and -1 with errno set.
+ */
+int log_open (enum log_level level, const char *file_name);
+
+/*
+ * Add a message of LEVEL to the ring of the calling thread, it is
+ * dropped if the ring is full, the caller never waits.
+ * use 'LOG_MESSAGE' so the arguments are not evaluated for nothing.
+ */
+void log_write (enum log_level level, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+/*
+ * Write what is left and stop the flusher, the messages logged after
+ * it are dropped.
+ */
+void log_close (void);
+
+#endif // DR_LIB_LOG_H_
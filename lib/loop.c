@@ -0,0 +1,248 @@
+#include "loop.h"
+
+static void
+loop_on_timer (int fd, void *data)
+{
+  struct loop *loop = data;
+  uint64_t expirations;
+
+  if (read (fd, &expirations, sizeof (expirations)) < 0)
+    {
+      return;
+    }
+
+  loop->frame_pending = 0;
+  clock_gettime (CLOCK_MONOTONIC, &loop->last_frame);
+
+  loop->on_frame (loop->data);
+}
+
+static void
+loop_on_signal (int fd, void *data)
+{
+  struct loop *loop = data;
+  struct signalfd_siginfo info;
+
+  while (read (fd, &info, sizeof (info)) == sizeof (info))
+    {
+      loop->on_signal (info.ssi_signo, loop->data);
+    }
+}
+
+int
+loop_init (struct loop *loop, const sigset_t *signals,
+           loop_signal_callback on_signal, loop_frame_callback on_frame,
+           void *data)
+{
+  int i;
+
+  for (i = 0; i < LOOP_MAX_WATCHES; ++i)
+    {
+      loop->watches[i].fd = -1;
+    }
+
+  loop->on_signal = on_signal;
+  loop->on_frame = on_frame;
+  loop->data = data;
+  loop->last_frame.tv_sec = 0;
+  loop->last_frame.tv_nsec = 0;
+  loop->frame_pending = 0;
+  loop->running = 0;
+  loop->timer_fd = -1;
+  loop->signal_fd = -1;
+
+  loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0)
+    {
+      return -1;
+    }
+
+  loop->timer_fd
+      = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (loop->timer_fd < 0)
+    {
+      loop_free (loop);
+      return -1;
+    }
+
+  if (sigprocmask (SIG_BLOCK, signals, NULL) != 0)
+    {
+      loop_free (loop);
+      return -1;
+    }
+
+  loop->signal_fd = signalfd (-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (loop->signal_fd < 0)
+    {
+      loop_free (loop);
+      return -1;
+    }
+
+  if (loop_add (loop, loop->timer_fd, loop_on_timer, loop) != 0
+      || loop_add (loop, loop->signal_fd, loop_on_signal, loop) != 0)
+    {
+      loop_free (loop);
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+loop_add (struct loop *loop, int fd, loop_callback callback, void *data)
+{
+  struct epoll_event event;
+  struct loop_watch *watch = NULL;
+  int i;
+
+  for (i = 0; i < LOOP_MAX_WATCHES; ++i)
+    {
+      if (loop->watches[i].fd < 0)
+        {
+          watch = &loop->watches[i];
+          break;
+        }
+    }
+
+  if (watch == NULL)
+    {
+      errno = ENOSPC;
+      return -1;
+    }
+
+  watch->fd = fd;
+  watch->callback = callback;
+  watch->data = data;
+
+  memset (&event, 0, sizeof (event));
+  event.events = EPOLLIN;
+  event.data.ptr = watch;
+
+  if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+      watch->fd = -1;
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+loop_remove (struct loop *loop, int fd)
+{
+  int i;
+
+  for (i = 0; i < LOOP_MAX_WATCHES; ++i)
+    {
+      if (loop->watches[i].fd == fd)
+        {
+          epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+          loop->watches[i].fd = -1;
+        }
+    }
+}
+
+void
+loop_request_frame (struct loop *loop)
+{
+  struct itimerspec when;
+  struct timespec now;
+  int64_t elapsed;
+  int64_t delay;
+
+  if (loop->frame_pending)
+    {
+      return;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  elapsed = (int64_t)(now.tv_sec - loop->last_frame.tv_sec) * 1000000000
+            + (now.tv_nsec - loop->last_frame.tv_nsec);
+
+  /*
+   * A zero value disarms the timer, so the
+   * shortest delay is one nanosecond.
+   */
+  delay = LOOP_FRAME_INTERVAL - elapsed;
+  if (delay < 1)
+    {
+      delay = 1;
+    }
+
+  memset (&when, 0, sizeof (when));
+  when.it_value.tv_sec = delay / 1000000000;
+  when.it_value.tv_nsec = delay % 1000000000;
+
+  if (timerfd_settime (loop->timer_fd, 0, &when, NULL) == 0)
+    {
+      loop->frame_pending = 1;
+    }
+}
+
+int
+loop_run (struct loop *loop)
+{
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  struct loop_watch *watch;
+  int count;
+  int i;
+
+  loop->running = 1;
+
+  while (loop->running)
+    {
+      count = epoll_wait (loop->epoll_fd, events, LOOP_MAX_EVENTS, -1);
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          return -1;
+        }
+
+      for (i = 0; i < count && loop->running; ++i)
+        {
+          watch = events[i].data.ptr;
+
+          /*
+           * The watch could have been removed by a
+           * callback of the same wake up.
+           */
+          if (watch->fd >= 0)
+            {
+              watch->callback (watch->fd, watch->data);
+            }
+        }
+    }
+
+  return 0;
+}
+
+void
+loop_quit (struct loop *loop)
+{
+  loop->running = 0;
+}
+
+void
+loop_free (struct loop *loop)
+{
+  if (loop->signal_fd >= 0)
+    {
+      close (loop->signal_fd);
+      loop->signal_fd = -1;
+    }
+
+  if (loop->timer_fd >= 0)
+    {
+      close (loop->timer_fd);
+      loop->timer_fd = -1;
+    }
+
+  if (loop->epoll_fd >= 0)
+    {
+      close (loop->epoll_fd);
+      loop->epoll_fd = -1;
+    }
+}
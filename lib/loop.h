@@ -0,0 +1,136 @@
+/*
+ * loop - library to wait for events with epoll
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_LOOP_H_
+#define DR_LIB_LOOP_H_
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Number of file descriptors a loop can watch.
+ */
+#define LOOP_MAX_WATCHES 32
+
+/*
+ * Number of events handled for every wake up.
+ */
+#define LOOP_MAX_EVENTS 16
+
+/*
+ * Shortest time between two frames in nanoseconds, about 60 frames
+ * per second whatever the number of updates.
+ */
+#define LOOP_FRAME_INTERVAL (16 * 1000 * 1000)
+
+/*
+ * Called when FD is ready, DATA is the pointer given to 'loop_add'.
+ */
+typedef void (*loop_callback) (int fd, void *data);
+
+/*
+ * Called for every signal the loop was asked to catch.
+ */
+typedef void (*loop_signal_callback) (int signal, void *data);
+
+/*
+ * Called to draw a frame.
+ */
+typedef void (*loop_frame_callback) (void *data);
+
+struct loop_watch
+{
+  int fd;
+  loop_callback callback;
+  void *data;
+};
+
+/*
+ * Event loop built on epoll, the signals go through a signalfd and
+ * the frames through a timerfd so many updates end up in one frame
+ * and the loop sleeps when nothing happens.
+ */
+struct loop
+{
+  int epoll_fd;
+  int timer_fd;
+  int signal_fd;
+  struct loop_watch watches[LOOP_MAX_WATCHES];
+
+  loop_signal_callback on_signal;
+  loop_frame_callback on_frame;
+  void *data;
+
+  struct timespec last_frame;
+  int frame_pending;
+  int running;
+};
+
+/*
+ * Setup LOOP, the signals of SIGNALS are blocked for the process
+ * and given to ON_SIGNAL instead, ON_FRAME draws a frame.
+ * this must be called before starting any thread so they inherit
+ * the blocked signals.
+ * return 0 on success and -1 with errno set.
+ */
+int loop_init (struct loop *loop, const sigset_t *signals,
+               loop_signal_callback on_signal, loop_frame_callback on_frame,
+               void *data);
+
+/*
+ * Call CALLBACK with DATA every time FD is readable.
+ * return 0 on success and -1 with errno set.
+ */
+int loop_add (struct loop *loop, int fd, loop_callback callback, void *data);
+
+/*
+ * Stop watching FD.
+ */
+void loop_remove (struct loop *loop, int fd);
+
+/*
+ * Ask for a frame, it is drawn as soon as the last frame is
+ * LOOP_FRAME_INTERVAL old and asking again before that does nothing.
+ */
+void loop_request_frame (struct loop *loop);
+
+/*
+ * Wait for events and dispatch them until 'loop_quit' is called.
+ * return 0 on success and -1 with errno set.
+ */
+int loop_run (struct loop *loop);
+
+/*
+ * Make 'loop_run' return after the current events.
+ */
+void loop_quit (struct loop *loop);
+
+/*
+ * Release the file descriptors of LOOP.
+ */
+void loop_free (struct loop *loop);
+
+#endif // DR_LIB_LOOP_H_
@@ -0,0 +1,704 @@
+#include "meta.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * Submission and completion rings shared with the kernel,
+ * refer to io_uring(7).
+ */
+struct meta_ring
+{
+  int fd;
+  void *sq_ptr;
+  void *cq_ptr;
+  size_t sq_size;
+  size_t cq_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static void
+meta_ring_close (struct meta_ring *ring)
+{
+  if (ring->sqes != NULL)
+    {
+      munmap (ring->sqes, ring->sqes_size);
+    }
+
+  if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+    {
+      munmap (ring->cq_ptr, ring->cq_size);
+    }
+
+  if (ring->sq_ptr != NULL)
+    {
+      munmap (ring->sq_ptr, ring->sq_size);
+    }
+
+  close (ring->fd);
+}
+
+/*
+ * Setup a ring of ENTRIES submissions.
+ * return 0 on success and -1 if io_uring is not available.
+ */
+static int
+meta_ring_open (struct meta_ring *ring, unsigned entries)
+{
+  struct io_uring_params params;
+  char *sq;
+  char *cq;
+
+  memset (ring, 0, sizeof (struct meta_ring));
+  memset (&params, 0, sizeof (params));
+
+  ring->fd = syscall (__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+    {
+      return -1;
+    }
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  ring->cq_size = params.cq_off.cqes
+                  + params.cq_entries * sizeof (struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (ring->cq_size > ring->sq_size)
+        {
+          ring->sq_size = ring->cq_size;
+        }
+      ring->cq_size = ring->sq_size;
+    }
+
+  ring->sq_ptr = mmap (NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED)
+    {
+      ring->sq_ptr = NULL;
+      meta_ring_close (ring);
+      return -1;
+    }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      ring->cq_ptr = ring->sq_ptr;
+    }
+  else
+    {
+      ring->cq_ptr = mmap (NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+      if (ring->cq_ptr == MAP_FAILED)
+        {
+          ring->cq_ptr = NULL;
+          meta_ring_close (ring);
+          return -1;
+        }
+    }
+
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      ring->sqes = NULL;
+      meta_ring_close (ring);
+      return -1;
+    }
+
+  sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+  cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  return 0;
+}
+#endif
+
+/*
+ * Let go of JOB, the last of the threads and the caller frees it.
+ */
+static void
+meta_job_release (struct meta_job *job)
+{
+  if (__atomic_sub_fetch (&job->references, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  pthread_cond_destroy (&job->wake);
+  pthread_mutex_destroy (&job->lock);
+  close (job->event_fd);
+  close (job->dir_fd);
+  free (job);
+}
+
+/*
+ * Claim up to MAX entries that nobody fetched yet, the priority
+ * range goes first, and copy their names in NAMES so the store
+ * isn't read while the system calls run.  Wait while there is none.
+ * return the number of entries saved in INDEXES with the GENERATION
+ * of the store they were claimed in, 0 once stopped.
+ */
+static size_t
+meta_claim (struct meta_job *job, size_t *indexes,
+            char (*names)[NAME_MAX + 1], size_t max, size_t *generation)
+{
+  struct entry_store *store = job->store;
+  unsigned char expected;
+  size_t count = 0;
+  size_t i;
+
+  pthread_mutex_lock (&job->lock);
+
+  while (!job->stop && count == 0)
+    {
+      while (!job->stop && job->priority_first >= job->priority_end
+             && job->next >= store->count)
+        {
+          pthread_cond_wait (&job->wake, &job->lock);
+        }
+
+      while (!job->stop && count < max
+             && (job->priority_first < job->priority_end
+                 || job->next < store->count))
+        {
+          if (job->priority_first < job->priority_end)
+            {
+              i = job->priority_first++;
+            }
+          else
+            {
+              i = job->next++;
+            }
+
+          expected = ENTRY_META_NONE;
+          if (__atomic_compare_exchange_n (&store->state[i], &expected,
+                                           ENTRY_META_PENDING, 0,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+            {
+              snprintf (names[count], NAME_MAX + 1, "%s",
+                        entry_store_name (store, i));
+              indexes[count++] = i;
+            }
+        }
+    }
+
+  *generation = job->generation;
+  pthread_mutex_unlock (&job->lock);
+
+  return count;
+}
+
+/*
+ * Save the result of statx for the entry INDEX of STORE and publish
+ * it, ERROR is 0 on success and the errno value otherwise.
+ */
+static void
+meta_apply (struct entry_store *store, size_t index, int error,
+            const struct statx *stx)
+{
+  if (error == 0)
+    {
+      store->size[index] = stx->stx_size;
+      store->mtime[index] = stx->stx_mtime.tv_sec;
+      store->mode[index] = stx->stx_mode;
+      store->uid[index] = stx->stx_uid;
+      store->gid[index] = stx->stx_gid;
+    }
+  else
+    {
+      LOG_MESSAGE (LOG_LEVEL_DEBUG, "can't stat %s: %s",
+                   entry_store_name (store, index), strerror (error));
+    }
+
+  __atomic_store_n (&store->state[index],
+                    error == 0 ? ENTRY_META_READY : ENTRY_META_FAILED,
+                    __ATOMIC_RELEASE);
+}
+
+/*
+ * Save the COUNT results of a batch claimed in GENERATION unless the
+ * fetch was stopped or the store changed meanwhile, the store may be
+ * gone or the entries elsewhere then.
+ * return the number of results saved.
+ */
+static size_t
+meta_publish (struct meta_job *job, size_t generation, const size_t *indexes,
+              const int *errors, const struct statx *stx, size_t count)
+{
+  size_t i;
+
+  pthread_mutex_lock (&job->lock);
+
+  if (job->stop || job->generation != generation)
+    {
+      count = 0;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      meta_apply (job->store, indexes[i], errors[i], &stx[i]);
+    }
+
+  pthread_mutex_unlock (&job->lock);
+
+  return count;
+}
+
+/*
+ * Tell the caller a batch is done.
+ */
+static void
+meta_notify (struct meta_job *job, size_t count)
+{
+  uint64_t one = 1;
+  size_t wanted;
+  size_t done;
+
+  done = __atomic_add_fetch (&job->done, count, __ATOMIC_RELEASE);
+  wanted = __atomic_load_n (&job->wanted, __ATOMIC_RELAXED);
+  stats_add (STATS_STAT, count);
+
+  /*
+   * Only the batch that completes the fetch stops the timer.
+   */
+  if (done >= wanted && done - count < wanted)
+    {
+      stats_stop (STATS_META, job->started);
+    }
+
+  if (write (job->event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The counter is full, the caller already has
+       * something to read.
+       */
+    }
+}
+
+/*
+ * Fetch the entries of JOB with one statx call each.
+ */
+static void
+meta_stat_loop (struct meta_job *job)
+{
+  char names[META_BATCH_SIZE][NAME_MAX + 1];
+  struct statx stx[META_BATCH_SIZE];
+  size_t indexes[META_BATCH_SIZE];
+  int errors[META_BATCH_SIZE];
+  size_t generation;
+  size_t count;
+  size_t i;
+
+  while ((count = meta_claim (job, indexes, names, META_BATCH_SIZE,
+                              &generation))
+         > 0)
+    {
+      for (i = 0; i < count; ++i)
+        {
+          /*
+           * A single statx can take long on a slow filesystem,
+           * don't finish the batch once stopped.
+           */
+          if (__atomic_load_n (&job->stop, __ATOMIC_RELAXED))
+            {
+              break;
+            }
+
+          errors[i] = statx (job->dir_fd, names[i], AT_SYMLINK_NOFOLLOW,
+                             META_STATX_MASK, &stx[i])
+                              == 0
+                          ? 0
+                          : errno;
+        }
+
+      meta_notify (job, meta_publish (job, generation, indexes, errors, stx,
+                                      i));
+    }
+}
+
+/*
+ * Several of these threads run when io_uring is not available.
+ */
+static void *
+meta_stat_worker (void *data)
+{
+  struct meta_job *job = data;
+
+  meta_stat_loop (job);
+  meta_job_release (job);
+
+  return NULL;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ * Fetch the entries with a single ring, each claimed batch is
+ * submitted at once and the thread waits for what the kernel took,
+ * the rest is fetched with statx.
+ */
+static void *
+meta_ring_worker (void *data)
+{
+  struct meta_job *job = data;
+  char names[META_BATCH_SIZE][NAME_MAX + 1];
+  struct statx stx[META_BATCH_SIZE];
+  size_t indexes[META_BATCH_SIZE];
+  int errors[META_BATCH_SIZE];
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  struct meta_ring ring;
+  size_t generation;
+  size_t submitted;
+  unsigned tail;
+  unsigned head;
+  size_t count;
+  size_t i;
+  int ret;
+
+  if (meta_ring_open (&ring, META_BATCH_SIZE) != 0)
+    {
+      return meta_stat_worker (data);
+    }
+
+  while ((count = meta_claim (job, indexes, names, META_BATCH_SIZE,
+                              &generation))
+         > 0)
+    {
+      tail = *ring.sq_tail;
+      for (i = 0; i < count; ++i)
+        {
+          sqe = &ring.sqes[tail & *ring.sq_mask];
+          memset (sqe, 0, sizeof (struct io_uring_sqe));
+          sqe->opcode = IORING_OP_STATX;
+          sqe->fd = job->dir_fd;
+          sqe->addr = (uintptr_t)names[i];
+          sqe->len = META_STATX_MASK;
+          sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+          sqe->off = (uintptr_t)&stx[i];
+          sqe->user_data = i;
+          ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+          ++tail;
+        }
+      __atomic_store_n (ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+      do
+        {
+          ret = syscall (__NR_io_uring_enter, ring.fd, count, count,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+      while (ret < 0 && errno == EINTR);
+
+      /*
+       * The kernel takes the submissions in order and stops at the
+       * first it can't take, the others are taken back from the ring
+       * and given to the synchronous path.
+       */
+      submitted = ret < 0 ? 0 : (size_t)ret;
+      if (submitted < count)
+        {
+          __atomic_store_n (ring.sq_tail, tail - (count - submitted),
+                            __ATOMIC_RELEASE);
+          for (i = submitted; i < count; ++i)
+            {
+              errors[i] = statx (job->dir_fd, names[i], AT_SYMLINK_NOFOLLOW,
+                                 META_STATX_MASK, &stx[i])
+                                  == 0
+                              ? 0
+                              : errno;
+            }
+        }
+
+      head = *ring.cq_head;
+      for (i = 0; i < submitted;)
+        {
+          if (head == __atomic_load_n (ring.cq_tail, __ATOMIC_ACQUIRE))
+            {
+              syscall (__NR_io_uring_enter, ring.fd, 0, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+              continue;
+            }
+
+          cqe = &ring.cqes[head & *ring.cq_mask];
+          errors[cqe->user_data] = -cqe->res;
+          ++head;
+          ++i;
+        }
+      __atomic_store_n (ring.cq_head, head, __ATOMIC_RELEASE);
+
+      meta_notify (job, meta_publish (job, generation, indexes, errors, stx,
+                                      count));
+    }
+
+  meta_ring_close (&ring);
+  meta_job_release (job);
+
+  return NULL;
+}
+#endif
+
+/*
+ * Check if the kernel lets us use io_uring for statx.
+ */
+static int
+meta_ring_supported (void)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+  struct meta_ring ring;
+
+  if (getenv ("DR_NO_IO_URING") != NULL)
+    {
+      return 0;
+    }
+
+  if (meta_ring_open (&ring, 1) != 0)
+    {
+      return 0;
+    }
+
+  meta_ring_close (&ring);
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int
+meta_start (struct meta_fetcher *fetcher, const char *const dir_name,
+            struct entry_store *store)
+{
+  int dir_fd;
+  int ret;
+
+  dir_fd = open (dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    {
+      return -1;
+    }
+
+  ret = meta_start_fd (fetcher, dir_fd, store);
+  close (dir_fd);
+
+  return ret;
+}
+
+int
+meta_start_fd (struct meta_fetcher *fetcher, int dir_fd,
+               struct entry_store *store)
+{
+  void *(*worker) (void *) = meta_stat_worker;
+  int wanted = META_FALLBACK_THREADS;
+  struct meta_job *job;
+  pthread_t thread;
+  int started = 0;
+  size_t index;
+  int ret = 0;
+  int i;
+
+  job = malloc (sizeof (struct meta_job));
+  if (job == NULL)
+    {
+      return -1;
+    }
+
+  job->store = store;
+  job->next = 0;
+  job->priority_first = 0;
+  job->priority_end = 0;
+  job->done = 0;
+  job->wanted = 0;
+  job->stop = 0;
+  job->generation = 0;
+  job->started = stats_start ();
+  job->references = 1;
+
+  for (index = 0; index < store->count; ++index)
+    {
+      job->wanted += store->state[index] == ENTRY_META_NONE;
+    }
+
+  job->dir_fd = fcntl (dir_fd, F_DUPFD_CLOEXEC, 0);
+  if (job->dir_fd < 0)
+    {
+      free (job);
+      return -1;
+    }
+
+  job->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (job->event_fd < 0)
+    {
+      close (job->dir_fd);
+      free (job);
+      return -1;
+    }
+
+  pthread_mutex_init (&job->lock, NULL);
+  pthread_cond_init (&job->wake, NULL);
+
+  job->use_ring = meta_ring_supported ();
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (job->use_ring)
+    {
+      worker = meta_ring_worker;
+      wanted = 1;
+    }
+#endif
+
+  fetcher->job = job;
+  fetcher->event_fd = job->event_fd;
+
+  for (i = 0; i < wanted; ++i)
+    {
+      __atomic_add_fetch (&job->references, 1, __ATOMIC_RELAXED);
+      ret = pthread_create (&thread, NULL, worker, job);
+      if (ret != 0)
+        {
+          __atomic_sub_fetch (&job->references, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      pthread_detach (thread);
+      ++started;
+    }
+
+  if (started == 0)
+    {
+      meta_job_release (job);
+      errno = ret;
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+meta_pause (struct meta_fetcher *fetcher)
+{
+  pthread_mutex_lock (&fetcher->job->lock);
+}
+
+void
+meta_resume (struct meta_fetcher *fetcher)
+{
+  struct meta_job *job = fetcher->job;
+  struct entry_store *store = job->store;
+  size_t missing = 0;
+  size_t index;
+
+  /*
+   * The batches in flight are dropped, their entries are claimed
+   * again where they are now.
+   */
+  job->next = store->count;
+  for (index = store->count; index-- > 0;)
+    {
+      if (store->state[index] == ENTRY_META_PENDING)
+        {
+          store->state[index] = ENTRY_META_NONE;
+        }
+      if (store->state[index] == ENTRY_META_NONE)
+        {
+          job->next = index;
+          ++missing;
+        }
+    }
+
+  if (job->priority_end > store->count)
+    {
+      job->priority_end = store->count;
+    }
+
+  ++job->generation;
+  __atomic_store_n (&job->wanted,
+                    __atomic_load_n (&job->done, __ATOMIC_RELAXED) + missing,
+                    __ATOMIC_RELAXED);
+
+  pthread_cond_broadcast (&job->wake);
+  pthread_mutex_unlock (&job->lock);
+}
+
+void
+meta_prioritize (struct meta_fetcher *fetcher, size_t first, size_t count)
+{
+  struct meta_job *job = fetcher->job;
+  size_t end = first + count;
+
+  if (end > job->store->count)
+    {
+      end = job->store->count;
+    }
+
+  pthread_mutex_lock (&job->lock);
+  job->priority_first = first;
+  job->priority_end = end;
+  pthread_mutex_unlock (&job->lock);
+}
+
+size_t
+meta_done (struct meta_fetcher *fetcher)
+{
+  return __atomic_load_n (&fetcher->job->done, __ATOMIC_ACQUIRE);
+}
+
+int
+meta_finished (struct meta_fetcher *fetcher)
+{
+  return meta_done (fetcher)
+         >= __atomic_load_n (&fetcher->job->wanted, __ATOMIC_RELAXED);
+}
+
+void
+meta_stop (struct meta_fetcher *fetcher)
+{
+  struct meta_job *job = fetcher->job;
+  struct entry_store *store = job->store;
+  size_t index;
+
+  /*
+   * Only a thread saving a batch can hold the lock, the others
+   * check STOP before touching the store again.
+   */
+  pthread_mutex_lock (&job->lock);
+  __atomic_store_n (&job->stop, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast (&job->wake);
+  pthread_mutex_unlock (&job->lock);
+
+  /*
+   * The entries claimed by a batch that was cut short are
+   * fetched by the next fetcher.
+   */
+  for (index = 0; index < store->count; ++index)
+    {
+      if (store->state[index] == ENTRY_META_PENDING)
+        {
+          store->state[index] = ENTRY_META_NONE;
+        }
+    }
+
+  meta_job_release (job);
+  fetcher->job = NULL;
+  fetcher->event_fd = -1;
+}
@@ -0,0 +1,160 @@
+/*
+ * meta - library to fetch the metadata of the entries
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_META_H_
+#define DR_LIB_META_H_
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "entry.h"
+#include "log.h"
+#include "stats.h"
+
+/*
+ * Number of entries fetched with one submission.
+ */
+#define META_BATCH_SIZE 64
+
+/*
+ * Number of threads calling statx when io_uring is not available,
+ * the work is waiting on the disk or the network so it doesn't
+ * depend on the number of processors.
+ * setting DR_NO_IO_URING in the environment forces this path.
+ */
+#define META_FALLBACK_THREADS 8
+
+/*
+ * Fields asked to statx.
+ */
+#define META_STATX_MASK                                                     \
+  (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_UID           \
+   | STATX_GID)
+
+/*
+ * What the threads of a fetch share with its caller, the metadata of
+ * the entries of STORE is fetched in the background, the entries in
+ * the priority range (the viewport) before the others.
+ * EVENT_FD is an eventfd signaled after every batch so the caller
+ * can redraw the columns as they fill.
+ * WANTED is the number of entries that had no metadata when it
+ * started, the others are left as they are, STARTED is when it
+ * started for the statistics.
+ * STORE is only touched with LOCK held and until STOP is set, a
+ * thread stuck in statx finds it set when it comes back.  GENERATION
+ * changes with the store, the results of a batch claimed before are
+ * dropped.
+ * the threads wait on WAKE for entries to fetch until the fetch is
+ * stopped.
+ * REFERENCES counts the threads and the caller, the last one to let
+ * go frees the job.
+ */
+struct meta_job
+{
+  struct entry_store *store;
+  int dir_fd;
+  int event_fd;
+  int use_ring;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  size_t generation;
+  size_t next;
+  size_t priority_first;
+  size_t priority_end;
+
+  size_t done;
+  size_t wanted;
+  int stop;
+  uint64_t started;
+  int references;
+};
+
+/*
+ * Handle of a fetch, EVENT_FD is the one of JOB.
+ */
+struct meta_fetcher
+{
+  struct meta_job *job;
+  int event_fd;
+};
+
+/*
+ * Start fetching the metadata of every entry of STORE, the names
+ * are relative to the directory DIR_NAME.
+ * STORE must only change between 'meta_pause' and 'meta_resume'
+ * until 'meta_stop' is called.
+ * return 0 on success and -1 with errno set.
+ */
+int meta_start (struct meta_fetcher *fetcher, const char *const dir_name,
+                struct entry_store *store);
+
+/*
+ * Same as 'meta_start' for the directory open at DIR_FD, the entries
+ * are fetched relative to it and DIR_FD can be closed once it returns.
+ */
+int meta_start_fd (struct meta_fetcher *fetcher, int dir_fd,
+                   struct entry_store *store);
+
+/*
+ * Keep the threads of FETCHER away from the store while the caller
+ * changes it, until 'meta_resume' is called.
+ */
+void meta_pause (struct meta_fetcher *fetcher);
+
+/*
+ * Let the threads of FETCHER go on with the store as it is now,
+ * the entries that have no metadata, new or changed, are fetched.
+ */
+void meta_resume (struct meta_fetcher *fetcher);
+
+/*
+ * Fetch the COUNT entries from FIRST before the others.
+ */
+void meta_prioritize (struct meta_fetcher *fetcher, size_t first,
+                      size_t count);
+
+/*
+ * Get the number of entries whose metadata is known.
+ */
+size_t meta_done (struct meta_fetcher *fetcher);
+
+/*
+ * return 1 once the metadata of every entry is known.
+ */
+int meta_finished (struct meta_fetcher *fetcher);
+
+/*
+ * Cancel the fetch and let go of FETCHER, the threads are not waited
+ * for but don't touch the store once it returns, the entries they
+ * had claimed are left without metadata.
+ */
+void meta_stop (struct meta_fetcher *fetcher);
+
+#endif // DR_LIB_META_H_
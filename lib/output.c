@@ -0,0 +1,153 @@
+#include "output.h"
+
+int
+output_init (struct output *output, int fd)
+{
+  output->fd = fd;
+  output->count = 0;
+  output->used = 0;
+  output->error = 0;
+
+  output->buffer = malloc (OUTPUT_BUFFER_SIZE);
+  if (output->buffer == NULL)
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Write the pieces, a pipe or a terminal can take only a part of
+ * them at a time.
+ */
+static int
+output_write (struct output *output)
+{
+  struct iovec *pieces = output->pieces;
+  int count = output->count;
+  ssize_t written;
+
+  while (count > 0)
+    {
+      written = writev (output->fd, pieces, count);
+      stats_add (STATS_WRITES, 1);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          return -1;
+        }
+
+      while (count > 0 && (size_t)written >= pieces->iov_len)
+        {
+          written -= pieces->iov_len;
+          ++pieces;
+          --count;
+        }
+
+      if (count > 0)
+        {
+          pieces->iov_base = (char *)pieces->iov_base + written;
+          pieces->iov_len -= written;
+        }
+    }
+
+  return 0;
+}
+
+int
+output_flush (struct output *output)
+{
+  if (output->error == 0 && output_write (output) != 0)
+    {
+      output->error = errno;
+    }
+
+  output->count = 0;
+  output->used = 0;
+
+  if (output->error != 0)
+    {
+      errno = output->error;
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+output_reference (struct output *output, const void *data, size_t length)
+{
+  if (output->count == OUTPUT_MAX_PIECES)
+    {
+      output_flush (output);
+    }
+
+  output->pieces[output->count].iov_base = (void *)data;
+  output->pieces[output->count].iov_len = length;
+  ++output->count;
+}
+
+char *
+output_reserve (struct output *output, size_t size)
+{
+  /*
+   * What is in the buffer must not be written over before it is, the
+   * buffer is only reused once everything was flushed.
+   */
+  if (size > OUTPUT_BUFFER_SIZE - output->used
+      || output->count == OUTPUT_MAX_PIECES)
+    {
+      output_flush (output);
+    }
+
+  return output->buffer + output->used;
+}
+
+void
+output_commit (struct output *output, size_t length)
+{
+  char *start = output->buffer + output->used;
+  struct iovec *last;
+
+  output->used += length;
+
+  last = output->count > 0 ? &output->pieces[output->count - 1] : NULL;
+  if (last != NULL && (char *)last->iov_base + last->iov_len == start)
+    {
+      last->iov_len += length;
+      return;
+    }
+
+  output_reference (output, start, length);
+}
+
+void
+output_copy (struct output *output, const void *data, size_t length)
+{
+  /*
+   * Too large for the buffer, it is written right away.
+   */
+  if (length > OUTPUT_BUFFER_SIZE)
+    {
+      output_flush (output);
+      output_reference (output, data, length);
+      output_flush (output);
+      return;
+    }
+
+  memcpy (output_reserve (output, length), data, length);
+  output_commit (output, length);
+}
+
+void
+output_free (struct output *output)
+{
+  free (output->buffer);
+  output->buffer = NULL;
+  output->count = 0;
+  output->used = 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * output - library to write large outputs with few system calls
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_OUTPUT_H_
+#define DR_LIB_OUTPUT_H_
+
+#include <config.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * Most pieces given to one writev.
+ */
+#ifdef IOV_MAX
+#define OUTPUT_MAX_PIECES IOV_MAX
+#else
+#define OUTPUT_MAX_PIECES 1024
+#endif
+
+/*
+ * Size of the buffer of the pieces that are copied, it is written
+ * once full.
+ */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/*
+ * Output gathered in PIECES and written to FD with one writev once
+ * there are too many of them or BUFFER is full.
+ * the pieces added with 'output_reference' point to the memory of
+ * the caller, the others are written in BUFFER and the ones that
+ * follow each other are merged.
+ * small pieces are better copied, the kernel handles every piece on
+ * its own and a writev of many names is slower than a copy of them.
+ * ERROR is the errno value of the first write that failed, nothing
+ * is written after it.
+ */
+struct output
+{
+  int fd;
+  struct iovec pieces[OUTPUT_MAX_PIECES];
+  int count;
+  char *buffer;
+  size_t used;
+  int error;
+};
+
+/*
+ * Prepare OUTPUT to write to FD.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int output_init (struct output *output, int fd);
+
+/*
+ * Add the LENGTH bytes at DATA without copying them, they must not
+ * change until the next 'output_flush'.
+ */
+void output_reference (struct output *output, const void *data,
+                       size_t length);
+
+/*
+ * Get room for SIZE bytes in the buffer, up to OUTPUT_BUFFER_SIZE,
+ * to write them in place before 'output_commit'.
+ */
+char *output_reserve (struct output *output, size_t size);
+
+/*
+ * Add the LENGTH bytes written where 'output_reserve' pointed.
+ */
+void output_commit (struct output *output, size_t length);
+
+/*
+ * Add a copy of the LENGTH bytes at DATA.
+ */
+void output_copy (struct output *output, const void *data, size_t length);
+
+/*
+ * Write everything that was added.
+ * return 0 on success and -1 with errno set, after a failed write
+ * it always fails with the same error.
+ */
+int output_flush (struct output *output);
+
+/*
+ * Release the buffer of OUTPUT, what wasn't flushed is lost.
+ */
+void output_free (struct output *output);
+
+#endif // DR_LIB_OUTPUT_H_
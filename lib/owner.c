@@ -0,0 +1,373 @@
+#include "owner.h"
+
+static size_t
+owner_hash (enum owner_kind kind, uint32_t id, size_t capacity)
+{
+  return ((uint64_t)id * 0x9e3779b97f4a7c15ull ^ kind) & (capacity - 1);
+}
+
+/*
+ * Find the slot of ID of KIND in CACHE, or the empty slot where it
+ * goes, with the lock held.
+ */
+static struct owner_slot *
+owner_slot (struct owner_cache *cache, enum owner_kind kind, uint32_t id)
+{
+  size_t i = owner_hash (kind, id, cache->capacity);
+
+  while (cache->slots[i].state != OWNER_EMPTY
+         && (cache->slots[i].id != id || cache->slots[i].kind != kind))
+    {
+      i = (i + 1) & (cache->capacity - 1);
+    }
+
+  return &cache->slots[i];
+}
+
+/*
+ * Make room for one more slot in CACHE, with the lock held.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+owner_grow (struct owner_cache *cache)
+{
+  struct owner_slot *old = cache->slots;
+  size_t old_capacity = cache->capacity;
+  size_t capacity;
+  size_t i;
+
+  if (2 * (cache->count + 1) <= cache->capacity)
+    {
+      return 0;
+    }
+
+  capacity = old_capacity ? old_capacity * 2 : OWNER_INITIAL_CAPACITY;
+  cache->slots = calloc (capacity, sizeof (struct owner_slot));
+  if (cache->slots == NULL)
+    {
+      cache->slots = old;
+      return -1;
+    }
+
+  cache->capacity = capacity;
+  for (i = 0; i < old_capacity; ++i)
+    {
+      if (old[i].state != OWNER_EMPTY)
+        {
+          *owner_slot (cache, old[i].kind, old[i].id) = old[i];
+        }
+    }
+  free (old);
+
+  return 0;
+}
+
+/*
+ * Add ID of KIND to the queue of CACHE, with the lock held.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+owner_enqueue (struct owner_cache *cache, enum owner_kind kind, uint32_t id)
+{
+  struct owner_key *queue;
+  size_t capacity;
+
+  if (cache->queued == cache->queue_capacity)
+    {
+      capacity = cache->queue_capacity ? cache->queue_capacity * 2
+                                       : OWNER_BATCH;
+      queue = realloc (cache->queue, capacity * sizeof (*queue));
+      if (queue == NULL)
+        {
+          return -1;
+        }
+      cache->queue = queue;
+      cache->queue_capacity = capacity;
+    }
+
+  cache->queue[cache->queued].id = id;
+  cache->queue[cache->queued].kind = kind;
+  ++cache->queued;
+
+  return 0;
+}
+
+/*
+ * Ask the name service for the name of KEY and write it in NAME.
+ * return 1 if it has one, 0 if it has none and -1 with errno set if
+ * the name service failed.
+ */
+static int
+owner_lookup (const struct owner_key *key, char *name)
+{
+  char small[OWNER_BUFFER_SIZE];
+  char *buffer = small;
+  size_t size = sizeof (small);
+  struct passwd pw;
+  struct passwd *pw_result = NULL;
+  struct group gr;
+  struct group *gr_result = NULL;
+  char *larger;
+  int found = 0;
+  int ret;
+
+  while (1)
+    {
+      if (key->kind == OWNER_USER)
+        {
+          ret = getpwuid_r (key->id, &pw, buffer, size, &pw_result);
+        }
+      else
+        {
+          ret = getgrgid_r (key->id, &gr, buffer, size, &gr_result);
+        }
+
+      if (ret != ERANGE)
+        {
+          break;
+        }
+
+      larger = realloc (buffer == small ? NULL : buffer, size * 2);
+      if (larger == NULL)
+        {
+          ret = ENOMEM;
+          break;
+        }
+      buffer = larger;
+      size *= 2;
+    }
+
+  if (ret == 0 && key->kind == OWNER_USER && pw_result != NULL)
+    {
+      snprintf (name, OWNER_NAME_MAX, "%s", pw.pw_name);
+      found = 1;
+    }
+  else if (ret == 0 && key->kind == OWNER_GROUP && gr_result != NULL)
+    {
+      snprintf (name, OWNER_NAME_MAX, "%s", gr.gr_name);
+      found = 1;
+    }
+
+  if (buffer != small)
+    {
+      free (buffer);
+    }
+
+  /*
+   * These are how some systems say the id has no name.
+   */
+  if (ret == ENOENT || ret == ESRCH || ret == EBADF || ret == EPERM)
+    {
+      ret = 0;
+    }
+
+  if (ret != 0)
+    {
+      errno = ret;
+      return -1;
+    }
+
+  return found;
+}
+
+static void
+owner_notify (struct owner_cache *cache)
+{
+  uint64_t one = 1;
+
+  if (write (cache->event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The counter is full, the caller already has
+       * something to read.
+       */
+    }
+}
+
+/*
+ * Look up the queued ids a batch at a time, the lock is not held
+ * while the name service answers so the caller keeps drawing.
+ */
+static void *
+owner_worker (void *data)
+{
+  struct owner_cache *cache = data;
+  struct owner_key batch[OWNER_BATCH];
+  char names[OWNER_BATCH][OWNER_NAME_MAX];
+  signed char found[OWNER_BATCH];
+  struct owner_slot *slot;
+  size_t resolved;
+  size_t count;
+  size_t i;
+
+  pthread_mutex_lock (&cache->lock);
+
+  for (;;)
+    {
+      while (cache->queued == 0 && !cache->stop)
+        {
+          pthread_cond_wait (&cache->wake, &cache->lock);
+        }
+
+      if (cache->stop)
+        {
+          break;
+        }
+
+      count = cache->queued < OWNER_BATCH ? cache->queued : OWNER_BATCH;
+      cache->queued -= count;
+      memcpy (batch, cache->queue + cache->queued, count * sizeof (*batch));
+
+      pthread_mutex_unlock (&cache->lock);
+
+      for (i = 0; i < count; ++i)
+        {
+          found[i] = owner_lookup (&batch[i], names[i]);
+        }
+      stats_add (STATS_OWNER_LOOKUPS, count);
+
+      pthread_mutex_lock (&cache->lock);
+
+      resolved = 0;
+      for (i = 0; i < count; ++i)
+        {
+          slot = owner_slot (cache, batch[i].kind, batch[i].id);
+          if (found[i] > 0)
+            {
+              memcpy (slot->name, names[i], OWNER_NAME_MAX);
+              slot->state = OWNER_RESOLVED;
+              ++resolved;
+            }
+          else
+            {
+              slot->state = found[i] == 0 ? OWNER_MISSING : OWNER_FAILED;
+            }
+        }
+
+      /*
+       * The numbers stay on screen for the others, a frame would
+       * only ask again for the ids that failed.
+       */
+      if (resolved > 0)
+        {
+          owner_notify (cache);
+        }
+    }
+
+  pthread_mutex_unlock (&cache->lock);
+
+  return NULL;
+}
+
+int
+owner_cache_init (struct owner_cache *cache)
+{
+  int ret;
+
+  cache->slots = NULL;
+  cache->count = 0;
+  cache->capacity = 0;
+  cache->queue = NULL;
+  cache->queued = 0;
+  cache->queue_capacity = 0;
+  cache->stop = 0;
+
+  cache->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cache->event_fd < 0)
+    {
+      return -1;
+    }
+
+  pthread_mutex_init (&cache->lock, NULL);
+  pthread_cond_init (&cache->wake, NULL);
+
+  ret = pthread_create (&cache->thread, NULL, owner_worker, cache);
+  if (ret != 0)
+    {
+      pthread_cond_destroy (&cache->wake);
+      pthread_mutex_destroy (&cache->lock);
+      close (cache->event_fd);
+      errno = ret;
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+owner_name (struct owner_cache *cache, enum owner_kind kind, uint32_t id,
+            char *buffer, size_t size)
+{
+  struct owner_slot *slot;
+  int found = 0;
+
+  pthread_mutex_lock (&cache->lock);
+
+  /*
+   * Without memory the number is shown, the id is asked
+   * for again on the next frame.
+   */
+  if (owner_grow (cache) == 0)
+    {
+      slot = owner_slot (cache, kind, id);
+      if ((slot->state == OWNER_EMPTY || slot->state == OWNER_FAILED)
+          && owner_enqueue (cache, kind, id) == 0)
+        {
+          if (slot->state == OWNER_EMPTY)
+            {
+              ++cache->count;
+            }
+          slot->id = id;
+          slot->kind = kind;
+          slot->state = OWNER_QUEUED;
+        }
+      else if (slot->state == OWNER_RESOLVED)
+        {
+          snprintf (buffer, size, "%s", slot->name);
+          found = 1;
+        }
+    }
+
+  pthread_mutex_unlock (&cache->lock);
+
+  if (!found)
+    {
+      snprintf (buffer, size, "%" PRIu32, id);
+    }
+
+  return found;
+}
+
+void
+owner_flush (struct owner_cache *cache)
+{
+  pthread_mutex_lock (&cache->lock);
+  if (cache->queued > 0)
+    {
+      pthread_cond_signal (&cache->wake);
+    }
+  pthread_mutex_unlock (&cache->lock);
+}
+
+void
+owner_cache_free (struct owner_cache *cache)
+{
+  pthread_mutex_lock (&cache->lock);
+  cache->stop = 1;
+  pthread_cond_signal (&cache->wake);
+  pthread_mutex_unlock (&cache->lock);
+
+  pthread_join (cache->thread, NULL);
+
+  pthread_cond_destroy (&cache->wake);
+  pthread_mutex_destroy (&cache->lock);
+  close (cache->event_fd);
+  free (cache->slots);
+  free (cache->queue);
+  cache->slots = NULL;
+  cache->queue = NULL;
+  cache->count = 0;
+  cache->capacity = 0;
+  cache->queued = 0;
+  cache->queue_capacity = 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * owner - library to resolve the owners of the entries to names
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_OWNER_H_
+#define DR_LIB_OWNER_H_
+
+#include <errno.h>
+#include <grp.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * Longest name kept, the longer ones are cut.
+ */
+#define OWNER_NAME_MAX 32
+
+/*
+ * Number of slots allocated the first time the cache grows.
+ */
+#define OWNER_INITIAL_CAPACITY 64
+
+/*
+ * Number of ids the thread takes from the queue at once.
+ */
+#define OWNER_BATCH 64
+
+/*
+ * Size of the first buffer of 'getpwuid_r' and 'getgrgid_r', it is
+ * doubled until a group with many members fits.
+ */
+#define OWNER_BUFFER_SIZE 16384
+
+enum owner_kind
+{
+  OWNER_USER,
+  OWNER_GROUP,
+};
+
+/*
+ * Progress of an id, OWNER_MISSING is kept like a name so an id
+ * without one is only looked up once.  OWNER_FAILED is an id the
+ * name service couldn't answer for, it is asked again the next time
+ * it is shown.
+ */
+enum owner_state
+{
+  OWNER_EMPTY,
+  OWNER_QUEUED,
+  OWNER_RESOLVED,
+  OWNER_MISSING,
+  OWNER_FAILED,
+};
+
+struct owner_slot
+{
+  uint32_t id;
+  unsigned char kind;
+  unsigned char state;
+  char name[OWNER_NAME_MAX];
+};
+
+struct owner_key
+{
+  uint32_t id;
+  unsigned char kind;
+};
+
+/*
+ * Names of the users and groups seen so far, an id gets a slot the
+ * first time it is asked for and the QUEUED ids of QUEUE are looked
+ * up by a thread in batches, the name service can take milliseconds
+ * for each of them.
+ * EVENT_FD is signaled after a batch that found names so the caller
+ * can show them.
+ */
+struct owner_cache
+{
+  int event_fd;
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  struct owner_slot *slots;
+  size_t count;
+  size_t capacity;
+  struct owner_key *queue;
+  size_t queued;
+  size_t queue_capacity;
+  int stop;
+};
+
+/*
+ * Start the thread of CACHE.
+ * return 0 on success and -1 with errno set.
+ */
+int owner_cache_init (struct owner_cache *cache);
+
+/*
+ * Write the name of the user or group ID of KIND in BUFFER of SIZE
+ * bytes, or its number until the name is known or when it has
+ * none, the ids seen for the first time are queued.
+ * return 1 when the name was written and 0 otherwise.
+ */
+int owner_name (struct owner_cache *cache, enum owner_kind kind,
+                uint32_t id, char *buffer, size_t size);
+
+/*
+ * Wake the thread for the ids queued since the last call, they
+ * are looked up together.
+ */
+void owner_flush (struct owner_cache *cache);
+
+/*
+ * Stop the thread and release the resources of CACHE.
+ */
+void owner_cache_free (struct owner_cache *cache);
+
+#endif // DR_LIB_OWNER_H_
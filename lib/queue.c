@@ -0,0 +1,74 @@
+#include "queue.h"
+
+int
+queue_init (struct queue *queue, size_t capacity)
+{
+  size_t size = 2;
+
+  while (size < capacity)
+    {
+      size *= 2;
+    }
+
+  queue->slots = calloc (size, sizeof (void *));
+  if (queue->slots == NULL)
+    {
+      return -1;
+    }
+
+  queue->capacity = size;
+  queue->head = 0;
+  queue->tail = 0;
+
+  return 0;
+}
+
+int
+queue_push (struct queue *queue, void *item)
+{
+  size_t tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+  size_t head = __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE);
+
+  if (tail - head == queue->capacity)
+    {
+      return -1;
+    }
+
+  queue->slots[tail & (queue->capacity - 1)] = item;
+  __atomic_store_n (&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+void *
+queue_pop (struct queue *queue)
+{
+  size_t head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+  void *item;
+
+  if (head == tail)
+    {
+      return NULL;
+    }
+
+  item = queue->slots[head & (queue->capacity - 1)];
+  __atomic_store_n (&queue->head, head + 1, __ATOMIC_RELEASE);
+
+  return item;
+}
+
+int
+queue_empty (struct queue *queue)
+{
+  return __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE)
+         == __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+void
+queue_free (struct queue *queue)
+{
+  free (queue->slots);
+  queue->slots = NULL;
+  queue->capacity = 0;
+}
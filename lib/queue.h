@@ -0,0 +1,73 @@
+/*
+ * queue - library to pass pointers between two threads
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_QUEUE_H_
+#define DR_LIB_QUEUE_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ * Size of a cache line, the two ends of the queue are kept
+ * on their own line so the threads don't fight over it.
+ */
+#define QUEUE_CACHE_LINE 64
+
+/*
+ * Bounded lock free queue with a single producer and a single
+ * consumer, CAPACITY is a power of two.
+ * HEAD is only written by the consumer and TAIL by the producer.
+ */
+struct queue
+{
+  void **slots;
+  size_t capacity;
+  _Alignas (QUEUE_CACHE_LINE) size_t head;
+  _Alignas (QUEUE_CACHE_LINE) size_t tail;
+};
+
+/*
+ * Allocate QUEUE for at least CAPACITY items.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int queue_init (struct queue *queue, size_t capacity);
+
+/*
+ * Add ITEM at the end of QUEUE, only called by the producer.
+ * return 0 on success and -1 if the queue is full.
+ */
+int queue_push (struct queue *queue, void *item);
+
+/*
+ * Take the first item of QUEUE, only called by the consumer.
+ * return NULL if the queue is empty.
+ */
+void *queue_pop (struct queue *queue);
+
+/*
+ * return 1 if QUEUE has no item.
+ */
+int queue_empty (struct queue *queue);
+
+/*
+ * Release the slots of QUEUE, the items are not freed.
+ */
+void queue_free (struct queue *queue);
+
+#endif // DR_LIB_QUEUE_H_
@@ -0,0 +1,400 @@
+#include "scan.h"
+
+/*
+ * Time the thread waits when the caller doesn't drain the queue.
+ */
+#define SCAN_FULL_WAIT_NS (1000 * 1000)
+
+static void
+scan_notify (struct scan_job *job)
+{
+  uint64_t one = 1;
+
+  if (write (job->event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The counter is full, the caller already has
+       * something to read.
+       */
+    }
+}
+
+/*
+ * Copy BATCH in a chunk that outlives the buffer of the reader.
+ */
+static struct scan_chunk *
+scan_chunk_new (const struct dir_batch *batch)
+{
+  struct scan_chunk *chunk;
+  size_t names_length = 0;
+  size_t i;
+  char *name;
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      names_length += batch->records[i].name_length + 1;
+    }
+
+  chunk = malloc (sizeof (struct scan_chunk) + names_length);
+  if (chunk == NULL)
+    {
+      return NULL;
+    }
+
+  chunk->count = batch->count;
+  name = chunk->names;
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      chunk->types[i] = batch->records[i].type;
+      chunk->lengths[i] = batch->records[i].name_length;
+      memcpy (name, batch->records[i].name, chunk->lengths[i] + 1);
+      name += chunk->lengths[i] + 1;
+    }
+
+  return chunk;
+}
+
+/*
+ * Push CHUNK, wait while the queue is full unless the scan
+ * gets cancelled.
+ * return 0 on success and -1 if the scan was cancelled.
+ */
+static int
+scan_push (struct scan_job *job, struct scan_chunk *chunk)
+{
+  struct timespec wait = { 0, SCAN_FULL_WAIT_NS };
+
+  while (queue_push (&job->queue, chunk) != 0)
+    {
+      if (__atomic_load_n (&job->cancel, __ATOMIC_RELAXED))
+        {
+          return -1;
+        }
+      nanosleep (&wait, NULL);
+    }
+
+  return 0;
+}
+
+/*
+ * Let go of JOB, the last of the thread and the caller frees it with
+ * the chunks left in its queue.
+ */
+static void
+scan_job_release (struct scan_job *job)
+{
+  void *chunk;
+
+  if (__atomic_sub_fetch (&job->references, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  while ((chunk = queue_pop (&job->queue)) != NULL)
+    {
+      free (chunk);
+    }
+
+  queue_free (&job->queue);
+  entry_store_free (&job->loaded);
+  close (job->event_fd);
+  if (job->dir_fd >= 0)
+    {
+      close (job->dir_fd);
+    }
+  free (job->dir_name);
+  free (job);
+}
+
+static void *
+scan_worker (void *data)
+{
+  struct scan_job *job = data;
+  struct scan_chunk *chunk;
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  size_t count;
+  uint64_t start = stats_start ();
+  int state = SCAN_DONE;
+  int ret;
+
+  if (job->loader != NULL)
+    {
+      if (job->loader (job->dir_name, &job->st, &job->loaded) == 0)
+        {
+          job->sorted = 1;
+          __atomic_store_n (&job->read, job->loaded.count, __ATOMIC_RELAXED);
+          __atomic_store_n (&job->state, SCAN_DONE, __ATOMIC_RELEASE);
+          scan_notify (job);
+          scan_job_release (job);
+          return NULL;
+        }
+      entry_store_free (&job->loaded);
+    }
+
+  /*
+   * The copy of an open directory shares its position, it is read
+   * from a new descriptor.
+   */
+  reader.buffer = NULL;
+  batch = malloc (sizeof (struct dir_batch));
+  if (batch == NULL
+      || (job->dir_fd >= 0
+              ? dir_reader_open_at (&reader, job->dir_fd, ".", 0)
+              : dir_reader_open (&reader, job->dir_name))
+             != 0)
+    {
+      job->error = errno;
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't open %s: %m", job->dir_name);
+      free (batch);
+      __atomic_store_n (&job->state, SCAN_FAILED, __ATOMIC_RELEASE);
+      scan_notify (job);
+      scan_job_release (job);
+      return NULL;
+    }
+
+  while ((ret = dir_reader_next_batch (&reader, batch)) > 0)
+    {
+      chunk = scan_chunk_new (batch);
+      if (chunk == NULL)
+        {
+          ret = -1;
+          break;
+        }
+
+      /*
+       * The chunk belongs to the caller once it is pushed.
+       */
+      count = chunk->count;
+      if (scan_push (job, chunk) != 0)
+        {
+          free (chunk);
+          state = SCAN_CANCELLED;
+          break;
+        }
+
+      __atomic_add_fetch (&job->read, count, __ATOMIC_RELAXED);
+      scan_notify (job);
+
+      /*
+       * What was read before the cancel is still handed over.
+       */
+      if (__atomic_load_n (&job->cancel, __ATOMIC_RELAXED))
+        {
+          state = SCAN_CANCELLED;
+          break;
+        }
+    }
+
+  if (ret < 0)
+    {
+      job->error = errno;
+      state = SCAN_FAILED;
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't read %s: %m", job->dir_name);
+    }
+
+  LOG_MESSAGE (LOG_LEVEL_DEBUG, "read %zu entries of %s",
+               __atomic_load_n (&job->read, __ATOMIC_RELAXED),
+               job->dir_name);
+
+  dir_reader_close (&reader);
+  free (batch);
+  stats_stop (STATS_READ, start);
+
+  __atomic_store_n (&job->state, state, __ATOMIC_RELEASE);
+  scan_notify (job);
+  scan_job_release (job);
+
+  return NULL;
+}
+
+int
+scan_start (struct scanner *scanner, const char *const dir_name)
+{
+  return scan_start_fd (scanner, -1, dir_name);
+}
+
+int
+scan_start_fd (struct scanner *scanner, int dir_fd,
+               const char *const dir_name)
+{
+  return scan_start_loaded (scanner, dir_fd, dir_name, NULL, NULL);
+}
+
+int
+scan_start_loaded (struct scanner *scanner, int dir_fd,
+                   const char *const dir_name, scan_loader loader,
+                   const struct stat *st)
+{
+  struct scan_job *job;
+  pthread_t thread;
+  int ret;
+
+  job = malloc (sizeof (struct scan_job));
+  if (job == NULL)
+    {
+      return -1;
+    }
+
+  job->cancel = 0;
+  job->state = SCAN_RUNNING;
+  job->error = 0;
+  job->read = 0;
+  job->loader = loader;
+  if (st != NULL)
+    {
+      job->st = *st;
+    }
+  entry_store_init (&job->loaded);
+  job->sorted = 0;
+  job->references = 2;
+
+  job->dir_name = strdup (dir_name);
+  if (job->dir_name == NULL)
+    {
+      free (job);
+      return -1;
+    }
+
+  job->dir_fd = dir_fd >= 0 ? fcntl (dir_fd, F_DUPFD_CLOEXEC, 0) : -1;
+  if (dir_fd >= 0 && job->dir_fd < 0)
+    {
+      free (job->dir_name);
+      free (job);
+      return -1;
+    }
+
+  if (queue_init (&job->queue, SCAN_QUEUE_CAPACITY) != 0)
+    {
+      job->event_fd = -1;
+      goto fail;
+    }
+
+  job->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (job->event_fd < 0)
+    {
+      queue_free (&job->queue);
+      goto fail;
+    }
+
+  ret = pthread_create (&thread, NULL, scan_worker, job);
+  if (ret != 0)
+    {
+      close (job->event_fd);
+      queue_free (&job->queue);
+      errno = ret;
+      goto fail;
+    }
+  pthread_detach (thread);
+
+  scanner->job = job;
+  scanner->event_fd = job->event_fd;
+
+  return 0;
+
+fail:
+  ret = errno;
+  if (job->dir_fd >= 0)
+    {
+      close (job->dir_fd);
+    }
+  free (job->dir_name);
+  free (job);
+  errno = ret;
+  return -1;
+}
+
+long
+scan_drain (struct scanner *scanner, struct entry_store *store)
+{
+  struct scan_chunk *chunk;
+  uint64_t events;
+  const char *name;
+  long added = 0;
+  size_t i;
+
+  if (read (scanner->job->event_fd, &events, sizeof (events)) < 0)
+    {
+      /*
+       * Nothing was signaled, there can still be chunks
+       * pushed before the last read.
+       */
+    }
+
+  while ((chunk = queue_pop (&scanner->job->queue)) != NULL)
+    {
+      if (entry_store_reserve (store, store->count + chunk->count) != 0)
+        {
+          free (chunk);
+          return -1;
+        }
+
+      name = chunk->names;
+      for (i = 0; i < chunk->count; ++i)
+        {
+          if (entry_store_append (store, name, chunk->lengths[i],
+                                  chunk->types[i])
+              != 0)
+            {
+              free (chunk);
+              return -1;
+            }
+          name += chunk->lengths[i] + 1;
+        }
+
+      added += chunk->count;
+      free (chunk);
+    }
+
+  return added;
+}
+
+int
+scan_take_loaded (struct scanner *scanner, struct entry_store *store)
+{
+  if (scan_state (scanner) != SCAN_DONE || !scanner->job->sorted)
+    {
+      return 0;
+    }
+
+  entry_store_free (store);
+  *store = scanner->job->loaded;
+  entry_store_init (&scanner->job->loaded);
+
+  return 1;
+}
+
+enum scan_state
+scan_state (struct scanner *scanner)
+{
+  return __atomic_load_n (&scanner->job->state, __ATOMIC_ACQUIRE);
+}
+
+int
+scan_error (struct scanner *scanner)
+{
+  return scan_state (scanner) == SCAN_FAILED ? scanner->job->error : 0;
+}
+
+int
+scan_finished (struct scanner *scanner)
+{
+  return scan_state (scanner) != SCAN_RUNNING
+         && queue_empty (&scanner->job->queue);
+}
+
+void
+scan_cancel (struct scanner *scanner)
+{
+  __atomic_store_n (&scanner->job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+void
+scan_stop (struct scanner *scanner)
+{
+  scan_cancel (scanner);
+  scan_job_release (scanner->job);
+  scanner->job = NULL;
+  scanner->event_fd = -1;
+}
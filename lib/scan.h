@@ -0,0 +1,185 @@
+/*
+ * scan - library to read a directory on a background thread
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_SCAN_H_
+#define DR_LIB_SCAN_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "log.h"
+#include "queue.h"
+#include "stats.h"
+
+/*
+ * Number of chunks waiting for the caller before
+ * the scanning thread waits.
+ */
+#define SCAN_QUEUE_CAPACITY 256
+
+/*
+ * State of a scanner.
+ */
+enum scan_state
+{
+  SCAN_RUNNING,
+  SCAN_DONE,
+  SCAN_FAILED,
+  SCAN_CANCELLED,
+};
+
+/*
+ * Copy of a batch of the reader that the scanning thread hands to
+ * the caller, the names are packed one after the other with their
+ * '\0' in NAMES.
+ */
+struct scan_chunk
+{
+  size_t count;
+  unsigned char types[DIR_BATCH_SIZE];
+  unsigned short lengths[DIR_BATCH_SIZE];
+  char names[];
+};
+
+/*
+ * Fill the empty STORE with the sorted listing of the directory at
+ * PATH as it was in ST without reading the directory, from a copy
+ * kept somewhere else.
+ * it runs on the scanning thread and can wait.
+ * return 0 on success and -1 when there is no such copy.
+ */
+typedef int (*scan_loader) (const char *path, const struct stat *st,
+                            struct entry_store *store);
+
+/*
+ * What the scanning thread shares with its caller, DIR_NAME is read
+ * on its own thread, the batches go through QUEUE and EVENT_FD is
+ * signaled when there is something new to take, including the end
+ * of the scan.
+ * DIR_FD is a copy of the descriptor of the directory when it is
+ * already open, -1 otherwise.
+ * READ is the number of entries read so far.
+ * LOADER is asked for the listing of the directory ST first, when it
+ * has it SORTED is set, LOADED holds it and nothing goes through
+ * QUEUE.
+ * REFERENCES counts the thread and the caller, the last one to let
+ * go frees the job so a stopped scan never waits for the thread.
+ */
+struct scan_job
+{
+  char *dir_name;
+  int dir_fd;
+  struct queue queue;
+  int event_fd;
+  int cancel;
+  int state;
+  int error;
+  size_t read;
+  scan_loader loader;
+  struct stat st;
+  struct entry_store loaded;
+  int sorted;
+  int references;
+};
+
+/*
+ * Handle of a scan, EVENT_FD is the one of JOB.
+ */
+struct scanner
+{
+  struct scan_job *job;
+  int event_fd;
+};
+
+/*
+ * Start reading DIR_NAME in the background.
+ * return 0 on success and -1 with errno set.
+ */
+int scan_start (struct scanner *scanner, const char *const dir_name);
+
+/*
+ * Same as 'scan_start' for the directory open at DIR_FD, DIR_NAME is
+ * then only used in the log and DIR_FD can be closed once it returns.
+ * a DIR_FD of -1 opens DIR_NAME like 'scan_start'.
+ */
+int scan_start_fd (struct scanner *scanner, int dir_fd,
+                   const char *const dir_name);
+
+/*
+ * Same as 'scan_start_fd' but LOADER is asked for the listing of the
+ * directory ST on the thread, the directory is only read if it
+ * doesn't have it.
+ */
+int scan_start_loaded (struct scanner *scanner, int dir_fd,
+                       const char *const dir_name, scan_loader loader,
+                       const struct stat *st);
+
+/*
+ * Move the listing the loader of a finished SCANNER had to the empty
+ * STORE, it is already sorted.
+ * return 1 if it was moved and 0 if the directory was read instead.
+ */
+int scan_take_loaded (struct scanner *scanner, struct entry_store *store);
+
+/*
+ * Append every chunk waiting in SCANNER to STORE.
+ * return the number of entries added or -1 if the allocation failed.
+ */
+long scan_drain (struct scanner *scanner, struct entry_store *store);
+
+/*
+ * Get the state of SCANNER, one of 'enum scan_state'.
+ */
+enum scan_state scan_state (struct scanner *scanner);
+
+/*
+ * Get the errno of a scan that failed.
+ */
+int scan_error (struct scanner *scanner);
+
+/*
+ * return 1 once the thread stopped and every chunk was drained.
+ */
+int scan_finished (struct scanner *scanner);
+
+/*
+ * Ask the thread to stop, the entries read so far stay
+ * in the queue.
+ */
+void scan_cancel (struct scanner *scanner);
+
+/*
+ * Cancel SCANNER and let go of it, the chunks that were not drained
+ * are dropped.  The thread is not waited for, it can be stuck in a
+ * slow filesystem, it releases the job when it returns.
+ */
+void scan_stop (struct scanner *scanner);
+
+#endif // DR_LIB_SCAN_H_
@@ -0,0 +1,618 @@
+#include "snap.h"
+
+/*
+ * Hash of the LENGTH bytes at DATA, LENGTH is a multiple of 8 and
+ * the bytes are mixed a word at a time so checking a snapshot stays
+ * far cheaper than reading the directory.
+ */
+static uint64_t
+snap_checksum (const unsigned char *data, size_t length)
+{
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+  uint64_t word;
+  size_t i;
+
+  for (i = 0; i < length; i += sizeof (word))
+    {
+      memcpy (&word, data + i, sizeof (word));
+      hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 32;
+    }
+
+  return hash;
+}
+
+/*
+ * Round LENGTH up to a multiple of 8.
+ */
+static size_t
+snap_align (size_t length)
+{
+  return (length + 7) & ~(size_t)7;
+}
+
+/*
+ * Offsets of the columns in a snapshot file.
+ */
+struct snap_layout
+{
+  size_t name;
+  size_t size;
+  size_t mtime;
+  size_t mode;
+  size_t uid;
+  size_t gid;
+  size_t type;
+  size_t state;
+  size_t names;
+  size_t file_size;
+};
+
+/*
+ * Place the columns of COUNT entries and NAMES_LENGTH bytes
+ * of names in LAYOUT.
+ */
+static void
+snap_layout (struct snap_layout *layout, size_t count, size_t names_length)
+{
+  size_t offset = sizeof (struct snap_header);
+
+  layout->name = offset;
+  offset += count * sizeof (struct arena_handle);
+  layout->size = offset;
+  offset += count * sizeof (int64_t);
+  layout->mtime = offset;
+  offset += count * sizeof (int64_t);
+  layout->mode = offset;
+  offset += snap_align (count * sizeof (uint32_t));
+  layout->uid = offset;
+  offset += snap_align (count * sizeof (uint32_t));
+  layout->gid = offset;
+  offset += snap_align (count * sizeof (uint32_t));
+  layout->type = offset;
+  offset += snap_align (count);
+  layout->state = offset;
+  offset += snap_align (count);
+  layout->names = offset;
+  offset += snap_align (names_length);
+  layout->file_size = offset;
+}
+
+/*
+ * Fill HEADER with the identity of the directory ST, the
+ * current locale and the sizes of COUNT entries and NAMES_LENGTH
+ * bytes of names.
+ */
+static void
+snap_fill_header (struct snap_header *header, const struct stat *st,
+                  size_t count, size_t names_length)
+{
+  struct snap_layout layout;
+
+  snap_layout (&layout, count, names_length);
+
+  memset (header, 0, sizeof (*header));
+  memcpy (header->magic, SNAP_MAGIC, sizeof (header->magic));
+  header->version = SNAP_VERSION;
+  header->header_size = sizeof (*header);
+  header->file_size = layout.file_size;
+  header->dev = st->st_dev;
+  header->ino = st->st_ino;
+  header->mtime_sec = st->st_mtim.tv_sec;
+  header->mtime_nsec = st->st_mtim.tv_nsec;
+  header->ctime_sec = st->st_ctim.tv_sec;
+  header->ctime_nsec = st->st_ctim.tv_nsec;
+  header->count = count;
+  header->names_length = names_length;
+
+  /*
+   * The order of the entries depends on the collation.
+   */
+  snprintf (header->collate, sizeof (header->collate), "%s",
+            setlocale (LC_COLLATE, NULL));
+}
+
+int
+snap_directory (char *buffer, size_t size, int create)
+{
+  const char *cache_home = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+  int length;
+
+  if (cache_home != NULL && cache_home[0] == '/')
+    {
+      length = snprintf (buffer, size, "%s/dr", cache_home);
+    }
+  else if (home != NULL && home[0] == '/')
+    {
+      length = snprintf (buffer, size, "%s/.cache", home);
+      if (create && length > 0 && (size_t)length < size)
+        {
+          mkdir (buffer, 0700);
+        }
+      length = snprintf (buffer, size, "%s/.cache/dr", home);
+    }
+  else
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+  if (length < 0 || (size_t)length >= size)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  if (create && mkdir (buffer, 0700) != 0 && errno != EEXIST)
+    {
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Write the path of the snapshot of the directory ST in BUFFER
+ * of SIZE bytes.
+ */
+static int
+snap_path (const struct stat *st, char *buffer, size_t size)
+{
+  char directory[PATH_MAX];
+  int length;
+
+  if (snap_directory (directory, sizeof (directory), 0) != 0)
+    {
+      return -1;
+    }
+
+  length = snprintf (buffer, size, "%s/%016jx-%016jx.snap", directory,
+                     (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+  if (length < 0 || (size_t)length >= size)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Check the snapshot of SIZE bytes at DATA against the directory
+ * ST, the locale and itself.
+ * return 0 if it can be used and -1 otherwise.
+ */
+static int
+snap_validate (const unsigned char *data, size_t size, const struct stat *st)
+{
+  struct snap_header expected;
+  const struct snap_header *header = (const struct snap_header *)data;
+  struct snap_layout layout;
+  const struct arena_handle *name;
+  const unsigned char *state;
+  const char *names;
+  size_t i;
+
+  if (size < sizeof (*header)
+      || memcmp (header->magic, SNAP_MAGIC, sizeof (header->magic)) != 0
+      || header->version != SNAP_VERSION
+      || header->header_size != sizeof (*header)
+      || header->count > UINT32_MAX || header->names_length > UINT32_MAX)
+    {
+      return -1;
+    }
+
+  snap_fill_header (&expected, st, header->count, header->names_length);
+
+  if (header->file_size != size || expected.file_size != size
+      || header->dev != expected.dev || header->ino != expected.ino
+      || header->mtime_sec != expected.mtime_sec
+      || header->mtime_nsec != expected.mtime_nsec
+      || header->ctime_sec != expected.ctime_sec
+      || header->ctime_nsec != expected.ctime_nsec
+      || strncmp (header->collate, expected.collate, sizeof (header->collate))
+             != 0)
+    {
+      return -1;
+    }
+
+  if (snap_checksum (data + sizeof (*header), size - sizeof (*header))
+      != header->checksum)
+    {
+      return -1;
+    }
+
+  /*
+   * A matching checksum doesn't make the file trustworthy, every
+   * name must be inside the names and end with a nul and the
+   * metadata is either ready or still to fetch.
+   */
+  snap_layout (&layout, header->count, header->names_length);
+  name = (const struct arena_handle *)(data + layout.name);
+  state = data + layout.state;
+  names = (const char *)(data + layout.names);
+
+  for (i = 0; i < header->count; ++i)
+    {
+      if ((uint64_t)name[i].offset + name[i].length >= header->names_length
+          || names[name[i].offset + name[i].length] != '\0'
+          || (state[i] != ENTRY_META_NONE && state[i] != ENTRY_META_READY))
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+int
+snap_read (int fd, const struct stat *st, struct entry_store *store)
+{
+  const struct snap_header *header;
+  struct snap_layout layout;
+  const uint32_t *mode;
+  const uint32_t *uid;
+  const uint32_t *gid;
+  struct stat file_st;
+  unsigned char *data;
+  size_t count;
+  size_t i;
+  int status = -1;
+
+  if (fstat (fd, &file_st) != 0 || file_st.st_size < (off_t)sizeof (*header))
+    {
+      return -1;
+    }
+
+  data = mmap (NULL, file_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    {
+      return -1;
+    }
+
+  if (snap_validate (data, file_st.st_size, st) != 0)
+    {
+      goto out;
+    }
+
+  header = (const struct snap_header *)data;
+  count = header->count;
+  snap_layout (&layout, count, header->names_length);
+
+  if (entry_store_reserve (store, count) != 0
+      || arena_reserve (&store->names, header->names_length) != 0)
+    {
+      goto out;
+    }
+
+  memcpy (store->name, data + layout.name,
+          count * sizeof (struct arena_handle));
+  memcpy (store->size, data + layout.size, count * sizeof (int64_t));
+  memcpy (store->mtime, data + layout.mtime, count * sizeof (int64_t));
+  memcpy (store->type, data + layout.type, count);
+  memcpy (store->state, data + layout.state, count);
+  memcpy (store->names.data, data + layout.names, header->names_length);
+  store->names.length = header->names_length;
+
+  mode = (const uint32_t *)(data + layout.mode);
+  uid = (const uint32_t *)(data + layout.uid);
+  gid = (const uint32_t *)(data + layout.gid);
+  for (i = 0; i < count; ++i)
+    {
+      store->mode[i] = mode[i];
+      store->uid[i] = uid[i];
+      store->gid[i] = gid[i];
+    }
+  store->count = count;
+
+  status = 0;
+
+out:
+  munmap (data, file_st.st_size);
+
+  return status;
+}
+
+int
+snap_load (const struct stat *st, struct entry_store *store)
+{
+  char path[PATH_MAX];
+  int fd;
+
+  if (snap_path (st, path, sizeof (path)) != 0)
+    {
+      return -1;
+    }
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (snap_read (fd, st, store) != 0)
+    {
+      /*
+       * Corrupt or outdated, the next complete scan replaces it.
+       */
+      close (fd);
+      unlink (path);
+      return -1;
+    }
+
+  close (fd);
+
+  return 0;
+}
+
+/*
+ * Information about a snapshot file for 'snap_prune'.
+ */
+struct snap_file
+{
+  char name[NAME_MAX + 1];
+  off_t size;
+  struct timespec mtime;
+};
+
+static int
+snap_compare_files (const void *a, const void *b)
+{
+  const struct snap_file *file_a = a;
+  const struct snap_file *file_b = b;
+
+  if (file_a->mtime.tv_sec != file_b->mtime.tv_sec)
+    {
+      return file_a->mtime.tv_sec < file_b->mtime.tv_sec ? -1 : 1;
+    }
+
+  if (file_a->mtime.tv_nsec != file_b->mtime.tv_nsec)
+    {
+      return file_a->mtime.tv_nsec < file_b->mtime.tv_nsec ? -1 : 1;
+    }
+
+  return 0;
+}
+
+/*
+ * Remove the oldest snapshots of the cache DIRECTORY until they
+ * fit in SNAP_MAX_CACHE_SIZE.
+ */
+static void
+snap_prune (const char *directory)
+{
+  struct snap_file *files = NULL;
+  struct snap_file *grown;
+  struct dirent *ep;
+  struct stat st;
+  size_t count = 0;
+  size_t capacity = 0;
+  off_t total = 0;
+  size_t length;
+  size_t i;
+  DIR *dp;
+
+  dp = opendir (directory);
+  if (dp == NULL)
+    {
+      return;
+    }
+
+  while ((ep = readdir (dp)) != NULL)
+    {
+      length = strlen (ep->d_name);
+      if (length < 5 || strcmp (ep->d_name + length - 5, ".snap") != 0
+          || fstatat (dirfd (dp), ep->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+          || !S_ISREG (st.st_mode))
+        {
+          continue;
+        }
+
+      if (count == capacity)
+        {
+          capacity = capacity ? capacity * 2 : 64;
+          grown = realloc (files, capacity * sizeof (*files));
+          if (grown == NULL)
+            {
+              goto out;
+            }
+          files = grown;
+        }
+
+      memcpy (files[count].name, ep->d_name, length + 1);
+      files[count].size = st.st_size;
+      files[count].mtime = st.st_mtim;
+      total += st.st_size;
+      ++count;
+    }
+
+  if (total <= SNAP_MAX_CACHE_SIZE)
+    {
+      goto out;
+    }
+
+  qsort (files, count, sizeof (*files), snap_compare_files);
+
+  for (i = 0; i < count && total > SNAP_MAX_CACHE_SIZE; ++i)
+    {
+      if (unlinkat (dirfd (dp), files[i].name, 0) == 0)
+        {
+          total -= files[i].size;
+        }
+    }
+
+out:
+  free (files);
+  closedir (dp);
+}
+
+int
+snap_write (int fd, const struct stat *st, const struct entry_store *store,
+            int meta)
+{
+  struct snap_header header;
+  struct snap_layout layout;
+  struct arena_handle *name;
+  unsigned char *data;
+  unsigned char *type;
+  unsigned char *state;
+  int64_t *size;
+  int64_t *mtime;
+  uint32_t *mode;
+  uint32_t *uid;
+  uint32_t *gid;
+  size_t count = store->count;
+  size_t offset;
+  ssize_t written;
+  size_t i;
+  int saved_errno;
+
+  snap_fill_header (&header, st, count, store->names.length);
+  snap_layout (&layout, count, store->names.length);
+
+  /*
+   * The file is assembled in memory to hash it, calloc leaves the
+   * padding zeroed.
+   */
+  data = calloc (1, layout.file_size);
+  if (data == NULL)
+    {
+      return -1;
+    }
+
+  name = (struct arena_handle *)(data + layout.name);
+  size = (int64_t *)(data + layout.size);
+  mtime = (int64_t *)(data + layout.mtime);
+  mode = (uint32_t *)(data + layout.mode);
+  uid = (uint32_t *)(data + layout.uid);
+  gid = (uint32_t *)(data + layout.gid);
+  type = data + layout.type;
+  state = data + layout.state;
+
+  /*
+   * The metadata may still be fetched on other threads, only
+   * what is published as ready is kept, and only when asked for.
+   */
+  for (i = 0; i < count; ++i)
+    {
+      name[i] = store->name[i];
+      type[i] = store->type[i];
+
+      if (meta && entry_store_meta_state (store, i) == ENTRY_META_READY)
+        {
+          size[i] = store->size[i];
+          mtime[i] = store->mtime[i];
+          mode[i] = store->mode[i];
+          uid[i] = store->uid[i];
+          gid[i] = store->gid[i];
+          state[i] = ENTRY_META_READY;
+        }
+      else
+        {
+          size[i] = ENTRY_UNKNOWN;
+          mtime[i] = ENTRY_UNKNOWN;
+          mode[i] = 0;
+          uid[i] = 0;
+          gid[i] = 0;
+          state[i] = ENTRY_META_NONE;
+        }
+    }
+
+  if (store->names.length > 0)
+    {
+      memcpy (data + layout.names, store->names.data, store->names.length);
+    }
+
+  header.checksum = snap_checksum (data + sizeof (header),
+                                   layout.file_size - sizeof (header));
+  memcpy (data, &header, sizeof (header));
+
+  for (offset = 0; offset < layout.file_size; offset += written)
+    {
+      written = write (fd, data + offset, layout.file_size - offset);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            {
+              written = 0;
+              continue;
+            }
+          saved_errno = errno;
+          free (data);
+          errno = saved_errno;
+          return -1;
+        }
+    }
+
+  free (data);
+
+  return 0;
+}
+
+int
+snap_save (const struct stat *st, const struct entry_store *store)
+{
+  struct snap_header header;
+  char directory[PATH_MAX];
+  char path[PATH_MAX];
+  char temporary[PATH_MAX + 16];
+  struct timespec now;
+  int saved_errno;
+  int fd;
+
+  clock_gettime (CLOCK_REALTIME, &now);
+  if (now.tv_sec - st->st_mtim.tv_sec < SNAP_RACY_SECONDS
+      || now.tv_sec - st->st_ctim.tv_sec < SNAP_RACY_SECONDS)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+  if (snap_directory (directory, sizeof (directory), 1) != 0
+      || snap_path (st, path, sizeof (path)) != 0)
+    {
+      return -1;
+    }
+
+  snap_fill_header (&header, st, store->count, store->names.length);
+
+  if (header.file_size > SNAP_MAX_CACHE_SIZE)
+    {
+      errno = EFBIG;
+      return -1;
+    }
+
+  /*
+   * Write a temporary file and rename it so a reader never
+   * maps a partial snapshot.
+   */
+  snprintf (temporary, sizeof (temporary), "%s.%d.tmp", path, getpid ());
+
+  fd = open (temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  if (snap_write (fd, st, store, 0) != 0)
+    {
+      saved_errno = errno;
+      close (fd);
+      unlink (temporary);
+      errno = saved_errno;
+      return -1;
+    }
+
+  if (close (fd) != 0 || rename (temporary, path) != 0)
+    {
+      saved_errno = errno;
+      unlink (temporary);
+      errno = saved_errno;
+      return -1;
+    }
+
+  snap_prune (directory);
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * snap - library to save sorted listings in the cache directory
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_SNAP_H_
+#define DR_LIB_SNAP_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "entry.h"
+
+/*
+ * First bytes of a snapshot file and version of the format, a
+ * file of another version is ignored and written again.
+ */
+#define SNAP_MAGIC "DRSNAP\0\0"
+#define SNAP_VERSION 3
+
+/*
+ * Directories with fewer entries are read faster than their
+ * snapshot is written, they are not saved.
+ */
+#define SNAP_MIN_ENTRIES 1000
+
+/*
+ * Size of the snapshots kept in the cache directory, the oldest
+ * ones are removed past it.
+ */
+#define SNAP_MAX_CACHE_SIZE (256 * 1024 * 1024)
+
+/*
+ * A directory changed less than this many seconds before it was
+ * stated is not saved, the coarsest file systems keep the times to
+ * 2 seconds.
+ */
+#define SNAP_RACY_SECONDS 2
+
+/*
+ * Header of a snapshot, it is followed by the COUNT name handles,
+ * sizes, mtimes, modes, owners, groups, types and metadata states of
+ * the entries and the NAMES_LENGTH bytes of the names, each column
+ * padded to 8 bytes.
+ * the entries are sorted like 'dir_typesort' for the locale COLLATE.
+ * the directory is identified by DEV and INO and the snapshot is
+ * only used while its MTIME and CTIME are the same, CHECKSUM
+ * covers everything after the header.
+ */
+struct snap_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t file_size;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t ctime_sec;
+  int64_t ctime_nsec;
+  uint64_t count;
+  uint64_t names_length;
+  char collate[64];
+  uint64_t checksum;
+};
+
+/*
+ * Write the directory of the snapshots in BUFFER of SIZE bytes,
+ * $XDG_CACHE_HOME/dr or ~/.cache/dr, and create it if CREATE is set
+ * and it doesn't exist.
+ * return 0 on success and -1 with errno set.
+ */
+int snap_directory (char *buffer, size_t size, int create);
+
+/*
+ * Write the snapshot of the sorted STORE of the directory ST in the
+ * file FD, the metadata that is ready is kept if META is set.
+ * the times of the directory don't change when a file is written in
+ * place, META is only set by a writer that watches the directory and
+ * keeps the metadata current.
+ * return 0 on success and -1 with errno set.
+ */
+int snap_write (int fd, const struct stat *st,
+                const struct entry_store *store, int meta);
+
+/*
+ * Fill the empty STORE with the snapshot of the directory ST
+ * in the file FD.
+ * return 0 on success and -1 if it is not a valid snapshot.
+ */
+int snap_read (int fd, const struct stat *st, struct entry_store *store);
+
+/*
+ * Fill the empty STORE with the snapshot of the directory ST,
+ * the names and the order come from the file and nothing is
+ * read from the directory.
+ * return 0 on success and -1 if there is no valid snapshot.
+ */
+int snap_load (const struct stat *st, struct entry_store *store);
+
+/*
+ * Save the sorted STORE as the snapshot of the directory ST without
+ * its metadata, nothing keeps it current once it is saved, ST
+ * must come from before the directory was read so a change during
+ * the read makes the snapshot outdated instead of wrong.
+ * a change in the same tick as ST would leave the same times and go
+ * unseen, so a directory changed in the last SNAP_RACY_SECONDS is
+ * not saved and errno is set to EAGAIN.
+ * the oldest snapshots are removed once the cache is too large.
+ * return 0 on success and -1 with errno set.
+ */
+int snap_save (const struct stat *st, const struct entry_store *store);
+
+#endif // DR_LIB_SNAP_H_
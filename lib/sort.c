@@ -0,0 +1,547 @@
+#include "sort.h"
+
+/*
+ * Length of the runs sorted by insertion before merging.
+ */
+#define SORT_RUN_LENGTH 32
+
+int
+sort_collate_is_bytewise (void)
+{
+  const char *collate = setlocale (LC_COLLATE, NULL);
+
+  return collate == NULL || strcmp (collate, "C") == 0
+         || strcmp (collate, "POSIX") == 0;
+}
+
+/*
+ * Pack the CATEGORY and the first bytes of KEY in a single integer
+ * so comparing two prefixes compares the category then the key.
+ * keys never contain a '\0' so padding with zeros keeps shorter
+ * keys first.
+ */
+static uint64_t
+sort_make_prefix (enum sort_category category, const char *key,
+                  size_t key_length)
+{
+  uint64_t prefix = (uint64_t)category << (SORT_PREFIX_BYTES * 8);
+  size_t i;
+
+  for (i = 0; i < SORT_PREFIX_BYTES && i < key_length; ++i)
+    {
+      prefix |= (uint64_t)(unsigned char)key[i]
+                << ((SORT_PREFIX_BYTES - 1 - i) * 8);
+    }
+
+  return prefix;
+}
+
+/*
+ * Append the collation key of NAME to ARENA.
+ */
+static int
+sort_push_collation_key (struct arena *arena, const char *name,
+                         size_t name_length, struct arena_handle *handle)
+{
+  size_t available;
+  size_t length;
+
+  available = name_length * 4 + 16;
+
+  for (;;)
+    {
+      if (arena_reserve (arena, available) != 0)
+        {
+          return -1;
+        }
+
+      length = strxfrm (arena->data + arena->length, name, available);
+      if (length < available)
+        {
+          break;
+        }
+
+      available = length + 1;
+    }
+
+  handle->offset = arena->length;
+  handle->length = length;
+  arena->length += length + 1;
+
+  return 0;
+}
+
+int
+sort_build_records (const struct entry_store *store, struct sort_keys *keys)
+{
+  struct sort_record *record;
+  struct arena_handle handle;
+  const char *name;
+  int bytewise;
+  size_t i;
+
+  arena_init (&keys->keys);
+  keys->base = NULL;
+  keys->count = 0;
+
+  keys->records = malloc ((store->count + 1) * sizeof (struct sort_record));
+  if (keys->records == NULL)
+    {
+      return -1;
+    }
+
+  bytewise = sort_collate_is_bytewise ();
+
+  for (i = 0; i < store->count; ++i)
+    {
+      record = &keys->records[i];
+      name = entry_store_name (store, i);
+
+      if (bytewise)
+        {
+          handle = store->name[i];
+        }
+      else if (sort_push_collation_key (&keys->keys, name,
+                                        store->name[i].length, &handle)
+               != 0)
+        {
+          sort_keys_free (keys);
+          return -1;
+        }
+
+      record->key = handle.offset;
+      record->key_length = handle.length;
+      record->index = i;
+    }
+
+  keys->base = bytewise ? store->names.data : keys->keys.data;
+
+  /*
+   * The arena could have moved while the keys were added so the
+   * prefixes are computed once it is complete.
+   */
+  for (i = 0; i < store->count; ++i)
+    {
+      record = &keys->records[i];
+      name = entry_store_name (store, i);
+      record->prefix = sort_make_prefix (
+          sort_category (name, store->type[i]), keys->base + record->key,
+          record->key_length);
+    }
+
+  keys->count = store->count;
+
+  return 0;
+}
+
+/*
+ * Compare the records A and B, the prefix decides almost every
+ * comparison and the rest of the keys is only read on a tie.
+ */
+static inline int
+sort_record_compare (const struct sort_record *a, const struct sort_record *b,
+                     const char *base)
+{
+  size_t a_length;
+  size_t b_length;
+  size_t length;
+  int ret;
+
+  if (a->prefix != b->prefix)
+    {
+      return a->prefix < b->prefix ? -1 : 1;
+    }
+
+  a_length = a->key_length > SORT_PREFIX_BYTES
+                 ? a->key_length - SORT_PREFIX_BYTES
+                 : 0;
+  b_length = b->key_length > SORT_PREFIX_BYTES
+                 ? b->key_length - SORT_PREFIX_BYTES
+                 : 0;
+  length = a_length < b_length ? a_length : b_length;
+
+  if (length > 0)
+    {
+      ret = memcmp (base + a->key + SORT_PREFIX_BYTES,
+                    base + b->key + SORT_PREFIX_BYTES, length);
+      if (ret != 0)
+        {
+          return ret;
+        }
+    }
+
+  return (a_length > b_length) - (a_length < b_length);
+}
+
+static void
+sort_insertion (struct sort_record *records, size_t count, const char *base)
+{
+  struct sort_record record;
+  size_t i;
+  size_t j;
+
+  for (i = 1; i < count; ++i)
+    {
+      record = records[i];
+
+      j = i;
+      while (j > 0
+             && sort_record_compare (&record, &records[j - 1], base) < 0)
+        {
+          records[j] = records[j - 1];
+          --j;
+        }
+
+      records[j] = record;
+    }
+}
+
+/*
+ * Merge the sorted runs SRC[LEFT..MIDDLE) and SRC[MIDDLE..RIGHT)
+ * into DST[LEFT..RIGHT).
+ */
+static void
+sort_merge (const struct sort_record *src, size_t left, size_t middle,
+            size_t right, struct sort_record *dst, const char *base)
+{
+  size_t i = left;
+  size_t j = middle;
+  size_t k = left;
+
+  while (i < middle && j < right)
+    {
+      if (sort_record_compare (&src[j], &src[i], base) < 0)
+        {
+          dst[k++] = src[j++];
+        }
+      else
+        {
+          dst[k++] = src[i++];
+        }
+    }
+
+  memcpy (&dst[k], &src[i], (middle - i) * sizeof (struct sort_record));
+  k += middle - i;
+  memcpy (&dst[k], &src[j], (right - j) * sizeof (struct sort_record));
+}
+
+int
+sort_records (struct sort_record *records, size_t count, const char *base)
+{
+  struct sort_record *buffer;
+  struct sort_record *src;
+  struct sort_record *dst;
+  struct sort_record *swap;
+  size_t width;
+  size_t left;
+  size_t middle;
+  size_t right;
+
+  for (left = 0; left < count; left += SORT_RUN_LENGTH)
+    {
+      right = left + SORT_RUN_LENGTH < count ? left + SORT_RUN_LENGTH : count;
+      sort_insertion (&records[left], right - left, base);
+    }
+
+  if (count <= SORT_RUN_LENGTH)
+    {
+      return 0;
+    }
+
+  buffer = malloc (count * sizeof (struct sort_record));
+  if (buffer == NULL)
+    {
+      return -1;
+    }
+
+  src = records;
+  dst = buffer;
+
+  for (width = SORT_RUN_LENGTH; width < count; width *= 2)
+    {
+      for (left = 0; left < count; left += 2 * width)
+        {
+          middle = left + width < count ? left + width : count;
+          right = left + 2 * width < count ? left + 2 * width : count;
+          sort_merge (src, left, middle, right, dst, base);
+        }
+
+      swap = src;
+      src = dst;
+      dst = swap;
+    }
+
+  if (src != records)
+    {
+      memcpy (records, src, count * sizeof (struct sort_record));
+    }
+
+  free (buffer);
+
+  return 0;
+}
+
+/*
+ * Work given to a thread of the parallel sort, either sort
+ * SRC[LEFT..RIGHT) in place when DST is NULL, or merge
+ * SRC[LEFT..MIDDLE) and SRC[MIDDLE..RIGHT) into DST.
+ */
+struct sort_task
+{
+  pthread_t thread;
+  struct sort_record *src;
+  struct sort_record *dst;
+  size_t left;
+  size_t middle;
+  size_t right;
+  const char *base;
+  int status;
+};
+
+static void *
+sort_run_task (void *data)
+{
+  struct sort_task *task = data;
+
+  if (task->dst == NULL)
+    {
+      task->status = sort_records (&task->src[task->left],
+                                   task->right - task->left, task->base);
+    }
+  else
+    {
+      sort_merge (task->src, task->left, task->middle, task->right,
+                  task->dst, task->base);
+      task->status = 0;
+    }
+
+  return NULL;
+}
+
+/*
+ * Run the COUNT TASKS on their own thread and wait for them,
+ * the first task runs on the calling thread.
+ * return 0 if every task succeeded.
+ */
+static int
+sort_run_tasks (struct sort_task *tasks, size_t count)
+{
+  size_t started;
+  size_t i;
+  int status = 0;
+
+  for (started = 1; started < count; ++started)
+    {
+      if (pthread_create (&tasks[started].thread, NULL, sort_run_task,
+                          &tasks[started])
+          != 0)
+        {
+          break;
+        }
+    }
+
+  /*
+   * Tasks that couldn't get a thread run here.
+   */
+  sort_run_task (&tasks[0]);
+  for (i = started; i < count; ++i)
+    {
+      sort_run_task (&tasks[i]);
+    }
+
+  for (i = 1; i < started; ++i)
+    {
+      pthread_join (tasks[i].thread, NULL);
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      status |= tasks[i].status;
+    }
+
+  return status;
+}
+
+int
+sort_threads_for (size_t count, int threads)
+{
+  size_t useful;
+
+  if (threads <= 0)
+    {
+      threads = sysconf (_SC_NPROCESSORS_ONLN);
+    }
+
+  if (threads > SORT_MAX_THREADS)
+    {
+      threads = SORT_MAX_THREADS;
+    }
+
+  /*
+   * Spawning a thread costs more than sorting a small chunk.
+   */
+  useful = count / SORT_PARALLEL_MIN_ENTRIES;
+  if (useful < (size_t)threads)
+    {
+      threads = useful;
+    }
+
+  return threads < 1 ? 1 : threads;
+}
+
+int
+sort_records_parallel (struct sort_record *records, size_t count,
+                       const char *base, int threads)
+{
+  struct sort_task tasks[SORT_MAX_THREADS];
+  size_t bounds[SORT_MAX_THREADS + 1];
+  struct sort_record *buffer;
+  struct sort_record *src;
+  struct sort_record *dst;
+  struct sort_record *swap;
+  size_t runs;
+  size_t pairs;
+  size_t merged;
+  size_t i;
+
+  runs = sort_threads_for (count, threads);
+  if (runs == 1)
+    {
+      return sort_records (records, count, base);
+    }
+
+  for (i = 0; i <= runs; ++i)
+    {
+      bounds[i] = count * i / runs;
+    }
+
+  for (i = 0; i < runs; ++i)
+    {
+      tasks[i].src = records;
+      tasks[i].dst = NULL;
+      tasks[i].left = bounds[i];
+      tasks[i].right = bounds[i + 1];
+      tasks[i].base = base;
+    }
+
+  if (sort_run_tasks (tasks, runs) != 0)
+    {
+      return -1;
+    }
+
+  buffer = malloc (count * sizeof (struct sort_record));
+  if (buffer == NULL)
+    {
+      return -1;
+    }
+
+  src = records;
+  dst = buffer;
+
+  /*
+   * Merge the sorted runs two by two, every merge of
+   * a level runs on its own thread.
+   */
+  while (runs > 1)
+    {
+      pairs = 0;
+
+      for (i = 0; i + 1 < runs; i += 2)
+        {
+          tasks[pairs].src = src;
+          tasks[pairs].dst = dst;
+          tasks[pairs].left = bounds[i];
+          tasks[pairs].middle = bounds[i + 1];
+          tasks[pairs].right = bounds[i + 2];
+          tasks[pairs].base = base;
+          bounds[pairs++] = bounds[i];
+        }
+
+      merged = pairs;
+
+      /*
+       * The last run has no pair at this level.
+       */
+      if (i < runs)
+        {
+          memcpy (&dst[bounds[i]], &src[bounds[i]],
+                  (bounds[i + 1] - bounds[i]) * sizeof (struct sort_record));
+          bounds[merged++] = bounds[i];
+        }
+
+      bounds[merged] = count;
+
+      sort_run_tasks (tasks, pairs);
+
+      runs = merged;
+
+      swap = src;
+      src = dst;
+      dst = swap;
+    }
+
+  if (src != records)
+    {
+      memcpy (records, src, count * sizeof (struct sort_record));
+    }
+
+  free (buffer);
+
+  return 0;
+}
+
+void
+sort_keys_free (struct sort_keys *keys)
+{
+  arena_free (&keys->keys);
+  free (keys->records);
+  keys->records = NULL;
+  keys->base = NULL;
+  keys->count = 0;
+}
+
+int
+sort_entry_store (struct entry_store *store, int threads)
+{
+  struct sort_keys keys;
+  uint64_t start;
+  uint32_t *order;
+  size_t i;
+  int status;
+
+  if (store->count < 2)
+    {
+      return 0;
+    }
+
+  start = stats_start ();
+
+  if (sort_build_records (store, &keys) != 0)
+    {
+      return -1;
+    }
+
+  if (sort_records_parallel (keys.records, keys.count, keys.base, threads)
+      != 0)
+    {
+      sort_keys_free (&keys);
+      return -1;
+    }
+
+  /*
+   * The records are not needed once the order is known,
+   * reuse their memory for it.
+   */
+  order = (uint32_t *)keys.records;
+  for (i = 0; i < keys.count; ++i)
+    {
+      order[i] = keys.records[i].index;
+    }
+
+  status = entry_store_permute (store, order);
+
+  sort_keys_free (&keys);
+  stats_stop (STATS_SORT, start);
+
+  return status;
+}
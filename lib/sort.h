@@ -0,0 +1,147 @@
+/*
+ * sort - library to sort the entries of a listing
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_SORT_H_
+#define DR_LIB_SORT_H_
+
+#include <dirent.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "entry.h"
+#include "stats.h"
+
+/*
+ * Number of key bytes packed in the prefix of a record.
+ */
+#define SORT_PREFIX_BYTES 7
+
+/*
+ * Smallest number of entries given to a thread of the parallel
+ * sort, smaller listings are sorted on the calling thread.
+ */
+#define SORT_PARALLEL_MIN_ENTRIES 65536
+
+/*
+ * Upper limit of threads used by the parallel sort.
+ */
+#define SORT_MAX_THREADS 64
+
+/*
+ * Categories of 'dir_typesort' in their order.
+ */
+enum sort_category
+{
+  SORT_HIDDEN_DIRECTORY,
+  SORT_DIRECTORY,
+  SORT_HIDDEN_FILE,
+  SORT_FILE,
+};
+
+/*
+ * Compact sort record, PREFIX holds the category in the top byte
+ * followed by the first SORT_PREFIX_BYTES bytes of the collation key
+ * so most comparisons are a single integer compare.
+ * KEY and KEY_LENGTH point to the whole key and INDEX is the
+ * position of the entry in the store.
+ */
+struct sort_record
+{
+  uint64_t prefix;
+  uint32_t key;
+  uint32_t key_length;
+  uint32_t index;
+};
+
+/*
+ * Records of a listing and the keys they point into, the KEYS
+ * arena is only used when the locale needs 'strxfrm', otherwise
+ * the records point to the names of the store.
+ */
+struct sort_keys
+{
+  struct arena keys;
+  const char *base;
+  struct sort_record *records;
+  size_t count;
+};
+
+/*
+ * Get the category of an entry NAME of TYPE.
+ */
+static inline enum sort_category
+sort_category (const char *name, unsigned char type)
+{
+  return (enum sort_category)(((type != DT_DIR) << 1) | (name[0] != '.'));
+}
+
+/*
+ * return 1 if the collation of the current locale is the same
+ * as comparing bytes, which is the case for "C" and "POSIX".
+ */
+int sort_collate_is_bytewise (void);
+
+/*
+ * Compute the category and the collation key of every entry of
+ * STORE once and save the records in KEYS.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int sort_build_records (const struct entry_store *store,
+                        struct sort_keys *keys);
+
+/*
+ * Sort the COUNT RECORDS with keys starting at BASE.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int sort_records (struct sort_record *records, size_t count,
+                  const char *base);
+
+/*
+ * Get the number of threads worth using to sort COUNT records when
+ * the user asked for THREADS, 0 or less means one per processor.
+ */
+int sort_threads_for (size_t count, int threads);
+
+/*
+ * Sort the COUNT RECORDS on up to THREADS threads, each thread
+ * sorts a chunk and the chunks are merged two by two.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int sort_records_parallel (struct sort_record *records, size_t count,
+                           const char *base, int threads);
+
+/*
+ * Release the records and keys of KEYS.
+ */
+void sort_keys_free (struct sort_keys *keys);
+
+/*
+ * Sort STORE in the same order as 'dir_typesort' using
+ * precomputed keys on up to THREADS threads.
+ * return 0 on success and -1 if the allocation failed.
+ */
+int sort_entry_store (struct entry_store *store, int threads);
+
+#endif // DR_LIB_SORT_H_
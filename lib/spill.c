@@ -0,0 +1,276 @@
+#include "spill.h"
+
+/*
+ * Directory of the spill files, it is opened the first time a file
+ * is needed, SPILL_DIR_FD is then the directory or -1 if the arrays
+ * stay in the heap.
+ */
+static char spill_dir_name[PATH_MAX];
+static int spill_dir_opened;
+static int spill_dir_fd = -1;
+
+/*
+ * Arrays in spill files, the stores are filled and freed from any
+ * thread.
+ */
+static struct spill_region spill_regions[SPILL_MAX_REGIONS];
+static size_t spill_count;
+static pthread_mutex_t spill_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int
+spill_init (const char *dir_name)
+{
+  int length;
+
+  length = snprintf (spill_dir_name, sizeof (spill_dir_name), "%s",
+                     dir_name);
+  if (length < 0 || (size_t)length >= sizeof (spill_dir_name))
+    {
+      spill_dir_name[0] = '\0';
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Create the directory of the spill files and its parent if needed
+ * and open it, with the lock held.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+spill_open_directory (void)
+{
+  char parent[PATH_MAX];
+  char *slash;
+  int dir_fd;
+  int fd;
+
+  if (spill_dir_name[0] == '\0')
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+  if (mkdir (spill_dir_name, 0700) != 0 && errno == ENOENT)
+    {
+      memcpy (parent, spill_dir_name, sizeof (parent));
+      slash = strrchr (parent, '/');
+      if (slash != NULL && slash != parent)
+        {
+          *slash = '\0';
+          mkdir (parent, 0700);
+        }
+      mkdir (spill_dir_name, 0700);
+    }
+
+  dir_fd = open (spill_dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    {
+      return -1;
+    }
+
+  /*
+   * Not every file system has unnamed temporary files.
+   */
+  fd = openat (dir_fd, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0)
+    {
+      close (dir_fd);
+      return -1;
+    }
+  close (fd);
+
+  spill_dir_fd = dir_fd;
+
+  return 0;
+}
+
+/*
+ * Get the index of the region of DATA or -1 if it is in the heap,
+ * with the lock held.
+ */
+static long
+spill_find (const void *data)
+{
+  size_t i;
+
+  for (i = 0; i < spill_count; ++i)
+    {
+      if (spill_regions[i].data == data)
+        {
+          return i;
+        }
+    }
+
+  return -1;
+}
+
+/*
+ * Map SIZE bytes of a new spill file.
+ * return the address or NULL if it has to stay in the heap.
+ */
+static void *
+spill_map (size_t size)
+{
+  struct spill_region *region;
+  void *data;
+  int fd;
+
+  if (size < SPILL_MIN_SIZE)
+    {
+      return NULL;
+    }
+
+  pthread_mutex_lock (&spill_lock);
+  if (!spill_dir_opened)
+    {
+      spill_dir_opened = 1;
+      spill_open_directory ();
+    }
+  pthread_mutex_unlock (&spill_lock);
+
+  if (spill_dir_fd < 0)
+    {
+      return NULL;
+    }
+
+  fd = openat (spill_dir_fd, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0)
+    {
+      return NULL;
+    }
+
+  /*
+   * The blocks are allocated now so a full disk fails here
+   * and not with a SIGBUS when a page is written.
+   */
+  if (fallocate (fd, 0, 0, size) != 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  pthread_mutex_lock (&spill_lock);
+  if (spill_count == SPILL_MAX_REGIONS)
+    {
+      pthread_mutex_unlock (&spill_lock);
+      munmap (data, size);
+      close (fd);
+      return NULL;
+    }
+
+  region = &spill_regions[spill_count++];
+  region->data = data;
+  region->size = size;
+  region->fd = fd;
+  pthread_mutex_unlock (&spill_lock);
+
+  return data;
+}
+
+void *
+spill_malloc (size_t size)
+{
+  void *data = spill_map (size);
+
+  return data != NULL ? data : malloc (size);
+}
+
+void *
+spill_realloc (void *data, size_t size)
+{
+  struct spill_region *region;
+  void *new_data;
+  size_t length;
+  long index;
+
+  if (data == NULL)
+    {
+      return spill_malloc (size);
+    }
+
+  pthread_mutex_lock (&spill_lock);
+  index = spill_find (data);
+  if (index >= 0)
+    {
+      region = &spill_regions[index];
+
+      if (size > region->size
+          && fallocate (region->fd, 0, region->size, size - region->size)
+                 != 0)
+        {
+          pthread_mutex_unlock (&spill_lock);
+          return NULL;
+        }
+
+      new_data = mremap (data, region->size, size, MREMAP_MAYMOVE);
+      if (new_data == MAP_FAILED)
+        {
+          pthread_mutex_unlock (&spill_lock);
+          return NULL;
+        }
+
+      if (size < region->size && ftruncate (region->fd, size) != 0)
+        {
+          /*
+           * The end of the file is only wasted space.
+           */
+        }
+
+      region->data = new_data;
+      region->size = size;
+      pthread_mutex_unlock (&spill_lock);
+
+      return new_data;
+    }
+  pthread_mutex_unlock (&spill_lock);
+
+  new_data = spill_map (size);
+  if (new_data == NULL)
+    {
+      return realloc (data, size);
+    }
+
+  length = malloc_usable_size (data);
+  memcpy (new_data, data, length < size ? length : size);
+  free (data);
+
+  return new_data;
+}
+
+void
+spill_free (void *data)
+{
+  struct spill_region region;
+  long index;
+
+  if (data == NULL)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&spill_lock);
+  index = spill_find (data);
+  if (index < 0)
+    {
+      pthread_mutex_unlock (&spill_lock);
+      free (data);
+      return;
+    }
+
+  region = spill_regions[index];
+  spill_regions[index] = spill_regions[--spill_count];
+  pthread_mutex_unlock (&spill_lock);
+
+  munmap (region.data, region.size);
+  close (region.fd);
+}
@@ -0,0 +1,91 @@
+/*
+ * spill - library to keep the large arrays of a listing in files
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_SPILL_H_
+#define DR_LIB_SPILL_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Size from which an array is kept in a spill file, the smaller
+ * ones stay in the heap.
+ */
+#define SPILL_MIN_SIZE (16 * 1024 * 1024)
+
+/*
+ * Upper limit of the arrays in spill files at the same time, the
+ * next ones stay in the heap.
+ */
+#define SPILL_MAX_REGIONS 64
+
+/*
+ * Array mapped from an unlinked file of FD, it has SIZE bytes.
+ */
+struct spill_region
+{
+  void *data;
+  size_t size;
+  int fd;
+};
+
+/*
+ * Keep the arrays of SPILL_MIN_SIZE bytes or more allocated from now
+ * on in unlinked files of the directory DIR_NAME, the kernel writes
+ * the pages that weren't used for a while to the file and reclaims
+ * their memory like it does for any file instead of keeping them
+ * until the listing is freed.
+ * the directory must be on a disk, a tmpfs keeps the files in memory,
+ * it is only created and opened when the first of these arrays is
+ * allocated, and the arrays stay in the heap when it can't hold them.
+ * return 0 on success and -1 with errno set if DIR_NAME is too long.
+ */
+int spill_init (const char *dir_name);
+
+/*
+ * Allocate SIZE bytes like malloc, in a spill file if it is large.
+ * return the address or NULL with errno set.
+ */
+void *spill_malloc (size_t size);
+
+/*
+ * Resize DATA, which comes from 'spill_malloc', 'spill_realloc' or
+ * malloc, to SIZE bytes like realloc, the array moves to a spill file
+ * when it becomes large.
+ * return the new address or NULL with errno set, DATA is still
+ * valid then.
+ */
+void *spill_realloc (void *data, size_t size);
+
+/*
+ * Release DATA, from the heap or a spill file.
+ */
+void spill_free (void *data);
+
+#endif // DR_LIB_SPILL_H_
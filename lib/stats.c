@@ -0,0 +1,174 @@
+#include "stats.h"
+
+int stats_enabled;
+struct stats stats;
+
+static const char *const stats_phase_names[STATS_PHASES] = {
+  "read", "load", "sort", "meta", "apply", "filter", "render", "print",
+  "key", "total",
+};
+
+static const char *const stats_counter_names[STATS_COUNTERS] = {
+  "entries", "bytes", "getdents", "stat", "writes", "prefetch-hits",
+  "prefetch-misses", "owner-lookups",
+};
+
+void
+stats_enable (void)
+{
+  stats_enabled = 1;
+}
+
+uint64_t
+stats_clock (void)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  /*
+   * 0 means nothing is measured.
+   */
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec + 1;
+}
+
+void
+stats_record (enum stats_phase phase, uint64_t duration)
+{
+  struct stats_record *record = &stats.phases[phase];
+  uint64_t max = __atomic_load_n (&record->max, __ATOMIC_RELAXED);
+  int bucket = 0;
+
+  if (duration > 0)
+    {
+      bucket = 64 - __builtin_clzll (duration);
+    }
+  if (bucket >= STATS_BUCKETS)
+    {
+      bucket = STATS_BUCKETS - 1;
+    }
+
+  __atomic_add_fetch (&record->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&record->total, duration, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&record->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+  while (duration > max
+         && !__atomic_compare_exchange_n (&record->max, &max, duration, 1,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED))
+    {
+    }
+}
+
+const char *
+stats_phase_name (enum stats_phase phase)
+{
+  return stats_phase_names[phase];
+}
+
+const char *
+stats_counter_name (enum stats_counter counter)
+{
+  return stats_counter_names[counter];
+}
+
+/*
+ * Get the upper bound of the bucket that holds the duration of rank
+ * PERCENT in RECORD, in nanoseconds, it can be off by a factor of 2
+ * and is never more than the longest one.
+ */
+static uint64_t
+stats_percentile (const struct stats_record *record, unsigned percent)
+{
+  uint64_t rank = (record->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  int i;
+
+  for (i = 0; i < STATS_BUCKETS - 1; ++i)
+    {
+      seen += record->buckets[i];
+      if (seen >= rank)
+        {
+          break;
+        }
+    }
+
+  if (i >= 63 || ((uint64_t)1 << i) > record->max)
+    {
+      return record->max;
+    }
+
+  return (uint64_t)1 << i;
+}
+
+int
+stats_report (FILE *stream)
+{
+  const struct stats_record *record;
+  int i;
+
+  fprintf (stream, "%-8s %8s %12s %10s %10s %10s %10s %10s\n", "phase",
+           "count", "total ms", "mean us", "p50 us", "p90 us", "p99 us",
+           "max us");
+
+  for (i = 0; i < STATS_PHASES; ++i)
+    {
+      record = &stats.phases[i];
+      if (record->count == 0)
+        {
+          continue;
+        }
+
+      fprintf (stream,
+               "%-8s %8" PRIu64 " %12.3f %10.1f %10.1f %10.1f %10.1f "
+               "%10.1f\n",
+               stats_phase_names[i], record->count, record->total / 1e6,
+               record->total / 1e3 / record->count,
+               stats_percentile (record, 50) / 1e3,
+               stats_percentile (record, 90) / 1e3,
+               stats_percentile (record, 99) / 1e3, record->max / 1e3);
+    }
+
+  for (i = 0; i < STATS_COUNTERS; ++i)
+    {
+      fprintf (stream, "%-15s %8" PRIu64 "\n", stats_counter_names[i],
+               stats.counters[i]);
+    }
+
+  return fflush (stream) == 0 ? 0 : -1;
+}
+
+int
+stats_dump (FILE *stream)
+{
+  const struct stats_record *record;
+  int i;
+  int j;
+
+  fputs ("{\"phases\":{", stream);
+  for (i = 0; i < STATS_PHASES; ++i)
+    {
+      record = &stats.phases[i];
+      fprintf (stream,
+               "%s\"%s\":{\"count\":%" PRIu64 ",\"total\":%" PRIu64
+               ",\"max\":%" PRIu64 ",\"histogram\":[",
+               i > 0 ? "," : "", stats_phase_names[i], record->count,
+               record->total, record->max);
+      for (j = 0; j < STATS_BUCKETS; ++j)
+        {
+          fprintf (stream, "%s%" PRIu64, j > 0 ? "," : "",
+                   record->buckets[j]);
+        }
+      fputs ("]}", stream);
+    }
+
+  fputs ("},\"counters\":{", stream);
+  for (i = 0; i < STATS_COUNTERS; ++i)
+    {
+      fprintf (stream, "%s\"%s\":%" PRIu64, i > 0 ? "," : "",
+               stats_counter_names[i], stats.counters[i]);
+    }
+  fputs ("}}\n", stream);
+
+  return fflush (stream) == 0 && !ferror (stream) ? 0 : -1;
+}
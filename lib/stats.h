@@ -0,0 +1,179 @@
+/*
+ * stats - library to time the phases of dr and count what they do
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_STATS_H_
+#define DR_LIB_STATS_H_
+
+#include <config.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Buckets of the histograms, the bucket I counts the durations of
+ * less than 2^I nanoseconds that don't fit in the previous one, the
+ * last one takes everything longer.
+ */
+#define STATS_BUCKETS 40
+
+/*
+ * Phases that are timed, each of them can run several times and on
+ * several threads.
+ * STATS_KEY is the time from a key to the frame that shows it.
+ */
+enum stats_phase
+{
+  STATS_READ,
+  STATS_LOAD,
+  STATS_SORT,
+  STATS_META,
+  STATS_APPLY,
+  STATS_FILTER,
+  STATS_RENDER,
+  STATS_PRINT,
+  STATS_KEY,
+  STATS_TOTAL,
+  STATS_PHASES,
+};
+
+/*
+ * Things that are counted, the entries read, the bytes allocated for
+ * the listings, the system calls that touch the filesystem, the
+ * directories entered that were prefetched or had to be read and the
+ * users and groups looked up by name.
+ */
+enum stats_counter
+{
+  STATS_ENTRIES,
+  STATS_BYTES,
+  STATS_GETDENTS,
+  STATS_STAT,
+  STATS_WRITES,
+  STATS_PREFETCH_HITS,
+  STATS_PREFETCH_MISSES,
+  STATS_OWNER_LOOKUPS,
+  STATS_COUNTERS,
+};
+
+/*
+ * How many times a phase ran, for how long in total and at most, in
+ * nanoseconds, and how the durations are spread.
+ */
+struct stats_record
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+};
+
+/*
+ * Everything measured since 'stats_enable', the updates are atomic
+ * so any thread can make them.
+ */
+struct stats
+{
+  struct stats_record phases[STATS_PHASES];
+  uint64_t counters[STATS_COUNTERS];
+};
+
+/*
+ * Set once the statistics are kept in STATS, nothing is measured
+ * until then and every hook returns after testing it.
+ */
+extern int stats_enabled;
+extern struct stats stats;
+
+/*
+ * Start measuring.
+ */
+void stats_enable (void);
+
+/*
+ * Get the monotonic clock in nanoseconds.
+ */
+uint64_t stats_clock (void);
+
+/*
+ * Add DURATION nanoseconds to PHASE.
+ */
+void stats_record (enum stats_phase phase, uint64_t duration);
+
+/*
+ * Get the time a phase starts at, or 0 when nothing is measured.
+ */
+static inline uint64_t
+stats_start (void)
+{
+  return __builtin_expect (stats_enabled, 0) ? stats_clock () : 0;
+}
+
+/*
+ * Add to PHASE the time since START, returned by 'stats_start'.
+ */
+static inline void
+stats_stop (enum stats_phase phase, uint64_t start)
+{
+  if (__builtin_expect (start != 0, 0))
+    {
+      stats_record (phase, stats_clock () - start);
+    }
+}
+
+/*
+ * Add VALUE to COUNTER.
+ */
+static inline void
+stats_add (enum stats_counter counter, uint64_t value)
+{
+  if (__builtin_expect (stats_enabled, 0))
+    {
+      __atomic_add_fetch (&stats.counters[counter], value,
+                          __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Get the name of PHASE.
+ */
+const char *stats_phase_name (enum stats_phase phase);
+
+/*
+ * Get the name of COUNTER.
+ */
+const char *stats_counter_name (enum stats_counter counter);
+
+/*
+ * Write a table of the phases that ran and of the counters in
+ * STREAM, with the median, the 90th and 99th percentiles of the
+ * durations read from the histograms.
+ * return 0 on success and -1 with errno set.
+ */
+int stats_report (FILE *stream);
+
+/*
+ * Write everything measured as one JSON object in STREAM, the
+ * durations are in nanoseconds and the histograms are arrays of
+ * STATS_BUCKETS counts.
+ * return 0 on success and -1 with errno set.
+ */
+int stats_dump (FILE *stream);
+
+#endif // DR_LIB_STATS_H_
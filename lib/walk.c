@@ -0,0 +1,800 @@
+#include "walk.h"
+
+static struct walk_directory *
+walk_directory_new (struct walk_directory *parent, const char *name)
+{
+  struct walk_directory *directory;
+
+  directory = calloc (1, sizeof (struct walk_directory));
+  if (directory == NULL)
+    {
+      return NULL;
+    }
+
+  directory->parent = parent;
+  directory->name = name;
+  directory->fd = -1;
+  directory->pending = 1;
+  directory->depth = parent ? parent->depth + 1 : 0;
+
+  return directory;
+}
+
+static void
+walk_directory_free (struct walk_directory *directory)
+{
+  size_t i;
+
+  for (i = 0; i < directory->count; ++i)
+    {
+      if (directory->children[i] != NULL)
+        {
+          walk_directory_free (directory->children[i]);
+        }
+    }
+
+  if (directory->fd >= 0)
+    {
+      close (directory->fd);
+    }
+
+  if (directory->parent == NULL)
+    {
+      free ((char *)directory->name);
+    }
+
+  free (directory->children);
+  free (directory);
+}
+
+/*
+ * Drop a reference to the descriptor of DIRECTORY, it is closed
+ * once the directory and all its children were opened.
+ */
+static void
+walk_release (struct walk_directory *directory)
+{
+  if (__atomic_sub_fetch (&directory->pending, 1, __ATOMIC_ACQ_REL) == 0
+      && directory->fd >= 0)
+    {
+      close (directory->fd);
+      directory->fd = -1;
+    }
+}
+
+static int
+walk_deque_push (struct walk_deque *deque, struct walk_directory *directory)
+{
+  struct walk_directory **tasks;
+  size_t capacity;
+  size_t i;
+
+  pthread_mutex_lock (&deque->lock);
+
+  if (deque->count == deque->capacity)
+    {
+      capacity = deque->capacity ? deque->capacity * 2
+                                 : WALK_DEQUE_INITIAL_CAPACITY;
+      tasks = malloc (capacity * sizeof (struct walk_directory *));
+      if (tasks == NULL)
+        {
+          pthread_mutex_unlock (&deque->lock);
+          return -1;
+        }
+
+      for (i = 0; i < deque->count; ++i)
+        {
+          tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+
+      free (deque->tasks);
+      deque->tasks = tasks;
+      deque->capacity = capacity;
+      deque->head = 0;
+    }
+
+  deque->tasks[(deque->head + deque->count) % deque->capacity] = directory;
+  ++deque->count;
+
+  pthread_mutex_unlock (&deque->lock);
+
+  return 0;
+}
+
+/*
+ * Take the directory pushed last, for the owner of DEQUE.
+ */
+static struct walk_directory *
+walk_deque_pop (struct walk_deque *deque)
+{
+  struct walk_directory *directory = NULL;
+
+  pthread_mutex_lock (&deque->lock);
+
+  if (deque->count > 0)
+    {
+      --deque->count;
+      directory
+          = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    }
+
+  pthread_mutex_unlock (&deque->lock);
+
+  return directory;
+}
+
+/*
+ * Take the directory pushed first, for the other threads.
+ */
+static struct walk_directory *
+walk_deque_steal (struct walk_deque *deque)
+{
+  struct walk_directory *directory = NULL;
+
+  pthread_mutex_lock (&deque->lock);
+
+  if (deque->count > 0)
+    {
+      directory = deque->tasks[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+      --deque->count;
+    }
+
+  pthread_mutex_unlock (&deque->lock);
+
+  return directory;
+}
+
+static void
+walk_notify (struct walk_job *job)
+{
+  uint64_t one = 1;
+
+  if (write (job->event_fd, &one, sizeof (one)) < 0)
+    {
+      /*
+       * The counter is full, the caller already has
+       * something to read.
+       */
+    }
+}
+
+/*
+ * Give DIRECTORY to the thread SELF.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+walk_push (struct walk_job *job, int self, struct walk_directory *directory)
+{
+  __atomic_add_fetch (&job->pending, 1, __ATOMIC_RELAXED);
+
+  if (walk_deque_push (&job->deques[self], directory) != 0)
+    {
+      __atomic_sub_fetch (&job->pending, 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+
+  if (__atomic_load_n (&job->sleeping, __ATOMIC_RELAXED) > 0)
+    {
+      pthread_mutex_lock (&job->idle_lock);
+      pthread_cond_signal (&job->idle);
+      pthread_mutex_unlock (&job->idle_lock);
+    }
+
+  return 0;
+}
+
+/*
+ * Tell WALKER a directory was read, the last one ends the walk.
+ */
+static void
+walk_done (struct walk_job *job)
+{
+  if (__atomic_sub_fetch (&job->pending, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&job->idle_lock);
+  __atomic_store_n (&job->finished, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast (&job->idle);
+  pthread_cond_broadcast (&job->done);
+  pthread_mutex_unlock (&job->idle_lock);
+
+  walk_notify (job);
+}
+
+/*
+ * Get the next directory for the thread SELF, from its own deque
+ * or stolen from another one.
+ * return NULL once the walk is over.
+ */
+static struct walk_directory *
+walk_next (struct walk_job *job, int self)
+{
+  struct walk_directory *directory;
+  struct timespec deadline;
+  int i;
+
+  while (1)
+    {
+      directory = walk_deque_pop (&job->deques[self]);
+      if (directory != NULL)
+        {
+          return directory;
+        }
+
+      for (i = 1; i < job->num_threads; ++i)
+        {
+          directory = walk_deque_steal (
+              &job->deques[(self + i) % job->num_threads]);
+          if (directory != NULL)
+            {
+              return directory;
+            }
+        }
+
+      if (__atomic_load_n (&job->pending, __ATOMIC_ACQUIRE) == 0)
+        {
+          return NULL;
+        }
+
+      /*
+       * Other threads are still reading and may push more, a
+       * push without a sleeper doesn't signal so don't wait long.
+       */
+      clock_gettime (CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 1000 * 1000;
+      if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+        {
+          deadline.tv_sec += 1;
+          deadline.tv_nsec -= 1000 * 1000 * 1000;
+        }
+
+      pthread_mutex_lock (&job->idle_lock);
+      ++job->sleeping;
+      if (__atomic_load_n (&job->pending, __ATOMIC_ACQUIRE) != 0)
+        {
+          pthread_cond_timedwait (&job->idle, &job->idle_lock,
+                                  &deadline);
+        }
+      --job->sleeping;
+      pthread_mutex_unlock (&job->idle_lock);
+    }
+}
+
+/*
+ * Copy the sorted entries of STORE in DIRECTORY, with a single
+ * allocation sized for them.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+walk_directory_fill (struct walk_directory *directory,
+                     const struct entry_store *store)
+{
+  size_t count = store->count;
+  size_t length = 0;
+  char *block;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+    {
+      length += store->name[i].length + 1;
+    }
+
+  block = malloc (count * (sizeof (struct walk_directory *)
+                           + sizeof (uint32_t) + sizeof (unsigned char))
+                  + length);
+  if (block == NULL)
+    {
+      return -1;
+    }
+
+  directory->children = (struct walk_directory **)block;
+  directory->offsets
+      = (uint32_t *)(block + count * sizeof (struct walk_directory *));
+  directory->types = (unsigned char *)(directory->offsets + count);
+  directory->names = (char *)(directory->types + count);
+
+  length = 0;
+  for (i = 0; i < count; ++i)
+    {
+      directory->children[i] = NULL;
+      directory->offsets[i] = length;
+      directory->types[i] = store->type[i];
+      memcpy (directory->names + length, entry_store_name (store, i),
+              store->name[i].length + 1);
+      length += store->name[i].length + 1;
+    }
+
+  directory->count = count;
+
+  return 0;
+}
+
+/*
+ * Check if the entry INDEX of DIRECTORY must be walked into.
+ */
+static int
+walk_is_directory (struct walk_job *job,
+                   const struct walk_directory *directory, size_t index)
+{
+  struct stat st;
+
+  if (directory->types[index] == DT_DIR)
+    {
+      return 1;
+    }
+
+  if (!job->follow || directory->types[index] != DT_LNK)
+    {
+      return 0;
+    }
+
+  return fstatat (directory->fd, walk_name (directory, index), &st, 0) == 0
+         && S_ISDIR (st.st_mode);
+}
+
+/*
+ * return 1 if DIRECTORY is the same as one of its parents.
+ */
+static int
+walk_is_loop (const struct walk_directory *directory)
+{
+  const struct walk_directory *parent;
+
+  for (parent = directory->parent; parent != NULL; parent = parent->parent)
+    {
+      if (parent->dev == directory->dev && parent->ino == directory->ino)
+        {
+          return 1;
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Read DIRECTORY relative to the descriptor of its parent and give
+ * its subdirectories to the thread SELF.
+ */
+static void
+walk_read (struct walk_job *job, int self, struct walk_directory *directory,
+           struct dir_reader *reader, struct dir_batch *batch,
+           struct entry_store *scratch)
+{
+  struct walk_directory *child;
+  struct stat st;
+  size_t i;
+  int ret;
+
+  /*
+   * The root is opened even if it is a symbolic link, like the
+   * directory given to the other commands.
+   */
+  ret = dir_reader_open_at (reader,
+                            directory->parent ? directory->parent->fd
+                                              : AT_FDCWD,
+                            directory->name,
+                            job->follow || directory->parent == NULL
+                                ? 0
+                                : O_NOFOLLOW);
+
+  if (directory->parent != NULL)
+    {
+      walk_release (directory->parent);
+    }
+
+  if (ret != 0)
+    {
+      directory->error = errno;
+      return;
+    }
+
+  /*
+   * The descriptor stays with the directory so its children
+   * are opened relative to it.
+   */
+  directory->fd = reader->fd;
+  reader->fd = -1;
+
+  /*
+   * A directory reached again through another link is listed again
+   * like 'find -L' does, only one of its own parents is a loop.
+   */
+  if (job->follow)
+    {
+      if (fstat (directory->fd, &st) != 0)
+        {
+          directory->error = errno;
+          walk_release (directory);
+          return;
+        }
+
+      directory->dev = st.st_dev;
+      directory->ino = st.st_ino;
+      if (walk_is_loop (directory))
+        {
+          directory->error = ELOOP;
+          walk_release (directory);
+          return;
+        }
+    }
+
+  reader->fd = directory->fd;
+  entry_store_clear (scratch);
+
+  while ((ret = dir_reader_next_batch (reader, batch)) > 0)
+    {
+      if (entry_store_append_batch (batch, scratch) != 0)
+        {
+          ret = -1;
+          break;
+        }
+    }
+  reader->fd = -1;
+
+  if (ret < 0)
+    {
+      directory->error = errno;
+    }
+
+  if (sort_entry_store (scratch, 1) != 0
+      || walk_directory_fill (directory, scratch) != 0)
+    {
+      directory->error = ENOMEM;
+      walk_release (directory);
+      return;
+    }
+
+  __atomic_add_fetch (&job->entries, directory->count, __ATOMIC_RELAXED);
+  if (__atomic_add_fetch (&job->directories, 1, __ATOMIC_RELAXED)
+          % WALK_NOTIFY_INTERVAL
+      == 0)
+    {
+      walk_notify (job);
+    }
+
+  for (i = 0; i < directory->count; ++i)
+    {
+      if (__atomic_load_n (&job->cancel, __ATOMIC_RELAXED))
+        {
+          break;
+        }
+
+      if (!walk_is_directory (job, directory, i))
+        {
+          continue;
+        }
+
+      child = walk_directory_new (directory, walk_name (directory, i));
+      if (child == NULL)
+        {
+          continue;
+        }
+
+      __atomic_add_fetch (&directory->pending, 1, __ATOMIC_RELAXED);
+      if (walk_push (job, self, child) != 0)
+        {
+          __atomic_sub_fetch (&directory->pending, 1, __ATOMIC_RELAXED);
+          free (child);
+          continue;
+        }
+
+      directory->children[i] = child;
+    }
+
+  walk_release (directory);
+}
+
+/*
+ * Let go of JOB, the last of the threads and the caller frees it
+ * with the tree.
+ */
+static void
+walk_job_release (struct walk_job *job)
+{
+  int i;
+
+  if (__atomic_sub_fetch (&job->references, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      return;
+    }
+
+  for (i = 0; i < WALK_MAX_THREADS; ++i)
+    {
+      if (job->deques[i].job != NULL)
+        {
+          pthread_mutex_destroy (&job->deques[i].lock);
+          free (job->deques[i].tasks);
+        }
+    }
+
+  pthread_mutex_destroy (&job->idle_lock);
+  pthread_cond_destroy (&job->idle);
+  pthread_cond_destroy (&job->done);
+  close (job->event_fd);
+
+  walk_directory_free (job->root);
+  free (job);
+}
+
+static void *
+walk_worker (void *data)
+{
+  struct walk_deque *deque = data;
+  struct walk_job *job = deque->job;
+  int self = deque - job->deques;
+  struct walk_directory *directory;
+  struct entry_store scratch;
+  struct dir_reader reader;
+  struct dir_batch *batch;
+
+  entry_store_init (&scratch);
+  reader.fd = -1;
+  reader.buffer = NULL;
+  batch = malloc (sizeof (struct dir_batch));
+
+  while ((directory = walk_next (job, self)) != NULL)
+    {
+      if (batch == NULL || __atomic_load_n (&job->cancel, __ATOMIC_RELAXED))
+        {
+          directory->error = batch == NULL ? ENOMEM : ECANCELED;
+          if (directory->parent != NULL)
+            {
+              walk_release (directory->parent);
+            }
+        }
+      else
+        {
+          walk_read (job, self, directory, &reader, batch, &scratch);
+        }
+
+      walk_done (job);
+    }
+
+  dir_reader_close (&reader);
+  entry_store_free (&scratch);
+  free (batch);
+  walk_job_release (job);
+
+  return NULL;
+}
+
+int
+walk_start (struct walker *walker, const char *const dir_name, int threads,
+            int follow)
+{
+  struct walk_job *job;
+  pthread_t thread;
+  struct stat st;
+  char *name;
+  int i;
+
+  if (stat (dir_name, &st) != 0)
+    {
+      return -1;
+    }
+
+  if (!S_ISDIR (st.st_mode))
+    {
+      errno = ENOTDIR;
+      return -1;
+    }
+
+  if (threads <= 0)
+    {
+      threads = sysconf (_SC_NPROCESSORS_ONLN);
+    }
+  if (threads < 1)
+    {
+      threads = 1;
+    }
+  if (threads > WALK_MAX_THREADS)
+    {
+      threads = WALK_MAX_THREADS;
+    }
+
+  job = calloc (1, sizeof (struct walk_job));
+  if (job == NULL)
+    {
+      return -1;
+    }
+  job->follow = follow;
+
+  name = strdup (dir_name);
+  job->root = name ? walk_directory_new (NULL, name) : NULL;
+  if (job->root == NULL)
+    {
+      free (name);
+      free (job);
+      return -1;
+    }
+
+  job->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (job->event_fd < 0)
+    {
+      walk_directory_free (job->root);
+      free (job);
+      return -1;
+    }
+
+  pthread_mutex_init (&job->idle_lock, NULL);
+  pthread_cond_init (&job->idle, NULL);
+  pthread_cond_init (&job->done, NULL);
+
+  for (i = 0; i < threads; ++i)
+    {
+      pthread_mutex_init (&job->deques[i].lock, NULL);
+      job->deques[i].job = job;
+    }
+  job->num_threads = threads;
+  job->references = 1;
+
+  walk_push (job, 0, job->root);
+
+  for (i = 0; i < threads; ++i)
+    {
+      __atomic_add_fetch (&job->references, 1, __ATOMIC_RELAXED);
+      if (pthread_create (&thread, NULL, walk_worker, &job->deques[i]) != 0)
+        {
+          __atomic_sub_fetch (&job->references, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      pthread_detach (thread);
+    }
+
+  /*
+   * The walk goes on with fewer threads if some didn't start.
+   */
+  if (i == 0)
+    {
+      walk_job_release (job);
+      errno = EAGAIN;
+      return -1;
+    }
+  __atomic_store_n (&job->num_threads, i, __ATOMIC_RELAXED);
+
+  walker->job = job;
+  walker->root = job->root;
+  walker->event_fd = job->event_fd;
+
+  return 0;
+}
+
+int
+walk_finished (struct walker *walker)
+{
+  return __atomic_load_n (&walker->job->finished, __ATOMIC_ACQUIRE);
+}
+
+void
+walk_cancel (struct walker *walker)
+{
+  __atomic_store_n (&walker->job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+void
+walk_wait (struct walker *walker)
+{
+  struct walk_job *job = walker->job;
+
+  pthread_mutex_lock (&job->idle_lock);
+  while (!__atomic_load_n (&job->finished, __ATOMIC_ACQUIRE))
+    {
+      pthread_cond_wait (&job->done, &job->idle_lock);
+    }
+  pthread_mutex_unlock (&job->idle_lock);
+}
+
+size_t
+walk_directories (struct walker *walker)
+{
+  return __atomic_load_n (&walker->job->directories, __ATOMIC_RELAXED);
+}
+
+size_t
+walk_entries (struct walker *walker)
+{
+  return __atomic_load_n (&walker->job->entries, __ATOMIC_RELAXED);
+}
+
+int
+walk_visit (const struct walk_directory *directory,
+            walk_visit_callback callback, void *data)
+{
+  size_t i;
+  int ret;
+
+  for (i = 0; i < directory->count; ++i)
+    {
+      ret = callback (directory, i, data);
+      if (ret != 0)
+        {
+          return ret;
+        }
+
+      if (directory->children[i] != NULL)
+        {
+          ret = walk_visit (directory->children[i], callback, data);
+          if (ret != 0)
+            {
+              return ret;
+            }
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Write the path of DIRECTORY in BUFFER of SIZE bytes.
+ * return its length or -1 if it doesn't fit.
+ */
+static int
+walk_directory_path (const struct walk_directory *directory, char *buffer,
+                     size_t size)
+{
+  int length = 0;
+  int ret;
+
+  if (directory->parent != NULL)
+    {
+      length = walk_directory_path (directory->parent, buffer, size);
+      if (length < 0)
+        {
+          return -1;
+        }
+
+      if (length == 0 || buffer[length - 1] != '/')
+        {
+          if ((size_t)length + 1 >= size)
+            {
+              return -1;
+            }
+          buffer[length++] = '/';
+        }
+    }
+
+  ret = snprintf (buffer + length, size - length, "%s", directory->name);
+  if (ret < 0 || (size_t)ret >= size - length)
+    {
+      return -1;
+    }
+
+  return length + ret;
+}
+
+int
+walk_path (const struct walk_directory *directory, size_t index,
+           char *buffer, size_t size)
+{
+  int length;
+  int ret;
+
+  length = walk_directory_path (directory, buffer, size);
+  if (length < 0)
+    {
+      return -1;
+    }
+
+  ret = snprintf (buffer + length, size - length, "%s%s",
+                  buffer[length - 1] == '/' ? "" : "/",
+                  walk_name (directory, index));
+  if (ret < 0 || (size_t)ret >= size - length)
+    {
+      return -1;
+    }
+
+  return length + ret;
+}
+
+void
+walk_free (struct walker *walker)
+{
+  walk_cancel (walker);
+  walk_job_release (walker->job);
+  walker->job = NULL;
+  walker->root = NULL;
+  walker->event_fd = -1;
+}
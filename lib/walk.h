@@ -0,0 +1,222 @@
+/*
+ * walk - library to walk a directory tree on several threads
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_LIB_WALK_H_
+#define DR_LIB_WALK_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "sort.h"
+
+/*
+ * Maximum number of threads walking a tree.
+ */
+#define WALK_MAX_THREADS 64
+
+/*
+ * Number of directories a deque holds before it grows.
+ */
+#define WALK_DEQUE_INITIAL_CAPACITY 64
+
+/*
+ * Number of directories read between two signals of the event_fd.
+ */
+#define WALK_NOTIFY_INTERVAL 64
+
+/*
+ * A directory of the tree, its COUNT entries are sorted like
+ * 'dir_typesort', the entry I is NAMES + OFFSETS[I] of TYPES[I]
+ * and CHILDREN[I] is its directory if it was walked into.
+ * NAME points into the names of PARENT, or is the path given to
+ * 'walk_start' for the root, and ERROR is the errno value if the
+ * directory couldn't be read.
+ * FD stays open until every child was opened relative to it,
+ * PENDING counts the directory itself and the children left.
+ * DEV and INO are only known when the symbolic links are followed,
+ * a directory that is one of its own parents is a loop.
+ */
+struct walk_directory
+{
+  struct walk_directory *parent;
+  const char *name;
+  dev_t dev;
+  ino_t ino;
+  int fd;
+  int pending;
+  int error;
+  int depth;
+
+  size_t count;
+  struct walk_directory **children;
+  uint32_t *offsets;
+  unsigned char *types;
+  char *names;
+};
+
+/*
+ * Directories waiting to be read by a thread, the owner pushes and
+ * pops at the tail so it goes depth first and keeps few descriptors
+ * open, the other threads steal from the head where the largest
+ * subtrees are.
+ */
+struct walk_deque
+{
+  _Alignas (64) pthread_mutex_t lock;
+  struct walk_job *job;
+  struct walk_directory **tasks;
+  size_t head;
+  size_t count;
+  size_t capacity;
+};
+
+/*
+ * Walk of the tree under ROOT shared by the threads and the caller,
+ * every thread has its own deque and steals from the others once it
+ * is empty.
+ * PENDING counts the directories pushed and not read yet, the walk
+ * is over when it reaches 0 and DONE is then signaled.
+ * EVENT_FD is an eventfd signaled while the walk goes and once
+ * it is done, DIRECTORIES and ENTRIES count what was read.
+ * REFERENCES counts the threads and the caller, the last one to let
+ * go frees the job and the tree so a stopped walk never waits for
+ * the threads.
+ */
+struct walk_job
+{
+  struct walk_directory *root;
+  int follow;
+  int event_fd;
+
+  struct walk_deque deques[WALK_MAX_THREADS];
+  int num_threads;
+
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle;
+  pthread_cond_t done;
+  int sleeping;
+
+  size_t pending;
+  size_t directories;
+  size_t entries;
+  int cancel;
+  int finished;
+  int references;
+};
+
+/*
+ * Handle of a walk, ROOT and EVENT_FD are the ones of JOB.
+ */
+struct walker
+{
+  struct walk_job *job;
+  struct walk_directory *root;
+  int event_fd;
+};
+
+/*
+ * Called by 'walk_visit' with the entry INDEX of DIRECTORY,
+ * a non zero return value stops the visit.
+ */
+typedef int (*walk_visit_callback) (const struct walk_directory *directory,
+                                    size_t index, void *data);
+
+/*
+ * Start walking the tree under DIR_NAME on THREADS threads, or one
+ * per processor if THREADS is 0, the symbolic links to directories
+ * are walked into if FOLLOW is not 0.
+ * DIR_NAME itself may be a symbolic link, a directory reached again
+ * through another link is walked again and one that leads back to
+ * its own parents gets ELOOP.
+ * return 0 on success and -1 with errno set.
+ */
+int walk_start (struct walker *walker, const char *const dir_name,
+                int threads, int follow);
+
+/*
+ * return 1 once every directory was read.
+ */
+int walk_finished (struct walker *walker);
+
+/*
+ * Stop reading new directories, the tree keeps what was read.
+ */
+void walk_cancel (struct walker *walker);
+
+/*
+ * Wait for the walk to be over, the tree can be visited after.
+ */
+void walk_wait (struct walker *walker);
+
+/*
+ * Get the number of directories read so far.
+ */
+size_t walk_directories (struct walker *walker);
+
+/*
+ * Get the number of entries read so far.
+ */
+size_t walk_entries (struct walker *walker);
+
+/*
+ * Call CALLBACK for every entry of the tree under DIRECTORY in the
+ * order of 'dir_typesort', the entries of a directory come right
+ * after it.
+ * return 0 or the value of CALLBACK if it stopped the visit.
+ */
+int walk_visit (const struct walk_directory *directory,
+                walk_visit_callback callback, void *data);
+
+/*
+ * Get the name of the entry INDEX of DIRECTORY.
+ */
+static inline const char *
+walk_name (const struct walk_directory *directory, size_t index)
+{
+  return directory->names + directory->offsets[index];
+}
+
+/*
+ * Write the path of the entry INDEX of DIRECTORY, starting with the
+ * path of the root, in BUFFER of SIZE bytes.
+ * return the length of the path or -1 if it doesn't fit.
+ */
+int walk_path (const struct walk_directory *directory, size_t index,
+               char *buffer, size_t size);
+
+/*
+ * Cancel WALKER and let go of it and of its tree, the threads are
+ * not waited for, they can be stuck in a slow filesystem, the last
+ * one to return releases the job.
+ */
+void walk_free (struct walker *walker);
+
+#endif // DR_LIB_WALK_H_
@@ -0,0 +1,617 @@
+/*
+ * bench - time every phase of a listing and print the results as JSON
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <locale.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "list.h"
+#include "sort.h"
+#include "walk.h"
+
+/*
+ * Number of times each phase is measured when no count is given.
+ */
+#define BENCH_DEFAULT_RUNS 10
+
+/*
+ * Version of the layout of the JSON report, changed when a member is
+ * renamed or removed so older results are not compared by mistake.
+ */
+#define BENCH_FORMAT 1
+
+/*
+ * Durations of the runs of a phase in nanoseconds, every run handles
+ * ENTRIES entries.
+ */
+struct bench_phase
+{
+  uint64_t *times;
+  int runs;
+  size_t entries;
+};
+
+/*
+ * Entries of a directory in the order 'dir_read_directory' returns
+ * them, both in STORE and in the layout of scandir, SORTED holds
+ * them in the order of the list.
+ */
+struct bench_directory
+{
+  const char *path;
+  struct entry_store store;
+  struct entry_store sorted;
+  struct dirent **eps;
+  size_t count;
+  size_t capacity;
+  int threads;
+  int null_fd;
+};
+
+static uint64_t
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+bench_compare_times (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Copy the entries of BATCH in the scandir layout of the
+ * 'struct bench_directory' DATA.
+ */
+static int
+bench_append_dirents (const struct dir_batch *batch, void *data)
+{
+  struct bench_directory *directory = data;
+  const struct dir_record *record;
+  struct dirent **eps;
+  struct dirent *ep;
+  size_t capacity;
+  size_t i;
+
+  for (i = 0; i < batch->count; ++i)
+    {
+      record = &batch->records[i];
+
+      if (directory->count == directory->capacity)
+        {
+          capacity = directory->capacity == 0 ? 1024
+                                              : directory->capacity * 2;
+          eps = realloc (directory->eps, capacity * sizeof (*eps));
+          if (eps == NULL)
+            {
+              return -1;
+            }
+          directory->eps = eps;
+          directory->capacity = capacity;
+        }
+
+      ep = malloc (offsetof (struct dirent, d_name) + record->name_length
+                   + 1);
+      if (ep == NULL)
+        {
+          return -1;
+        }
+      ep->d_type = record->type;
+      memcpy (ep->d_name, record->name, record->name_length + 1);
+
+      directory->eps[directory->count++] = ep;
+    }
+
+  return entry_store_append_batch (batch, &directory->store);
+}
+
+/*
+ * Read the directory of the scan with 'dir_get_directory_entries',
+ * its entries are sorted with 'dir_typesort'.
+ */
+static int
+bench_scan (struct bench_directory *directory, size_t *entries)
+{
+  struct dirent **eps;
+  int count;
+  int i;
+
+  if (dir_get_directory_entries (directory->path, &eps, &count) != 0)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      free (eps[i]);
+    }
+  free (eps);
+  *entries = count;
+
+  return 0;
+}
+
+/*
+ * Read the directory in a store like the interface does.
+ */
+static int
+bench_read (struct bench_directory *directory, size_t *entries)
+{
+  struct entry_store store;
+  int ret;
+
+  entry_store_init (&store);
+  ret = dir_read_directory (directory->path, entry_store_append_batch,
+                            &store);
+  *entries = store.count;
+  entry_store_free (&store);
+
+  return ret != 0 ? -1 : 0;
+}
+
+/*
+ * Walk the tree under the directory like 'dr -r' does.
+ */
+static int
+bench_walk (struct bench_directory *directory, size_t *entries)
+{
+  struct walker walker;
+  int error;
+
+  if (walk_start (&walker, directory->path, directory->threads, 0) != 0)
+    {
+      return -1;
+    }
+
+  walk_wait (&walker);
+  error = walker.root->error;
+  *entries = walk_entries (&walker);
+  walk_free (&walker);
+
+  if (error != 0)
+    {
+      errno = error;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Work timed without the setup of its input: TYPESORT sorts the
+ * entries in the order they were read with 'dir_typesort', CONVERT
+ * copies the sorted entries of the scandir layout to a store, SORT
+ * sorts a store in the order they were read with the engine and the
+ * renders print the sorted store to /dev/null.
+ */
+enum bench_work
+{
+  BENCH_TYPESORT,
+  BENCH_CONVERT,
+  BENCH_SORT,
+  BENCH_RENDER_LINES,
+  BENCH_RENDER_JSON,
+};
+
+/*
+ * Copy the entries of SOURCE to STORE.
+ * return 0 on success and -1 if the allocation failed.
+ */
+static int
+bench_copy_store (struct entry_store *store, const struct entry_store *source)
+{
+  size_t i;
+
+  for (i = 0; i < source->count; ++i)
+    {
+      if (entry_store_append (store, entry_store_name (source, i),
+                              source->name[i].length, source->type[i])
+          != 0)
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Time the runs of PHASE doing WORK on the entries of DIRECTORY.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+bench_run_work (struct bench_directory *directory, enum bench_work work,
+                struct bench_phase *phase)
+{
+  struct entry_store store;
+  struct dirent **eps;
+  uint64_t start;
+  size_t i;
+  int error = 0;
+  int r;
+
+  eps = malloc ((directory->count + 1) * sizeof (*eps));
+  if (eps == NULL)
+    {
+      return -1;
+    }
+
+  memcpy (eps, directory->eps, directory->count * sizeof (*eps));
+  qsort (eps, directory->count, sizeof (*eps),
+         (int (*) (const void *, const void *))dir_typesort);
+
+  for (r = 0; r < phase->runs && error == 0; ++r)
+    {
+      entry_store_init (&store);
+
+      if (work == BENCH_TYPESORT)
+        {
+          memcpy (eps, directory->eps, directory->count * sizeof (*eps));
+        }
+      else if (work == BENCH_SORT)
+        {
+          error = bench_copy_store (&store, &directory->store);
+        }
+
+      start = bench_now ();
+
+      switch (work)
+        {
+        case BENCH_TYPESORT:
+          qsort (eps, directory->count, sizeof (*eps),
+                 (int (*) (const void *, const void *))dir_typesort);
+          break;
+
+        case BENCH_CONVERT:
+          for (i = 0; i < directory->count && error == 0; ++i)
+            {
+              error = entry_store_append (&store, eps[i]->d_name,
+                                          strlen (eps[i]->d_name),
+                                          eps[i]->d_type);
+            }
+          break;
+
+        case BENCH_SORT:
+          if (error == 0)
+            {
+              error = sort_entry_store (&store, directory->threads);
+            }
+          break;
+
+        case BENCH_RENDER_LINES:
+        case BENCH_RENDER_JSON:
+          errno = list_print_store (directory->null_fd, &directory->sorted,
+                                    work == BENCH_RENDER_JSON
+                                        ? LIST_FORMAT_JSON
+                                        : LIST_FORMAT_LINES,
+                                    0);
+          error = errno != 0 ? -1 : 0;
+          break;
+        }
+
+      phase->times[r] = bench_now () - start;
+      entry_store_free (&store);
+    }
+
+  phase->entries = directory->count;
+  free (eps);
+
+  return error != 0 ? -1 : 0;
+}
+
+/*
+ * Time the runs of PHASE with READ, which reads the whole directory
+ * and sets ENTRIES to the number of entries it found.
+ */
+static int
+bench_run_read (struct bench_directory *directory,
+                int (*read) (struct bench_directory *, size_t *),
+                struct bench_phase *phase)
+{
+  uint64_t start;
+  int r;
+
+  for (r = 0; r < phase->runs; ++r)
+    {
+      start = bench_now ();
+      if (read (directory, &phase->entries) != 0)
+        {
+          return -1;
+        }
+      phase->times[r] = bench_now () - start;
+    }
+
+  return 0;
+}
+
+/*
+ * Print STRING as a JSON string.
+ */
+static void
+bench_print_string (const char *string)
+{
+  const unsigned char *p;
+
+  putchar ('"');
+  for (p = (const unsigned char *)string; *p != '\0'; ++p)
+    {
+      if (*p == '"' || *p == '\\')
+        {
+          printf ("\\%c", *p);
+        }
+      else if (*p < 0x20)
+        {
+          printf ("\\u%04x", *p);
+        }
+      else
+        {
+          putchar (*p);
+        }
+    }
+  putchar ('"');
+}
+
+/*
+ * Get the time below which PERCENT of the sorted TIMES of RUNS runs
+ * are, by the nearest rank.
+ */
+static uint64_t
+bench_percentile (const uint64_t *times, int runs, int percent)
+{
+  int rank = (percent * runs + 99) / 100;
+
+  return times[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * Print the members of PHASE, the throughput is for the median.
+ */
+static void
+bench_print_phase (const char *name, struct bench_phase *phase, int last)
+{
+  uint64_t total = 0;
+  uint64_t median;
+  int r;
+
+  qsort (phase->times, phase->runs, sizeof (uint64_t), bench_compare_times);
+
+  for (r = 0; r < phase->runs; ++r)
+    {
+      total += phase->times[r];
+    }
+  median = bench_percentile (phase->times, phase->runs, 50);
+
+  printf ("        \"%s\": {\n", name);
+  printf ("          \"entries\": %zu,\n", phase->entries);
+  printf ("          \"min_ns\": %" PRIu64 ",\n", phase->times[0]);
+  printf ("          \"p50_ns\": %" PRIu64 ",\n", median);
+  printf ("          \"p90_ns\": %" PRIu64 ",\n",
+          bench_percentile (phase->times, phase->runs, 90));
+  printf ("          \"p99_ns\": %" PRIu64 ",\n",
+          bench_percentile (phase->times, phase->runs, 99));
+  printf ("          \"max_ns\": %" PRIu64 ",\n",
+          phase->times[phase->runs - 1]);
+  printf ("          \"mean_ns\": %" PRIu64 ",\n", total / phase->runs);
+  printf ("          \"entries_per_second\": %.0f\n",
+          median > 0 ? phase->entries * 1e9 / median : 0.0);
+  printf ("        }%s\n", last ? "" : ",");
+}
+
+/*
+ * Read the directory PATH once, then time every phase RUNS times on
+ * THREADS threads and print its JSON object.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+bench_directory (const char *path, int runs, int threads, int null_fd,
+                 int last)
+{
+  static const char *const names[] = {
+    "scan", "read", "walk", "typesort", "convert", "sort", "render_lines",
+    "render_json",
+  };
+  struct bench_phase phases[sizeof (names) / sizeof (names[0])];
+  struct bench_directory directory = { 0 };
+  size_t count = sizeof (names) / sizeof (names[0]);
+  int ret = 0;
+  size_t i;
+
+  directory.path = path;
+  directory.threads = threads;
+  directory.null_fd = null_fd;
+  entry_store_init (&directory.store);
+  entry_store_init (&directory.sorted);
+
+  for (i = 0; i < count; ++i)
+    {
+      phases[i].runs = runs;
+      phases[i].entries = 0;
+      phases[i].times = calloc (runs, sizeof (uint64_t));
+      if (phases[i].times == NULL)
+        {
+          ret = -1;
+        }
+    }
+
+  /*
+   * The directory is read once before the runs so every phase finds
+   * it in the caches, the results are for warm reads.
+   */
+  if (ret == 0
+      && dir_read_directory (path, bench_append_dirents, &directory) != 0)
+    {
+      ret = -1;
+    }
+
+  if (ret == 0
+      && (bench_copy_store (&directory.sorted, &directory.store) != 0
+          || sort_entry_store (&directory.sorted, threads) != 0))
+    {
+      ret = -1;
+    }
+
+  if (ret == 0
+      && (bench_run_read (&directory, bench_scan, &phases[0]) != 0
+          || bench_run_read (&directory, bench_read, &phases[1]) != 0
+          || bench_run_read (&directory, bench_walk, &phases[2]) != 0
+          || bench_run_work (&directory, BENCH_TYPESORT, &phases[3]) != 0
+          || bench_run_work (&directory, BENCH_CONVERT, &phases[4]) != 0
+          || bench_run_work (&directory, BENCH_SORT, &phases[5]) != 0
+          || bench_run_work (&directory, BENCH_RENDER_LINES, &phases[6])
+                 != 0
+          || bench_run_work (&directory, BENCH_RENDER_JSON, &phases[7])
+                 != 0))
+    {
+      ret = -1;
+    }
+
+  if (ret == 0)
+    {
+      printf ("    {\n");
+      printf ("      \"path\": ");
+      bench_print_string (path);
+      printf (",\n");
+      printf ("      \"entries\": %zu,\n", directory.count);
+      printf ("      \"phases\": {\n");
+      for (i = 0; i < count; ++i)
+        {
+          bench_print_phase (names[i], &phases[i], i == count - 1);
+        }
+      printf ("      }\n");
+      printf ("    }%s\n", last ? "" : ",");
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      free (phases[i].times);
+    }
+  for (i = 0; i < directory.count; ++i)
+    {
+      free (directory.eps[i]);
+    }
+  free (directory.eps);
+  entry_store_free (&directory.store);
+  entry_store_free (&directory.sorted);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  int runs = BENCH_DEFAULT_RUNS;
+  int threads = 0;
+  int null_fd;
+  int opt;
+  int i;
+
+  setlocale (LC_ALL, "");
+
+  while ((opt = getopt (argc, argv, "n:t:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          runs = strtol (optarg, NULL, 10);
+          break;
+        case 't':
+          threads = strtol (optarg, NULL, 10);
+          break;
+        default:
+          optind = argc + 1;
+          break;
+        }
+    }
+
+  if (optind >= argc || runs < 1)
+    {
+      fprintf (stderr, "usage: %s [-n RUNS] [-t THREADS] DIRECTORY...\n",
+               argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  /*
+   * Nothing is printed unless every directory can be read.
+   */
+  for (i = optind; i < argc; ++i)
+    {
+      if (access (argv[i], R_OK | X_OK) != 0)
+        {
+          perror (argv[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  null_fd = open ("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (null_fd < 0)
+    {
+      perror ("/dev/null");
+      return EXIT_FAILURE;
+    }
+
+  /*
+   * The members are always printed in the same order and the times
+   * are integers, so two reports can be compared line by line.
+   */
+  printf ("{\n");
+  printf ("  \"format\": %d,\n", BENCH_FORMAT);
+  printf ("  \"version\": \"%s\",\n", PACKAGE_VERSION);
+  printf ("  \"locale\": ");
+  bench_print_string (setlocale (LC_COLLATE, NULL));
+  printf (",\n");
+  printf ("  \"runs\": %d,\n", runs);
+  printf ("  \"threads\": %d,\n", threads);
+  printf ("  \"directories\": [\n");
+
+  for (i = optind; i < argc; ++i)
+    {
+      if (bench_directory (argv[i], runs, threads, null_fd, i == argc - 1)
+          != 0)
+        {
+          perror (argv[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  printf ("  ]\n");
+  printf ("}\n");
+
+  close (null_fd);
+
+  return EXIT_SUCCESS;
+}
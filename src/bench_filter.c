@@ -0,0 +1,255 @@
+/*
+ * bench_filter - measure the filter as a pattern is typed
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "filter.h"
+#include "sort.h"
+
+/*
+ * Number of entries of the synthetic listing when
+ * no count is given.
+ */
+#define BENCH_DEFAULT_ENTRIES 1000000
+
+/*
+ * Patterns typed when none is given.
+ */
+static const char *const bench_default_patterns[] = {
+  "main",
+  "cfg_bak",
+  "'test",
+};
+
+static double
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fill STORE with COUNT names made of words like a source tree.
+ */
+static int
+bench_fill_store (struct entry_store *store, size_t count)
+{
+  static const char *const words[] = {
+    "main", "config", "test", "util", "index", "cache", "module",
+    "Parser", "render", "build", "data", "backup", "cfg", "lib",
+    "src", "image", "thumb", "log", "event", "handler",
+  };
+  static const char *const suffixes[] = { ".c", ".h", ".txt", ".json",
+                                          ".png", ".bak", "" };
+  static const char separators[] = "_-.";
+  char name[128];
+  size_t length;
+  size_t i;
+  int words_count;
+
+  srand (42);
+
+  for (i = 0; i < count; ++i)
+    {
+      length = 0;
+      for (words_count = 1 + rand () % 3; words_count > 0; --words_count)
+        {
+          length += snprintf (name + length, sizeof (name) - length, "%s%c",
+                              words[rand () % 20],
+                              separators[rand () % 3]);
+        }
+      length += snprintf (name + length, sizeof (name) - length, "%zx%s", i,
+                          suffixes[rand () % 7]);
+
+      if (entry_store_append (store, name, length,
+                              rand () % 10 == 0 ? DT_DIR : DT_REG)
+          != 0)
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Type PATTERN one byte at a time like a user and print the time of
+ * every step, then the time to match the whole pattern at once.
+ * the names are copied first like when '/' is pressed.
+ */
+static int
+bench_type (struct filter *filter, const struct entry_store *store,
+            const char *pattern)
+{
+  char typed[FILTER_MAX_PATTERN + 1];
+  size_t length = strlen (pattern);
+  double worst = 0;
+  double time;
+  size_t i;
+
+  filter_reset (filter);
+
+  time = bench_now ();
+  if (filter_set (filter, store, "") != 0)
+    {
+      return -1;
+    }
+  time = bench_now () - time;
+  printf ("  %-12s %8zu names   %7.2f ms\n", "(copy)", store->count,
+          time * 1e3);
+
+  for (i = 1; i <= length; ++i)
+    {
+      memcpy (typed, pattern, i);
+      typed[i] = '\0';
+
+      time = bench_now ();
+      if (filter_set (filter, store, typed) != 0)
+        {
+          return -1;
+        }
+      time = bench_now () - time;
+
+      if (time > worst)
+        {
+          worst = time;
+        }
+      printf ("  %-12s %8zu matches %7.2f ms\n", typed, filter->count,
+              time * 1e3);
+    }
+
+  if (filter_set (filter, store, "") != 0)
+    {
+      return -1;
+    }
+
+  time = bench_now ();
+  if (filter_set (filter, store, pattern) != 0)
+    {
+      return -1;
+    }
+  time = bench_now () - time;
+
+  printf ("  worst key: %.2f ms, from scratch: %.2f ms\n", worst * 1e3,
+          time * 1e3);
+  if (filter->count > 0)
+    {
+      printf ("  best match: %s\n",
+              entry_store_name (store, filter_entry (filter, 0)));
+    }
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct entry_store store;
+  struct filter filter;
+  size_t count = BENCH_DEFAULT_ENTRIES;
+  size_t i;
+  int threads = 1;
+  int status = EXIT_SUCCESS;
+
+  /*
+   * The first argument is the number of entries or a directory,
+   * the second the number of threads, 0 means one per processor,
+   * and the others are the patterns.
+   */
+  entry_store_init (&store);
+  if (argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9'))
+    {
+      if (dir_read_directory (argv[1], entry_store_append_batch, &store)
+          != 0)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+  else
+    {
+      if (argc > 1)
+        {
+          count = strtoul (argv[1], NULL, 10);
+        }
+
+      if (bench_fill_store (&store, count) != 0)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (argc > 2)
+    {
+      threads = strtol (argv[2], NULL, 10);
+    }
+
+  /*
+   * The list on screen is sorted, the names are not in the order
+   * of the arena anymore.
+   */
+  if (sort_entry_store (&store, threads) != 0)
+    {
+      return EXIT_FAILURE;
+    }
+
+  filter_init (&filter, threads);
+
+  printf ("entries: %zu\n", store.count);
+  printf ("kernel: %s\n", filter_kernel_name ());
+  printf ("threads: %d\n", sort_threads_for (store.count, threads));
+
+  if (argc > 3)
+    {
+      for (i = 3; i < (size_t)argc && status == EXIT_SUCCESS; ++i)
+        {
+          printf ("pattern: %s\n", argv[i]);
+          if (bench_type (&filter, &store, argv[i]) != 0)
+            {
+              status = EXIT_FAILURE;
+            }
+        }
+    }
+  else
+    {
+      for (i = 0; i < sizeof (bench_default_patterns) / sizeof (char *)
+                  && status == EXIT_SUCCESS;
+           ++i)
+        {
+          printf ("pattern: %s\n", bench_default_patterns[i]);
+          if (bench_type (&filter, &store, bench_default_patterns[i]) != 0)
+            {
+              status = EXIT_FAILURE;
+            }
+        }
+    }
+
+  filter_free (&filter);
+  entry_store_free (&store);
+
+  return status;
+}
@@ -0,0 +1,211 @@
+/*
+ * bench_sort - compare the sort engine with 'dir_typesort'
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dir.h"
+#include "entry.h"
+#include "sort.h"
+
+/*
+ * Number of entries of the synthetic listing when
+ * no count is given.
+ */
+#define BENCH_DEFAULT_ENTRIES 1000000
+
+static double
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fill STORE with COUNT unique names, about one in ten is a
+ * directory and one in twenty is hidden, like a build directory.
+ */
+static int
+bench_fill_store (struct entry_store *store, size_t count)
+{
+  static const char charset[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "0123456789._-";
+  char name[64];
+  unsigned char type;
+  size_t length;
+  size_t i;
+  size_t c;
+
+  srand (42);
+
+  for (i = 0; i < count; ++i)
+    {
+      length = 0;
+
+      if (rand () % 20 == 0)
+        {
+          name[length++] = '.';
+        }
+
+      for (c = 4 + rand () % 20; c > 0; --c)
+        {
+          name[length++] = charset[rand () % (sizeof (charset) - 1)];
+        }
+
+      length += snprintf (name + length, sizeof (name) - length, "%zx", i);
+      type = rand () % 10 == 0 ? DT_DIR : DT_REG;
+
+      if (entry_store_append (store, name, length, type) != 0)
+        {
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct entry_store store;
+  struct entry_store sorted;
+  struct dirent **eps;
+  size_t count = BENCH_DEFAULT_ENTRIES;
+  int threads = 1;
+  double start;
+  double typesort_time;
+  double engine_time;
+  size_t length;
+  size_t i;
+
+  setlocale (LC_ALL, "");
+
+  /*
+   * The second argument is the number of sort threads,
+   * 0 means one per processor.
+   */
+  if (argc > 2)
+    {
+      threads = strtol (argv[2], NULL, 10);
+    }
+
+  entry_store_init (&store);
+  entry_store_init (&sorted);
+
+  /*
+   * Sort a real directory when a path is given,
+   * a synthetic listing of COUNT entries otherwise.
+   */
+  if (argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9'))
+    {
+      if (dir_read_directory (argv[1], entry_store_append_batch, &store) != 0)
+        {
+          return EXIT_FAILURE;
+        }
+      count = store.count;
+    }
+  else
+    {
+      if (argc > 1)
+        {
+          count = strtoul (argv[1], NULL, 10);
+        }
+
+      if (bench_fill_store (&store, count) != 0)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+
+  /*
+   * Same layout as scandir returns.
+   */
+  eps = malloc (count * sizeof (struct dirent *));
+  if (eps == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      length = store.name[i].length;
+      eps[i] = malloc (offsetof (struct dirent, d_name) + length + 1);
+      if (eps[i] == NULL)
+        {
+          return EXIT_FAILURE;
+        }
+      eps[i]->d_type = store.type[i];
+      memcpy (eps[i]->d_name, entry_store_name (&store, i), length + 1);
+
+      if (entry_store_append (&sorted, entry_store_name (&store, i), length,
+                              store.type[i])
+          != 0)
+        {
+          return EXIT_FAILURE;
+        }
+    }
+
+  start = bench_now ();
+  qsort (eps, count, sizeof (struct dirent *),
+         (int (*) (const void *, const void *))dir_typesort);
+  typesort_time = bench_now () - start;
+
+  start = bench_now ();
+  if (sort_entry_store (&sorted, threads) != 0)
+    {
+      return EXIT_FAILURE;
+    }
+  engine_time = bench_now () - start;
+
+  for (i = 0; i < count; ++i)
+    {
+      if (strcmp (eps[i]->d_name, entry_store_name (&sorted, i)) != 0)
+        {
+          fprintf (stderr, "order differs at %zu: '%s' '%s'\n", i,
+                   eps[i]->d_name, entry_store_name (&sorted, i));
+          return EXIT_FAILURE;
+        }
+    }
+
+  printf ("entries: %zu\n", count);
+  printf ("locale: %s (%s keys)\n", setlocale (LC_COLLATE, NULL),
+          sort_collate_is_bytewise () ? "byte" : "strxfrm");
+  printf ("threads: %d\n", sort_threads_for (count, threads));
+  printf ("dir_typesort: %.3f s\n", typesort_time);
+  printf ("sort engine: %.3f s\n", engine_time);
+  printf ("speedup: %.2fx\n", typesort_time / engine_time);
+
+  for (i = 0; i < count; ++i)
+    {
+      free (eps[i]);
+    }
+  free (eps);
+  entry_store_free (&store);
+  entry_store_free (&sorted);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,179 @@
+/*
+ * bench_start - compare the ways to get a sorted listing on screen
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "dir.h"
+#include "entry.h"
+#include "snap.h"
+#include "sort.h"
+
+/*
+ * Number of times each start is measured, the best time is kept.
+ */
+#define BENCH_RUNS 5
+
+static double
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Read and sort the directory like a start without cache.
+ */
+static int
+bench_cold (const char *path, __attribute__ ((unused)) const struct stat *st,
+            struct entry_store *store)
+{
+  if (dir_read_directory (path, entry_store_append_batch, store) != 0)
+    {
+      return -1;
+    }
+
+  return sort_entry_store (store, 0);
+}
+
+static int
+bench_snapshot (__attribute__ ((unused)) const char *path,
+                const struct stat *st, struct entry_store *store)
+{
+  return snap_load (st, store);
+}
+
+static int
+bench_daemon (const char *path, const struct stat *st,
+              struct entry_store *store)
+{
+  return daemon_fetch (path, st, store);
+}
+
+/*
+ * Print the best time of BENCH_RUNS runs of START for the directory
+ * PATH of ST, everything the first frame needs is in the store once
+ * it returns.
+ * return 0 on success and -1 if START failed.
+ */
+static int
+bench_start (const char *label,
+             int (*start) (const char *, const struct stat *,
+                           struct entry_store *),
+             const char *path, const struct stat *st)
+{
+  struct entry_store store;
+  double best = 0;
+  double time;
+  size_t count = 0;
+  int i;
+
+  for (i = 0; i < BENCH_RUNS; ++i)
+    {
+      entry_store_init (&store);
+
+      time = bench_now ();
+      if (start (path, st, &store) != 0)
+        {
+          printf ("%s: unavailable (%s)\n", label, strerror (errno));
+          entry_store_free (&store);
+          return -1;
+        }
+      time = bench_now () - time;
+
+      if (i == 0 || time < best)
+        {
+          best = time;
+        }
+      count = store.count;
+
+      entry_store_free (&store);
+    }
+
+  printf ("%s: %.3f ms (%zu entries)\n", label, best * 1e3, count);
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct entry_store store;
+  char path[PATH_MAX];
+  struct stat st;
+
+  setlocale (LC_ALL, "");
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s DIRECTORY\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (realpath (argv[1], path) == NULL || stat (path, &st) != 0)
+    {
+      perror (argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  /*
+   * The snapshot is written here so the directory needs no
+   * previous visit, the daemon must be started with 'dr --daemon'.
+   */
+  entry_store_init (&store);
+  if (bench_cold (path, &st, &store) != 0)
+    {
+      perror ("snapshot");
+      return EXIT_FAILURE;
+    }
+
+  /*
+   * A directory that just changed is not saved, the tree may have
+   * just been generated.
+   */
+  while (snap_save (&st, &store) != 0)
+    {
+      if (errno != EAGAIN)
+        {
+          perror ("snapshot");
+          return EXIT_FAILURE;
+        }
+      sleep (1);
+    }
+  entry_store_free (&store);
+
+  printf ("directory: %s\n", path);
+  bench_start ("cold start", bench_cold, path, &st);
+  bench_start ("snapshot", bench_snapshot, path, &st);
+  bench_start ("daemon", bench_daemon, path, &st);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+/*
+ * bench_tree - generate the synthetic directories of the benchmarks
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Number of entries of the flat directory when no count is given,
+ * the others are a tenth of it.
+ */
+#define BENCH_DEFAULT_ENTRIES 100000
+
+/*
+ * Levels of the deep tree and entries in each of them.
+ */
+#define BENCH_DEEP_LEVELS 64
+#define BENCH_DEEP_ENTRIES 32
+
+/*
+ * Pieces the names of the unicode directory are made of: accents,
+ * decomposed accents, other scripts, wide characters and an emoji,
+ * mixed with cases that only differ by their capitals.
+ */
+static const char *const bench_pieces[] = {
+  "a",        "B",        "z",        "\xc3\xa9", "\xc3\x89",
+  "e\xcc\x81", "\xc3\x9f", "\xc3\xbc", "\xd0\xb6", "\xd0\x96",
+  "\xce\xbb", "\xe4\xb8\xad", "\xe6\x96\x87", "\xed\x95\x9c",
+  "\xf0\x9f\x99\x82", "_", "-", " ",
+};
+
+#define BENCH_PIECES (sizeof (bench_pieces) / sizeof (bench_pieces[0]))
+
+/*
+ * Create the entry NAME in DIR_FD, one in ten is a directory, one in
+ * twenty a symbolic link, one in thirty a named pipe and one in
+ * fifty a socket when MIXED is set, the others are empty files.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+bench_create (int dir_fd, const char *name, int mixed)
+{
+  int kind = mixed ? rand () % 100 : 99;
+  int fd;
+
+  if (kind < 10)
+    {
+      return mkdirat (dir_fd, name, 0755);
+    }
+  if (kind < 15)
+    {
+      return symlinkat ("../target", dir_fd, name);
+    }
+  if (kind < 18)
+    {
+      return mknodat (dir_fd, name, S_IFIFO | 0644, 0);
+    }
+  if (kind < 20)
+    {
+      return mknodat (dir_fd, name, S_IFSOCK | 0644, 0);
+    }
+
+  fd = openat (dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  return close (fd);
+}
+
+/*
+ * Create the directory NAME in PARENT_FD and open it.
+ * return its descriptor or -1 with errno set.
+ */
+static int
+bench_mkdir (int parent_fd, const char *name)
+{
+  if (mkdirat (parent_fd, name, 0755) != 0)
+    {
+      return -1;
+    }
+
+  return openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/*
+ * Fill the directory NAME of PARENT_FD with COUNT entries of every
+ * type whose names look like a build directory, about one in twenty
+ * is hidden.
+ * the names of this directory and of the next ones end with their
+ * index after a '-' so they are all different.
+ */
+static int
+bench_flat (int parent_fd, const char *name, size_t count)
+{
+  static const char charset[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "0123456789._-";
+  char entry[64];
+  size_t length;
+  size_t i;
+  size_t c;
+  int ret = 0;
+  int fd;
+
+  fd = bench_mkdir (parent_fd, name);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < count && ret == 0; ++i)
+    {
+      length = 0;
+
+      if (rand () % 20 == 0)
+        {
+          entry[length++] = '.';
+        }
+
+      for (c = 4 + rand () % 20; c > 0; --c)
+        {
+          entry[length++] = charset[rand () % (sizeof (charset) - 1)];
+        }
+
+      snprintf (entry + length, sizeof (entry) - length, "-%zx", i);
+      ret = bench_create (fd, entry, 1);
+    }
+
+  close (fd);
+
+  return ret;
+}
+
+/*
+ * Fill the directory NAME of PARENT_FD with COUNT files whose names
+ * are between 200 bytes and NAME_MAX, they only differ at the end.
+ */
+static int
+bench_long (int parent_fd, const char *name, size_t count)
+{
+  char entry[NAME_MAX + 1];
+  size_t length;
+  size_t i;
+  int ret = 0;
+  int fd;
+
+  fd = bench_mkdir (parent_fd, name);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < count && ret == 0; ++i)
+    {
+      length = 200 + rand () % (NAME_MAX - 200 - 16);
+      memset (entry, 'a' + rand () % 26, length);
+      snprintf (entry + length, sizeof (entry) - length, "-%zx", i);
+      ret = bench_create (fd, entry, 0);
+    }
+
+  close (fd);
+
+  return ret;
+}
+
+/*
+ * Fill the directory NAME of PARENT_FD with COUNT files whose names
+ * are made of up to twelve of BENCH_PIECES.
+ */
+static int
+bench_unicode (int parent_fd, const char *name, size_t count)
+{
+  char entry[NAME_MAX + 1];
+  const char *piece;
+  size_t length;
+  size_t i;
+  size_t c;
+  int ret = 0;
+  int fd;
+
+  fd = bench_mkdir (parent_fd, name);
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  for (i = 0; i < count && ret == 0; ++i)
+    {
+      length = 0;
+
+      for (c = 1 + rand () % 12; c > 0; --c)
+        {
+          piece = bench_pieces[rand () % BENCH_PIECES];
+          memcpy (entry + length, piece, strlen (piece));
+          length += strlen (piece);
+        }
+
+      snprintf (entry + length, sizeof (entry) - length, "-%zx", i);
+      ret = bench_create (fd, entry, 0);
+    }
+
+  close (fd);
+
+  return ret;
+}
+
+/*
+ * Create the directory NAME of PARENT_FD with BENCH_DEEP_LEVELS
+ * levels of directories, each holding the next one and
+ * BENCH_DEEP_ENTRIES entries of every type.
+ */
+static int
+bench_deep (int parent_fd, const char *name)
+{
+  char entry[32];
+  int level;
+  int next;
+  int ret = 0;
+  int fd;
+  int i;
+
+  fd = bench_mkdir (parent_fd, name);
+
+  for (level = 0; level < BENCH_DEEP_LEVELS && fd >= 0 && ret == 0; ++level)
+    {
+      for (i = 0; i < BENCH_DEEP_ENTRIES && ret == 0; ++i)
+        {
+          snprintf (entry, sizeof (entry), "entry-%d-%d", level, i);
+          ret = bench_create (fd, entry, 1);
+        }
+
+      next = ret == 0 ? bench_mkdir (fd, "next") : -1;
+      close (fd);
+      fd = next;
+    }
+
+  if (fd < 0)
+    {
+      return -1;
+    }
+  close (fd);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t count = BENCH_DEFAULT_ENTRIES;
+  int fd;
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s DIRECTORY [ENTRIES]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (argc > 2)
+    {
+      count = strtoul (argv[2], NULL, 10);
+    }
+
+  /*
+   * The same trees every time so two runs can be compared,
+   * DIRECTORY must not exist yet.
+   */
+  srand (42);
+
+  fd = bench_mkdir (AT_FDCWD, argv[1]);
+  if (fd < 0 || bench_flat (fd, "flat", count) != 0
+      || bench_long (fd, "long", count / 10) != 0
+      || bench_unicode (fd, "unicode", count / 10) != 0
+      || bench_deep (fd, "deep") != 0)
+    {
+      perror (argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  close (fd);
+
+  return EXIT_SUCCESS;
+}
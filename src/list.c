@@ -0,0 +1,867 @@
+#include "list.h"
+
+/*
+ * Copy the string literal TEXT at P and move P after it.
+ */
+#define LIST_PUT_TEXT(p, text)                                                \
+  do                                                                          \
+    {                                                                         \
+      memcpy ((p), (text), sizeof (text) - 1);                                \
+      (p) += sizeof (text) - 1;                                               \
+    }                                                                         \
+  while (0)
+
+/*
+ * Write VALUE in decimal at P.
+ * return the end of what was written.
+ */
+static char *
+list_put_decimal (char *p, int64_t value)
+{
+  char digits[24];
+  size_t position = sizeof (digits);
+  uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+  do
+    {
+      digits[--position] = '0' + magnitude % 10;
+      magnitude /= 10;
+    }
+  while (magnitude > 0);
+
+  if (value < 0)
+    {
+      digits[--position] = '-';
+    }
+
+  memcpy (p, digits + position, sizeof (digits) - position);
+
+  return p + sizeof (digits) - position;
+}
+
+/*
+ * Get the length of the UTF-8 sequence at the start of the LENGTH
+ * bytes of S, the overlong forms, the surrogates and the code points
+ * past U+10FFFF are not valid.
+ * return 0 if it is not a valid sequence.
+ */
+static size_t
+list_utf8_length (const unsigned char *s, size_t length)
+{
+  size_t count;
+  size_t i;
+
+  if (s[0] < 0xc2 || s[0] > 0xf4)
+    {
+      return 0;
+    }
+
+  count = s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 : 4;
+  if (length < count)
+    {
+      return 0;
+    }
+
+  for (i = 1; i < count; ++i)
+    {
+      if ((s[i] & 0xc0) != 0x80)
+        {
+          return 0;
+        }
+    }
+
+  if ((s[0] == 0xe0 && s[1] < 0xa0) || (s[0] == 0xed && s[1] > 0x9f)
+      || (s[0] == 0xf0 && s[1] < 0x90) || (s[0] == 0xf4 && s[1] > 0x8f))
+    {
+      return 0;
+    }
+
+  return count;
+}
+
+/*
+ * Write the JSON string of the LENGTH bytes of NAME at P, only the
+ * quotes, the backslashes and the control characters are escaped,
+ * the other bytes are written as they are.
+ * a name that is not valid UTF-8 would make the whole line invalid,
+ * each byte that isn't part of a valid sequence is replaced with
+ * U+FFFD, the null output keeps the exact names.
+ * P must have room for LIST_LINE_SIZE (LENGTH) bytes.
+ * return the end of what was written.
+ */
+static char *
+list_put_json_string (char *p, const char *name, size_t length)
+{
+  static const char hex[] = "0123456789abcdef";
+  unsigned char c;
+  size_t sequence;
+  size_t start = 0;
+  size_t i = 0;
+
+  *p++ = '"';
+
+  while (i < length)
+    {
+      c = name[i];
+      if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+        {
+          ++i;
+          continue;
+        }
+
+      if (c >= 0x80)
+        {
+          sequence = list_utf8_length ((const unsigned char *)name + i,
+                                       length - i);
+          if (sequence > 0)
+            {
+              i += sequence;
+              continue;
+            }
+        }
+
+      memcpy (p, name + start, i - start);
+      p += i - start;
+      start = i + 1;
+
+      switch (c)
+        {
+        case '"':
+          LIST_PUT_TEXT (p, "\\\"");
+          break;
+        case '\\':
+          LIST_PUT_TEXT (p, "\\\\");
+          break;
+        case '\n':
+          LIST_PUT_TEXT (p, "\\n");
+          break;
+        case '\t':
+          LIST_PUT_TEXT (p, "\\t");
+          break;
+        default:
+          if (c >= 0x80)
+            {
+              LIST_PUT_TEXT (p, "\\ufffd");
+              break;
+            }
+          LIST_PUT_TEXT (p, "\\u00");
+          *p++ = hex[c >> 4];
+          *p++ = hex[c & 0xf];
+          break;
+        }
+
+      ++i;
+    }
+
+  memcpy (p, name + start, length - start);
+  p += length - start;
+  *p++ = '"';
+
+  return p;
+}
+
+/*
+ * Get the name of TYPE in the JSON output.
+ */
+static const char *
+list_type_name (unsigned char type)
+{
+  switch (type)
+    {
+    case DT_DIR:
+      return "directory";
+    case DT_REG:
+      return "file";
+    case DT_LNK:
+      return "link";
+    case DT_FIFO:
+      return "fifo";
+    case DT_SOCK:
+      return "socket";
+    case DT_CHR:
+      return "character";
+    case DT_BLK:
+      return "block";
+    default:
+      return "unknown";
+    }
+}
+
+/*
+ * Write the JSON name of TYPE at P.
+ * return the end of what was written.
+ */
+static char *
+list_put_type_name (char *p, unsigned char type)
+{
+  const char *name = list_type_name (type);
+  size_t length = strlen (name);
+
+  *p++ = '"';
+  memcpy (p, name, length);
+  p += length;
+  *p++ = '"';
+
+  return p;
+}
+
+/*
+ * Get the letter of TYPE like 'ls -l' shows it.
+ */
+static char
+list_type_letter (unsigned char type)
+{
+  switch (type)
+    {
+    case DT_DIR:
+      return 'd';
+    case DT_REG:
+      return '-';
+    case DT_LNK:
+      return 'l';
+    case DT_FIFO:
+      return 'p';
+    case DT_SOCK:
+      return 's';
+    case DT_CHR:
+      return 'c';
+    case DT_BLK:
+      return 'b';
+    default:
+      return '?';
+    }
+}
+
+/*
+ * Write the permission bits of MODE in octal at P.
+ * return the end of what was written.
+ */
+static char *
+list_put_mode (char *p, mode_t mode)
+{
+  int i;
+
+  for (i = 3; i >= 0; --i)
+    {
+      p[i] = '0' + (mode & 07);
+      mode >>= 3;
+    }
+
+  return p + 4;
+}
+
+/*
+ * Add the entry INDEX of STORE followed by the terminator of FORMAT,
+ * the line is written in place in the buffer of OUTPUT.
+ * DIRECTORY is the path of the directory the entries are in when
+ * several were asked for and NULL otherwise, it is the "directory"
+ * member of the JSON objects and prefixes the names separated by
+ * nulls.
+ */
+static void
+list_print_store_entry (struct output *output,
+                        const struct entry_store *store, size_t index,
+                        enum list_format format, int metadata,
+                        const char *directory)
+{
+  const char *name = entry_store_name (store, index);
+  size_t length = store->name[index].length;
+  size_t directory_length = directory != NULL ? strlen (directory) : 0;
+  int ready = entry_store_meta_state (store, index) == ENTRY_META_READY;
+  char *start = output_reserve (output, LIST_LINE_SIZE (length
+                                                        + directory_length));
+  char *p = start;
+
+  if (format == LIST_FORMAT_JSON)
+    {
+      LIST_PUT_TEXT (p, "{\"name\":");
+      p = list_put_json_string (p, name, length);
+      if (directory != NULL)
+        {
+          LIST_PUT_TEXT (p, ",\"directory\":");
+          p = list_put_json_string (p, directory, directory_length);
+        }
+      LIST_PUT_TEXT (p, ",\"type\":");
+      p = list_put_type_name (p, store->type[index]);
+
+      if (metadata && ready)
+        {
+          LIST_PUT_TEXT (p, ",\"mode\":\"");
+          p = list_put_mode (p, store->mode[index]);
+          LIST_PUT_TEXT (p, "\",\"size\":");
+          p = list_put_decimal (p, store->size[index]);
+          LIST_PUT_TEXT (p, ",\"mtime\":");
+          p = list_put_decimal (p, store->mtime[index]);
+        }
+      else if (metadata)
+        {
+          LIST_PUT_TEXT (p, ",\"mode\":null,\"size\":null,\"mtime\":null");
+        }
+
+      LIST_PUT_TEXT (p, "}\n");
+      output_commit (output, p - start);
+      return;
+    }
+
+  /*
+   * The columns are separated by tabs and the name comes last so
+   * it can hold any byte but the terminator.
+   */
+  if (metadata)
+    {
+      *p++ = list_type_letter (store->type[index]);
+      *p++ = '\t';
+      if (ready)
+        {
+          p = list_put_mode (p, store->mode[index]);
+          *p++ = '\t';
+          p = list_put_decimal (p, store->size[index]);
+          *p++ = '\t';
+          p = list_put_decimal (p, store->mtime[index]);
+          *p++ = '\t';
+        }
+      else
+        {
+          LIST_PUT_TEXT (p, "-\t-\t-\t");
+        }
+    }
+
+  if (directory != NULL && format == LIST_FORMAT_NULL)
+    {
+      memcpy (p, directory, directory_length);
+      p += directory_length;
+      if (directory_length > 0 && directory[directory_length - 1] != '/')
+        {
+          *p++ = '/';
+        }
+    }
+
+  memcpy (p, name, length);
+  p += length;
+  *p++ = format == LIST_FORMAT_NULL ? '\0' : '\n';
+
+  output_commit (output, p - start);
+}
+
+/*
+ * Read the entries of the directory DIR_FD in STORE and sort them.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+list_read_store (int dir_fd, struct entry_store *store, int threads)
+{
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  uint64_t start = stats_start ();
+  int saved_errno;
+  int ret;
+
+  batch = malloc (sizeof (struct dir_batch));
+  if (batch == NULL)
+    {
+      return -1;
+    }
+
+  reader.buffer = NULL;
+  if (dir_reader_open_at (&reader, dir_fd, ".", 0) != 0)
+    {
+      saved_errno = errno;
+      free (batch);
+      errno = saved_errno;
+      return -1;
+    }
+
+  while ((ret = dir_reader_next_batch (&reader, batch)) > 0)
+    {
+      if (entry_store_append_batch (batch, store) != 0)
+        {
+          errno = ENOMEM;
+          ret = -1;
+          break;
+        }
+    }
+
+  saved_errno = errno;
+  free (batch);
+  dir_reader_close (&reader);
+  stats_stop (STATS_READ, start);
+
+  if (ret < 0)
+    {
+      errno = saved_errno;
+      return -1;
+    }
+
+  if (sort_entry_store (store, threads) != 0)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Fetch the metadata of the entries of STORE that don't have it and
+ * wait for it.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+list_fetch_meta (const char *path, struct entry_store *store)
+{
+  struct meta_fetcher meta;
+  struct pollfd pfd;
+  uint64_t events;
+
+  if (store->count == 0)
+    {
+      return 0;
+    }
+
+  if (meta_start (&meta, path, store) != 0)
+    {
+      return -1;
+    }
+
+  pfd.fd = meta.event_fd;
+  pfd.events = POLLIN;
+
+  while (!meta_finished (&meta))
+    {
+      if (poll (&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+          break;
+        }
+
+      if (read (meta.event_fd, &events, sizeof (events)) < 0
+          && errno != EAGAIN)
+        {
+          break;
+        }
+    }
+
+  meta_stop (&meta);
+
+  return 0;
+}
+
+/*
+ * Get the listing of DIR_NAME in STORE like 'list_directories' says.
+ * return 0 or the errno value of the error that stopped it.
+ */
+static int
+list_load (const char *dir_name, struct entry_store *store, int threads,
+           int metadata, int snapshots)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  uint64_t start;
+  int dir_fd;
+  int error = 0;
+  int loaded;
+
+  if (realpath (dir_name, path) == NULL)
+    {
+      return errno;
+    }
+
+  dir_fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+    {
+      return errno;
+    }
+
+  /*
+   * The directory is stated before it is read, a change during the
+   * read leaves a newer mtime and the snapshot won't be used.
+   */
+  if (fstat (dir_fd, &st) != 0)
+    {
+      close (dir_fd);
+      return errno;
+    }
+
+  loaded = 0;
+  if (snapshots)
+    {
+      start = stats_start ();
+      loaded = daemon_fetch (path, &st, store) == 0
+               || snap_load (&st, store) == 0;
+      stats_stop (STATS_LOAD, start);
+    }
+
+  if (loaded)
+    {
+      error = 0;
+    }
+  else if (list_read_store (dir_fd, store, threads) != 0)
+    {
+      error = errno;
+    }
+  else if (snapshots && store->count >= SNAP_MIN_ENTRIES)
+    {
+      snap_save (&st, store);
+    }
+
+  close (dir_fd);
+
+  if (error == 0 && metadata && list_fetch_meta (path, store) != 0)
+    {
+      error = errno;
+    }
+
+  return error;
+}
+
+/*
+ * Listing of one of the directories given to 'list_directories',
+ * DONE is set once STORE holds it or ERROR says why it couldn't.
+ */
+struct list_job
+{
+  const char *name;
+  struct entry_store store;
+  int error;
+  int done;
+};
+
+/*
+ * Jobs loaded by the workers, each takes the job NEXT until there is
+ * none left and signals DONE when it finished one.
+ */
+struct list_pool
+{
+  struct list_job *jobs;
+  size_t count;
+  size_t next;
+  int threads;
+  int metadata;
+  int snapshots;
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+};
+
+static void *
+list_worker (void *data)
+{
+  struct list_pool *pool = data;
+  struct list_job *job;
+  int error;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&pool->mutex);
+      if (pool->next == pool->count)
+        {
+          pthread_mutex_unlock (&pool->mutex);
+          return NULL;
+        }
+      job = &pool->jobs[pool->next++];
+      pthread_mutex_unlock (&pool->mutex);
+
+      error = list_load (job->name, &job->store, pool->threads,
+                         pool->metadata, pool->snapshots);
+
+      pthread_mutex_lock (&pool->mutex);
+      job->error = error;
+      job->done = 1;
+      pthread_cond_broadcast (&pool->done);
+      pthread_mutex_unlock (&pool->mutex);
+    }
+}
+
+/*
+ * Add the entries of JOB to OUTPUT, as a section headed by its name
+ * like 'ls' does when there are several directories.
+ */
+static void
+list_print_job (struct output *output, const struct list_job *job,
+                size_t index, size_t count, enum list_format format,
+                int metadata)
+{
+  const char *directory = count > 1 ? job->name : NULL;
+  size_t length = strlen (job->name);
+  char *start;
+  char *p;
+  size_t i;
+
+  if (count > 1 && format == LIST_FORMAT_LINES)
+    {
+      start = output_reserve (output, length + 3);
+      p = start;
+      if (index > 0)
+        {
+          *p++ = '\n';
+        }
+      memcpy (p, job->name, length);
+      p += length;
+      LIST_PUT_TEXT (p, ":\n");
+      output_commit (output, p - start);
+      directory = NULL;
+    }
+
+  for (i = 0; i < job->store.count && output->error == 0; ++i)
+    {
+      list_print_store_entry (output, &job->store, i, format, metadata,
+                              directory);
+    }
+}
+
+int
+list_print_store (int fd, const struct entry_store *store,
+                  enum list_format format, int metadata)
+{
+  struct output output;
+  int error = 0;
+  size_t i;
+
+  if (output_init (&output, fd) != 0)
+    {
+      return ENOMEM;
+    }
+
+  for (i = 0; i < store->count && output.error == 0; ++i)
+    {
+      list_print_store_entry (&output, store, i, format, metadata, NULL);
+    }
+
+  if (output_flush (&output) != 0)
+    {
+      error = errno;
+    }
+  output_free (&output);
+
+  return error;
+}
+
+int
+list_directories (const char *const *dir_names, size_t count, int threads,
+                  enum list_format format, int metadata, int snapshots)
+{
+  pthread_t workers[LIST_MAX_WORKERS];
+  struct list_pool pool;
+  struct output output;
+  struct list_job *job;
+  size_t started = 0;
+  uint64_t start;
+  int failed = 0;
+  int error = 0;
+  size_t i;
+
+  pool.jobs = calloc (count, sizeof (struct list_job));
+  if (pool.jobs == NULL)
+    {
+      return ENOMEM;
+    }
+
+  if (output_init (&output, STDOUT_FILENO) != 0)
+    {
+      free (pool.jobs);
+      return ENOMEM;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      pool.jobs[i].name = dir_names[i];
+      entry_store_init (&pool.jobs[i].store);
+    }
+
+  pool.count = count;
+  pool.next = 0;
+  pool.threads = threads;
+  pool.metadata = metadata;
+  pool.snapshots = snapshots;
+  pthread_mutex_init (&pool.mutex, NULL);
+  pthread_cond_init (&pool.done, NULL);
+
+  /*
+   * The directories are mostly waited for, on slow mounts, so they
+   * are all read at once and the whole takes about as long as the
+   * slowest of them, one alone is read here.
+   */
+  while (count > 1 && started < count && started < LIST_MAX_WORKERS
+         && pthread_create (&workers[started], NULL, list_worker, &pool)
+                == 0)
+    {
+      ++started;
+    }
+
+  if (started == 0)
+    {
+      list_worker (&pool);
+    }
+
+  for (i = 0; i < count && output.error == 0; ++i)
+    {
+      job = &pool.jobs[i];
+
+      pthread_mutex_lock (&pool.mutex);
+      while (!job->done)
+        {
+          pthread_cond_wait (&pool.done, &pool.mutex);
+        }
+      pthread_mutex_unlock (&pool.mutex);
+
+      if (job->error == 0)
+        {
+          start = stats_start ();
+          list_print_job (&output, job, i, count, format, metadata);
+          stats_stop (STATS_PRINT, start);
+        }
+      else
+        {
+          LOG_MESSAGE (LOG_LEVEL_WARNING, "can't list %s: %s", job->name,
+                       strerror (job->error));
+          output_flush (&output);
+          fprintf (stderr, "%s: %s: %s\n", program_invocation_short_name,
+                   job->name, strerror (job->error));
+          failed = 1;
+        }
+
+      entry_store_free (&job->store);
+    }
+
+  /*
+   * Once the output is closed there is no point in reading the rest.
+   */
+  pthread_mutex_lock (&pool.mutex);
+  pool.next = count;
+  pthread_mutex_unlock (&pool.mutex);
+
+  for (i = 0; i < started; ++i)
+    {
+      pthread_join (workers[i], NULL);
+    }
+
+  if (output_flush (&output) != 0 && error == 0)
+    {
+      error = errno;
+    }
+  output_free (&output);
+
+  for (i = 0; i < count; ++i)
+    {
+      entry_store_free (&pool.jobs[i].store);
+    }
+
+  pthread_cond_destroy (&pool.done);
+  pthread_mutex_destroy (&pool.mutex);
+  free (pool.jobs);
+
+  if (error == 0 && failed)
+    {
+      return -1;
+    }
+
+  return error;
+}
+
+/*
+ * Data of 'list_print_entry'.
+ */
+struct list_printer
+{
+  struct output output;
+  enum list_format format;
+  int failed;
+};
+
+static int
+list_print_entry (const struct walk_directory *directory, size_t index,
+                  void *data)
+{
+  const struct walk_directory *child = directory->children[index];
+  struct list_printer *printer = data;
+  struct output *output = &printer->output;
+  char path[PATH_MAX];
+  char *start;
+  char *p;
+  int length;
+
+  length = walk_path (directory, index, path, sizeof (path));
+  if (length < 0)
+    {
+      fprintf (stderr, "%s: %s/%s: %s\n", program_invocation_short_name,
+               directory->name, walk_name (directory, index),
+               strerror (ENAMETOOLONG));
+      printer->failed = 1;
+      return 0;
+    }
+
+  start = output_reserve (output, LIST_LINE_SIZE (length));
+  p = start;
+
+  if (printer->format == LIST_FORMAT_JSON)
+    {
+      LIST_PUT_TEXT (p, "{\"path\":");
+      p = list_put_json_string (p, path, length);
+      LIST_PUT_TEXT (p, ",\"type\":");
+      p = list_put_type_name (p, directory->types[index]);
+      LIST_PUT_TEXT (p, "}\n");
+    }
+  else
+    {
+      memcpy (p, path, length);
+      p += length;
+      *p++ = printer->format == LIST_FORMAT_NULL ? '\0' : '\n';
+    }
+
+  output_commit (output, p - start);
+
+  if (child != NULL && child->error != 0)
+    {
+      fprintf (stderr, "%s: %s: %s\n", program_invocation_short_name, path,
+               strerror (child->error));
+      printer->failed = 1;
+    }
+
+  /*
+   * Stop walking once the output is closed.
+   */
+  return output->error != 0;
+}
+
+int
+list_recursive (const char *dir_name, int threads, int follow,
+                enum list_format format)
+{
+  struct list_printer printer;
+  struct walker walker;
+  uint64_t start;
+  int error;
+
+  if (walk_start (&walker, dir_name, threads, follow) != 0)
+    {
+      return errno;
+    }
+
+  walk_wait (&walker);
+
+  error = walker.root->error;
+  if (error == 0 && output_init (&printer.output, STDOUT_FILENO) != 0)
+    {
+      error = ENOMEM;
+    }
+
+  if (error == 0)
+    {
+      printer.format = format;
+      printer.failed = 0;
+      start = stats_start ();
+      walk_visit (walker.root, list_print_entry, &printer);
+      stats_stop (STATS_PRINT, start);
+      if (output_flush (&printer.output) != 0)
+        {
+          error = errno;
+        }
+      else if (printer.failed)
+        {
+          error = -1;
+        }
+      output_free (&printer.output);
+    }
+
+  walk_free (&walker);
+
+  return error;
+}
@@ -0,0 +1,110 @@
+/*
+ * list - print listings without the user interface
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_SRC_LIST_H_
+#define DR_SRC_LIST_H_
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "dir.h"
+#include "entry.h"
+#include "log.h"
+#include "meta.h"
+#include "output.h"
+#include "snap.h"
+#include "sort.h"
+#include "stats.h"
+#include "walk.h"
+
+/*
+ * Most bytes of the line of an entry whose name or path has LENGTH
+ * bytes, every byte of a JSON string can take 6 and the metadata
+ * columns take less than 128.
+ */
+#define LIST_LINE_SIZE(length) (6 * (length) + 128)
+
+/*
+ * How the entries are printed: one per line, each followed by a null
+ * byte so any name can be read back, or one JSON object per line.
+ */
+enum list_format
+{
+  LIST_FORMAT_LINES,
+  LIST_FORMAT_NULL,
+  LIST_FORMAT_JSON,
+};
+
+/*
+ * Print the path of every entry under DIR_NAME in FORMAT, in the
+ * order of 'dir_typesort' with the content of a directory right
+ * after it, the tree is walked on THREADS threads and the symbolic
+ * links to directories are followed if FOLLOW is not 0.
+ * the directories that can't be read are reported on stderr.
+ * return 0, the errno value of the error that stopped it or -1 if
+ * some of the directories under it couldn't be read.
+ */
+int list_recursive (const char *dir_name, int threads, int follow,
+                    enum list_format format);
+
+/*
+ * Upper limit of the directories read at the same time by
+ * 'list_directories'.
+ */
+#define LIST_MAX_WORKERS 16
+
+/*
+ * Print the entries of the COUNT directories of DIR_NAMES in FORMAT
+ * in the order of the list of the interface, with their type,
+ * permissions, size and modification time if METADATA is set.
+ * the listings come from the daemon or the snapshots of the cache
+ * directory if SNAPSHOTS is set, they are read and sorted on THREADS
+ * threads otherwise.
+ * the directories are read at the same time and printed in the
+ * order of DIR_NAMES, as sections headed by their name in lines, and
+ * with their name in the JSON objects or before the names separated
+ * by nulls when there are several of them.
+ * the directories that can't be read are reported on stderr.
+ * the lines are written in place in large buffers given to writev.
+ * return 0, the errno value of the error that stopped it or -1 if
+ * some of the directories couldn't be read.
+ */
+int list_directories (const char *const *dir_names, size_t count,
+                      int threads, enum list_format format, int metadata,
+                      int snapshots);
+
+/*
+ * Print the entries of STORE to FD in FORMAT like 'list_directories'
+ * prints a single directory, without reading or sorting anything.
+ * return 0 or the errno value of the error.
+ */
+int list_print_store (int fd, const struct entry_store *store,
+                      enum list_format format, int metadata);
+
+#endif // DR_SRC_LIST_H_
@@ -20,17 +20,21 @@
 #include <argp.h>
 #include <config.h>
 #include <errno.h>
+#include <limits.h>
 #include <locale.h>
-#include <ncurses.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "cli.h"
-#include "dir.h"
+#include "list.h"
+#include "log.h"
+#include "server.h"
+#include "snap.h"
+#include "spill.h"
+#include "stats.h"
 #include "str.h"
-
-#define MAX_SIZE 2056
+#include "tui.h"
 
 /*
  * Argp parser to go through the options,
@@ -46,6 +50,9 @@ argp_parser (int key, char *arg, struct argp_state *state)
    * know is a pointer to our arguments structure.
    */
   struct cli_arguments *arguments = state->input;
+  unsigned long memory;
+  char *end = NULL;
+  char **names;
 
   switch (key)
     {
@@ -55,6 +62,53 @@ argp_parser (int key, char *arg, struct argp_state *state)
     case 'q':
       arguments->quiet = 1;
       break;
+    case 'g':
+      arguments->log_file = arg;
+      break;
+    case 'j':
+      arguments->threads = strtol (arg, &end, 10);
+      if (*arg == '\0' || *end != '\0' || arguments->threads < 1)
+        {
+          argp_error (state, _ ("invalid number of threads: '%s'"), arg);
+        }
+      break;
+    case 'H':
+      memory = strtoul (arg, &end, 10);
+      if (*arg == '\0' || *arg == '-' || *end != '\0'
+          || memory > SIZE_MAX / (1024 * 1024))
+        {
+          argp_error (state, _ ("invalid history size: '%s'"), arg);
+        }
+      arguments->history_memory = memory * 1024 * 1024;
+      break;
+    case 'r':
+      arguments->recursive = 1;
+      break;
+    case 'p':
+      arguments->print = 1;
+      break;
+    case '0':
+      arguments->null = 1;
+      break;
+    case 'J':
+      arguments->json = 1;
+      break;
+    case 'l':
+      arguments->long_format = 1;
+      break;
+    case 'L':
+      arguments->follow = 1;
+      break;
+    case 'C':
+      arguments->no_cache = 1;
+      break;
+    case 'D':
+      arguments->daemon = 1;
+      break;
+    case 'S':
+      arguments->stats = 1;
+      arguments->stats_file = arg;
+      break;
     case 'h':
       argp_state_help (state, state->out_stream, ARGP_HELP_STD_HELP);
       break;
@@ -70,7 +124,14 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->no_args = 1;
       break;
     case ARGP_KEY_ARG:
-      arguments->name = arg;
+      names = realloc (arguments->names,
+                       (arguments->name_count + 1) * sizeof (char *));
+      if (names == NULL)
+        {
+          argp_failure (state, EXIT_FAILURE, ENOMEM, "%s", arg);
+        }
+      arguments->names = names;
+      arguments->names[arguments->name_count++] = arg;
       break;
     default:
       return ARGP_ERR_UNKNOWN;
@@ -79,98 +140,40 @@ argp_parser (int key, char *arg, struct argp_state *state)
 }
 
 /*
- * Construct the argp data structure wich we pass to the argp parse function.
- */
-struct argp argp = {
-  cli_argp_options, argp_parser, cli_argp_args_doc, cli_argp_doc, 0, 0, 0,
-};
-
-/*
- *  struct to hold info about each file and directory
- *  refer to struct dirent in <dirent.h>
+ * Print the report of '--stats' on stderr and dump the statistics
+ * in FILE_NAME if it is not NULL, errno is kept for the exit status.
  */
-struct file_entry
+static void
+main_write_stats (const char *file_name)
 {
-  char *fe_name;
-  unsigned char fe_name_length;
-  unsigned char fe_type;
-};
-
-/*
-  if (fe_raw_type == DT_DIR)
-    {
-      *fe_type = 'd';
-      return;
-    }
+  int saved_errno = errno;
+  FILE *file;
 
-  if (fe_raw_type == DT_LNK)
-    {
-      *fe_type = 'l';
-      return;
-    }
+  stats_report (stderr);
 
-  if (fe_raw_type == DT_SOCK)
+  if (file_name != NULL)
     {
-      *fe_type = 's';
-      return;
+      file = fopen (file_name, "w");
+      if (file == NULL || stats_dump (file) != 0)
+        {
+          fprintf (stderr, "%s: %s: %s\n", program_invocation_short_name,
+                   file_name, strerror (errno));
+        }
+      if (file != NULL)
+        {
+          fclose (file);
+        }
     }
 
-  *fe_type = '.';
-*/
-void
-file_entry_determine_type (unsigned char *fe_raw_type, char *fe_type)
-{
-  switch (*fe_raw_type)
-    {
-    case DT_DIR:
-      *fe_type = 'd';
-      break;
-
-    case DT_LNK:
-      *fe_type = 'l';
-      break;
-
-    case DT_SOCK:
-      *fe_type = 's';
-      break;
-
-    default:
-      *fe_type = '.';
-      break;
-    }
+  errno = saved_errno;
 }
 
-void
-tui_print_list (WINDOW *win, int *win_cur_pos,
-                struct file_entry **file_entries_list, int num_entries)
-{
-
-  int cen = 0;
-  char file_entry_type = '.';
-
-  wmove (win, 0, 0);
-  refresh ();
-
-  for (cen = 0; cen < num_entries; ++cen)
-    {
-      file_entry_determine_type (&file_entries_list[cen]->fe_type,
-                                 &file_entry_type);
-      wmove (win, cen, 2);
-      waddstr (win, file_entries_list[cen]->fe_name);
-      wmove (win, cen, 0);
-      refresh ();
-    }
-  *win_cur_pos = cen;
-  refresh ();
-
-  wmove (win, *win_cur_pos, 0);
-
-  wprintw (win, _ ("listed: %d entries\n"), num_entries);
-  refresh ();
-
-  wmove (win, 0, 0);
-  refresh ();
-}
+/*
+ * Construct the argp data structure wich we pass to the argp parse function.
+ */
+struct argp argp = {
+  cli_argp_options, argp_parser, cli_argp_args_doc, cli_argp_doc, 0, 0, 0,
+};
 
 int
 main (int argc, char **argv)
@@ -182,7 +185,22 @@ main (int argc, char **argv)
   struct cli_arguments arguments;
   arguments.quiet = 0;
   arguments.verbose = 0;
+  arguments.threads = 0;
+  arguments.history_memory = TUI_HISTORY_DEFAULT_MEMORY;
+  arguments.recursive = 0;
+  arguments.print = 0;
+  arguments.null = 0;
+  arguments.json = 0;
+  arguments.long_format = 0;
+  arguments.follow = 0;
+  arguments.no_cache = 0;
+  arguments.daemon = 0;
+  arguments.stats = 0;
+  arguments.stats_file = NULL;
+  arguments.log_file = NULL;
   arguments.no_args = 0;
+  arguments.names = NULL;
+  arguments.name_count = 0;
 
   /*
    * Get the path where the program was executed.
@@ -195,6 +213,15 @@ main (int argc, char **argv)
 
   argp_parse (&argp, argc, argv, ARGP_NO_HELP, 0, &arguments);
 
+  /*
+   * Nothing is measured without '--stats', the hooks only test a flag.
+   */
+  if (arguments.stats)
+    {
+      stats_enable ();
+    }
+  uint64_t start = stats_start ();
+
   /*
    * Set the local based on the system where the program is run.
    */
@@ -207,190 +234,144 @@ main (int argc, char **argv)
   textdomain (PACKAGE);
 
   /*
-   * TODO: implement a logging architecture
-   * to save logs either in the syslog or in file.log.
+   * The messages go to syslog or to the log file from a thread of
+   * their own, never to the terminal the interface draws on.
    */
+  enum log_level log_level = LOG_LEVEL_WARNING;
   if (arguments.verbose)
     {
-      printf ("verbose: true\n");
+      log_level = LOG_LEVEL_DEBUG;
+    }
+  else if (arguments.quiet)
+    {
+      log_level = LOG_LEVEL_ERROR;
     }
 
-  /*
-   * Just don't.
-   */
-  if (arguments.quiet)
+  if (log_open (log_level, arguments.log_file) != 0)
     {
-      printf ("verbose: true\n");
+      fprintf (stderr, "%s: %s: %s\n", exec_name,
+               arguments.log_file ? arguments.log_file : "syslog",
+               strerror (errno));
     }
 
   /*
-   * TODO: add ncurses here.
+   * If no arguments were passed we set list the current directory.
    */
+  static char current_directory[] = "./";
+  static char *current_directory_names[] = { current_directory };
+  char **dir_names = arguments.names;
+  size_t dir_count = arguments.name_count;
+  size_t i;
 
-  /*
-   * Get the entries and save them here for later use.
-   */
-  char *name_dir_list = NULL;
-  int lenght_list_dir_name = MAX_STR_SIZE * sizeof (char);
-  /*
-   * Allocate enough size for directory path name.
-   */
-  name_dir_list = malloc (lenght_list_dir_name + 1);
-  if (name_dir_list == NULL)
+  if (arguments.no_args)
     {
-      goto error;
+      dir_names = current_directory_names;
+      dir_count = 1;
     }
 
-  memset (name_dir_list, 0, sizeof (char));
+  LOG_MESSAGE (LOG_LEVEL_INFO, "%s started for %zu paths", PACKAGE_STRING,
+               dir_count);
 
   /*
-   * If no arguments were passed we set list the current directory.
+   * The large listings are kept in files of the cache directory,
+   * which is on a disk unlike /tmp that is often in memory, it is
+   * only created once a listing is that large.
    */
-  if (arguments.no_args)
+  char spill_directory[PATH_MAX];
+  if (snap_directory (spill_directory, sizeof (spill_directory), 0) != 0
+      || spill_init (spill_directory) != 0)
     {
-      name_dir_list = "./";
+      LOG_MESSAGE (LOG_LEVEL_INFO, "the listings stay in memory: %m");
     }
-  else
-    {
-      name_dir_list = arguments.name;
-    }
-
-  int num_entries = 0;
 
-  struct dirent **dir_list = NULL;
-  int lenght_dir_list = MAX_SIZE * sizeof (struct dirent);
-  dir_list = malloc (lenght_dir_list + 1);
-  if (dir_list == NULL)
+  /*
+   * The entries are printed when asked for or when the output is
+   * not a terminal, like from a script or through a pipe.
+   */
+  enum list_format format = LIST_FORMAT_LINES;
+  if (arguments.json)
     {
-      goto error;
+      format = LIST_FORMAT_JSON;
     }
-
-  memset (dir_list, 0, sizeof (struct dirent));
-
-  if (dir_get_directory_entries (name_dir_list, &dir_list, &num_entries) != 0)
+  else if (arguments.null)
     {
-      goto error;
+      format = LIST_FORMAT_NULL;
     }
 
-  struct file_entry **file_entries_list = NULL;
-  int file_entries_list_length = MAX_SIZE * sizeof (struct file_entry);
-
-  file_entries_list = malloc (file_entries_list_length + 1);
-
-  if (file_entries_list == NULL)
+  int failed = 0;
+  if (arguments.daemon)
     {
-      goto error;
+      errno = server_run (arguments.threads);
     }
-
-  memset (file_entries_list, 0, sizeof (struct file_entry));
-
-  int i = 0;
-  int dir_name_length = 0;
-
-  for (i = 0; i < num_entries; ++i)
+  else if (arguments.recursive)
     {
-      dir_name_length = strlen (dir_list[i]->d_name);
-
-      file_entries_list[i]->fe_name = NULL;
-      file_entries_list[i]->fe_name
-          = malloc (MAX_STR_SIZE * dir_name_length + 1);
-
-      if (file_entries_list[i]->fe_name == NULL)
+      /*
+       * A path that can't be listed doesn't stop the next ones, its
+       * error is reported right away.
+       */
+      for (i = 0; i < dir_count; ++i)
         {
-          goto error;
+          int error = list_recursive (dir_names[i], arguments.threads,
+                                      arguments.follow, format);
+          if (error > 0)
+            {
+              LOG_MESSAGE (LOG_LEVEL_WARNING, "can't list %s: %s",
+                           dir_names[i], strerror (error));
+              fprintf (stderr, "%s: %s: %s\n", exec_name, dir_names[i],
+                       strerror (error));
+            }
+          if (error != 0)
+            {
+              failed = 1;
+            }
         }
-
-      memset (file_entries_list[i]->fe_name, 0, sizeof (char));
-      strcpy (file_entries_list[i]->fe_name, dir_list[i]->d_name);
-
-      file_entries_list[i]->fe_name_length = dir_name_length;
-      file_entries_list[i]->fe_type = dir_list[i]->d_type;
+      errno = 0;
     }
-
-  int stdscr_max_y = 0;
-
-  int input_key;
-
-  int tui_stdscr_welcome_message_length = MAX_STR_SIZE * sizeof (char);
-
-  char *tui_stdscr_welcome_message = NULL;
-
-  tui_stdscr_welcome_message = malloc (tui_stdscr_welcome_message_length + 1);
-
-  memset (tui_stdscr_welcome_message, 0, sizeof (char));
-
-  strcpy (tui_stdscr_welcome_message,
-          _ ("Hello to 'dr' your tui file manager."));
-
-  int stdscr_cur_pos = 0;
-
-  int length_entry = 0;
-
-  use_env (TRUE);
-  use_tioctl (TRUE);
-
-  initscr ();
-
-  cbreak ();
-  noecho ();
-  intrflush (stdscr, FALSE);
-  keypad (stdscr, TRUE);
-
-  stdscr_max_y = getmaxy (stdscr);
-
-  wmove (stdscr, stdscr_max_y - 1, 0);
-  refresh ();
-
-  waddstr (stdscr, tui_stdscr_welcome_message);
-  refresh ();
-
-  tui_print_list (stdscr, &stdscr_cur_pos, file_entries_list, num_entries);
-  refresh ();
-
-  stdscr_cur_pos = 0;
-
-  // TODO: add keybindings
-
-  while (1)
+  else if (arguments.print || arguments.json || arguments.null
+           || arguments.long_format || !isatty (STDOUT_FILENO))
     {
-      length_entry = strlen (dir_list[stdscr_cur_pos]->d_name);
-
-      mvchgat (0, 0, length_entry, A_BOLD | A_UNDERLINE, 1, NULL);
-      refresh ();
-
-      input_key = wgetch (stdscr);
-      refresh ();
-
-      switch (input_key)
-        {
-        case 'q':
-        case 'Q':
-          goto quit_tui;
-        default:
-          refresh ();
-          break;
-        }
+      int error = list_directories ((const char *const *)dir_names,
+                                    dir_count, arguments.threads, format,
+                                    arguments.long_format,
+                                    !arguments.no_cache);
+      failed = error < 0;
+      errno = error < 0 ? 0 : error;
+    }
+  else
+    {
+      errno = tui_run ((const char *const *)dir_names, dir_count,
+                       arguments.threads, !arguments.no_cache,
+                       arguments.history_memory);
     }
 
-quit_tui:
-  refresh ();
-  endwin ();
+  stats_stop (STATS_TOTAL, start);
+  if (arguments.stats)
+    {
+      main_write_stats (arguments.stats_file);
+    }
 
   /*
    * Handle most error case here in defer way
    * to not repeat though the function.
    * if there is a better way maybe we can change this.
    */
-error:
   if (errno != 0)
     {
-      printf (_ ("%s: error %d: %s\n"), exec_name, errno, strerror (errno));
+      int error = errno;
 
-      refresh ();
-      endwin ();
+      LOG_MESSAGE (LOG_LEVEL_ERROR, "stopped by error %d: %m", error);
+      log_close ();
+
+      fprintf (stderr, _ ("%s: error %d: %s\n"), exec_name, error,
+               strerror (error));
 
       exit (EXIT_FAILURE);
     }
 
-  exit (EXIT_SUCCESS);
+  log_close ();
+
+  /*
+   * The paths that couldn't be listed were reported one by one.
+   */
+  exit (failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -0,0 +1,412 @@
+#include "server.h"
+
+static void server_on_meta (int fd, void *data);
+
+/*
+ * Fetch the metadata of DIRECTORY at PATH in the background so
+ * the next client gets it with the names.
+ */
+static void
+server_start_meta (struct server *server, struct cache_directory *directory,
+                   const char *path)
+{
+  if (directory->entries.count == 0
+      || meta_start (&server->meta, path, &directory->entries) != 0)
+    {
+      return;
+    }
+
+  /*
+   * The end of the fetch would never be seen.
+   */
+  if (loop_add (&server->loop, server->meta.event_fd, server_on_meta,
+                server)
+      != 0)
+    {
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't follow the metadata of %s: %m",
+                   path);
+      meta_stop (&server->meta);
+      return;
+    }
+
+  server->meta_running = 1;
+  server->meta_directory = directory;
+}
+
+/*
+ * The store can't change while the metadata is fetched and the
+ * cache can drop it when a directory is added.
+ */
+static void
+server_stop_meta (struct server *server)
+{
+  if (server->meta_running)
+    {
+      loop_remove (&server->loop, server->meta.event_fd);
+      meta_stop (&server->meta);
+      server->meta_running = 0;
+      server->meta_directory = NULL;
+    }
+}
+
+static void
+server_on_meta (int fd, void *data)
+{
+  struct server *server = data;
+  uint64_t events;
+
+  if (read (fd, &events, sizeof (events)) < 0)
+    {
+      return;
+    }
+
+  if (meta_finished (&server->meta))
+    {
+      server_stop_meta (server);
+    }
+}
+
+/*
+ * Forget the snapshot kept for the next clients.
+ */
+static void
+server_drop_snapshot (struct server *server)
+{
+  if (server->snapshot_fd >= 0)
+    {
+      close (server->snapshot_fd);
+      server->snapshot_fd = -1;
+      server->snapshot_directory = NULL;
+    }
+}
+
+/*
+ * return 1 if the metadata of every entry of DIRECTORY is known.
+ */
+static int
+server_meta_complete (const struct cache_directory *directory)
+{
+  size_t i;
+
+  for (i = 0; i < directory->entries.count; ++i)
+    {
+      if (entry_store_meta_state (&directory->entries, i)
+          != ENTRY_META_READY)
+        {
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+/*
+ * Read and sort the entries of the new DIRECTORY.
+ * return 0 on success and -1 with errno set.
+ */
+static int
+server_read (struct server *server, struct cache_directory *directory)
+{
+  struct dir_reader reader;
+  struct dir_batch *batch;
+  int saved_errno;
+  int ret;
+
+  batch = malloc (sizeof (struct dir_batch));
+  if (batch == NULL)
+    {
+      return -1;
+    }
+
+  reader.buffer = NULL;
+  if (dir_reader_open_at (&reader, directory->dir_fd, ".", 0) != 0)
+    {
+      saved_errno = errno;
+      free (batch);
+      errno = saved_errno;
+      return -1;
+    }
+
+  while ((ret = dir_reader_next_batch (&reader, batch)) > 0)
+    {
+      if (entry_store_append_batch (batch, &directory->entries) != 0)
+        {
+          errno = ENOMEM;
+          ret = -1;
+          break;
+        }
+    }
+
+  saved_errno = errno;
+  free (batch);
+  dir_reader_close (&reader);
+
+  if (ret < 0)
+    {
+      errno = saved_errno;
+      return -1;
+    }
+
+  if (sort_entry_store (&directory->entries, server->threads) != 0)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  directory->ready = 1;
+  directory->complete = 1;
+
+  return 0;
+}
+
+/*
+ * Write the listing of the directory at PATH in a new memfd put
+ * in *SNAPSHOT_FD, from the cache when it is there.
+ * return 0 or an errno value.
+ */
+static int
+server_answer (struct server *server, const char *path, int *snapshot_fd)
+{
+  struct cache_directory *directory;
+  struct stat st;
+  int error;
+  int fd;
+
+  if (path[0] != '/')
+    {
+      return EINVAL;
+    }
+
+  server_stop_meta (server);
+
+  directory = cache_lookup (&server->cache, path);
+  if (directory == NULL)
+    {
+      /*
+       * Watched before it is read like in the interface, adding
+       * it can free the directory of the snapshot.
+       */
+      server_drop_snapshot (server);
+
+      directory = cache_insert (&server->cache, path);
+      if (directory == NULL)
+        {
+          return errno;
+        }
+
+      if (fstat (directory->dir_fd, &st) != 0
+          || server_read (server, directory) != 0)
+        {
+          error = errno;
+          cache_remove (&server->cache, directory);
+          return error;
+        }
+    }
+  else if (fstat (directory->dir_fd, &st) != 0)
+    {
+      return errno;
+    }
+
+  /*
+   * The events are read after the stat so every change older than
+   * ST is in the listing, a newer one makes the client refuse it.
+   */
+  if (cache_read_events (&server->cache) < 0)
+    {
+      return errno;
+    }
+
+  if (directory->lost)
+    {
+      server_drop_snapshot (server);
+      cache_remove (&server->cache, directory);
+      return ESTALE;
+    }
+
+  if (directory == server->snapshot_directory
+      && !cache_has_changes (directory)
+      && st.st_mtim.tv_sec == server->snapshot_st.st_mtim.tv_sec
+      && st.st_mtim.tv_nsec == server->snapshot_st.st_mtim.tv_nsec
+      && st.st_ctim.tv_sec == server->snapshot_st.st_ctim.tv_sec
+      && st.st_ctim.tv_nsec == server->snapshot_st.st_ctim.tv_nsec)
+    {
+      *snapshot_fd = dup (server->snapshot_fd);
+      return *snapshot_fd < 0 ? errno : 0;
+    }
+
+  server_drop_snapshot (server);
+
+  if (cache_apply (directory) != 0)
+    {
+      return ENOMEM;
+    }
+
+  fd = memfd_create ("dr-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    {
+      return errno;
+    }
+
+  /*
+   * Sealed so the client can map it without trusting the daemon
+   * to leave it alone.
+   * the metadata is sent while the directory is watched, a file
+   * written in place gets its metadata fetched again once the
+   * change is applied, so the client can trust what is ready.
+   */
+  if (snap_write (fd, &st, &directory->entries, directory->wd >= 0) != 0
+      || fcntl (fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+             != 0)
+    {
+      error = errno;
+      close (fd);
+      return error;
+    }
+
+  /*
+   * A listing with all its metadata only changes with the directory
+   * or the files the watch reports, the same snapshot is sent until
+   * then.
+   */
+  if (server_meta_complete (directory))
+    {
+      server->snapshot_fd = dup (fd);
+      server->snapshot_directory
+          = server->snapshot_fd >= 0 ? directory : NULL;
+      server->snapshot_st = st;
+    }
+  else
+    {
+      server_start_meta (server, directory, path);
+    }
+
+  *snapshot_fd = fd;
+
+  return 0;
+}
+
+static void
+server_on_client (__attribute__ ((unused)) int fd, void *data)
+{
+  struct server *server = data;
+  char path[PATH_MAX];
+  int snapshot_fd = -1;
+  int client;
+  int error;
+
+  client = daemon_accept (server->listen_fd, path, sizeof (path));
+  if (client < 0)
+    {
+      return;
+    }
+
+  error = server_answer (server, path, &snapshot_fd);
+  if (error != 0)
+    {
+      LOG_MESSAGE (LOG_LEVEL_INFO, "can't answer for %s: %s", path,
+                   strerror (error));
+    }
+  else
+    {
+      LOG_MESSAGE (LOG_LEVEL_DEBUG, "sent the listing of %s", path);
+    }
+
+  /*
+   * A client that went away is not an error for the daemon.
+   */
+  daemon_reply (client, error, snapshot_fd);
+
+  if (snapshot_fd >= 0)
+    {
+      close (snapshot_fd);
+    }
+  close (client);
+}
+
+static void
+server_on_watch (__attribute__ ((unused)) int fd, void *data)
+{
+  struct server *server = data;
+
+  if (cache_read_events (&server->cache) < 0)
+    {
+      server->error = errno;
+      loop_quit (&server->loop);
+    }
+}
+
+static void
+server_on_signal (__attribute__ ((unused)) int signal, void *data)
+{
+  struct server *server = data;
+
+  loop_quit (&server->loop);
+}
+
+int
+server_run (int threads)
+{
+  struct server server;
+  char socket_path[PATH_MAX];
+  sigset_t signals;
+
+  memset (&server, 0, sizeof (server));
+  server.threads = threads;
+  server.snapshot_fd = -1;
+
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGINT);
+  sigaddset (&signals, SIGTERM);
+  sigaddset (&signals, SIGHUP);
+
+  /*
+   * The signals must be blocked before the threads start.
+   */
+  if (loop_init (&server.loop, &signals, server_on_signal, NULL, &server)
+      != 0)
+    {
+      return errno;
+    }
+
+  if (daemon_socket_path (socket_path, sizeof (socket_path)) != 0)
+    {
+      server.error = errno;
+      loop_free (&server.loop);
+      return server.error;
+    }
+
+  server.listen_fd = daemon_listen ();
+  if (server.listen_fd < 0)
+    {
+      server.error = errno;
+      loop_free (&server.loop);
+      return server.error;
+    }
+
+  if (cache_init (&server.cache) != 0
+      || loop_add (&server.loop, server.cache.inotify_fd, server_on_watch,
+                   &server)
+             != 0
+      || loop_add (&server.loop, server.listen_fd, server_on_client,
+                   &server)
+             != 0)
+    {
+      server.error = errno;
+    }
+  else if (loop_run (&server.loop) != 0)
+    {
+      server.error = errno;
+    }
+
+  server_stop_meta (&server);
+  server_drop_snapshot (&server);
+
+  close (server.listen_fd);
+  unlink (socket_path);
+
+  cache_free (&server.cache);
+  loop_free (&server.loop);
+
+  return server.error;
+}
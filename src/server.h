@@ -0,0 +1,78 @@
+/*
+ * server - keep the listings in memory for the other dr processes
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_SRC_SERVER_H_
+#define DR_SRC_SERVER_H_
+
+#include <config.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "daemon.h"
+#include "dir.h"
+#include "entry.h"
+#include "log.h"
+#include "loop.h"
+#include "meta.h"
+#include "snap.h"
+#include "sort.h"
+
+/*
+ * State of the daemon, everything happens in the callbacks of LOOP:
+ * clients on LISTEN_FD, changes from the watches of CACHE, signals
+ * and metadata from META.
+ * the listings asked for are kept in CACHE with a watch so the next
+ * client gets them without reading the directory, META fetches the
+ * metadata of META_DIRECTORY, the last one asked for, in between.
+ * SNAPSHOT_FD is the sealed snapshot of SNAPSHOT_DIRECTORY in the
+ * state SNAPSHOT_ST once its metadata is complete, it is sent again
+ * until the directory changes.
+ * ERROR is the errno value that stopped the daemon.
+ */
+struct server
+{
+  int threads;
+  int listen_fd;
+  struct dir_cache cache;
+  struct loop loop;
+  struct meta_fetcher meta;
+  struct cache_directory *meta_directory;
+  int meta_running;
+  int snapshot_fd;
+  struct cache_directory *snapshot_directory;
+  struct stat snapshot_st;
+  int error;
+};
+
+/*
+ * Serve the listings of the directories to the other dr processes
+ * of the user until a signal stops it, the directories are sorted
+ * on up to THREADS threads.
+ * return 0 or the errno value of the error that stopped it.
+ */
+int server_run (int threads);
+
+#endif // DR_SRC_SERVER_H_
@@ -0,0 +1,99 @@
+/*
+ * slowfs - LD_PRELOAD shim to try dr on a slow filesystem
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every call to getdents64 and statx sleeps before going to the
+ * real function, the delay is read from DR_SLOWFS_DELAY in
+ * milliseconds (100 by default):
+ *
+ *   LD_PRELOAD=src/.libs/libslowfs.so DR_SLOWFS_DELAY=500 src/dr /usr/lib
+ *
+ * io_uring doesn't go through the C library so the shim turns
+ * it off for the metadata with DR_NO_IO_URING.
+ */
+
+#include <config.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/*
+ * Delay used when DR_SLOWFS_DELAY is not set.
+ */
+#define SLOWFS_DEFAULT_DELAY 100
+
+static long slowfs_delay = SLOWFS_DEFAULT_DELAY;
+
+__attribute__ ((constructor)) static void
+slowfs_init (void)
+{
+  const char *delay = getenv ("DR_SLOWFS_DELAY");
+
+  if (delay != NULL)
+    {
+      slowfs_delay = strtol (delay, NULL, 10);
+    }
+
+  setenv ("DR_NO_IO_URING", "1", 0);
+}
+
+static void
+slowfs_sleep (void)
+{
+  struct timespec wait;
+
+  wait.tv_sec = slowfs_delay / 1000;
+  wait.tv_nsec = (slowfs_delay % 1000) * 1000 * 1000;
+
+  nanosleep (&wait, NULL);
+}
+
+ssize_t
+getdents64 (int fd, void *buffer, size_t length)
+{
+  static ssize_t (*real_getdents64) (int, void *, size_t);
+
+  if (real_getdents64 == NULL)
+    {
+      real_getdents64 = dlsym (RTLD_NEXT, "getdents64");
+    }
+
+  slowfs_sleep ();
+
+  return real_getdents64 (fd, buffer, length);
+}
+
+int
+statx (int dir_fd, const char *path, int flags, unsigned int mask,
+       struct statx *buffer)
+{
+  static int (*real_statx) (int, const char *, int, unsigned int,
+                            struct statx *);
+
+  if (real_statx == NULL)
+    {
+      real_statx = dlsym (RTLD_NEXT, "statx");
+    }
+
+  slowfs_sleep ();
+
+  return real_statx (dir_fd, path, flags, mask, buffer);
+}
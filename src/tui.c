@@ -0,0 +1,2525 @@
+#include "tui.h"
+
+void
+file_entry_determine_type (const unsigned char *fe_raw_type, char *fe_type)
+{
+  switch (*fe_raw_type)
+    {
+    case DT_DIR:
+      *fe_type = 'd';
+      break;
+
+    case DT_LNK:
+      *fe_type = 'l';
+      break;
+
+    case DT_SOCK:
+      *fe_type = 's';
+      break;
+
+    default:
+      *fe_type = '.';
+      break;
+    }
+}
+
+/*
+ * Frames of the progress indicator shown while scanning.
+ */
+static const char tui_spinner[] = "|/-\\";
+
+void
+file_entry_format_mode (mode_t mode, char *fe_mode)
+{
+  static const char rwx[] = "rwxrwxrwx";
+  int i = 0;
+
+  for (i = 0; i < 9; ++i)
+    {
+      fe_mode[i] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    }
+
+  if (mode & S_ISUID)
+    {
+      fe_mode[2] = (mode & S_IXUSR) ? 's' : 'S';
+    }
+
+  if (mode & S_ISGID)
+    {
+      fe_mode[5] = (mode & S_IXGRP) ? 's' : 'S';
+    }
+
+  if (mode & S_ISVTX)
+    {
+      fe_mode[8] = (mode & S_IXOTH) ? 't' : 'T';
+    }
+
+  fe_mode[9] = '\0';
+}
+
+void
+file_entry_format_size (int64_t size, char *fe_size)
+{
+  static const char units[] = "BKMGTPE";
+  double value = size;
+  int unit = 0;
+
+  while (value >= 1024 && units[unit + 1] != '\0')
+    {
+      value /= 1024;
+      ++unit;
+    }
+
+  if (unit == 0)
+    {
+      snprintf (fe_size, 8, "%6" PRId64, size);
+    }
+  else
+    {
+      snprintf (fe_size, 8, "%5.1f%c", value, units[unit]);
+    }
+}
+
+void
+tui_list_view_resize (WINDOW *win, struct tui_list_view *view)
+{
+  view->height = getmaxy (win) - 1;
+  view->width = getmaxx (win);
+
+  if (view->height < 0)
+    {
+      view->height = 0;
+    }
+}
+
+void
+tui_list_view_move (struct tui_list_view *view, ptrdiff_t delta,
+                    size_t count)
+{
+  if (count == 0)
+    {
+      view->cursor = 0;
+      view->offset = 0;
+      return;
+    }
+
+  if (delta < 0 && (size_t)-delta > view->cursor)
+    {
+      view->cursor = 0;
+    }
+  else if (delta > 0 && (size_t)delta >= count - view->cursor)
+    {
+      view->cursor = count - 1;
+    }
+  else
+    {
+      view->cursor += delta;
+    }
+
+  if (view->cursor >= count)
+    {
+      view->cursor = count - 1;
+    }
+
+  if (view->cursor < view->offset)
+    {
+      view->offset = view->cursor;
+    }
+
+  if (view->height > 0 && view->cursor >= view->offset + view->height)
+    {
+      view->offset = view->cursor - view->height + 1;
+    }
+}
+
+void
+tui_print_list (WINDOW *win, const struct tui_list_view *view,
+                const struct entry_store *entries, const uint32_t *rows,
+                size_t row_count, const struct du_job *du,
+                struct owner_cache *owners, const char *status)
+{
+  char file_entry_type = '.';
+  char file_entry_mode[10];
+  char file_entry_size[8];
+  char file_entry_owner[OWNER_NAME_MAX];
+  char file_entry_group[OWNER_NAME_MAX];
+  size_t count = rows != NULL ? row_count : entries->count;
+  size_t line = 0;
+  size_t cen = 0;
+  int row = 0;
+
+  werase (win);
+
+  for (row = 0; row < view->height; ++row)
+    {
+      line = view->offset + row;
+      if (line >= count)
+        {
+          break;
+        }
+      cen = rows != NULL ? rows[line] : line;
+
+      file_entry_determine_type (&entries->type[cen], &file_entry_type);
+      mvwaddch (win, row, 0, file_entry_type);
+
+      /*
+       * The metadata is fetched in the background, the columns
+       * stay empty until it arrives.
+       */
+      switch (entry_store_meta_state (entries, cen))
+        {
+        case ENTRY_META_READY:
+          file_entry_format_mode (entries->mode[cen], file_entry_mode);
+          file_entry_format_size (entries->size[cen], file_entry_size);
+          owner_name (owners, OWNER_USER, entries->uid[cen],
+                      file_entry_owner, sizeof (file_entry_owner));
+          owner_name (owners, OWNER_GROUP, entries->gid[cen],
+                      file_entry_group, sizeof (file_entry_group));
+          break;
+        case ENTRY_META_FAILED:
+          strcpy (file_entry_mode, "?????????");
+          strcpy (file_entry_size, "     ?");
+          strcpy (file_entry_owner, "?");
+          strcpy (file_entry_group, "?");
+          break;
+        default:
+          strcpy (file_entry_mode, "         ");
+          strcpy (file_entry_size, "      ");
+          file_entry_owner[0] = '\0';
+          file_entry_group[0] = '\0';
+          break;
+        }
+
+      /*
+       * Directories show the size of their tree, with a '+'
+       * while it is still counted.
+       */
+      if (du != NULL && entries->type[cen] == DT_DIR)
+        {
+          switch (du_state (du, cen))
+            {
+            case DU_RUNNING:
+              mvwaddch (win, row, TUI_SIZE_COLUMN + 6, '+');
+              file_entry_format_size (du_bytes (du, cen), file_entry_size);
+              break;
+            case DU_DONE:
+              file_entry_format_size (du_bytes (du, cen), file_entry_size);
+              break;
+            default:
+              strcpy (file_entry_size, "      ");
+              break;
+            }
+        }
+
+      mvwaddnstr (win, row, TUI_MODE_COLUMN, file_entry_mode,
+                  view->width - TUI_MODE_COLUMN);
+      mvwaddnstr (win, row, TUI_SIZE_COLUMN, file_entry_size,
+                  view->width - TUI_SIZE_COLUMN);
+
+      if (view->width > TUI_GROUP_COLUMN)
+        {
+          mvwaddnstr (win, row, TUI_OWNER_COLUMN, file_entry_owner,
+                      TUI_OWNER_WIDTH);
+          mvwaddnstr (win, row, TUI_GROUP_COLUMN, file_entry_group,
+                      view->width - TUI_GROUP_COLUMN < TUI_OWNER_WIDTH
+                          ? view->width - TUI_GROUP_COLUMN
+                          : TUI_OWNER_WIDTH);
+        }
+
+      if (view->width > TUI_NAME_COLUMN)
+        {
+          mvwaddnstr (win, row, TUI_NAME_COLUMN,
+                      entry_store_name (entries, cen),
+                      view->width - TUI_NAME_COLUMN);
+        }
+
+      if (line == view->cursor)
+        {
+          mvwchgat (win, row, 0, -1, A_BOLD | A_UNDERLINE, 0, NULL);
+        }
+    }
+
+  wmove (win, view->height, 0);
+  waddnstr (win, status, view->width);
+  if (rows != NULL)
+    {
+      wprintw (win, _ ("  matched: %zu of %zu entries"), row_count,
+               entries->count);
+    }
+  else
+    {
+      wprintw (win, _ ("  listed: %zu entries"), entries->count);
+    }
+
+  wnoutrefresh (win);
+  doupdate ();
+
+  /*
+   * The ids of the rows on screen are looked up together.
+   */
+  owner_flush (owners);
+}
+
+void
+tui_print_tree (WINDOW *win, const struct tui_list_view *view,
+                const struct tui_tree_row *rows, size_t row_count,
+                const char *status)
+{
+  const struct walk_directory *directory;
+  char file_entry_type = '.';
+  size_t cen = 0;
+  int column = 0;
+  int row = 0;
+
+  werase (win);
+
+  for (row = 0; row < view->height; ++row)
+    {
+      cen = view->offset + row;
+      if (cen >= row_count)
+        {
+          break;
+        }
+
+      directory = rows[cen].directory;
+      file_entry_determine_type (&directory->types[rows[cen].index],
+                                 &file_entry_type);
+      mvwaddch (win, row, 0, file_entry_type);
+
+      column = TUI_MODE_COLUMN + 2 * directory->depth;
+      if (column < view->width)
+        {
+          mvwaddnstr (win, row, column,
+                      walk_name (directory, rows[cen].index),
+                      view->width - column);
+        }
+
+      if (cen == view->cursor)
+        {
+          mvwchgat (win, row, 0, -1, A_BOLD | A_UNDERLINE, 0, NULL);
+        }
+    }
+
+  wmove (win, view->height, 0);
+  waddnstr (win, status, view->width);
+  wprintw (win, _ ("  listed: %zu entries"), row_count);
+
+  wnoutrefresh (win);
+  doupdate ();
+}
+
+/*
+ * Get the tab on screen.
+ */
+static struct tui_tab *
+tui_tab (struct tui *tui)
+{
+  return &tui->tabs[tui->tab];
+}
+
+/*
+ * return 1 when the tab on screen shows DIRECTORY.
+ */
+static int
+tui_showing (const struct tui *tui, const struct cache_directory *directory)
+{
+  return tui->tabs[tui->tab].directory == directory;
+}
+
+static void tui_on_meta (int fd, void *data);
+
+/*
+ * Fetch the permissions and sizes of the entries that don't have
+ * them in the background, the rows on screen first.
+ * the directory of the tab on screen may still be read by another
+ * tab, it is then started once that scan is done.
+ */
+static void
+tui_start_meta (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+
+  if (!tab->directory->ready || tab->entries->count == 0
+      || meta_start_fd (&tui->meta, tab->directory->dir_fd, tab->entries)
+             != 0)
+    {
+      return;
+    }
+
+  /*
+   * The columns would only fill on the next key, the store would
+   * also be left to the threads while it is sorted.
+   */
+  if (loop_add (&tui->loop, tui->meta.event_fd, tui_on_meta, tui) != 0)
+    {
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't follow the metadata: %m");
+      meta_stop (&tui->meta);
+      return;
+    }
+
+  tui->meta_running = 1;
+}
+
+/*
+ * Called when leaving the directory or before its store is sorted,
+ * the entries not fetched yet are left for the next time.
+ */
+static void
+tui_stop_meta (struct tui *tui)
+{
+  if (tui->meta_running)
+    {
+      loop_remove (&tui->loop, tui->meta.event_fd);
+      meta_stop (&tui->meta);
+      tui->meta_running = 0;
+    }
+}
+
+static void tui_on_du (int fd, void *data);
+
+/*
+ * Count the size of the trees of the directories in the background,
+ * the totals already known come from the cache.
+ */
+static void
+tui_start_du (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+
+  if (!tab->directory->ready || tab->entries->count == 0
+      || du_start_fd (&tui->du, tab->directory->dir_fd, tab->entries,
+                      tui->du_cache)
+             != 0)
+    {
+      return;
+    }
+
+  /*
+   * The totals could not be shown as they grow, there is no
+   * point in counting them.
+   */
+  if (loop_add (&tui->loop, tui->du.event_fd, tui_on_du, tui) != 0)
+    {
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't follow the sizes: %m");
+      du_stop (&tui->du);
+      return;
+    }
+
+  tui->du_running = 1;
+}
+
+/*
+ * Called when leaving the directory or before its store changes,
+ * the trees not counted yet are left for the next time.
+ */
+static void
+tui_stop_du (struct tui *tui)
+{
+  if (tui->du_running)
+    {
+      loop_remove (&tui->loop, tui->du.event_fd);
+      du_stop (&tui->du);
+      tui->du_running = 0;
+    }
+}
+
+/*
+ * Stop reading the directory of TAB, when another tab shows it too
+ * what was read is kept as an incomplete listing like a cancelled
+ * scan.
+ */
+static void
+tui_stop_scan (struct tui *tui, struct tui_tab *tab)
+{
+  if (!tab->scanning)
+    {
+      return;
+    }
+
+  loop_remove (&tui->loop, tab->scanner.event_fd);
+  if (tab->directory->users <= 1)
+    {
+      scan_stop (&tab->scanner);
+      tab->scanning = 0;
+      return;
+    }
+
+  scan_cancel (&tab->scanner);
+  scan_drain (&tab->scanner, tab->entries);
+  scan_stop (&tab->scanner);
+  tab->scanning = 0;
+
+  if (sort_entry_store (tab->entries, tui->threads) == 0)
+    {
+      tab->directory->ready = 1;
+      tab->directory->complete = 0;
+    }
+}
+
+/*
+ * return 1 when a pattern was typed and only its matches are listed.
+ */
+static int
+tui_filtering (const struct tui *tui)
+{
+  return tui->filter_length > 0;
+}
+
+/*
+ * Get the number of rows of the list.
+ */
+static size_t
+tui_row_count (const struct tui *tui)
+{
+  return tui_filtering (tui) ? tui->filter.count
+                             : tui->tabs[tui->tab].entries->count;
+}
+
+/*
+ * Get the index in the store of the entry shown on row ROW.
+ */
+static size_t
+tui_row_entry (const struct tui *tui, size_t row)
+{
+  return tui_filtering (tui) ? filter_entry (&tui->filter, row) : row;
+}
+
+/*
+ * Put the cursor on the entry INDEX of the store, or keep it in the
+ * list if the entry is filtered out.
+ */
+static void
+tui_select_entry (struct tui *tui, size_t index)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  size_t count = tui_row_count (tui);
+  size_t row = index;
+
+  if (tui_filtering (tui))
+    {
+      for (row = 0; row < count && filter_entry (&tui->filter, row) != index;
+           ++row)
+        {
+        }
+
+      if (row == count)
+        {
+          row = tab->view.cursor;
+        }
+    }
+
+  tui_list_view_move (&tab->view, (ptrdiff_t)row - (ptrdiff_t)tab->view.cursor,
+                      count);
+}
+
+/*
+ * The entries of the store changed, the matches are looked for again
+ * in the next frame and there are none until then.
+ */
+static void
+tui_filter_changed (struct tui *tui)
+{
+  filter_reset (&tui->filter);
+  tui->filter_dirty = 1;
+}
+
+/*
+ * Match the entries again if the pattern or the store changed, the
+ * bytes typed since the last frame only look at the matches of the
+ * pattern without them.
+ * the names are copied for the filter as soon as '/' is pressed, the
+ * first byte typed doesn't have to wait for it.
+ */
+static void
+tui_refilter (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  uint64_t start;
+  int status;
+
+  if (!tui->filter_dirty)
+    {
+      return;
+    }
+
+  tui->filter_dirty = 0;
+
+  if (!tui_filtering (tui) && !tui->filter_input)
+    {
+      return;
+    }
+
+  start = stats_start ();
+  status = filter_set (&tui->filter, tab->entries, tui->filter_pattern);
+  stats_stop (STATS_FILTER, start);
+
+  if (status != 0)
+    {
+      snprintf (tui->message, sizeof (tui->message), "%s",
+                strerror (ENOMEM));
+      tui->filter_length = 0;
+      tui->filter_pattern[0] = '\0';
+      tui->filter_input = 0;
+      filter_reset (&tui->filter);
+    }
+
+  tui_list_view_move (&tab->view, 0, tui_row_count (tui));
+}
+
+/*
+ * List every entry again, the cursor stays on the entry it was on.
+ * the copy of the names is kept for the next pattern.
+ */
+static void
+tui_clear_filter (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  size_t index = tab->entries->count;
+
+  if (tab->view.cursor < tui_row_count (tui))
+    {
+      index = tui_row_entry (tui, tab->view.cursor);
+    }
+
+  tui->filter_length = 0;
+  tui->filter_pattern[0] = '\0';
+  tui->filter_input = 0;
+  tui->filter_dirty = 0;
+
+  tui_list_view_move (&tab->view, 0, tab->entries->count);
+  if (index < tab->entries->count)
+    {
+      tui_select_entry (tui, index);
+    }
+}
+
+/*
+ * Copy the name of the entry under the cursor to NAME, which holds
+ * NAME_MAX + 1 bytes.
+ * return its type or DT_UNKNOWN if the list is empty.
+ */
+static unsigned char
+tui_cursor_entry (struct tui *tui, char *name)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  size_t entry;
+
+  if (tab->view.cursor >= tui_row_count (tui))
+    {
+      return DT_UNKNOWN;
+    }
+
+  entry = tui_row_entry (tui, tab->view.cursor);
+  snprintf (name, NAME_MAX + 1, "%s", entry_store_name (tab->entries, entry));
+
+  return tab->entries->type[entry];
+}
+
+/*
+ * Put the cursor back on the entry NAME of TYPE once the entries
+ * moved, or keep it in the list if it is gone.
+ */
+static void
+tui_reselect (struct tui *tui, const char *name, unsigned char type)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  long index = -1;
+
+  if (type != DT_UNKNOWN)
+    {
+      index = entry_store_find (tab->entries, name, type);
+    }
+
+  if (index >= 0)
+    {
+      tui_select_entry (tui, index);
+    }
+  else
+    {
+      tui_list_view_move (&tab->view, 0, tui_row_count (tui));
+    }
+}
+
+/*
+ * Sort the entries read in DIRECTORY by a scan that ended in STATE,
+ * the state of the directory before the scan was ST, apply what
+ * changed meanwhile and start fetching the metadata if the directory
+ * is on screen.
+ * the entries were shown in the order they were read, the cursor
+ * stays on the entry it was moved to.
+ * SORTED is set when the listing was loaded sorted instead of read.
+ */
+static void
+tui_sort_scanned (struct tui *tui, struct cache_directory *directory,
+                  enum scan_state state, const struct stat *st, int sorted)
+{
+  char name[NAME_MAX + 1];
+  unsigned char type = DT_UNKNOWN;
+  int showing = tui_showing (tui, directory);
+
+  if (showing && tui_tab (tui)->view.cursor > 0)
+    {
+      type = tui_cursor_entry (tui, name);
+    }
+
+  if (!sorted && sort_entry_store (&directory->entries, tui->threads) != 0)
+    {
+      tui->error = ENOMEM;
+      loop_quit (&tui->loop);
+      return;
+    }
+
+  directory->ready = 1;
+  directory->complete = state == SCAN_DONE;
+
+  /*
+   * Save the listing as it was read, before the changes are applied,
+   * a change during the scan left a newer mtime on the directory so
+   * the snapshot won't be used.
+   * it is only an optimization and failing to save it is not an error.
+   */
+  if (tui->snapshots && !sorted && directory->complete
+      && directory->entries.count >= SNAP_MIN_ENTRIES)
+    {
+      snap_save (st, &directory->entries);
+    }
+
+  if (cache_apply (directory) != 0)
+    {
+      tui->error = ENOMEM;
+      loop_quit (&tui->loop);
+      return;
+    }
+
+  if (showing)
+    {
+      tui_filter_changed (tui);
+      if (type != DT_UNKNOWN)
+        {
+          tui_refilter (tui);
+          tui_reselect (tui, name, type);
+        }
+      tui_start_meta (tui);
+      tui_start_du (tui);
+    }
+}
+
+/*
+ * Called once the scanner of TAB is done.
+ */
+static void
+tui_finish_scan (struct tui *tui, struct tui_tab *tab)
+{
+  enum scan_state state = scan_state (&tab->scanner);
+  int error = scan_error (&tab->scanner);
+  int sorted = scan_take_loaded (&tab->scanner, tab->entries);
+
+  loop_remove (&tui->loop, tab->scanner.event_fd);
+  scan_stop (&tab->scanner);
+  tab->scanning = 0;
+
+  /*
+   * What was read is shown as an incomplete listing with the error,
+   * the other tabs go on.
+   */
+  if (state == SCAN_FAILED)
+    {
+      LOG_MESSAGE (LOG_LEVEL_ERROR, "the scan of %s failed: %s", tab->path,
+                   strerror (error));
+      tab->error = error;
+    }
+
+  tui_sort_scanned (tui, tab->directory, state, &tab->scan_st, sorted);
+}
+
+/*
+ * Apply the changes of the directory on screen, the cursor stays
+ * on the same entry if it is still there.
+ * the metadata and the sizes keep being fetched, only the entries
+ * that are new or changed are fetched again.
+ */
+static void
+tui_apply_changes (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  char name[NAME_MAX + 1];
+  unsigned char type = tui_cursor_entry (tui, name);
+  uint64_t start;
+  int ret;
+
+  if (tui->meta_running)
+    {
+      meta_pause (&tui->meta);
+    }
+
+  start = stats_start ();
+  ret = cache_apply (tab->directory);
+  stats_stop (STATS_APPLY, start);
+
+  if (tui->meta_running)
+    {
+      meta_resume (&tui->meta);
+    }
+
+  if (ret != 0)
+    {
+      tui->error = ENOMEM;
+      loop_quit (&tui->loop);
+      return;
+    }
+
+  if (tui->du_running && du_update (&tui->du, tab->entries) != 0)
+    {
+      tui_stop_du (tui);
+    }
+
+  tui_filter_changed (tui);
+  tui_refilter (tui);
+  tui_reselect (tui, name, type);
+
+  if (!tui->meta_running)
+    {
+      tui_start_meta (tui);
+    }
+  if (!tui->du_running)
+    {
+      tui_start_du (tui);
+    }
+}
+
+/*
+ * Put the cursor on the directory NAME, used when going back
+ * to the parent.
+ */
+static void
+tui_select (struct tui *tui, const char *name)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  long index;
+
+  if (!tab->directory->ready)
+    {
+      return;
+    }
+
+  index = entry_store_find (tab->entries, name, DT_DIR);
+  if (index >= 0)
+    {
+      tui_select_entry (tui, index);
+    }
+}
+
+static void tui_on_scan (int fd, void *data);
+
+/*
+ * Get the directory at PATH shown by another tab than TAB, or NULL
+ * if there is none.
+ */
+static struct cache_directory *
+tui_shared_directory (struct tui *tui, const struct tui_tab *tab,
+                      const char *path)
+{
+  size_t i;
+
+  for (i = 0; i < tui->tab_count; ++i)
+    {
+      if (&tui->tabs[i] != tab && tui->tabs[i].directory != NULL
+          && tui->tabs[i].directory != &tui->unreadable
+          && strcmp (tui->tabs[i].path, path) == 0)
+        {
+          return tui->tabs[i].directory;
+        }
+    }
+
+  return NULL;
+}
+
+/*
+ * Stop keeping the listing of ENTRY for the history.
+ */
+static void
+tui_history_release (struct tui *tui, struct tui_history_entry *entry)
+{
+  if (entry->directory != NULL)
+    {
+      cache_release (&tui->cache, entry->directory);
+      entry->directory = NULL;
+    }
+}
+
+/*
+ * Release the listings the histories keep from the oldest visit
+ * until they fit in the memory of the histories, and the listings
+ * that missed changes, which the cache reads again.
+ * a listing kept by several visits is counted for every one.
+ */
+static void
+tui_history_trim (struct tui *tui)
+{
+  struct tui_history_entry *oldest;
+  struct tui_history_entry *entry;
+  size_t memory;
+  size_t kept;
+  size_t i;
+  size_t j;
+
+  do
+    {
+      oldest = NULL;
+      memory = 0;
+      kept = 0;
+
+      for (i = 0; i < tui->tab_count; ++i)
+        {
+          for (j = 0; j < tui->tabs[i].history.count; ++j)
+            {
+              entry = &tui->tabs[i].history.entries[j];
+              if (entry->directory != NULL && entry->directory->lost)
+                {
+                  tui_history_release (tui, entry);
+                }
+              if (entry->directory == NULL)
+                {
+                  continue;
+                }
+
+              memory += cache_directory_size (entry->directory);
+              ++kept;
+              if (oldest == NULL || entry->visited < oldest->visited)
+                {
+                  oldest = entry;
+                }
+            }
+        }
+
+      if (oldest == NULL
+          || (memory <= tui->history_memory && kept <= TUI_HISTORY_MAX_KEPT))
+        {
+          return;
+        }
+
+      LOG_MESSAGE (LOG_LEVEL_DEBUG, "released %s from the history",
+                   oldest->path);
+      tui_history_release (tui, oldest);
+    }
+  while (1);
+}
+
+/*
+ * Called before TAB leaves its directory, the history keeps its
+ * listing if it was read entirely and where the list was left.
+ */
+static void
+tui_history_leave (struct tui_tab *tab)
+{
+  struct tui_history_entry *entry;
+
+  if (tab->history.count == 0)
+    {
+      return;
+    }
+
+  entry = &tab->history.entries[tab->history.position];
+  entry->cursor = tab->view.cursor;
+  entry->offset = tab->view.offset;
+
+  if (entry->directory == NULL && tab->directory->complete
+      && !tab->directory->lost)
+    {
+      entry->directory = tab->directory;
+      ++entry->directory->users;
+    }
+}
+
+/*
+ * Called when TAB couldn't leave its directory, the tab still holds
+ * the listing the history kept.
+ */
+static void
+tui_history_stay (struct tui_tab *tab)
+{
+  if (tab->history.count > 0)
+    {
+      tui_history_release (tab->tui,
+                           &tab->history.entries[tab->history.position]);
+    }
+}
+
+/*
+ * Add the directory TAB went to after the one it left, the
+ * directories that were left to go forward are forgotten.
+ */
+static void
+tui_history_push (struct tui *tui, struct tui_tab *tab)
+{
+  struct tui_history *history = &tab->history;
+  struct tui_history_entry *entry;
+  char *path;
+
+  path = strdup (tab->path);
+  if (path == NULL)
+    {
+      return;
+    }
+
+  while (history->count > 0 && history->count > history->position + 1)
+    {
+      entry = &history->entries[--history->count];
+      tui_history_release (tui, entry);
+      free (entry->path);
+    }
+
+  if (history->count == TUI_HISTORY_SIZE)
+    {
+      tui_history_release (tui, &history->entries[0]);
+      free (history->entries[0].path);
+      memmove (history->entries, history->entries + 1,
+               (TUI_HISTORY_SIZE - 1) * sizeof (struct tui_history_entry));
+      --history->count;
+    }
+
+  history->position = history->count++;
+  entry = &history->entries[history->position];
+  entry->path = path;
+  entry->directory = NULL;
+  entry->cursor = 0;
+  entry->offset = 0;
+  entry->visited = ++tui->history_clock;
+
+  tui_history_trim (tui);
+}
+
+/*
+ * Forget the history of TAB.
+ */
+static void
+tui_history_free (struct tui_tab *tab)
+{
+  struct tui_history *history = &tab->history;
+
+  while (history->count > 0)
+    {
+      tui_history_release (tab->tui, &history->entries[--history->count]);
+      free (history->entries[history->count].path);
+    }
+}
+
+/*
+ * Get the sorted listing of the directory at PATH in the state ST from
+ * the daemon or from its snapshot, the daemon can take DAEMON_TIMEOUT
+ * to answer so it runs on the scanning thread.
+ * see 'scan_loader'.
+ */
+static int
+tui_load (const char *path, const struct stat *st, struct entry_store *store)
+{
+  uint64_t start = stats_start ();
+  int loaded;
+
+  loaded = daemon_fetch (path, st, store) == 0 || snap_load (st, store) == 0;
+  stats_stop (STATS_LOAD, start);
+
+  return loaded ? 0 : -1;
+}
+
+/*
+ * Show in TAB the directory NAME relative to DIR_FD, KEPT is its
+ * listing when the history kept it and nothing is looked up then.
+ * the listing comes from the cache when it was visited before or is
+ * shown by another tab, or is read by the scanner of TAB otherwise.
+ * see 'tui_open_at'.
+ */
+static int
+tui_enter (struct tui *tui, struct tui_tab *tab,
+           struct cache_directory *kept, int dir_fd, const char *name,
+           const char *path)
+{
+  struct cache_directory *directory = kept;
+  struct cache_directory *previous = tab->directory;
+  int showing = tab == tui_tab (tui);
+  struct scanner scanner;
+  struct stat st;
+  int scanning = 0;
+  int saved_errno;
+
+  if (directory == NULL)
+    {
+      directory = cache_lookup_at (&tui->cache, dir_fd, name);
+    }
+  if (directory == NULL)
+    {
+      directory = tui_shared_directory (tui, tab, path);
+    }
+
+  /*
+   * The directory that was under the cursor may still be read,
+   * the rest of it is shown as it comes.
+   */
+  if (directory == NULL && tui->prefetch.scanning
+      && strcmp (tui->prefetch.path, path) == 0)
+    {
+      directory = tui->prefetch.directory;
+    }
+
+  /*
+   * Everything that can fail is done before the tab leaves its
+   * directory, it is left as it was on error.
+   */
+  if (directory != NULL)
+    {
+      if (cache_apply (directory) != 0)
+        {
+          errno = ENOMEM;
+          return -1;
+        }
+    }
+  else
+    {
+      /*
+       * The directory is watched before it is read so nothing that
+       * happens during the scan is missed.
+       */
+      tui_history_trim (tui);
+      directory = cache_insert_at (&tui->cache, dir_fd, name, path);
+      if (directory == NULL)
+        {
+          return -1;
+        }
+
+      /*
+       * Stat the directory once it is watched, any change after this
+       * is seen by the watch and any change before it is in the mtime.
+       * the directory is read on its own thread so a slow filesystem
+       * doesn't freeze the terminal, the entries are shown as they
+       * come and sorted once everything is there, the tabs are read
+       * at the same time.
+       * a listing kept by the daemon or a snapshot of the same
+       * directory that didn't change since is asked for first on that
+       * thread.
+       */
+      if (fstat (directory->dir_fd, &st) != 0
+          || scan_start_loaded (&scanner, directory->dir_fd, path,
+                                tui->snapshots ? tui_load : NULL, &st)
+                 != 0)
+        {
+          goto fail;
+        }
+
+      if (loop_add (&tui->loop, scanner.event_fd, tui_on_scan, tab) != 0)
+        {
+          scan_stop (&scanner);
+          goto fail;
+        }
+
+      scanning = 1;
+    }
+
+  tui_stop_scan (tui, tab);
+  if (showing)
+    {
+      tui_stop_meta (tui);
+      tui_stop_du (tui);
+    }
+
+  if (previous != NULL)
+    {
+      previous->cursor = tab->view.cursor;
+      previous->offset = tab->view.offset;
+    }
+
+  if (showing)
+    {
+      /*
+       * The pattern was typed for the directory that is left.
+       */
+      tui->filter_length = 0;
+      tui->filter_pattern[0] = '\0';
+      tui->filter_input = 0;
+      tui->filter_dirty = 0;
+      filter_reset (&tui->filter);
+    }
+
+  snprintf (tab->path, sizeof (tab->path), "%s", path);
+  tab->directory = directory;
+  tab->entries = &directory->entries;
+  tab->error = 0;
+  ++directory->users;
+
+  /*
+   * The directory that is left can be dropped from the cache to make
+   * room for another one once no tab shows it.
+   */
+  if (previous != NULL)
+    {
+      cache_release (&tui->cache, previous);
+    }
+
+  if (scanning)
+    {
+      if (previous != NULL)
+        {
+          stats_add (STATS_PREFETCH_MISSES, 1);
+        }
+
+      tab->scanner = scanner;
+      tab->scanning = 1;
+      tab->scan_st = st;
+      tab->view.offset = 0;
+      tab->view.cursor = 0;
+      loop_request_frame (&tui->loop);
+
+      return 0;
+    }
+
+  if (directory->prefetched || directory == tui->prefetch.directory)
+    {
+      LOG_MESSAGE (LOG_LEVEL_DEBUG, "%s was prefetched", path);
+      stats_add (STATS_PREFETCH_HITS, 1);
+      directory->prefetched = 0;
+    }
+
+  tab->view.offset = directory->offset;
+  tab->view.cursor = directory->cursor;
+  tui_list_view_move (&tab->view, 0, tab->entries->count);
+
+  if (showing)
+    {
+      tui_start_meta (tui);
+      tui_start_du (tui);
+    }
+  loop_request_frame (&tui->loop);
+
+  return 0;
+
+fail:
+  saved_errno = errno;
+  cache_remove (&tui->cache, directory);
+  errno = saved_errno;
+  return -1;
+}
+
+/*
+ * Show the directory NAME relative to DIR_FD in TAB.
+ * PATH is its path without symbolic links, only NAME is looked up so
+ * going through a deep tree doesn't resolve every level again.
+ * DIR_FD may be the directory of TAB, it is not used once TAB left it.
+ * the metadata is only fetched when TAB is on screen.
+ * return 0 on success and -1 with errno set, the directory of TAB
+ * doesn't change if NAME can't be listed.
+ */
+static int
+tui_open_at (struct tui *tui, struct tui_tab *tab, int dir_fd,
+             const char *name, const char *path)
+{
+  struct stat st;
+
+  if (fstatat (dir_fd, name, &st, 0) != 0)
+    {
+      return -1;
+    }
+
+  if (!S_ISDIR (st.st_mode))
+    {
+      errno = ENOTDIR;
+      return -1;
+    }
+
+  if (faccessat (dir_fd, name, R_OK | X_OK, 0) != 0)
+    {
+      return -1;
+    }
+
+  return tui_enter (tui, tab, NULL, dir_fd, name, path);
+}
+
+/*
+ * Same as 'tui_open_at' for the directory at PATH, resolved from the
+ * root or from the working directory.
+ */
+static int
+tui_open (struct tui *tui, struct tui_tab *tab, const char *path)
+{
+  char resolved[PATH_MAX];
+
+  if (realpath (path, resolved) == NULL)
+    {
+      return -1;
+    }
+
+  return tui_open_at (tui, tab, AT_FDCWD, resolved, resolved);
+}
+
+/*
+ * Go STEP directories back or forward in the history of the tab on
+ * screen, a listing the history kept is shown as it was left
+ * without reading or sorting anything.
+ */
+static void
+tui_history_go (struct tui *tui, int step)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  struct tui_history *history = &tab->history;
+  struct tui_history_entry *entry;
+  size_t position = history->position + step;
+  struct stat st;
+  int ret;
+
+  if (history->count == 0 || position >= history->count)
+    {
+      return;
+    }
+
+  /*
+   * A listing that missed changes is read again like a new visit.
+   */
+  tui_history_trim (tui);
+  entry = &history->entries[position];
+
+  /*
+   * inotify only tells a directory was removed once its descriptor is
+   * closed, it has no link left before.
+   */
+  if (entry->directory != NULL
+      && (fstat (entry->directory->dir_fd, &st) != 0 || st.st_nlink == 0))
+    {
+      tui_history_release (tui, entry);
+    }
+
+  tui_history_leave (tab);
+  if (entry->directory != NULL)
+    {
+      ret = tui_enter (tui, tab, entry->directory, AT_FDCWD, entry->path,
+                       entry->path);
+    }
+  else
+    {
+      ret = tui_open (tui, tab, entry->path);
+    }
+
+  if (ret != 0)
+    {
+      tui_history_stay (tab);
+      LOG_MESSAGE (LOG_LEVEL_INFO, "can't open %s: %m", entry->path);
+      snprintf (tui->message, sizeof (tui->message), "%s: %s",
+                entry->path, strerror (errno));
+      return;
+    }
+
+  /*
+   * The tab holds the listing now.
+   */
+  tui_history_release (tui, entry);
+  history->position = position;
+  entry->visited = ++tui->history_clock;
+
+  if (tab->directory->ready)
+    {
+      tab->view.cursor = entry->cursor;
+      tab->view.offset = entry->offset;
+      tui_list_view_move (&tab->view, 0, tab->entries->count);
+    }
+
+  tui_history_trim (tui);
+}
+
+static void tui_on_prefetch (int fd, void *data);
+
+/*
+ * Stop reading the directory under the cursor, its listing is
+ * dropped unless a tab went into it.
+ */
+static void
+tui_cancel_prefetch (struct tui *tui)
+{
+  struct tui_prefetch *prefetch = &tui->prefetch;
+  struct cache_directory *directory = prefetch->directory;
+
+  if (prefetch->scanning)
+    {
+      loop_remove (&tui->loop, prefetch->scanner.event_fd);
+      scan_stop (&prefetch->scanner);
+      prefetch->scanning = 0;
+
+      if (--directory->users == 0)
+        {
+          LOG_MESSAGE (LOG_LEVEL_DEBUG, "cancelled the prefetch of %s",
+                       prefetch->path);
+          cache_remove (&tui->cache, directory);
+        }
+    }
+
+  prefetch->directory = NULL;
+  prefetch->path[0] = '\0';
+}
+
+/*
+ * Read the directory NAME relative to DIR_FD, at PATH, in the
+ * background unless it is in the cache or shown by a tab, nothing is
+ * shown if it can't be read.
+ */
+static void
+tui_start_prefetch (struct tui *tui, int dir_fd, const char *name,
+                    const char *path)
+{
+  struct tui_prefetch *prefetch = &tui->prefetch;
+  struct cache_directory *directory;
+
+  snprintf (prefetch->path, sizeof (prefetch->path), "%s", path);
+
+  if (faccessat (dir_fd, name, R_OK | X_OK, 0) != 0
+      || cache_lookup_at (&tui->cache, dir_fd, name) != NULL
+      || tui_shared_directory (tui, NULL, path) != NULL)
+    {
+      return;
+    }
+
+  /*
+   * The listings the histories keep that missed changes are let go
+   * first, the one of this directory would be replaced.
+   */
+  tui_history_trim (tui);
+  directory = cache_insert_at (&tui->cache, dir_fd, name, path);
+  if (directory == NULL)
+    {
+      return;
+    }
+
+  /*
+   * A snapshot isn't loaded here, going into the directory does it
+   * as fast.
+   */
+  if (fstat (directory->dir_fd, &prefetch->scan_st) != 0
+      || scan_start_fd (&prefetch->scanner, directory->dir_fd, path) != 0)
+    {
+      cache_remove (&tui->cache, directory);
+      return;
+    }
+
+  if (loop_add (&tui->loop, prefetch->scanner.event_fd, tui_on_prefetch,
+                tui)
+      != 0)
+    {
+      scan_stop (&prefetch->scanner);
+      cache_remove (&tui->cache, directory);
+      return;
+    }
+
+  LOG_MESSAGE (LOG_LEVEL_DEBUG, "prefetching %s", path);
+  prefetch->directory = directory;
+  prefetch->scanning = 1;
+  ++directory->users;
+}
+
+/*
+ * Called once the directory under the cursor was read, it stays in
+ * the cache for the next visit.
+ */
+static void
+tui_finish_prefetch (struct tui *tui)
+{
+  struct tui_prefetch *prefetch = &tui->prefetch;
+  struct cache_directory *directory = prefetch->directory;
+  enum scan_state state = scan_state (&prefetch->scanner);
+  int error = scan_error (&prefetch->scanner);
+  size_t i;
+
+  loop_remove (&tui->loop, prefetch->scanner.event_fd);
+  scan_stop (&prefetch->scanner);
+  prefetch->scanning = 0;
+  prefetch->directory = NULL;
+  --directory->users;
+
+  if (state == SCAN_FAILED)
+    {
+      LOG_MESSAGE (LOG_LEVEL_INFO, "can't prefetch %s: %s", prefetch->path,
+                   strerror (error));
+    }
+
+  /*
+   * A listing that failed or was replaced meanwhile is only kept
+   * for the tabs that went into it.
+   */
+  if (directory->users == 0 && (state == SCAN_FAILED || directory->detached))
+    {
+      cache_remove (&tui->cache, directory);
+      return;
+    }
+
+  if (state == SCAN_FAILED)
+    {
+      for (i = 0; i < tui->tab_count; ++i)
+        {
+          if (tui->tabs[i].directory == directory)
+            {
+              tui->tabs[i].error = error;
+            }
+        }
+    }
+
+  LOG_MESSAGE (LOG_LEVEL_DEBUG, "prefetched %zu entries of %s",
+               directory->entries.count, prefetch->path);
+
+  /*
+   * A tab that went into it during the scan already counted the hit.
+   */
+  directory->prefetched = directory->users == 0;
+  tui_sort_scanned (tui, directory, state, &prefetch->scan_st, 0);
+}
+
+static void
+tui_on_prefetch (__attribute__ ((unused)) int fd, void *data)
+{
+  struct tui *tui = data;
+  struct tui_prefetch *prefetch = &tui->prefetch;
+  struct cache_directory *directory = prefetch->directory;
+  int showing = tui_showing (tui, directory);
+
+  if (scan_drain (&prefetch->scanner, &directory->entries) < 0)
+    {
+      tui->error = ENOMEM;
+      loop_quit (&tui->loop);
+      return;
+    }
+
+  /*
+   * The next directory under the cursor is read in the next frame.
+   */
+  if (scan_finished (&prefetch->scanner))
+    {
+      tui_finish_prefetch (tui);
+      loop_request_frame (&tui->loop);
+    }
+
+  /*
+   * A tab went into the directory before it was read.
+   */
+  if (!showing)
+    {
+      return;
+    }
+
+  ++tui->progress;
+  tui_filter_changed (tui);
+
+  if (!tui_filtering (tui))
+    {
+      tui_list_view_move (&tui_tab (tui)->view, 0, directory->entries.count);
+    }
+  loop_request_frame (&tui->loop);
+}
+
+/*
+ * Read the directory under the cursor of the tab on screen, after the
+ * frame so moving the cursor is never slowed down.
+ * only one directory is read at a time, the previous one is dropped
+ * when the cursor stops on another one unless a tab went into it.
+ */
+static void
+tui_update_prefetch (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  struct tui_prefetch *prefetch = &tui->prefetch;
+  char name[NAME_MAX + 1];
+  char path[PATH_MAX];
+  const char *separator;
+
+  path[0] = '\0';
+  if (!tui->tree && tab->directory->ready
+      && tui_cursor_entry (tui, name) == DT_DIR)
+    {
+      separator = strcmp (tab->path, "/") == 0 ? "" : "/";
+      if (snprintf (path, sizeof (path), "%s%s%s", tab->path, separator,
+                    name)
+          >= (int)sizeof (path))
+        {
+          path[0] = '\0';
+        }
+    }
+
+  if (strcmp (path, prefetch->path) == 0)
+    {
+      snprintf (prefetch->cursor, sizeof (prefetch->cursor), "%s", path);
+      return;
+    }
+
+  /*
+   * The current read goes on while the cursor moves, the next frames
+   * check whether it stopped.
+   */
+  if (strcmp (path, prefetch->cursor) != 0)
+    {
+      snprintf (prefetch->cursor, sizeof (prefetch->cursor), "%s", path);
+      prefetch->moved = stats_clock ();
+      loop_request_frame (&tui->loop);
+      return;
+    }
+
+  if (stats_clock () - prefetch->moved < TUI_PREFETCH_DELAY)
+    {
+      loop_request_frame (&tui->loop);
+      return;
+    }
+
+  /*
+   * The tab that went into it reads it to the end.
+   */
+  if (prefetch->scanning && prefetch->directory->users > 1)
+    {
+      return;
+    }
+
+  tui_cancel_prefetch (tui);
+  if (path[0] != '\0')
+    {
+      tui_start_prefetch (tui, tab->directory->dir_fd, name, path);
+    }
+}
+
+/*
+ * Go to the directory NAME of the directory on screen, or to the
+ * parent if NAME is "..", both are looked up relative to the
+ * directory on screen.
+ */
+static void
+tui_navigate (struct tui *tui, const char *name)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  int up = strcmp (name, "..") == 0;
+  char path[PATH_MAX];
+  char previous[NAME_MAX + 1];
+  const char *separator;
+  char *base;
+  struct stat st;
+  int through_link;
+  int ret;
+
+  base = strrchr (tab->path, '/');
+  snprintf (previous, sizeof (previous), "%s", base ? base + 1 : "");
+
+  /*
+   * The path of the tab has no symbolic link so the parent is the
+   * path without its last name, "/" is its own parent.
+   */
+  if (up)
+    {
+      snprintf (path, sizeof (path), "%s", tab->path);
+      base = strrchr (path, '/');
+      if (base == path)
+        {
+          path[1] = '\0';
+        }
+      else if (base != NULL)
+        {
+          *base = '\0';
+        }
+    }
+  else
+    {
+      separator = strcmp (tab->path, "/") == 0 ? "" : "/";
+      if (snprintf (path, sizeof (path), "%s%s%s", tab->path, separator,
+                    name)
+          >= (int)sizeof (path))
+        {
+          snprintf (tui->message, sizeof (tui->message), "%s",
+                    strerror (ENAMETOOLONG));
+          return;
+        }
+    }
+
+  /*
+   * A symbolic link is resolved from the root so the path shown is
+   * the one of the directory it points to, and a directory that was
+   * removed has no parent left but its path may still have one.
+   */
+  through_link = !up
+                 && fstatat (tab->directory->dir_fd, name, &st,
+                             AT_SYMLINK_NOFOLLOW)
+                        == 0
+                 && S_ISLNK (st.st_mode);
+
+  tui_history_leave (tab);
+  if (through_link)
+    {
+      ret = tui_open (tui, tab, path);
+    }
+  else
+    {
+      ret = tui_open_at (tui, tab, tab->directory->dir_fd, name, path);
+      if (ret != 0 && up && (errno == ENOENT || errno == EBADF))
+        {
+          ret = tui_open (tui, tab, path);
+        }
+    }
+
+  if (ret != 0)
+    {
+      tui_history_stay (tab);
+      LOG_MESSAGE (LOG_LEVEL_INFO, "can't open %s: %m", path);
+      snprintf (tui->message, sizeof (tui->message), "%s: %s", name,
+                strerror (errno));
+      return;
+    }
+
+  tui_history_push (tui, tab);
+
+  if (up)
+    {
+      tui_select (tui, previous);
+    }
+}
+
+/*
+ * Callback for 'walk_visit' that adds a row to the tree view.
+ */
+static int
+tui_add_row (const struct walk_directory *directory, size_t index,
+             void *data)
+{
+  struct tui *tui = data;
+  struct tui_tree_row *rows;
+  size_t capacity;
+
+  if (tui->row_count == tui->row_capacity)
+    {
+      capacity = tui->row_capacity ? tui->row_capacity * 2 : 1024;
+      rows = realloc (tui->rows, capacity * sizeof (struct tui_tree_row));
+      if (rows == NULL)
+        {
+          return 1;
+        }
+      tui->rows = rows;
+      tui->row_capacity = capacity;
+    }
+
+  tui->rows[tui->row_count].directory = directory;
+  tui->rows[tui->row_count].index = index;
+  ++tui->row_count;
+
+  return 0;
+}
+
+static void
+tui_on_walk (int fd, void *data)
+{
+  struct tui *tui = data;
+  uint64_t events;
+
+  if (read (fd, &events, sizeof (events)) < 0)
+    {
+      return;
+    }
+
+  ++tui->progress;
+
+  if (walk_finished (&tui->walker))
+    {
+      loop_remove (&tui->loop, tui->walker.event_fd);
+      tui->walking = 0;
+
+      tui->row_count = 0;
+      if (walk_visit (tui->walker.root, tui_add_row, tui) != 0)
+        {
+          snprintf (tui->message, sizeof (tui->message), "%s",
+                    strerror (ENOMEM));
+        }
+      tui_list_view_move (&tui->tree_view, 0, tui->row_count);
+    }
+
+  loop_request_frame (&tui->loop);
+}
+
+/*
+ * Show the tree under the directory on screen, it is walked on
+ * every thread first.
+ */
+static void
+tui_start_tree (struct tui *tui)
+{
+  struct tui_tab *tab = tui_tab (tui);
+
+  if (walk_start (&tui->walker, tab->path, tui->threads, 0) != 0)
+    {
+      snprintf (tui->message, sizeof (tui->message), "%s",
+                strerror (errno));
+      return;
+    }
+
+  if (loop_add (&tui->loop, tui->walker.event_fd, tui_on_walk, tui) != 0)
+    {
+      walk_free (&tui->walker);
+      snprintf (tui->message, sizeof (tui->message), "%s",
+                strerror (errno));
+      return;
+    }
+
+  tui->tree = 1;
+  tui->walking = 1;
+  tui->row_count = 0;
+  tui->tree_view.offset = 0;
+  tui->tree_view.cursor = 0;
+  tui->tree_view.height = tab->view.height;
+  tui->tree_view.width = tab->view.width;
+}
+
+static void
+tui_stop_tree (struct tui *tui)
+{
+  if (!tui->tree)
+    {
+      return;
+    }
+
+  if (tui->walking)
+    {
+      loop_remove (&tui->loop, tui->walker.event_fd);
+      tui->walking = 0;
+    }
+
+  walk_free (&tui->walker);
+  tui->tree = 0;
+  tui->row_count = 0;
+}
+
+/*
+ * Leave the tree view for the directory of the row under
+ * the cursor.
+ */
+static void
+tui_open_row (struct tui *tui)
+{
+  const struct tui_tree_row *row;
+  char path[PATH_MAX];
+
+  if (tui->walking || tui->tree_view.cursor >= tui->row_count)
+    {
+      return;
+    }
+
+  row = &tui->rows[tui->tree_view.cursor];
+  if (row->directory->children[row->index] == NULL)
+    {
+      return;
+    }
+
+  if (walk_path (row->directory, row->index, path, sizeof (path)) < 0)
+    {
+      snprintf (tui->message, sizeof (tui->message), "%s",
+                strerror (ENAMETOOLONG));
+      return;
+    }
+
+  tui_stop_tree (tui);
+
+  tui_history_leave (tui_tab (tui));
+  if (tui_open (tui, tui_tab (tui), path) != 0)
+    {
+      tui_history_stay (tui_tab (tui));
+      snprintf (tui->message, sizeof (tui->message), "%s",
+                strerror (errno));
+      return;
+    }
+
+  tui_history_push (tui, tui_tab (tui));
+}
+
+/*
+ * Put the tab INDEX on screen, what was on screen stops fetching metadata and
+ * the pattern typed for it is dropped.
+ */
+static void
+tui_switch_tab (struct tui *tui, size_t index)
+{
+  struct tui_tab *tab;
+
+  if (index >= tui->tab_count || index == tui->tab)
+    {
+      return;
+    }
+
+  tui_stop_tree (tui);
+  tui_stop_meta (tui);
+  tui_stop_du (tui);
+  tui_clear_filter (tui);
+  filter_reset (&tui->filter);
+
+  tui->tab = index;
+  tab = tui_tab (tui);
+  tui_list_view_move (&tab->view, 0, tab->entries->count);
+
+  if (cache_has_changes (tab->directory))
+    {
+      tui_apply_changes (tui);
+    }
+  else
+    {
+      tui_start_meta (tui);
+      tui_start_du (tui);
+    }
+}
+
+static void
+tui_on_scan (__attribute__ ((unused)) int fd, void *data)
+{
+  struct tui_tab *tab = data;
+  struct tui *tui = tab->tui;
+
+  if (scan_drain (&tab->scanner, tab->entries) < 0)
+    {
+      tui->error = ENOMEM;
+      loop_quit (&tui->loop);
+      return;
+    }
+
+  if (scan_finished (&tab->scanner))
+    {
+      tui_finish_scan (tui, tab);
+    }
+
+  /*
+   * The tabs that are not on screen are only read.
+   */
+  if (!tui_showing (tui, tab->directory))
+    {
+      return;
+    }
+
+  ++tui->progress;
+  tui_filter_changed (tui);
+
+  /*
+   * The matches are only known in the next frame.
+   */
+  if (!tui_filtering (tui))
+    {
+      tui_list_view_move (&tui_tab (tui)->view, 0, tab->entries->count);
+    }
+  loop_request_frame (&tui->loop);
+}
+
+static void
+tui_on_meta (int fd, void *data)
+{
+  struct tui *tui = data;
+  uint64_t events;
+
+  if (read (fd, &events, sizeof (events)) < 0)
+    {
+      return;
+    }
+
+  loop_request_frame (&tui->loop);
+}
+
+static void
+tui_on_owners (int fd, void *data)
+{
+  struct tui *tui = data;
+  uint64_t events;
+
+  if (read (fd, &events, sizeof (events)) < 0)
+    {
+      return;
+    }
+
+  loop_request_frame (&tui->loop);
+}
+
+static void
+tui_on_du (int fd, void *data)
+{
+  struct tui *tui = data;
+  uint64_t events;
+
+  if (read (fd, &events, sizeof (events)) < 0)
+    {
+      return;
+    }
+
+  loop_request_frame (&tui->loop);
+}
+
+/*
+ * The changes are only applied when a frame is drawn, a directory
+ * written to thousands of times per second is updated once
+ * per frame.
+ */
+static void
+tui_on_watch (__attribute__ ((unused)) int fd, void *data)
+{
+  struct tui *tui = data;
+  struct tui_tab *tab = tui_tab (tui);
+
+  if (cache_read_events (&tui->cache) < 0)
+    {
+      return;
+    }
+
+  if (cache_has_changes (tab->directory))
+    {
+      loop_request_frame (&tui->loop);
+    }
+}
+
+/*
+ * Edit the pattern after '/', the list is filtered as it is typed,
+ * enter keeps the matches and escape lists every entry again.
+ */
+static void
+tui_handle_filter_key (struct tui *tui, int input_key)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  size_t count = tui_row_count (tui);
+
+  switch (input_key)
+    {
+    case TUI_KEY_ESCAPE:
+      tui_clear_filter (tui);
+      return;
+    case '\n':
+    case KEY_ENTER:
+      tui->filter_input = 0;
+      return;
+    case KEY_DOWN:
+      tui_list_view_move (&tab->view, 1, count);
+      return;
+    case KEY_UP:
+      tui_list_view_move (&tab->view, -1, count);
+      return;
+    case KEY_NPAGE:
+      tui_list_view_move (&tab->view, tab->view.height, count);
+      return;
+    case KEY_PPAGE:
+      tui_list_view_move (&tab->view, -tab->view.height, count);
+      return;
+    case KEY_BACKSPACE:
+    case TUI_KEY_DELETE:
+    case '\b':
+      if (tui->filter_length == 0)
+        {
+          tui->filter_input = 0;
+          return;
+        }
+      tui->filter_pattern[--tui->filter_length] = '\0';
+      break;
+    default:
+      if (input_key < ' ' || input_key > UCHAR_MAX
+          || tui->filter_length == FILTER_MAX_PATTERN)
+        {
+          return;
+        }
+      tui->filter_pattern[tui->filter_length++] = input_key;
+      tui->filter_pattern[tui->filter_length] = '\0';
+      break;
+    }
+
+  /*
+   * The best match comes first.
+   */
+  tab->view.cursor = 0;
+  tab->view.offset = 0;
+  tui->filter_dirty = 1;
+
+  if (!tui_filtering (tui))
+    {
+      tui_list_view_move (&tab->view, 0, tab->entries->count);
+    }
+}
+
+/*
+ * Cancel the scan of the directory on screen, it may be read by
+ * another tab or be the directory that was under the cursor.
+ */
+static void
+tui_cancel_scan (struct tui *tui)
+{
+  size_t i;
+
+  for (i = 0; i < tui->tab_count; ++i)
+    {
+      if (tui->tabs[i].scanning && tui_showing (tui, tui->tabs[i].directory))
+        {
+          scan_cancel (&tui->tabs[i].scanner);
+        }
+    }
+
+  if (tui->prefetch.scanning && tui_showing (tui, tui->prefetch.directory))
+    {
+      scan_cancel (&tui->prefetch.scanner);
+    }
+}
+
+static void
+tui_handle_key (struct tui *tui, int input_key)
+{
+  struct tui_tab *tab = tui_tab (tui);
+  struct tui_list_view *view = tui->tree ? &tui->tree_view : &tab->view;
+  size_t count = tui->tree ? tui->row_count : tui_row_count (tui);
+
+  if (tui->filter_input)
+    {
+      tui_handle_filter_key (tui, input_key);
+      return;
+    }
+
+  switch (input_key)
+    {
+    case 'q':
+    case 'Q':
+      loop_quit (&tui->loop);
+      break;
+    case TUI_KEY_ESCAPE:
+      if (tui->walking)
+        {
+          walk_cancel (&tui->walker);
+        }
+      else if (!tab->directory->ready)
+        {
+          tui_cancel_scan (tui);
+        }
+      else if (!tui->tree && tui_filtering (tui))
+        {
+          tui_clear_filter (tui);
+        }
+      break;
+    case '/':
+      if (!tui->tree)
+        {
+          tui->filter_input = 1;
+          tui->filter_dirty = 1;
+        }
+      break;
+    case '\t':
+      tui_switch_tab (tui, (tui->tab + 1) % tui->tab_count);
+      break;
+    case KEY_BTAB:
+      tui_switch_tab (tui, (tui->tab + tui->tab_count - 1) % tui->tab_count);
+      break;
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      tui_switch_tab (tui, input_key - '1');
+      break;
+    case 't':
+      if (tui->tree)
+        {
+          tui_stop_tree (tui);
+        }
+      else
+        {
+          tui_start_tree (tui);
+        }
+      break;
+    case 'j':
+    case KEY_DOWN:
+      tui_list_view_move (view, 1, count);
+      break;
+    case 'k':
+    case KEY_UP:
+      tui_list_view_move (view, -1, count);
+      break;
+    case KEY_NPAGE:
+      tui_list_view_move (view, view->height, count);
+      break;
+    case KEY_PPAGE:
+      tui_list_view_move (view, -view->height, count);
+      break;
+    case 'g':
+    case KEY_HOME:
+      tui_list_view_move (view, -(ptrdiff_t)count, count);
+      break;
+    case 'G':
+    case KEY_END:
+      tui_list_view_move (view, count, count);
+      break;
+    case 'l':
+    case '\n':
+    case KEY_RIGHT:
+    case KEY_ENTER:
+      if (tui->tree)
+        {
+          tui_open_row (tui);
+        }
+      else if (tab->view.cursor < count)
+        {
+          tui_navigate (tui,
+                        entry_store_name (tab->entries,
+                                          tui_row_entry (tui,
+                                                         tab->view.cursor)));
+        }
+      break;
+    case 'h':
+    case KEY_LEFT:
+    case KEY_BACKSPACE:
+      if (tui->tree)
+        {
+          tui_stop_tree (tui);
+        }
+      else
+        {
+          tui_navigate (tui, "..");
+        }
+      break;
+    case 'H':
+      if (!tui->tree)
+        {
+          tui_history_go (tui, -1);
+        }
+      break;
+    case 'L':
+      if (!tui->tree)
+        {
+          tui_history_go (tui, 1);
+        }
+      break;
+    default:
+      break;
+    }
+}
+
+static void
+tui_on_input (__attribute__ ((unused)) int fd, void *data)
+{
+  struct tui *tui = data;
+  int input_key;
+
+  /*
+   * Take every key that arrived, they all end up in one frame.
+   */
+  while ((input_key = wgetch (stdscr)) != ERR)
+    {
+      if (tui->key_time == 0)
+        {
+          tui->key_time = stats_start ();
+        }
+      tui->message[0] = '\0';
+      tui_handle_key (tui, input_key);
+    }
+
+  loop_request_frame (&tui->loop);
+}
+
+static void
+tui_on_signal (int signal, void *data)
+{
+  struct tui *tui = data;
+  struct tui_tab *tab = tui_tab (tui);
+  struct winsize size;
+  size_t i;
+
+  switch (signal)
+    {
+    case SIGWINCH:
+      if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+        {
+          resizeterm (size.ws_row, size.ws_col);
+        }
+      for (i = 0; i < tui->tab_count; ++i)
+        {
+          tui_list_view_resize (stdscr, &tui->tabs[i].view);
+          tui_list_view_move (&tui->tabs[i].view, 0,
+                              tui->tabs[i].entries->count);
+        }
+      tui_list_view_move (&tab->view, 0, tui_row_count (tui));
+      tui_list_view_resize (stdscr, &tui->tree_view);
+      tui_list_view_move (&tui->tree_view, 0, tui->row_count);
+      loop_request_frame (&tui->loop);
+      break;
+    default:
+      loop_quit (&tui->loop);
+      break;
+    }
+}
+
+static void
+tui_on_frame (void *data)
+{
+  struct tui *tui = data;
+  struct tui_tab *tab = tui_tab (tui);
+  char status[PATH_MAX + FILTER_MAX_PATTERN + 32];
+  uint64_t start;
+  int used = 0;
+
+  if (cache_has_changes (tab->directory))
+    {
+      tui_apply_changes (tui);
+    }
+
+  tui_refilter (tui);
+
+  /*
+   * The rows of a filtered list are spread over the store.
+   */
+  if (tui->meta_running && !tui_filtering (tui))
+    {
+      meta_prioritize (&tui->meta, tab->view.offset, tab->view.height);
+    }
+
+  /*
+   * The number of the tab comes first when there are several.
+   */
+  if (tui->tab_count > 1)
+    {
+      used = snprintf (status, sizeof (status), "[%zu/%zu] ", tui->tab + 1,
+                       tui->tab_count);
+    }
+
+  if (tui->message[0] != '\0')
+    {
+      snprintf (status + used, sizeof (status) - used, "%s", tui->message);
+    }
+  else if (tui->walking)
+    {
+      snprintf (status + used, sizeof (status) - used,
+                _ ("%c walking... %zu directories (ESC to cancel)"),
+                tui_spinner[tui->progress % 4],
+                walk_directories (&tui->walker));
+    }
+  else if (tui->tree)
+    {
+      snprintf (status + used, sizeof (status) - used, "%s", tab->path);
+    }
+  else if (tui->filter_input)
+    {
+      snprintf (status + used, sizeof (status) - used, "/%s",
+                tui->filter_pattern);
+    }
+  else if (tab->error != 0)
+    {
+      snprintf (status + used, sizeof (status) - used,
+                _ ("can't read %s: %s"), tab->path, strerror (tab->error));
+    }
+  else if (!tab->directory->ready)
+    {
+      snprintf (status + used, sizeof (status) - used,
+                _ ("%c scanning... (ESC to cancel)"),
+                tui_spinner[tui->progress % 4]);
+    }
+  else if (!tab->directory->complete)
+    {
+      snprintf (status + used, sizeof (status) - used, "%s",
+                _ ("scan cancelled, the list is incomplete."));
+    }
+  else if (tui_filtering (tui))
+    {
+      snprintf (status + used, sizeof (status) - used, "%s  /%s", tab->path,
+                tui->filter_pattern);
+    }
+  else
+    {
+      snprintf (status + used, sizeof (status) - used, "%s", tab->path);
+    }
+
+  start = stats_start ();
+  if (tui->tree)
+    {
+      tui_print_tree (stdscr, &tui->tree_view, tui->rows, tui->row_count,
+                      status);
+    }
+  else
+    {
+      tui_print_list (stdscr, &tab->view, tab->entries,
+                      tui_filtering (tui) ? tui->filter.order : NULL,
+                      tui->filter.count, tui->du_running ? tui->du.job : NULL,
+                      &tui->owners, status);
+    }
+  stats_stop (STATS_RENDER, start);
+
+  /*
+   * The keys that came since the last frame are on screen.
+   */
+  stats_stop (STATS_KEY, tui->key_time);
+  tui->key_time = 0;
+  tui_update_prefetch (tui);
+}
+
+int
+tui_run (const char *const *dir_names, size_t count, int threads,
+         int snapshots, size_t history_memory)
+{
+  struct tui tui;
+  sigset_t signals;
+  size_t opened = 0;
+  int error = 0;
+  size_t i;
+
+  memset (&tui, 0, sizeof (tui));
+  tui.threads = threads;
+  tui.snapshots = snapshots;
+  tui.history_memory = history_memory;
+  filter_init (&tui.filter, threads);
+
+  entry_store_init (&tui.unreadable.entries);
+  tui.unreadable.dir_fd = -1;
+  tui.unreadable.wd = -1;
+  tui.unreadable.ready = 1;
+
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGWINCH);
+  sigaddset (&signals, SIGINT);
+  sigaddset (&signals, SIGTERM);
+  sigaddset (&signals, SIGHUP);
+
+  /*
+   * The signals must be blocked before the threads start.
+   */
+  if (loop_init (&tui.loop, &signals, tui_on_signal, tui_on_frame, &tui)
+      != 0)
+    {
+      return errno;
+    }
+
+  tui.du_cache = du_cache_new ();
+  if (tui.du_cache == NULL)
+    {
+      tui.error = errno;
+      loop_free (&tui.loop);
+      return tui.error;
+    }
+
+  if (cache_init (&tui.cache) != 0
+      || loop_add (&tui.loop, tui.cache.inotify_fd, tui_on_watch, &tui)
+             != 0)
+    {
+      tui.error = errno;
+      du_cache_release (tui.du_cache);
+      loop_free (&tui.loop);
+      return tui.error;
+    }
+
+  /*
+   * The names arrive on the next frames, the numbers are shown
+   * until then.
+   */
+  if (owner_cache_init (&tui.owners) != 0)
+    {
+      tui.error = errno;
+      du_cache_release (tui.du_cache);
+      cache_free (&tui.cache);
+      loop_free (&tui.loop);
+      return tui.error;
+    }
+  loop_add (&tui.loop, tui.owners.event_fd, tui_on_owners, &tui);
+
+  /*
+   * Every scan is started before the first batch is waited for, the
+   * tabs are read in parallel and the slowest decides how long it
+   * takes.
+   */
+  tui.tab_count = count < TUI_MAX_TABS ? count : TUI_MAX_TABS;
+  for (i = 0; i < tui.tab_count; ++i)
+    {
+      tui.tabs[i].tui = &tui;
+      if (tui_open (&tui, &tui.tabs[i], dir_names[i]) == 0)
+        {
+          tui_history_push (&tui, &tui.tabs[i]);
+          ++opened;
+          continue;
+        }
+
+      /*
+       * The error is shown in place of the listing, the other tabs
+       * go on.
+       */
+      LOG_MESSAGE (LOG_LEVEL_WARNING, "can't open %s: %m", dir_names[i]);
+      if (error == 0)
+        {
+          error = errno;
+        }
+      tui.tabs[i].error = errno;
+      tui.tabs[i].directory = &tui.unreadable;
+      tui.tabs[i].entries = &tui.unreadable.entries;
+      ++tui.unreadable.users;
+      snprintf (tui.tabs[i].path, sizeof (tui.tabs[i].path), "%s",
+                dir_names[i]);
+      tui_history_push (&tui, &tui.tabs[i]);
+    }
+
+  if (opened == 0)
+    {
+      tui.error = error;
+    }
+
+  if (tui.error != 0)
+    {
+      for (i = 0; i < tui.tab_count; ++i)
+        {
+          tui_stop_scan (&tui, &tui.tabs[i]);
+          tui_history_free (&tui.tabs[i]);
+        }
+      tui_stop_meta (&tui);
+      tui_stop_du (&tui);
+      filter_free (&tui.filter);
+      du_cache_release (tui.du_cache);
+      owner_cache_free (&tui.owners);
+      cache_free (&tui.cache);
+      loop_free (&tui.loop);
+      return tui.error;
+    }
+
+  if (count > TUI_MAX_TABS)
+    {
+      snprintf (tui.message, sizeof (tui.message),
+                _ ("only the first %d paths are shown."), TUI_MAX_TABS);
+    }
+
+  use_env (TRUE);
+  use_tioctl (TRUE);
+
+  initscr ();
+
+  cbreak ();
+  noecho ();
+  intrflush (stdscr, FALSE);
+  keypad (stdscr, TRUE);
+  nodelay (stdscr, TRUE);
+  curs_set (0);
+  set_escdelay (TUI_ESCAPE_DELAY);
+
+  for (i = 0; i < tui.tab_count; ++i)
+    {
+      tui_list_view_resize (stdscr, &tui.tabs[i].view);
+      tui_list_view_move (&tui.tabs[i].view, 0,
+                          tui.tabs[i].entries->count);
+    }
+
+  if (loop_add (&tui.loop, STDIN_FILENO, tui_on_input, &tui) != 0)
+    {
+      tui.error = errno;
+    }
+  else
+    {
+      loop_request_frame (&tui.loop);
+
+      if (loop_run (&tui.loop) != 0)
+        {
+          tui.error = errno;
+        }
+    }
+
+  endwin ();
+
+  tui_stop_tree (&tui);
+  for (i = 0; i < tui.tab_count; ++i)
+    {
+      tui_stop_scan (&tui, &tui.tabs[i]);
+      tui_history_free (&tui.tabs[i]);
+    }
+  tui_cancel_prefetch (&tui);
+  tui_stop_meta (&tui);
+  tui_stop_du (&tui);
+
+  free (tui.rows);
+  filter_free (&tui.filter);
+  du_cache_release (tui.du_cache);
+  owner_cache_free (&tui.owners);
+  cache_free (&tui.cache);
+  loop_free (&tui.loop);
+
+  return tui.error;
+}
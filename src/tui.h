@@ -0,0 +1,340 @@
+/*
+ * tui - user interface of dr
+ *
+ * Copyright (C) 2024  MahmoudESSE
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DR_SRC_TUI_H_
+#define DR_SRC_TUI_H_
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <ncurses.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "daemon.h"
+#include "dir.h"
+#include "du.h"
+#include "entry.h"
+#include "filter.h"
+#include "log.h"
+#include "loop.h"
+#include "meta.h"
+#include "owner.h"
+#include "scan.h"
+#include "snap.h"
+#include "sort.h"
+#include "stats.h"
+#include "str.h"
+#include "walk.h"
+
+/*
+ * Columns of a row of the list.
+ */
+#define TUI_MODE_COLUMN 2
+#define TUI_SIZE_COLUMN 12
+#define TUI_OWNER_COLUMN 20
+#define TUI_GROUP_COLUMN 29
+#define TUI_NAME_COLUMN 38
+
+/*
+ * Characters of the owner and group shown, the longer names are cut.
+ */
+#define TUI_OWNER_WIDTH 8
+
+/*
+ * Key code of escape and how long to wait for the
+ * rest of an escape sequence in milliseconds.
+ */
+#define TUI_KEY_ESCAPE 27
+#define TUI_ESCAPE_DELAY 25
+
+/*
+ * Key code sent by the backspace of most terminals.
+ */
+#define TUI_KEY_DELETE 127
+
+/*
+ * Part of the list shown in the window, only the entries from
+ * OFFSET to OFFSET + HEIGHT are drawn and CURSOR is the
+ * selected entry.
+ */
+struct tui_list_view
+{
+  size_t offset;
+  size_t cursor;
+  int height;
+  int width;
+};
+
+/*
+ * Row of the tree view, the entry INDEX of DIRECTORY.
+ */
+struct tui_tree_row
+{
+  const struct walk_directory *directory;
+  size_t index;
+};
+
+/*
+ * Most directories shown at the same time, one per tab, the keys 1
+ * to 9 go to them.
+ */
+#define TUI_MAX_TABS 9
+
+/*
+ * Most directories in the history of a tab, the oldest one is
+ * forgotten to make room for a new one.
+ */
+#define TUI_HISTORY_SIZE 64
+
+/*
+ * Most listings the histories keep in the cache at the same time,
+ * there must still be room for the tabs and the prefetch.
+ */
+#define TUI_HISTORY_MAX_KEPT (CACHE_MAX_DIRECTORIES - TUI_MAX_TABS - 1)
+
+/*
+ * Memory the histories keep listings in when no limit is given, in
+ * bytes.
+ */
+#define TUI_HISTORY_DEFAULT_MEMORY (64 * 1024 * 1024)
+
+/*
+ * Time the cursor stays on a directory before it is prefetched, in
+ * nanoseconds, holding a key down doesn't start a read per entry.
+ */
+#define TUI_PREFETCH_DELAY (50 * 1000 * 1000)
+
+/*
+ * Directory a tab went through, at PATH, with the CURSOR and OFFSET
+ * the list was left at.
+ * DIRECTORY is its sorted listing, kept in the cache by counting as
+ * one of its users, or NULL once the memory of the histories was
+ * needed and going back reads PATH again.
+ * VISITED orders the visits of every tab, the listings of the oldest
+ * ones are released first.
+ */
+struct tui_history_entry
+{
+  char *path;
+  struct cache_directory *directory;
+  size_t cursor;
+  size_t offset;
+  uint64_t visited;
+};
+
+/*
+ * Directories a tab went through, ENTRIES[POSITION] is the one shown
+ * and the ones after it are left to go forward.
+ */
+struct tui_history
+{
+  struct tui_history_entry entries[TUI_HISTORY_SIZE];
+  size_t count;
+  size_t position;
+};
+
+struct tui;
+
+/*
+ * Tab of the user interface, DIRECTORY is the cached listing of PATH
+ * it shows and ENTRIES its entries, another tab showing the same
+ * directory shares it.
+ * SCANNER reads DIRECTORY while SCANNING is set, SCAN_ST is the
+ * state of the directory before the scan, ERROR is the errno value
+ * of a scan that failed, shown instead of the path.
+ * HISTORY is where 'H' and 'L' go back and forward.
+ */
+struct tui_tab
+{
+  struct tui *tui;
+  char path[PATH_MAX];
+  struct cache_directory *directory;
+  struct entry_store *entries;
+  struct tui_list_view view;
+  struct scanner scanner;
+  int scanning;
+  struct stat scan_st;
+  int error;
+  struct tui_history history;
+};
+
+/*
+ * Directory under the cursor read in the background so going into it
+ * draws at once, DIRECTORY is its listing at PATH in the cache.
+ * SCANNER reads it while SCANNING is set, SCAN_ST is the state of the
+ * directory before the scan.
+ * CURSOR is the directory under the cursor since MOVED, it is read
+ * once the cursor stayed there TUI_PREFETCH_DELAY.
+ * a tab going into it before the scan is done shares DIRECTORY.
+ */
+struct tui_prefetch
+{
+  char path[PATH_MAX];
+  char cursor[PATH_MAX];
+  uint64_t moved;
+  struct cache_directory *directory;
+  struct scanner scanner;
+  int scanning;
+  struct stat scan_st;
+};
+
+/*
+ * State of the user interface, everything happens in the callbacks
+ * of LOOP: keys on stdin, batches from the scanners, metadata from
+ * META, changes from the watches of CACHE, signals and frames.
+ * the TAB_COUNT tabs of TABS are read at the same time and TAB is
+ * the one on screen, MESSAGE replaces the status line until the
+ * next key.
+ * DU counts the size of the directories of the list, the totals
+ * are kept in DU_CACHE for the next visits, it only runs for the
+ * tab on screen like META.
+ * OWNERS has the names of the owners and groups of the entries, the
+ * numbers are shown until they are known.
+ * SNAPSHOTS is set when the sorted listings are asked to the daemon
+ * or saved in and loaded from the cache directory.
+ * FILTER_PATTERN is typed after '/' while FILTER_INPUT is set, when
+ * it is not empty only the entries of FILTER are listed, the rows of
+ * the view are then ranks of FILTER and FILTER_DIRTY is set when
+ * they must be matched again.
+ * TREE is set while the tree of the tab read by WALKER is shown,
+ * its ROW_COUNT rows are in ROWS and TREE_VIEW is the part on
+ * screen.
+ * PREFETCH reads the directory under the cursor until the cursor
+ * moves on.
+ * the histories of the tabs keep listings in up to HISTORY_MEMORY
+ * bytes, HISTORY_CLOCK counts the visits.
+ * KEY_TIME is when the first key not drawn yet came, for the
+ * statistics.
+ * UNREADABLE is the empty listing shown by the tabs whose path
+ * couldn't be opened, it is not in CACHE.
+ * ERROR is the errno value that stopped the interface.
+ */
+struct tui
+{
+  struct tui_tab tabs[TUI_MAX_TABS];
+  size_t tab_count;
+  size_t tab;
+  int threads;
+  struct dir_cache cache;
+  int snapshots;
+  struct filter filter;
+  char filter_pattern[FILTER_MAX_PATTERN + 1];
+  size_t filter_length;
+  int filter_input;
+  int filter_dirty;
+  struct meta_fetcher meta;
+  int meta_running;
+  struct du_counter du;
+  int du_running;
+  struct du_cache *du_cache;
+  struct owner_cache owners;
+  struct loop loop;
+  struct walker walker;
+  int walking;
+  int tree;
+  struct tui_tree_row *rows;
+  size_t row_count;
+  size_t row_capacity;
+  struct tui_list_view tree_view;
+  struct tui_prefetch prefetch;
+  size_t history_memory;
+  struct cache_directory unreadable;
+  uint64_t history_clock;
+  unsigned progress;
+  char message[MAX_STR_SIZE];
+  uint64_t key_time;
+  int error;
+};
+
+/*
+ * Get the character that shows the type FE_RAW_TYPE of an entry.
+ */
+void file_entry_determine_type (const unsigned char *fe_raw_type,
+                                char *fe_type);
+
+/*
+ * Write the permissions of MODE in FE_MODE like 'ls -l' does,
+ * FE_MODE must hold at least 10 characters.
+ */
+void file_entry_format_mode (mode_t mode, char *fe_mode);
+
+/*
+ * Write SIZE in FE_SIZE with a unit suffix, FE_SIZE must
+ * hold at least 8 characters.
+ */
+void file_entry_format_size (int64_t size, char *fe_size);
+
+/*
+ * Fit VIEW in WIN, the last line is kept for the status.
+ */
+void tui_list_view_resize (WINDOW *win, struct tui_list_view *view);
+
+/*
+ * Move the cursor of VIEW by DELTA entries in a list of COUNT
+ * entries and scroll so the cursor stays visible.
+ */
+void tui_list_view_move (struct tui_list_view *view, ptrdiff_t delta,
+                         size_t count);
+
+/*
+ * Draw the entries of VIEW and the STATUS line in WIN, the cost
+ * only depends on the height of the window and the screen is
+ * updated once per frame.
+ * when ROWS is not NULL only the ROW_COUNT entries it holds are
+ * listed, in its order.
+ * the directories show the totals of DU when it is not NULL and the
+ * owners and groups come from OWNERS, the ids not seen before are
+ * looked up once the rows are drawn.
+ */
+void tui_print_list (WINDOW *win, const struct tui_list_view *view,
+                     const struct entry_store *entries,
+                     const uint32_t *rows, size_t row_count,
+                     const struct du_job *du, struct owner_cache *owners,
+                     const char *status);
+
+/*
+ * Draw the ROW_COUNT rows of the tree in VIEW and the STATUS
+ * line in WIN, the entries are indented by their depth.
+ */
+void tui_print_tree (WINDOW *win, const struct tui_list_view *view,
+                     const struct tui_tree_row *rows, size_t row_count,
+                     const char *status);
+
+/*
+ * Show the COUNT directories of DIR_NAMES in tabs until the user
+ * quits, they are read at the same time and the lists are sorted on
+ * up to THREADS threads, only the first TUI_MAX_TABS get a tab.
+ * the daemon and the snapshots of the cache directory are used if
+ * SNAPSHOTS is set.
+ * the histories keep the listings of up to HISTORY_MEMORY bytes so
+ * going back and forward shows them at once.
+ * return 0 or the errno value of the error that stopped it.
+ */
+int tui_run (const char *const *dir_names, size_t count, int threads,
+             int snapshots, size_t history_memory);
+
+#endif // DR_SRC_TUI_H_